@@ -0,0 +1,61 @@
+#!/bin/bash
+# Metric evaluations avoided by --metric-cache-mm, and what the cache costs in
+# accuracy.
+#
+# Usage: bench_metric_cache.sh path/to/project [FixedImage] [MovingDirectory]
+#
+# Defaults to bin/Fixed/000000.dcm against every slice of bin/Moving. Every
+# slice is registered with --reproducible once without the cache and once per
+# tolerance in TOLERANCES (default 0.01 mm). Prints one CSV row per run
+# (tolerance, slice, translation, evaluations, cache hits, calls, seconds,
+# distance in mm to the uncached translation of the same slice), then the
+# totals of each tolerance.
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 path/to/project [FixedImage] [MovingDirectory]"
+    exit 1
+fi
+
+PROJECT=$1
+FIXED=${2:-bin/Fixed/000000.dcm}
+MOVING_DIR=${3:-bin/Moving}
+TOLERANCES=${TOLERANCES:-"0.01"}
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+for tolerance in 0 $TOLERANCES; do
+    for moving in "$MOVING_DIR"/*.dcm; do
+        START=$(date +%s%N)
+        LOG=$("$PROJECT" "$FIXED" "$moving" "$OUT/out.dcm" --reproducible --metric-cache-mm "$tolerance" 2>&1)
+        END=$(date +%s%N)
+        X=$(echo "$LOG" | sed -n 's/^Translation along X = //p')
+        Y=$(echo "$LOG" | sed -n 's/^Translation along Y = //p')
+        EVALUATIONS=$(echo "$LOG" | sed -n 's/^Metric evaluations = \([0-9]*\),.*/\1/p')
+        # Metric cache hits = H of C calls (P%), evaluations avoided = H (about S s)
+        CACHE=$(echo "$LOG" | sed -n 's/^Metric cache hits = \([0-9]*\) of \([0-9]*\) calls.*/\1,\2/p')
+        echo "$tolerance,$(basename "$moving"),$X,$Y,${EVALUATIONS:-0},${CACHE:-0,0},$(( (END - START) / 1000000 ))"
+    done
+done > "$OUT/runs.csv"
+
+echo "tolerance_mm,slice,x,y,evaluations,cache_hits,calls,seconds,distance_to_uncached_mm"
+awk -F, '
+    $1 == 0 { refX[$2] = $3; refY[$2] = $4 }
+    { rows[NR] = $0 }
+    END {
+        for (i = 1; i <= NR; ++i) {
+            split(rows[i], f, ",")
+            d = ""
+            if (f[2] in refX && f[3] != "") {
+                d = sqrt((f[3] - refX[f[2]]) ^ 2 + (f[4] - refY[f[2]]) ^ 2)
+                if (d > max[f[1]]) max[f[1]] = d
+            }
+            runs[f[1]]++; evaluations[f[1]] += f[5]; hits[f[1]] += f[6]; calls[f[1]] += f[7]; ms[f[1]] += f[8]
+            printf "%s,%s,%s,%s,%s,%s,%s,%.3f,%s\n", f[1], f[2], f[3], f[4], f[5], f[6], f[7], f[8] / 1000.0, d
+        }
+        print ""
+        print "tolerance_mm,runs,evaluations,evaluations_avoided,hit_rate,mean_seconds,max_distance_mm"
+        for (t in runs) {
+            printf "%s,%d,%d,%d,%.3f,%.3f,%.4f\n", t, runs[t], evaluations[t], hits[t], calls[t] ? hits[t] / calls[t] : 0,
+                   ms[t] / runs[t] / 1000.0, max[t]
+        }
+    }' "$OUT/runs.csv"
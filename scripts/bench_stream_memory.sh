@@ -0,0 +1,32 @@
+#!/bin/bash
+# Peak memory of ./project against output size and number of stream divisions.
+#
+# Usage: bench_stream_memory.sh path/to/project FixedImage MovingImage [FixedImage MovingImage ...]
+#
+# Each pair is registered once per division count; the output is written as
+# MetaImage (.mha) so the writer can actually stream. Prints one CSV row per
+# run: fixed image, number of output pixels, divisions, peak RSS in KB.
+
+if [ $# -lt 3 ]; then
+    echo "Usage: $0 path/to/project FixedImage MovingImage [FixedImage MovingImage ...]"
+    exit 1
+fi
+
+PROJECT=$1
+shift
+DIVISIONS=${DIVISIONS:-"1 4 16 64"}
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+echo "fixed,pixels,divisions,peak_rss_kb"
+while [ $# -ge 2 ]; do
+    FIXED=$1
+    MOVING=$2
+    shift 2
+    for d in $DIVISIONS; do
+        LOG=$("$PROJECT" "$FIXED" "$MOVING" "$OUT/out.mha" --stream-divisions "$d" 2>&1)
+        RSS=$(echo "$LOG" | sed -n 's/^Peak RSS (KB) = //p')
+        PIXELS=$(sed -n 's/^DimSize = //p' "$OUT/out.mha" | awk '{ n = 1; for (i = 1; i <= NF; ++i) n *= $i; print n }')
+        echo "$FIXED,$PIXELS,$d,$RSS"
+    done
+done
@@ -0,0 +1,52 @@
+#!/bin/bash
+# Threading overhead per metric evaluation with the thread pools against
+# --spawn-threads.
+#
+# Usage: bench_thread_pool.sh path/to/project [FixedImage] [MovingDirectory]
+#
+# Defaults to bin/Fixed/000000.dcm against every slice of bin/Moving. Every
+# slice is registered once per mode with --reproducible, so both modes run the
+# same evaluations. Prints one CSV row per run (mode, slice, evaluations, mean
+# us per evaluation, threading overhead us per evaluation, seconds), then the
+# means of each mode.
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 path/to/project [FixedImage] [MovingDirectory]"
+    exit 1
+fi
+
+PROJECT=$1
+FIXED=${2:-bin/Fixed/000000.dcm}
+MOVING_DIR=${3:-bin/Moving}
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+for mode in pool spawn; do
+    FLAGS=""
+    if [ "$mode" = spawn ]; then
+        FLAGS="--spawn-threads"
+    fi
+    for moving in "$MOVING_DIR"/*.dcm; do
+        START=$(date +%s%N)
+        LOG=$("$PROJECT" "$FIXED" "$moving" "$OUT/out.dcm" --reproducible $FLAGS 2>&1)
+        END=$(date +%s%N)
+        # Metric evaluations = N, mean M us, threading overhead T us per evaluation
+        TIMING=$(echo "$LOG" | sed -n 's/^Metric evaluations = \([0-9]*\), mean \([0-9.e+-]*\) us, threading overhead \([0-9.e+-]*\) us.*/\1,\2,\3/p')
+        echo "$mode,$(basename "$moving"),$TIMING,$(( (END - START) / 1000000 ))"
+    done
+done > "$OUT/runs.csv"
+
+echo "mode,slice,evaluations,mean_us,overhead_us,seconds"
+awk -F, '
+    {
+        printf "%s,%s,%s,%s,%s,%.3f\n", $1, $2, $3, $4, $5, $6 / 1000.0
+        runs[$1]++; evaluations[$1] += $3; mean[$1] += $3 * $4; overhead[$1] += $3 * $5; ms[$1] += $6
+    }
+    END {
+        print ""
+        print "mode,runs,evaluations,mean_us,overhead_us,mean_seconds"
+        for (m in runs) {
+            e = evaluations[m] ? evaluations[m] : 1
+            printf "%s,%d,%d,%.2f,%.2f,%.3f\n", m, runs[m], evaluations[m], mean[m] / e, overhead[m] / e, ms[m] / runs[m] / 1000.0
+        }
+    }' "$OUT/runs.csv"
@@ -0,0 +1,75 @@
+#!/bin/bash
+# Runtime, cache misses and accuracy of --internal-type uint16 against float.
+#
+# Usage: compare_internal_types.sh path/to/project [FixedImage] [MovingDirectory]
+#
+# Defaults to bin/Fixed/000000.dcm against every slice of bin/Moving. Each
+# slice is registered once per internal type with --reproducible. When perf is
+# available every run is counted with perf stat; last-level cache misses times
+# 64 bytes approximate the memory traffic. Prints one CSV row per run, then
+# per type the mean seconds, cache misses and estimated traffic, and the mean /
+# max distance in mm to the float translation of the same slice. Exits with 1
+# if any uint16 translation is further than TOLERANCE mm (default 0.1) from
+# float.
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 path/to/project [FixedImage] [MovingDirectory]"
+    exit 1
+fi
+
+PROJECT=$1
+FIXED=${2:-bin/Fixed/000000.dcm}
+MOVING_DIR=${3:-bin/Moving}
+TYPES=${TYPES:-"float uint16"}
+TOLERANCE=${TOLERANCE:-0.1}
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+PERF=""
+if command -v perf > /dev/null 2>&1 && perf stat -e cache-misses true > /dev/null 2>&1; then
+    PERF="perf stat -x, -e cache-misses,cache-references -o $OUT/perf.csv"
+fi
+
+for type in $TYPES; do
+    for moving in "$MOVING_DIR"/*.dcm; do
+        START=$(date +%s%N)
+        LOG=$($PERF "$PROJECT" "$FIXED" "$moving" "$OUT/out.dcm" --reproducible --internal-type "$type" 2>&1)
+        END=$(date +%s%N)
+        X=$(echo "$LOG" | sed -n 's/^Translation along X = //p')
+        Y=$(echo "$LOG" | sed -n 's/^Translation along Y = //p')
+        MISSES=""
+        if [ -n "$PERF" ]; then
+            MISSES=$(awk -F, '$3 == "cache-misses" { print $1 }' "$OUT/perf.csv")
+        fi
+        echo "$type,$(basename "$moving"),$X,$Y,$(( (END - START) / 1000000 )),$MISSES"
+    done
+done > "$OUT/runs.csv"
+
+echo "type,slice,x,y,seconds,cache_misses,distance_to_float_mm"
+awk -F, -v tolerance="$TOLERANCE" '
+    $1 == "float" { refX[$2] = $3; refY[$2] = $4 }
+    { rows[NR] = $0 }
+    END {
+        failed = 0
+        for (i = 1; i <= NR; ++i) {
+            split(rows[i], f, ",")
+            d = ""
+            if (f[2] in refX && f[3] != "") {
+                d = sqrt((f[3] - refX[f[2]]) ^ 2 + (f[4] - refY[f[2]]) ^ 2)
+                n[f[1]]++; sum[f[1]] += d; if (d > max[f[1]]) max[f[1]] = d
+                if (d > tolerance) failed = 1
+            }
+            runs[f[1]]++; ms[f[1]] += f[5]; misses[f[1]] += f[6]
+            printf "%s,%s,%s,%s,%.3f,%s,%s\n", f[1], f[2], f[3], f[4], f[5] / 1000.0, f[6], d
+        }
+        print ""
+        print "type,runs,mean_seconds,mean_cache_misses,mean_traffic_mb,mean_distance_mm,max_distance_mm"
+        for (t in runs) {
+            printf "%s,%d,%.3f,%.0f,%.1f,%.4f,%.4f\n", t, runs[t], ms[t] / runs[t] / 1000.0,
+                   misses[t] / runs[t], misses[t] / runs[t] * 64 / 1048576, n[t] ? sum[t] / n[t] : 0, max[t]
+        }
+        if (failed) {
+            printf "\nSome translations are more than %s mm from float\n", tolerance
+            exit 1
+        }
+    }' "$OUT/runs.csv"
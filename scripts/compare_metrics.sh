@@ -0,0 +1,56 @@
+#!/bin/bash
+# Accuracy and throughput of each --metric against ITK's reference Mattes MI.
+#
+# Usage: compare_metrics.sh path/to/project [FixedImage] [MovingDirectory]
+#
+# Defaults to bin/Fixed/000000.dcm against every slice of bin/Moving. Every
+# slice is registered once per metric with --reproducible, so reruns give the
+# same numbers. Prints one CSV row per run (metric, slice, translation,
+# iterations, seconds, distance in mm to the mattes translation of the same
+# slice), then the mean time and mean / max distance of each metric.
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 path/to/project [FixedImage] [MovingDirectory]"
+    exit 1
+fi
+
+PROJECT=$1
+FIXED=${2:-bin/Fixed/000000.dcm}
+MOVING_DIR=${3:-bin/Moving}
+METRICS=${METRICS:-"mattes mi ncc meansquares"}
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+for metric in $METRICS; do
+    for moving in "$MOVING_DIR"/*.dcm; do
+        START=$(date +%s%N)
+        LOG=$("$PROJECT" "$FIXED" "$moving" "$OUT/out.dcm" --reproducible --metric "$metric" 2>&1)
+        END=$(date +%s%N)
+        X=$(echo "$LOG" | sed -n 's/^Translation along X = //p')
+        Y=$(echo "$LOG" | sed -n 's/^Translation along Y = //p')
+        ITERATIONS=$(echo "$LOG" | sed -n 's/^Iterations = //p')
+        echo "$metric,$(basename "$moving"),$X,$Y,$ITERATIONS,$(( (END - START) / 1000000 ))"
+    done
+done > "$OUT/runs.csv"
+
+echo "metric,slice,x,y,iterations,seconds,distance_to_mattes_mm"
+awk -F, '
+    $1 == "mattes" { refX[$2] = $3; refY[$2] = $4 }
+    { rows[NR] = $0 }
+    END {
+        for (i = 1; i <= NR; ++i) {
+            split(rows[i], f, ",")
+            d = ""
+            if (f[2] in refX && f[3] != "") {
+                d = sqrt((f[3] - refX[f[2]]) ^ 2 + (f[4] - refY[f[2]]) ^ 2)
+                n[f[1]]++; sum[f[1]] += d; if (d > max[f[1]]) max[f[1]] = d
+            }
+            runs[f[1]]++; ms[f[1]] += f[6]
+            printf "%s,%s,%s,%s,%s,%.3f,%s\n", f[1], f[2], f[3], f[4], f[5], f[6] / 1000.0, d
+        }
+        print ""
+        print "metric,runs,mean_seconds,mean_distance_mm,max_distance_mm"
+        for (m in runs) {
+            printf "%s,%d,%.3f,%.4f,%.4f\n", m, runs[m], ms[m] / runs[m] / 1000.0, n[m] ? sum[m] / n[m] : 0, max[m]
+        }
+    }' "$OUT/runs.csv"
@@ -0,0 +1,424 @@
+/*
+    Implemented by Imran Irfan, and Evan Wong
+
+*/
+#ifndef AutotunePipeline_h
+#define AutotunePipeline_h
+
+#include "BatchPipeline.h"
+#include "RegistrationProfile.h"
+
+#include "itkResampleImageFilter.h"
+#include "itkMinimumMaximumImageCalculator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <random>
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            AUTOTUNE PIPELINE
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+//Searches bins, samples, levels, iterations and relaxation for the fastest
+//settings whose translations stay within a target error of known ones. The
+//calibration set is a directory of moving slices with reference
+//translations, or shifted copies of the fixed image. Every combination is
+//registered on every calibration slice, all of them concurrently; the
+//combinations no other beats on both mean runtime and mean error form the
+//Pareto front, and the fastest meeting the target is saved as a profile.
+
+struct AutotuneOptions
+{
+    AutotuneOptions() : numberOfSyntheticShifts(0), maximumShiftMm(10.0), targetErrorMm(0.5), numberOfWorkers(0), seedMode(FixedSeed) {}
+
+    std::string fixedImageFile;
+    std::string movingDirectory;             //calibration slices, unused with synthetic shifts
+    std::string referenceFile;               //their translations: a results log or "name x y [z]" lines
+    unsigned int numberOfSyntheticShifts;    //>0 registers this many shifted copies of the fixed image instead
+    double maximumShiftMm;                   //synthetic shifts are uniform in [-max, max] along each axis
+    double targetErrorMm;                    //mean distance to the reference translations the profile must meet
+    std::string profileFile;
+    std::string paretoFile;                  //CSV of the Pareto front, "" to skip
+    unsigned int numberOfWorkers;            //0 picks half the hardware threads
+    SeedMode seedMode;
+    std::vector<double> histogramBins;       //values searched; histogram bins only for mi and mattes
+    std::vector<double> spatialSamples;
+    std::vector<double> levels;
+    std::vector<double> iterations;
+    std::vector<double> relaxationFactors;
+    RegistrationSettings settings;           //everything else, and the current configuration to compare with
+};
+
+struct TuningCandidate
+{
+    TuningCandidate() : meanSeconds(0.0), meanErrorMm(0.0), maximumErrorMm(0.0), failures(0), pareto(false) {}
+
+    RegistrationSettings settings;
+    double meanSeconds;                      //registerSeconds over the calibration slices
+    double meanErrorMm;
+    double maximumErrorMm;
+    unsigned int failures;
+    bool pareto;
+};
+
+//Translations keyed by moving file name, from a results log (failed slices
+//left out) or from a text file of "name x y [z]" lines, '#' starting a
+//comment. False if the file cannot be read.
+inline bool LoadReferenceTranslations(const std::string &fileName, std::map<std::string, std::vector<double> > &references)
+{
+    ResultsLogReader log;
+    if (log.Open(fileName))
+    {
+        ResultsRecord record;
+        while (log.Read(record))
+        {
+            if (record.stopCondition >= 0)
+            {
+                references[GetResultsRecordName(record)] = std::vector<double>(record.translation, record.translation + 3);
+            }
+        }
+        return true;
+    }
+
+    std::ifstream file(fileName.c_str());
+    if (!file)
+    {
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        std::string name;
+        if (!(fields >> name))
+        {
+            continue;
+        }
+        std::vector<double> translation;
+        double value = 0.0;
+        while (fields >> value)
+        {
+            translation.push_back(value);
+        }
+        translation.resize(3, 0.0);
+        references[name] = translation;
+    }
+    return true;
+}
+
+//image resampled so that registering it onto image finds translation:
+//output(x) = image(x - translation), outside filled with the image minimum
+template <typename TImage>
+typename TImage::Pointer ShiftImage(const TImage *image, const std::vector<double> &translation)
+{
+    typedef itk::TranslationTransform<double, TImage::ImageDimension> TransformType;
+    typedef itk::ResampleImageFilter<TImage, TImage> ResampleFilterType;
+    typedef itk::MinimumMaximumImageCalculator<TImage> CalculatorType;
+
+    typename TransformType::Pointer transform = TransformType::New();
+    typename TransformType::OutputVectorType offset;
+    for (unsigned int axis = 0; axis < TImage::ImageDimension; ++axis)
+    {
+        offset[axis] = -translation[axis];
+    }
+    transform->SetOffset(offset);
+
+    typename CalculatorType::Pointer calculator = CalculatorType::New();
+    calculator->SetImage(image);
+    calculator->ComputeMinimum();
+
+    typename ResampleFilterType::Pointer resampler = ResampleFilterType::New();
+    resampler->SetInput(image);
+    resampler->SetTransform(transform);
+    resampler->SetReferenceImage(image);
+    resampler->UseReferenceImageOn();
+    resampler->SetDefaultPixelValue(calculator->GetMinimum());
+    resampler->Update();
+
+    typename TImage::Pointer shifted = resampler->GetOutput();
+    shifted->DisconnectPipeline();
+    return shifted;
+}
+
+//Every combination of the searched values, the current configuration first.
+//Bins are not searched for metrics without a histogram.
+inline std::vector<TuningCandidate> EnumerateTuningCandidates(const AutotuneOptions &options)
+{
+    const std::vector<double> histogramBins = MetricUsesHistogram(options.settings.metric) ? options.histogramBins
+                                            : std::vector<double>(1, options.settings.numberOfHistogramBins);
+
+    std::vector<TuningCandidate> candidates(1);
+    candidates[0].settings = options.settings;
+    for (std::size_t b = 0; b < histogramBins.size(); ++b)
+    for (std::size_t s = 0; s < options.spatialSamples.size(); ++s)
+    for (std::size_t l = 0; l < options.levels.size(); ++l)
+    for (std::size_t i = 0; i < options.iterations.size(); ++i)
+    for (std::size_t r = 0; r < options.relaxationFactors.size(); ++r)
+    {
+        TuningCandidate candidate;
+        candidate.settings = options.settings;
+        candidate.settings.numberOfHistogramBins = static_cast<unsigned int>(histogramBins[b]);
+        candidate.settings.numberOfSpatialSamples = static_cast<unsigned int>(options.spatialSamples[s]);
+        candidate.settings.numberOfLevels = static_cast<unsigned int>(options.levels[l]);
+        candidate.settings.numberOfIterations = static_cast<unsigned int>(options.iterations[i]);
+        candidate.settings.relaxationFactor = options.relaxationFactors[r];
+
+        const RegistrationSettings &current = options.settings;
+        const RegistrationSettings &tried = candidate.settings;
+        if (tried.numberOfHistogramBins != current.numberOfHistogramBins || tried.numberOfSpatialSamples != current.numberOfSpatialSamples
+            || tried.numberOfLevels != current.numberOfLevels || tried.numberOfIterations != current.numberOfIterations
+            || tried.relaxationFactor != current.relaxationFactor)
+        {
+            candidates.push_back(candidate);
+        }
+    }
+    return candidates;
+}
+
+//Marks the candidates without failures that no other beats on both mean
+//runtime and mean error, and returns them fastest first
+inline std::vector<std::size_t> MarkParetoFront(std::vector<TuningCandidate> &candidates)
+{
+    std::vector<std::size_t> order;
+    for (std::size_t c = 0; c < candidates.size(); ++c)
+    {
+        if (candidates[c].failures == 0)
+        {
+            order.push_back(c);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&candidates](std::size_t a, std::size_t b)
+    {
+        return candidates[a].meanSeconds < candidates[b].meanSeconds
+            || (candidates[a].meanSeconds == candidates[b].meanSeconds && candidates[a].meanErrorMm < candidates[b].meanErrorMm);
+    });
+
+    std::vector<std::size_t> front;
+    for (std::size_t k = 0; k < order.size(); ++k)
+    {
+        if (front.empty() || candidates[order[k]].meanErrorMm < candidates[front.back()].meanErrorMm)
+        {
+            candidates[order[k]].pareto = true;
+            front.push_back(order[k]);
+        }
+    }
+    return front;
+}
+
+inline void PrintTuningCandidate(std::ostream &os, const TuningCandidate &candidate)
+{
+    const RegistrationSettings &settings = candidate.settings;
+    os << "  bins " << settings.numberOfHistogramBins << ", samples " << settings.numberOfSpatialSamples
+       << ", levels " << settings.numberOfLevels << ", iterations " << settings.numberOfIterations
+       << ", relaxation " << settings.relaxationFactor << ": " << 1e3 * candidate.meanSeconds << " ms, error mean "
+       << candidate.meanErrorMm << " mm, max " << candidate.maximumErrorMm << " mm" << std::endl;
+}
+
+inline bool WriteParetoFront(const std::string &fileName, const std::vector<TuningCandidate> &candidates,
+                             const std::vector<std::size_t> &front, std::size_t chosen)
+{
+    std::ofstream file(fileName.c_str());
+    file << "bins,samples,levels,iterations,relaxation,mean_seconds,mean_error_mm,max_error_mm,chosen\n";
+    for (std::size_t k = 0; k < front.size(); ++k)
+    {
+        const TuningCandidate &candidate = candidates[front[k]];
+        const RegistrationSettings &settings = candidate.settings;
+        file << settings.numberOfHistogramBins << ',' << settings.numberOfSpatialSamples << ',' << settings.numberOfLevels << ','
+             << settings.numberOfIterations << ',' << settings.relaxationFactor << ',' << candidate.meanSeconds << ','
+             << candidate.meanErrorMm << ',' << candidate.maximumErrorMm << ',' << (front[k] == chosen ? 1 : 0) << '\n';
+    }
+    return static_cast<bool>(file);
+}
+
+//Runs the search and saves the profile. Returns the number of problems: 0
+//if a candidate met the target, 1 if only the most accurate could be saved
+//or the outputs could not be written. Throws itk::ExceptionObject if an
+//image cannot be read.
+template <typename TImage>
+unsigned int RunAutotune(const AutotuneOptions &options)
+{
+    const unsigned int Dimension = TImage::ImageDimension;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    //Calibration set: moving slices and the translation each should give
+    const typename TImage::Pointer fixedImage = ReadImage<TImage>(options.fixedImageFile);
+    std::vector<typename TImage::Pointer> movingImages;
+    std::vector<std::string> movingNames;
+    std::vector<std::vector<double> > expected;
+    if (options.numberOfSyntheticShifts > 0)
+    {
+        std::mt19937 generator(static_cast<std::mt19937::result_type>(options.settings.seed));
+        std::uniform_real_distribution<double> shift(-options.maximumShiftMm, options.maximumShiftMm);
+        for (unsigned int i = 0; i < options.numberOfSyntheticShifts; ++i)
+        {
+            std::vector<double> translation(Dimension);
+            for (unsigned int axis = 0; axis < Dimension; ++axis)
+            {
+                translation[axis] = shift(generator);
+            }
+            std::ostringstream name;
+            name << "shift" << i;
+            movingImages.push_back(ShiftImage<TImage>(fixedImage.GetPointer(), translation));
+            movingNames.push_back(name.str());
+            expected.push_back(translation);
+        }
+    }
+    else
+    {
+        std::map<std::string, std::vector<double> > references;
+        if (!LoadReferenceTranslations(options.referenceFile, references))
+        {
+            std::cerr << "Cannot read the reference translations " << options.referenceFile << std::endl;
+            return 1;
+        }
+        const std::vector<std::string> movingFiles = ListBatchSlices(options.movingDirectory);
+        for (std::size_t i = 0; i < movingFiles.size(); ++i)
+        {
+            const std::string name = itksys::SystemTools::GetFilenameName(movingFiles[i]);
+            const std::map<std::string, std::vector<double> >::const_iterator reference = references.find(name);
+            if (reference == references.end())
+            {
+                std::cerr << "No reference translation for " << name << ", left out" << std::endl;
+                continue;
+            }
+            movingImages.push_back(ReadImage<TImage>(movingFiles[i]));
+            movingNames.push_back(movingFiles[i]);
+            expected.push_back(std::vector<double>(reference->second.begin(), reference->second.begin() + Dimension));
+        }
+    }
+    if (movingImages.empty())
+    {
+        std::cerr << "The calibration set is empty" << std::endl;
+        return 1;
+    }
+
+    RegistrationSettings settings = options.settings;
+    settings.verbose = false;
+    const unsigned int numberOfWorkers = ChooseBatchThreading(options.numberOfWorkers, settings);
+    AutotuneOptions tuning = options;
+    tuning.settings = settings;
+    std::vector<TuningCandidate> candidates = EnumerateTuningCandidates(tuning);
+
+    const std::size_t numberOfSlices = movingImages.size();
+    std::cout << "Autotune: " << candidates.size() << " configurations on " << numberOfSlices << " slices, "
+              << numberOfWorkers << " workers of " << settings.numberOfThreads << " threads" << std::endl;
+
+    //Every (configuration, slice) pair is one job; a failed registration counts against its configuration
+    std::vector<double> seconds(candidates.size() * numberOfSlices, 0.0);
+    std::vector<double> errors(candidates.size() * numberOfSlices, 0.0);
+    std::vector<char> failed(candidates.size() * numberOfSlices, 0);
+    std::mutex consoleMutex;
+    ParallelForSlices(AllSlices(seconds.size()), numberOfWorkers, [&](std::size_t job)
+    {
+        const std::size_t c = job / numberOfSlices;
+        const std::size_t i = job % numberOfSlices;
+        try
+        {
+            RegistrationSettings sliceSettings = candidates[c].settings;
+            sliceSettings.seed = SliceSeed(options.seedMode, settings.seed, i, movingNames[i]);
+            const RegistrationResult result = RegisterImages<TImage>(fixedImage.GetPointer(), movingImages[i].GetPointer(), sliceSettings);
+
+            double squaredError = 0.0;
+            for (unsigned int axis = 0; axis < Dimension; ++axis)
+            {
+                squaredError += (result.translation[axis] - expected[i][axis]) * (result.translation[axis] - expected[i][axis]);
+            }
+            seconds[job] = result.registerSeconds;
+            errors[job] = std::sqrt(squaredError);
+        }
+        catch(itk::ExceptionObject &e)
+        {
+            failed[job] = 1;
+            std::lock_guard<std::mutex> lock(consoleMutex);
+            std::cerr << "Exception registration update (" << movingNames[i] << ")" << e << std::endl;
+        }
+        catch(std::exception &e)
+        {
+            failed[job] = 1;
+            std::lock_guard<std::mutex> lock(consoleMutex);
+            std::cerr << "Exception registration update (" << movingNames[i] << ")" << std::endl << e.what() << std::endl;
+        }
+    });
+
+    for (std::size_t c = 0; c < candidates.size(); ++c)
+    {
+        for (std::size_t i = 0; i < numberOfSlices; ++i)
+        {
+            const std::size_t job = c * numberOfSlices + i;
+            candidates[c].failures += failed[job];
+            candidates[c].meanSeconds += seconds[job] / numberOfSlices;
+            candidates[c].meanErrorMm += errors[job] / numberOfSlices;
+            candidates[c].maximumErrorMm = std::max(candidates[c].maximumErrorMm, errors[job]);
+        }
+    }
+
+    const std::vector<std::size_t> front = MarkParetoFront(candidates);
+    if (front.empty())
+    {
+        std::cerr << "Every configuration failed on some slice" << std::endl;
+        return 1;
+    }
+
+    //The front is fastest first with falling error: the first meeting the target is the fastest that does
+    std::size_t chosen = front.back();
+    bool targetMet = false;
+    for (std::size_t k = 0; k < front.size() && !targetMet; ++k)
+    {
+        if (candidates[front[k]].meanErrorMm <= options.targetErrorMm)
+        {
+            chosen = front[k];
+            targetMet = true;
+        }
+    }
+
+    std::cout << "Current configuration:" << std::endl;
+    PrintTuningCandidate(std::cout, candidates[0]);
+    std::cout << "Pareto front (" << front.size() << " configurations):" << std::endl;
+    for (std::size_t k = 0; k < front.size(); ++k)
+    {
+        PrintTuningCandidate(std::cout, candidates[front[k]]);
+    }
+    std::cout << (targetMet ? "Fastest within " : "None within ") << options.targetErrorMm
+              << (targetMet ? " mm:" : " mm; the most accurate:") << std::endl;
+    PrintTuningCandidate(std::cout, candidates[chosen]);
+
+    unsigned int problems = targetMet ? 0 : 1;
+    if (options.paretoFile != std::string("") && !WriteParetoFront(options.paretoFile, candidates, front, chosen))
+    {
+        std::cerr << "Cannot write the Pareto front to " << options.paretoFile << std::endl;
+        problems = 1;
+    }
+
+    RegistrationProfile profile;
+    profile.metric = MetricKindName(candidates[chosen].settings.metric);
+    profile.numberOfHistogramBins = candidates[chosen].settings.numberOfHistogramBins;
+    profile.numberOfSpatialSamples = candidates[chosen].settings.numberOfSpatialSamples;
+    profile.numberOfLevels = candidates[chosen].settings.numberOfLevels;
+    profile.numberOfIterations = candidates[chosen].settings.numberOfIterations;
+    profile.relaxationFactor = candidates[chosen].settings.relaxationFactor;
+    profile.meanSeconds = candidates[chosen].meanSeconds;
+    profile.meanErrorMm = candidates[chosen].meanErrorMm;
+    profile.maximumErrorMm = candidates[chosen].maximumErrorMm;
+    if (!SaveRegistrationProfile(options.profileFile, profile))
+    {
+        std::cerr << "Cannot write the profile to " << options.profileFile << std::endl;
+        problems = 1;
+    }
+    else
+    {
+        std::cout << "Profile saved to " << options.profileFile << "; load it with --profile" << std::endl;
+    }
+
+    std::cout << "Autotune took " << SecondsSince(start) << " s" << std::endl;
+    return problems;
+}
+
+#endif
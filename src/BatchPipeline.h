@@ -0,0 +1,1355 @@
+/*
+    Implemented by Imran Irfan, and Evan Wong
+
+*/
+#ifndef BatchPipeline_h
+#define BatchPipeline_h
+
+#include "RegistrationPipeline.h"
+#include "BoundedQueue.h"
+#include "ImageBufferPool.h"
+#include "DicomSeriesIndex.h"
+#include "SliceSignature.h"
+
+#include "itksys/Directory.hxx"
+#include "itksys/SystemTools.hxx"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            BATCH PIPELINE
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+struct BatchOptions
+{
+    BatchOptions()
+        : backgroundGL(100), numberOfWorkers(0), queueDepth(4), streamDivisions(1), seedMode(FixedSeed),
+          matchFixedSlices(false), matchCandidates(1), resume(false), firstSliceIndex(0), cancel(ITK_NULLPTR) {}
+
+    std::string fixedImageFile;              //a directory of reference slices with matchFixedSlices
+    std::string movingDirectory;
+    std::string outputDirectory;
+    std::string identityOutputDirectory;     //optional, "" to skip
+    std::string checkerboardBeforeDirectory; //optional, "" to skip
+    std::string checkerboardAfterDirectory;  //optional, "" to skip
+    double backgroundGL;
+    unsigned int numberOfWorkers;            //0 picks half the hardware threads
+    unsigned int queueDepth;                 //capacity of each inter-stage queue
+    unsigned int streamDivisions;
+    std::string resultsLogFile;              //optional, "" to skip
+    SeedMode seedMode;                       //per-slice seeds are derived from settings.seed
+    RegistrationSettings settings;
+    bool matchFixedSlices;                   //register each slice against its best matching reference slice
+    unsigned int matchCandidates;            //reference slices registered per moving slice, best result kept
+    std::string journalFile;                 //record of finished and failed slices, "" for none
+    bool resume;                             //skip slices the journal records as finished
+    std::vector<std::string> sliceFiles;     //slices to register in place of movingDirectory's, empty for all of those
+    std::size_t firstSliceIndex;             //position of sliceFiles[0] in the whole series, for seeds and records
+    const std::atomic<bool> *cancel;         //when set, no further slices are read; slices already read still finish
+};
+
+//All *.dcm files of a directory, sorted by name
+inline std::vector<std::string> ListDicomFiles(const std::string &directory)
+{
+    std::vector<std::string> fileNames;
+
+    itksys::Directory listing;
+    if (!listing.Load(directory.c_str()))
+    {
+        return fileNames;
+    }
+    for (unsigned long i = 0; i < listing.GetNumberOfFiles(); ++i)
+    {
+        const std::string name = listing.GetFile(i);
+        const std::string path = directory + "/" + name;
+        if (itksys::SystemTools::FileIsDirectory(path.c_str()))
+        {
+            continue;
+        }
+        if (itksys::SystemTools::LowerCase(itksys::SystemTools::GetFilenameLastExtension(name)) == ".dcm")
+        {
+            fileNames.push_back(path);
+        }
+    }
+    std::sort(fileNames.begin(), fileNames.end());
+    return fileNames;
+}
+
+//Moving slices of a batch in slice order: the largest DICOM series of the
+//directory, from its series index, or every *.dcm file sorted by name if no
+//file has a readable DICOM header
+inline std::vector<std::string> ListBatchSlices(const std::string &directory)
+{
+    const DicomDirectoryIndex index = IndexDicomDirectory(directory);
+    std::cout << "Series index: " << index.entries.size() << " files (" << index.numberOfCachedFiles << " from "
+              << DicomIndexFileName << ", " << index.numberOfScannedFiles << " scanned) in " << 1000.0 * index.seconds << " ms";
+    if (index.series.empty())
+    {
+        std::cout << "; no DICOM series, using file names" << std::endl;
+        return ListDicomFiles(directory);
+    }
+    std::cout << "; " << index.series.size() << " series, registering " << index.series.front().seriesInstanceUID
+              << " (" << index.series.front().files.size() << " slices)" << std::endl;
+    return index.series.front().files;
+}
+
+//directory/<file name of inputFile>, or "" if no directory was given
+inline std::string OutputPathFor(const std::string &directory, const std::string &inputFile)
+{
+    if (directory == std::string(""))
+    {
+        return "";
+    }
+    return directory + "/" + itksys::SystemTools::GetFilenameName(inputFile);
+}
+
+//Per-slice registration results of a batch, indexed like the sorted slice
+//list. Entries with stopConditionCode < 0 failed or were not run.
+typedef std::vector<RegistrationResult> BatchResults;
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            JOURNAL
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+//The batch journal is a results log (ResultsLog.h) that gets one record per
+//slice as soon as the slice is settled: its result once all its outputs are
+//written, or a record with stopCondition -1 if it failed. A run that dies
+//leaves at most a truncated last record, which readers ignore, so the
+//journal always lists exactly the slices that were finished. --resume reads
+//it back and skips those slices; without --resume a run starts a new journal.
+
+//Default journal, in the output directory
+const char * const BatchJournalFileName = ".batchjournal";
+
+//Every output file a batch writes for one moving slice
+inline std::vector<std::string> BatchOutputFiles(const BatchOptions &options, const std::string &movingFile)
+{
+    const std::string directories[] = { options.outputDirectory, options.identityOutputDirectory,
+                                        options.checkerboardBeforeDirectory, options.checkerboardAfterDirectory };
+    std::vector<std::string> fileNames;
+    for (unsigned int i = 0; i < 4; ++i)
+    {
+        if (directories[i] != std::string(""))
+        {
+            fileNames.push_back(OutputPathFor(directories[i], movingFile));
+        }
+    }
+    return fileNames;
+}
+
+//True if the file exists and an ImageIO can read its header
+inline bool IsReadableImageFile(const std::string &fileName)
+{
+    if (!itksys::SystemTools::FileExists(fileName.c_str(), true) || itksys::SystemTools::FileLength(fileName) == 0)
+    {
+        return false;
+    }
+    itk::ImageIOBase::Pointer imageIO = itk::ImageIOFactory::CreateImageIO(fileName.c_str(), itk::ImageIOFactory::ReadMode);
+    if (imageIO.IsNull())
+    {
+        return false;
+    }
+    try
+    {
+        imageIO->SetFileName(fileName);
+        imageIO->ReadImageInformation();
+    }
+    catch(itk::ExceptionObject &)
+    {
+        return false;
+    }
+    return true;
+}
+
+//The registration result a journal record holds, for an image of the given dimension
+inline RegistrationResult RegistrationResultFromRecord(const ResultsRecord &record, unsigned int dimension)
+{
+    RegistrationResult result;
+    result.translation.assign(record.translation, record.translation + std::min(dimension, 3u));
+    result.metricValue = record.metricValue;
+    result.stopConditionCode = record.stopCondition;
+    result.stopCondition = StopConditionName(record.stopCondition);
+    for (unsigned int level = 0; level < record.numberOfLevels && level < ResultsMaximumLevels; ++level)
+    {
+        result.iterationsPerLevel.push_back(record.iterationsPerLevel[level]);
+    }
+    result.iterations = result.iterationsPerLevel.empty() ? 0 : result.iterationsPerLevel.back();
+    result.readSeconds = record.readSeconds;
+    result.registerSeconds = record.registerSeconds;
+    result.outputSeconds = record.outputSeconds;
+    result.writeSeconds = record.writeSeconds;
+    return result;
+}
+
+//Results of the slices options.journalFile records as finished whose output
+//files are all still readable, indexed like movingFiles; the others have
+//stopConditionCode -1. Slices are matched by file name and the last record
+//of a slice counts. invalidOutputs receives the number of finished slices
+//that must be redone because an output is missing or unreadable.
+inline BatchResults LoadBatchJournal(const BatchOptions &options, const std::vector<std::string> &movingFiles,
+                                     unsigned int dimension, unsigned int &invalidOutputs)
+{
+    BatchResults finished(movingFiles.size());
+    invalidOutputs = 0;
+
+    ResultsLogReader journal;
+    if (options.journalFile == std::string("") || !journal.Open(options.journalFile))
+    {
+        return finished;
+    }
+
+    std::map<std::string, ResultsRecord> lastRecords;
+    ResultsRecord record;
+    while (journal.Read(record))
+    {
+        lastRecords[GetResultsRecordName(record)] = record;
+    }
+
+    for (std::size_t i = 0; i < movingFiles.size(); ++i)
+    {
+        //Names are stored truncated; truncate the same way before looking up
+        ResultsRecord key;
+        InitializeResultsRecord(key);
+        SetResultsRecordName(key, itksys::SystemTools::GetFilenameName(movingFiles[i]));
+        const std::map<std::string, ResultsRecord>::const_iterator it = lastRecords.find(GetResultsRecordName(key));
+        if (it == lastRecords.end() || it->second.stopCondition < 0)
+        {
+            continue;
+        }
+
+        const std::vector<std::string> outputFiles = BatchOutputFiles(options, movingFiles[i]);
+        bool valid = true;
+        for (std::size_t f = 0; f < outputFiles.size() && valid; ++f)
+        {
+            valid = IsReadableImageFile(outputFiles[f]);
+        }
+        if (!valid)
+        {
+            ++invalidOutputs;
+            continue;
+        }
+        finished[i] = RegistrationResultFromRecord(it->second, dimension);
+    }
+    return finished;
+}
+
+//Opens options.journalFile for appending, first removing it unless the run resumes
+inline bool OpenBatchJournal(const BatchOptions &options, ResultsLogWriter &journal)
+{
+    if (options.journalFile == std::string(""))
+    {
+        return true;
+    }
+    if (!options.resume)
+    {
+        itksys::SystemTools::RemoveFile(options.journalFile.c_str());
+    }
+    return journal.Open(options.journalFile);
+}
+
+//Number of concurrent registrations and threads per registration. Unless
+//given, half the hardware threads register concurrently and the rest of the
+//machine is split evenly between them.
+inline unsigned int ChooseBatchThreading(unsigned int requestedWorkers, RegistrationSettings &settings)
+{
+    const unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    const unsigned int numberOfWorkers = requestedWorkers ? requestedWorkers : std::max(1u, hardwareThreads / 2);
+    if (settings.numberOfThreads == 0)
+    {
+        settings.numberOfThreads = std::max(1u, hardwareThreads / numberOfWorkers);
+    }
+    return numberOfWorkers;
+}
+
+template <typename TImage>
+struct BatchSliceJob
+{
+    std::size_t index;
+    std::string fileName;
+    typename TImage::Pointer image;
+    double readSeconds;
+    int seed;
+    std::vector<typename TImage::Pointer> fixedImages; //matched reference slices, best first; empty for the shared fixed image
+    std::vector<std::string> fixedFileNames;
+};
+
+template <typename TImage>
+struct BatchOutputJob
+{
+    std::size_t index;
+    std::string fileName;
+    RegistrationResult result;
+    typename itk::RegistrationOutputImageFilter<TImage>::Pointer outputFilter;
+    OutputFileList outputFiles;
+    std::string fixedFileName; //matched reference slice, "" for the shared fixed image
+};
+
+//Signatures of every slice of a reference series, for matching moving slices
+//to reference slices (--match-fixed). Each slice is decoded once, reduced to
+//its signature and released.
+template <typename TImage>
+SliceSignatureIndex BuildSliceSignatureIndex(const std::vector<std::string> &fixedFiles)
+{
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    SliceSignatureIndex index;
+    for (std::size_t i = 0; i < fixedFiles.size(); ++i)
+    {
+        const typename TImage::Pointer image = ReadImage<TImage>(fixedFiles[i]);
+        index.Add(fixedFiles[i], ComputeSliceSignature(image.GetPointer()));
+    }
+    std::cout << "Signature index: " << index.GetNumberOfSlices() << " reference slices in " << SecondsSince(start) << " s" << std::endl;
+    return index;
+}
+
+//Recently decoded reference slices. Consecutive moving slices tend to match
+//the same or neighbouring reference slices, so most lookups are hits. Used
+//by the batch reader thread only.
+template <typename TImage>
+class FixedSliceCache
+{
+public:
+    explicit FixedSliceCache(std::size_t capacity) : m_Capacity(std::max<std::size_t>(capacity, 1)) {}
+
+    typename TImage::Pointer Get(const std::string &fileName)
+    {
+        for (std::size_t i = 0; i < m_Entries.size(); ++i)
+        {
+            if (m_Entries[i].first == fileName)
+            {
+                return m_Entries[i].second;
+            }
+        }
+        const typename TImage::Pointer image = ReadImage<TImage>(fileName);
+        m_Entries.push_back(std::make_pair(fileName, image));
+        if (m_Entries.size() > m_Capacity)
+        {
+            m_Entries.pop_front();
+        }
+        return image;
+    }
+
+private:
+    std::size_t m_Capacity;
+    std::deque<std::pair<std::string, typename TImage::Pointer> > m_Entries;
+};
+
+//Where the outcome of every slice of a run goes: the results log and the
+//journal (either may be closed), the console and the failure count. Used by
+//the stages of RunBatch and RunWatchFolder from any thread.
+class BatchSliceRecorder
+{
+public:
+    BatchSliceRecorder(ResultsLogWriter &resultsLog, ResultsLogWriter &journal)
+        : m_ResultsLog(resultsLog), m_Journal(journal), m_Failures(0) {}
+
+    //A slice that fails is reported, journaled and counted; the run goes on
+    void Failed(unsigned int sliceId, const std::string &fileName, const char *stage, const std::string &what)
+    {
+        m_Journal.Append(MakeResultsRecord(sliceId, itksys::SystemTools::GetFilenameName(fileName), RegistrationResult()));
+        ++m_Failures;
+        std::lock_guard<std::mutex> lock(m_ConsoleMutex);
+        std::cerr << "Exception in " << stage << " (" << fileName << ")" << std::endl << what << std::endl;
+    }
+
+    //Logs and journals a slice whose outputs are all on disk
+    void Finished(unsigned int sliceId, const std::string &fileName, const RegistrationResult &result)
+    {
+        const ResultsRecord record = MakeResultsRecord(sliceId, itksys::SystemTools::GetFilenameName(fileName), result);
+        m_ResultsLog.Append(record);
+        m_Journal.Append(record);
+    }
+
+    //The console line of a finished slice, with suffix appended
+    void Print(const std::string &fileName, const RegistrationResult &result, const std::string &fixedFileName,
+               const std::string &suffix)
+    {
+        std::lock_guard<std::mutex> lock(m_ConsoleMutex);
+        std::cout << itksys::SystemTools::GetFilenameName(fileName)
+                  << "  X = " << result.translation[0]
+                  << "  Y = " << result.translation[1];
+        if (result.translation.size() > 2)
+        {
+            std::cout << "  Z = " << result.translation[2];
+        }
+        std::cout << "  Iterations = " << result.iterations
+                  << "  Metric Value = " << result.metricValue;
+        if (fixedFileName != std::string(""))
+        {
+            std::cout << "  Fixed = " << itksys::SystemTools::GetFilenameName(fixedFileName);
+        }
+        std::cout << suffix << std::endl;
+    }
+
+    unsigned int GetNumberOfFailures() const { return m_Failures; }
+
+private:
+    ResultsLogWriter &m_ResultsLog;
+    ResultsLogWriter &m_Journal;
+    std::atomic<unsigned int> m_Failures;
+    std::mutex m_ConsoleMutex;
+};
+
+//Runs one stage of a slice. If it throws, the slice is recorded as failed in
+//stage and false is returned.
+template <typename TFunction>
+bool RunSliceStage(BatchSliceRecorder &recorder, unsigned int sliceId, const std::string &fileName, const char *stage,
+                   const TFunction &function)
+{
+    try
+    {
+        function();
+    }
+    catch(itk::ExceptionObject &e)
+    {
+        std::ostringstream what;
+        what << e;
+        recorder.Failed(sliceId, fileName, stage, what.str());
+        return false;
+    }
+    catch(std::exception &e)
+    {
+        recorder.Failed(sliceId, fileName, stage, e.what());
+        return false;
+    }
+    return true;
+}
+
+//A worker's step: registers job.image against fixedImage, or against each of
+//the job's matched reference slices keeping the best, unless preset holds a
+//valid result; then sets up the fused outputs in output. options supplies the
+//output directories, backgroundGL and streamDivisions (BatchOptions or
+//WatchOptions). Throws itk::ExceptionObject on failure.
+template <typename TImage, typename TOptions>
+void RegisterSliceOutputs(const TOptions &options, const RegistrationSettings &settings, const TImage *fixedImage,
+                          const BatchSliceJob<TImage> &job, const RegistrationResult *preset, BatchOutputJob<TImage> &output)
+{
+    typedef itk::RegistrationOutputImageFilter<TImage> OutputFilterType;
+
+    output.index = job.index;
+    output.fileName = job.fileName;
+
+    //The shared fixed image, or the matched reference slice that registers best
+    const TImage *sliceFixedImage = fixedImage;
+    if (!job.fixedImages.empty())
+    {
+        sliceFixedImage = job.fixedImages[0];
+        output.fixedFileName = job.fixedFileNames[0];
+    }
+
+    if (preset && preset->stopConditionCode >= 0)
+    {
+        output.result = *preset;
+    }
+    else
+    {
+        RegistrationSettings sliceSettings = settings;
+        sliceSettings.seed = job.seed;
+        output.result = RegisterImages<TImage>(sliceFixedImage, job.image, sliceSettings);
+        for (std::size_t m = 1; m < job.fixedImages.size(); ++m)
+        {
+            //Time and metric work of every candidate count towards the slice
+            const RegistrationResult candidate = RegisterImages<TImage>(job.fixedImages[m], job.image, sliceSettings);
+            RegistrationResult total = output.result;
+            total.registerSeconds += candidate.registerSeconds;
+            total.metricEvaluations += candidate.metricEvaluations;
+            total.metricSeconds += candidate.metricSeconds;
+            total.metricThreadingSeconds += candidate.metricThreadingSeconds;
+            total.metricCacheLookups += candidate.metricCacheLookups;
+            total.metricCacheHits += candidate.metricCacheHits;
+            if (candidate.metricValue < output.result.metricValue)
+            {
+                output.result = candidate;
+                sliceFixedImage = job.fixedImages[m];
+                output.fixedFileName = job.fixedFileNames[m];
+            }
+            output.result.registerSeconds = total.registerSeconds;
+            output.result.metricEvaluations = total.metricEvaluations;
+            output.result.metricSeconds = total.metricSeconds;
+            output.result.metricThreadingSeconds = total.metricThreadingSeconds;
+            output.result.metricCacheLookups = total.metricCacheLookups;
+            output.result.metricCacheHits = total.metricCacheHits;
+        }
+    }
+    output.result.readSeconds = job.readSeconds;
+
+    const std::chrono::steady_clock::time_point outputStart = std::chrono::steady_clock::now();
+    output.outputFilter = MakeRegistrationOutputFilter<TImage>(sliceFixedImage, job.image, output.result,
+        static_cast<typename TImage::PixelType>(options.backgroundGL), settings.numberOfThreads);
+    output.outputFiles = MakeOutputFileList<OutputFilterType>(
+        OutputPathFor(options.outputDirectory, job.fileName),
+        OutputPathFor(options.identityOutputDirectory, job.fileName),
+        OutputPathFor(options.checkerboardBeforeDirectory, job.fileName),
+        OutputPathFor(options.checkerboardAfterDirectory, job.fileName));
+
+    //Unstreamed outputs are computed here so the writer only encodes;
+    //streamed ones are computed slab by slab while writing.
+    if (options.streamDivisions <= 1)
+    {
+        output.outputFilter->Update();
+    }
+    output.result.outputSeconds = SecondsSince(outputStart);
+}
+
+//The writer's step: encodes and flushes the outputs of a slice, then logs and
+//journals it (only now that every output is on disk). False if a writer
+//failed, in which case the slice is recorded as failed.
+template <typename TImage>
+bool WriteSliceOutputs(BatchOutputJob<TImage> &output, unsigned int streamDivisions, unsigned int sliceId,
+                       BatchSliceRecorder &recorder)
+{
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (!RunSliceStage(recorder, sliceId, output.fileName, "File Writer", [&]()
+        {
+            WriteRegistrationOutputs(output.outputFilter.GetPointer(), output.outputFiles, streamDivisions);
+        }))
+    {
+        return false;
+    }
+    output.result.writeSeconds = SecondsSince(start);
+    recorder.Finished(sliceId, output.fileName, output.result);
+    return true;
+}
+
+//Registers every slice of options.movingDirectory against one fixed image with
+//three overlapping stages connected by bounded queues:
+//  reader thread  -> decodes the next moving slices ahead of the workers
+//  worker threads -> register and compute the fused outputs
+//  writer thread  -> encodes and flushes the output files
+//A full queue blocks its producer, so memory stays bounded by the queue depths.
+//Slices with a valid entry in presetResults skip registration and only get
+//their outputs. If results is given it receives every slice's final result.
+//A caller that already decoded options.fixedImageFile passes it as
+//presetFixedImage so it is not read again. Returns the number of slices that
+//failed.
+template <typename TImage>
+unsigned int RunBatch(const BatchOptions &options, const BatchResults *presetResults = ITK_NULLPTR, BatchResults *results = ITK_NULLPTR,
+                      const TImage *presetFixedImage = ITK_NULLPTR)
+{
+    typedef BatchSliceJob<TImage> SliceJobType;
+    typedef BatchOutputJob<TImage> OutputJobType;
+    typedef std::chrono::steady_clock Clock;
+
+    const std::vector<std::string> movingFiles = options.sliceFiles.empty() ? ListBatchSlices(options.movingDirectory) : options.sliceFiles;
+    if (movingFiles.empty())
+    {
+        std::cerr << "No .dcm files found in " << options.movingDirectory << std::endl;
+        return 1;
+    }
+
+    const std::string outputDirectories[] = { options.outputDirectory, options.identityOutputDirectory,
+                                              options.checkerboardBeforeDirectory, options.checkerboardAfterDirectory };
+    for (unsigned int i = 0; i < 4; ++i)
+    {
+        if (outputDirectories[i] != std::string(""))
+        {
+            itksys::SystemTools::MakeDirectory(outputDirectories[i].c_str());
+        }
+    }
+
+    //The fixed image is decoded once and shared read-only by every worker. With
+    //matchFixedSlices it is a series instead, and the reader thread attaches
+    //the reference slices whose signatures best match each moving slice.
+    typename TImage::ConstPointer fixedImage = presetFixedImage;
+    SliceSignatureIndex fixedIndex;
+    if (options.matchFixedSlices)
+    {
+        fixedIndex = BuildSliceSignatureIndex<TImage>(ListBatchSlices(options.fixedImageFile));
+        if (fixedIndex.GetNumberOfSlices() == 0)
+        {
+            std::cerr << "No reference slices found in " << options.fixedImageFile << std::endl;
+            return static_cast<unsigned int>(movingFiles.size());
+        }
+    }
+    else if (!fixedImage)
+    {
+        fixedImage = ReadImage<TImage>(options.fixedImageFile);
+    }
+    FixedSliceCache<TImage> fixedSliceCache(2 * options.matchCandidates + 2);
+
+    RegistrationSettings settings = options.settings;
+    settings.verbose = false;
+    const unsigned int numberOfWorkers = ChooseBatchThreading(options.numberOfWorkers, settings);
+
+    //Slices a previous run finished (--resume) are neither read nor registered again
+    unsigned int invalidOutputs = 0;
+    const BatchResults finished = options.resume ? LoadBatchJournal(options, movingFiles, TImage::ImageDimension, invalidOutputs)
+                                                 : BatchResults(movingFiles.size());
+    std::size_t numberOfFinished = 0;
+    for (std::size_t i = 0; i < finished.size(); ++i)
+    {
+        numberOfFinished += (finished[i].stopConditionCode >= 0) ? 1 : 0;
+    }
+    if (options.resume)
+    {
+        std::cout << "Resuming: " << numberOfFinished << " of " << movingFiles.size() << " slices finished in "
+                  << options.journalFile << ", " << invalidOutputs << " more redone for missing or unreadable outputs" << std::endl;
+    }
+
+    if (results)
+    {
+        *results = finished;
+    }
+
+    ResultsLogWriter resultsLog;
+    if (options.resultsLogFile != std::string("") && !resultsLog.Open(options.resultsLogFile))
+    {
+        std::cerr << "Cannot open results log " << options.resultsLogFile << std::endl;
+        return static_cast<unsigned int>(movingFiles.size());
+    }
+
+    ResultsLogWriter journal;
+    if (!OpenBatchJournal(options, journal))
+    {
+        std::cerr << "Cannot open batch journal " << options.journalFile << std::endl;
+        return static_cast<unsigned int>(movingFiles.size());
+    }
+
+    BatchSliceRecorder recorder(resultsLog, journal);
+    const auto sliceId = [&options](std::size_t index)
+    {
+        return static_cast<unsigned int>(options.firstSliceIndex + index);
+    };
+
+    BoundedQueue<SliceJobType> readQueue(options.queueDepth);
+    BoundedQueue<OutputJobType> writeQueue(options.queueDepth);
+
+    std::atomic<unsigned int> activeWorkers(numberOfWorkers);
+
+    double readSeconds = 0.0;
+    double writeSeconds = 0.0;
+    std::vector<double> workerSeconds(numberOfWorkers, 0.0);
+    unsigned long metricEvaluations = 0;
+    double metricSeconds = 0.0;
+    double metricThreadingSeconds = 0.0;
+    unsigned long metricCacheLookups = 0;
+    unsigned long metricCacheHits = 0;
+    std::size_t registeredSlices = 0;
+    std::size_t deadlineMisses = 0;
+    std::size_t deadlineCutShort = 0;
+    std::size_t movedStarts = 0;
+    std::size_t startsCancelled = 0;
+    double worstLatency = 0.0;
+
+    const Clock::time_point batchStart = Clock::now();
+    const ImageBufferPoolStatistics poolStart = ImageBufferPool::GetInstance().GetStatistics();
+
+    std::thread reader([&]()
+    {
+        for (std::size_t i = 0; i < movingFiles.size(); ++i)
+        {
+            if (options.cancel && options.cancel->load())
+            {
+                break;
+            }
+            if (finished[i].stopConditionCode >= 0)
+            {
+                continue;
+            }
+            const Clock::time_point start = Clock::now();
+            SliceJobType job;
+            job.index = i;
+            job.fileName = movingFiles[i];
+            if (!RunSliceStage(recorder, sliceId(i), job.fileName, "File Reader", [&]()
+                {
+                    job.image = ReadImage<TImage>(job.fileName);
+                    if (options.matchFixedSlices)
+                    {
+                        const std::vector<std::pair<std::size_t, double> > matches =
+                            fixedIndex.FindBestMatches(ComputeSliceSignature(job.image.GetPointer()), options.matchCandidates);
+                        for (std::size_t m = 0; m < matches.size(); ++m)
+                        {
+                            job.fixedFileNames.push_back(fixedIndex.GetFileName(matches[m].first));
+                            job.fixedImages.push_back(fixedSliceCache.Get(job.fixedFileNames.back()));
+                        }
+                    }
+                }))
+            {
+                continue;
+            }
+            //Hashing right after decoding reads the file from the page cache
+            job.seed = SliceSeed(options.seedMode, options.settings.seed, options.firstSliceIndex + i, job.fileName);
+            job.readSeconds = SecondsSince(start);
+            readSeconds += job.readSeconds;
+
+            if (!readQueue.Push(job))
+            {
+                break;
+            }
+        }
+        readQueue.Close();
+    });
+
+    std::vector<std::thread> workers;
+    for (unsigned int w = 0; w < numberOfWorkers; ++w)
+    {
+        workers.push_back(std::thread([&, w]()
+        {
+            SliceJobType job;
+            while (readQueue.Pop(job))
+            {
+                const Clock::time_point start = Clock::now();
+                OutputJobType output;
+                const RegistrationResult *preset = (presetResults && job.index < presetResults->size()) ? &(*presetResults)[job.index] : ITK_NULLPTR;
+                if (!RunSliceStage(recorder, sliceId(job.index), job.fileName, "registration update", [&]()
+                    {
+                        RegisterSliceOutputs<TImage>(options, settings, fixedImage, job, preset, output);
+                    }))
+                {
+                    continue;
+                }
+                workerSeconds[w] += SecondsSince(start);
+
+                job = SliceJobType();
+                if (!writeQueue.Push(output))
+                {
+                    break;
+                }
+            }
+            if (--activeWorkers == 0)
+            {
+                writeQueue.Close();
+            }
+        }));
+    }
+
+    std::thread writer([&]()
+    {
+        OutputJobType output;
+        while (writeQueue.Pop(output))
+        {
+            if (!WriteSliceOutputs(output, options.streamDivisions, sliceId(output.index), recorder))
+            {
+                continue;
+            }
+            writeSeconds += output.result.writeSeconds;
+            metricEvaluations += output.result.metricEvaluations;
+            metricSeconds += output.result.metricSeconds;
+            metricThreadingSeconds += output.result.metricThreadingSeconds;
+            metricCacheLookups += output.result.metricCacheLookups;
+            metricCacheHits += output.result.metricCacheHits;
+            ++registeredSlices;
+            deadlineMisses += (output.result.registerSeconds > settings.deadlineSeconds) ? 1 : 0;
+            deadlineCutShort += (output.result.levelsSkipped > 0) ? 1 : 0;
+            movedStarts += (output.result.winningStart > 0) ? 1 : 0;
+            startsCancelled += output.result.startsCancelled;
+            worstLatency = std::max(worstLatency, output.result.registerSeconds);
+            if (results)
+            {
+                (*results)[output.index] = output.result;
+            }
+            recorder.Print(output.fileName, output.result, output.fixedFileName, "");
+
+            output = OutputJobType();
+        }
+    });
+
+    reader.join();
+    for (unsigned int w = 0; w < numberOfWorkers; ++w)
+    {
+        workers[w].join();
+    }
+    writer.join();
+
+    const double wallSeconds = SecondsSince(batchStart);
+    double registerSeconds = 0.0;
+    for (unsigned int w = 0; w < numberOfWorkers; ++w)
+    {
+        registerSeconds += workerSeconds[w];
+    }
+
+    std::cout << "////////////////////////////////////////////////////////////////////" << std::endl;
+    std::cout << "Slices = " << movingFiles.size() << ", failed = " << recorder.GetNumberOfFailures();
+    if (options.resume)
+    {
+        std::cout << ", finished earlier = " << numberOfFinished;
+    }
+    std::cout << std::endl;
+    std::cout << "Workers = " << numberOfWorkers << ", threads per worker = " << settings.numberOfThreads << std::endl;
+    std::cout << "Wall time = " << wallSeconds << " s" << std::endl;
+    std::cout << "Reader busy = " << readSeconds << " s (" << 100.0 * readSeconds / wallSeconds << "%)" << std::endl;
+    std::cout << "Workers busy = " << registerSeconds << " s ("
+              << 100.0 * registerSeconds / (wallSeconds * numberOfWorkers) << "% of " << numberOfWorkers << ")" << std::endl;
+    std::cout << "Writer busy = " << writeSeconds << " s (" << 100.0 * writeSeconds / wallSeconds << "%)" << std::endl;
+    PrintQueueStatistics(std::cout, "Read queue", readQueue.GetStatistics());
+    PrintQueueStatistics(std::cout, "Write queue", writeQueue.GetStatistics());
+    PrintMetricTiming(std::cout, metricEvaluations, metricSeconds, metricThreadingSeconds);
+    PrintMetricCacheStatistics(std::cout, metricCacheLookups, metricCacheHits, metricSeconds, metricEvaluations);
+    PrintDeadlineStatistics(std::cout, settings.deadlineSeconds, registeredSlices, deadlineMisses, deadlineCutShort, worstLatency);
+    PrintMultiStartStatistics(std::cout, settings.numberOfStarts, registeredSlices, movedStarts, startsCancelled);
+    PrintImageBufferPoolStatistics(std::cout, ImageBufferPool::GetInstance().GetStatistics().Since(poolStart), movingFiles.size());
+
+    return recorder.GetNumberOfFailures();
+}
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            TIERED ESCALATION
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+//When a cheap first-pass result is not trusted
+struct EscalationCriteria
+{
+    EscalationCriteria() : neighbourhood(3), translationToleranceMM(1.0), robustSigmas(3.0) {}
+
+    unsigned int neighbourhood;    //slices on each side a slice is compared with
+    double translationToleranceMM; //translations this close to the neighbours are never outliers
+    double robustSigmas;           //outlier threshold, in robust standard deviations of the series
+};
+
+//Why a slice was escalated, as a bit mask
+enum EscalationReason
+{
+    EscalateFailed = 1,        //the cheap registration threw
+    EscalateStopCondition = 2, //stopped on anything but a small step or gradient
+    EscalateTranslation = 4,   //translation far from the neighbours' median
+    EscalateMetric = 8         //metric value clearly worse than the neighbours'
+};
+
+inline double Median(std::vector<double> values)
+{
+    if (values.empty())
+    {
+        return 0.0;
+    }
+    const std::size_t middle = values.size() / 2;
+    std::nth_element(values.begin(), values.begin() + middle, values.end());
+    return values[middle];
+}
+
+//Escalation reasons of every slice (0 = keep the cheap result). Slices are
+//compared with the median of their valid neighbours; the thresholds scale
+//with the median absolute deviation over the whole series, so a series that
+//drifts smoothly does not escalate.
+inline std::vector<unsigned int> FindSuspectSlices(const BatchResults &results, const EscalationCriteria &criteria)
+{
+    const std::size_t numberOfSlices = results.size();
+    std::vector<unsigned int> reasons(numberOfSlices, 0);
+    std::vector<double> translationResiduals(numberOfSlices, -1.0);
+    std::vector<double> metricResiduals(numberOfSlices, 0.0);
+    std::vector<bool> hasNeighbours(numberOfSlices, false);
+
+    for (std::size_t i = 0; i < numberOfSlices; ++i)
+    {
+        const RegistrationResult &result = results[i];
+        if (result.stopConditionCode < 0)
+        {
+            reasons[i] |= EscalateFailed;
+            continue;
+        }
+        //Converged, rather than stopped by the iteration limit or a failure
+        if (result.stopConditionCode != itk::RegularStepGradientDescentOptimizer::GradientMagnitudeTolerance
+            && result.stopConditionCode != itk::RegularStepGradientDescentOptimizer::StepTooSmall)
+        {
+            reasons[i] |= EscalateStopCondition;
+        }
+
+        const std::size_t first = i >= criteria.neighbourhood ? i - criteria.neighbourhood : 0;
+        const std::size_t last = std::min(numberOfSlices - 1, i + criteria.neighbourhood);
+        std::vector<double> metricValues;
+        std::vector<std::vector<double> > translations(result.translation.size());
+        for (std::size_t j = first; j <= last; ++j)
+        {
+            if (j == i || results[j].stopConditionCode < 0)
+            {
+                continue;
+            }
+            metricValues.push_back(results[j].metricValue);
+            for (std::size_t d = 0; d < result.translation.size(); ++d)
+            {
+                translations[d].push_back(results[j].translation[d]);
+            }
+        }
+        if (metricValues.empty())
+        {
+            continue;
+        }
+
+        double squaredDistance = 0.0;
+        for (std::size_t d = 0; d < result.translation.size(); ++d)
+        {
+            const double difference = result.translation[d] - Median(translations[d]);
+            squaredDistance += difference * difference;
+        }
+        hasNeighbours[i] = true;
+        translationResiduals[i] = std::sqrt(squaredDistance);
+        metricResiduals[i] = result.metricValue - Median(metricValues); //positive = worse, the metrics are minimised
+    }
+
+    std::vector<double> translationSpread;
+    std::vector<double> metricSpread;
+    for (std::size_t i = 0; i < numberOfSlices; ++i)
+    {
+        if (hasNeighbours[i])
+        {
+            translationSpread.push_back(translationResiduals[i]);
+            metricSpread.push_back(std::fabs(metricResiduals[i]));
+        }
+    }
+    const double robustScale = 1.4826; //median absolute deviation to standard deviation
+    const double translationThreshold = std::max(criteria.translationToleranceMM,
+                                                 criteria.robustSigmas * robustScale * Median(translationSpread));
+    const double metricThreshold = criteria.robustSigmas * robustScale * Median(metricSpread);
+
+    for (std::size_t i = 0; i < numberOfSlices; ++i)
+    {
+        if (!hasNeighbours[i])
+        {
+            continue;
+        }
+        if (translationResiduals[i] > translationThreshold)
+        {
+            reasons[i] |= EscalateTranslation;
+        }
+        if (metricThreshold > 0.0 && metricResiduals[i] > metricThreshold)
+        {
+            reasons[i] |= EscalateMetric;
+        }
+    }
+    return reasons;
+}
+
+//Runs function(i) for every slice index in indices on numberOfWorkers threads
+template <typename TFunction>
+void ParallelForSlices(const std::vector<std::size_t> &indices, unsigned int numberOfWorkers, const TFunction &function)
+{
+    std::atomic<std::size_t> next(0);
+    std::vector<std::thread> workers;
+    for (unsigned int w = 0; w < numberOfWorkers; ++w)
+    {
+        workers.push_back(std::thread([&]()
+        {
+            for (std::size_t k = next++; k < indices.size(); k = next++)
+            {
+                function(indices[k]);
+            }
+        }));
+    }
+    for (unsigned int w = 0; w < numberOfWorkers; ++w)
+    {
+        workers[w].join();
+    }
+}
+
+//0, 1, ..., count - 1
+inline std::vector<std::size_t> AllSlices(std::size_t count)
+{
+    std::vector<std::size_t> indices(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        indices[i] = i;
+    }
+    return indices;
+}
+
+//Registers the listed slices with the given settings on numberOfWorkers
+//threads, without producing outputs. Results go to results[i]; a slice that
+//fails keeps a result with stopConditionCode -1.
+template <typename TImage>
+void RegisterSlices(const TImage *fixedImage, const std::vector<std::string> &movingFiles, const std::vector<std::size_t> &indices,
+                    const RegistrationSettings &settings, SeedMode seedMode, unsigned int numberOfWorkers, BatchResults &results)
+{
+    std::mutex consoleMutex;
+    ParallelForSlices(indices, numberOfWorkers, [&](std::size_t i)
+    {
+        try
+        {
+            const typename TImage::Pointer movingImage = ReadImage<TImage>(movingFiles[i]);
+            RegistrationSettings sliceSettings = settings;
+            sliceSettings.seed = SliceSeed(seedMode, settings.seed, i, movingFiles[i]);
+            results[i] = RegisterImages<TImage>(fixedImage, movingImage, sliceSettings);
+        }
+        catch(itk::ExceptionObject &e)
+        {
+            results[i] = RegistrationResult();
+            std::lock_guard<std::mutex> lock(consoleMutex);
+            std::cerr << "Exception registration update (" << movingFiles[i] << ")" << e << std::endl;
+        }
+        catch(std::exception &e)
+        {
+            results[i] = RegistrationResult();
+            std::lock_guard<std::mutex> lock(consoleMutex);
+            std::cerr << "Exception registration update (" << movingFiles[i] << ")" << std::endl << e.what() << std::endl;
+        }
+    });
+}
+
+//Two-tier batch: every slice is registered with cheapSettings first, slices
+//whose result looks wrong next to their neighbours are registered again with
+//options.settings, and the outputs of all slices are produced by RunBatch.
+//Returns the number of slices that failed.
+template <typename TImage>
+unsigned int RunTieredBatch(const BatchOptions &options, const RegistrationSettings &cheapSettings, const EscalationCriteria &criteria)
+{
+    const std::vector<std::string> movingFiles = ListBatchSlices(options.movingDirectory);
+    if (movingFiles.empty())
+    {
+        std::cerr << "No .dcm files found in " << options.movingDirectory << std::endl;
+        return 1;
+    }
+
+    const typename TImage::Pointer fixedImage = ReadImage<TImage>(options.fixedImageFile);
+
+    RegistrationSettings settings = cheapSettings;
+    settings.verbose = false;
+    const unsigned int numberOfWorkers = ChooseBatchThreading(options.numberOfWorkers, settings);
+
+    //With --resume the finished slices keep their journaled (final) results,
+    //which also serve as neighbours when judging the others
+    unsigned int invalidOutputs = 0;
+    BatchResults cheapResults = options.resume ? LoadBatchJournal(options, movingFiles, TImage::ImageDimension, invalidOutputs)
+                                               : BatchResults(movingFiles.size());
+    std::vector<std::size_t> tier1Slices;
+    for (std::size_t i = 0; i < movingFiles.size(); ++i)
+    {
+        if (cheapResults[i].stopConditionCode < 0)
+        {
+            tier1Slices.push_back(i);
+        }
+    }
+    const BatchResults finished = cheapResults;
+
+    const std::chrono::steady_clock::time_point tier1Start = std::chrono::steady_clock::now();
+    RegisterSlices<TImage>(fixedImage, movingFiles, tier1Slices, settings, options.seedMode, numberOfWorkers, cheapResults);
+    const double tier1WallSeconds = SecondsSince(tier1Start);
+
+    std::vector<unsigned int> reasons = FindSuspectSlices(cheapResults, criteria);
+    for (std::size_t i = 0; i < movingFiles.size(); ++i)
+    {
+        reasons[i] = (finished[i].stopConditionCode >= 0) ? 0 : reasons[i];
+    }
+
+    //Escalated slices get no preset, so RunBatch registers them with the full settings
+    BatchResults presets = cheapResults;
+    unsigned int escalated = 0;
+    unsigned int reasonCounts[4] = { 0, 0, 0, 0 };
+    for (std::size_t i = 0; i < movingFiles.size(); ++i)
+    {
+        if (reasons[i] == 0)
+        {
+            continue;
+        }
+        ++escalated;
+        presets[i].stopConditionCode = -1;
+        std::cout << "Escalating " << itksys::SystemTools::GetFilenameName(movingFiles[i]) << ":";
+        const char * const reasonNames[] = { "failed", "stop condition", "translation", "metric" };
+        for (unsigned int r = 0; r < 4; ++r)
+        {
+            if (reasons[i] & (1u << r))
+            {
+                ++reasonCounts[r];
+                std::cout << " " << reasonNames[r];
+            }
+        }
+        std::cout << std::endl;
+    }
+
+    const std::chrono::steady_clock::time_point tier2Start = std::chrono::steady_clock::now();
+    BatchResults finalResults;
+    const unsigned int failures = RunBatch<TImage>(options, &presets, &finalResults, fixedImage.GetPointer());
+    const double tier2WallSeconds = SecondsSince(tier2Start);
+
+    //Registration time summed over slices, so the figures do not depend on
+    //how well the workers overlapped
+    double cheapSeconds = 0.0;
+    for (std::size_t k = 0; k < tier1Slices.size(); ++k)
+    {
+        cheapSeconds += cheapResults[tier1Slices[k]].registerSeconds;
+    }
+    double fullSeconds = 0.0;
+    unsigned int fullRuns = 0;
+    for (std::size_t i = 0; i < finalResults.size(); ++i)
+    {
+        if (reasons[i] != 0 && finalResults[i].stopConditionCode >= 0)
+        {
+            fullSeconds += finalResults[i].registerSeconds;
+            ++fullRuns;
+        }
+    }
+
+    std::cout << "////////////////////////////////////////////////////////////////////" << std::endl;
+    std::cout << "Tier 1 = " << tier1Slices.size() << " slices, " << cheapSeconds << " s registering ("
+              << tier1WallSeconds << " s wall)" << std::endl;
+    std::cout << "Escalated = " << escalated << " (" << 100.0 * escalated / std::max<std::size_t>(tier1Slices.size(), 1) << "%): "
+              << reasonCounts[0] << " failed, " << reasonCounts[1] << " stop condition, "
+              << reasonCounts[2] << " translation, " << reasonCounts[3] << " metric" << std::endl;
+    std::cout << "Tier 2 = " << fullRuns << " slices, " << fullSeconds << " s registering (outputs included: "
+              << tier2WallSeconds << " s wall)" << std::endl;
+    if (fullRuns > 0)
+    {
+        //Estimated from the mean full-configuration time of the escalated slices
+        const double allFullSeconds = fullSeconds / fullRuns * tier1Slices.size();
+        std::cout << "Speed-up over the full configuration for every slice = "
+                  << allFullSeconds / (cheapSeconds + fullSeconds) << "x (estimated " << allFullSeconds << " s)" << std::endl;
+    }
+    else
+    {
+        std::cout << "Speed-up = n/a (no slice needed the full configuration)" << std::endl;
+    }
+
+    return failures;
+}
+
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            SPARSE SLICES
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+struct SparseOptions
+{
+    SparseOptions() : step(4), maximumJumpMM(1.0), tolerance(0.05) {}
+
+    unsigned int step;    //initial distance between fully registered slices
+    double maximumJumpMM; //registered neighbours further apart than this get the slice between them registered too
+    double tolerance;     //relative metric increase an interpolated slice may show over its neighbours
+};
+
+//Fully registers every options.step-th slice (and the last), then halves any
+//gap whose end translations differ by more than maximumJumpMM until the
+//translation varies smoothly across every gap. Slices in between get the
+//linearly interpolated translation, checked with one metric evaluation
+//against the same evaluation at the registered neighbours; slices failing
+//the check are registered normally. Outputs are produced by RunBatch. With
+//options.resume the slices the journal records as finished are kept as they
+//are. Returns the number of slices that failed.
+template <typename TImage>
+unsigned int RunSparseBatch(const BatchOptions &options, const SparseOptions &sparse)
+{
+    const std::vector<std::string> movingFiles = ListBatchSlices(options.movingDirectory);
+    if (movingFiles.empty())
+    {
+        std::cerr << "No .dcm files found in " << options.movingDirectory << std::endl;
+        return 1;
+    }
+    const std::size_t numberOfSlices = movingFiles.size();
+    const std::size_t step = std::max(1u, sparse.step);
+
+    const typename TImage::Pointer fixedImage = ReadImage<TImage>(options.fixedImageFile);
+
+    RegistrationSettings settings = options.settings;
+    settings.verbose = false;
+    const unsigned int numberOfWorkers = ChooseBatchThreading(options.numberOfWorkers, settings);
+
+    //With --resume the slices the journal records as finished, registered or
+    //interpolated, keep their results: they anchor the gaps like key slices
+    //and are not registered or interpolated again, only evaluated where they
+    //bound a slice interpolated now
+    unsigned int invalidOutputs = 0;
+    BatchResults results = options.resume ? LoadBatchJournal(options, movingFiles, TImage::ImageDimension, invalidOutputs)
+                                          : BatchResults(numberOfSlices);
+    std::vector<bool> registered(numberOfSlices, false);
+    std::size_t resumedSlices = 0;
+    for (std::size_t i = 0; i < numberOfSlices; ++i)
+    {
+        registered[i] = results[i].stopConditionCode >= 0;
+        resumedSlices += registered[i] ? 1 : 0;
+    }
+    const std::vector<bool> resumed = registered;
+
+    //Key slices
+    std::vector<std::size_t> pending;
+    for (std::size_t i = 0; i < numberOfSlices; i += step)
+    {
+        if (!registered[i])
+        {
+            pending.push_back(i);
+        }
+    }
+    if (!registered[numberOfSlices - 1] && (pending.empty() || pending.back() != numberOfSlices - 1))
+    {
+        pending.push_back(numberOfSlices - 1);
+    }
+
+    std::size_t keySlices = 0;
+    for (;;)
+    {
+        RegisterSlices<TImage>(fixedImage, movingFiles, pending, settings, options.seedMode, numberOfWorkers, results);
+        for (std::size_t k = 0; k < pending.size(); ++k)
+        {
+            registered[pending[k]] = true;
+        }
+        keySlices += pending.size();
+
+        //Refine gaps where the translation jumps (or an end failed)
+        pending.clear();
+        std::size_t previous = 0;
+        for (std::size_t i = 1; i < numberOfSlices; ++i)
+        {
+            if (!registered[i])
+            {
+                continue;
+            }
+            if (i - previous > 1)
+            {
+                const RegistrationResult &a = results[previous];
+                const RegistrationResult &b = results[i];
+                double squaredJump = 0.0;
+                const bool bothValid = a.stopConditionCode >= 0 && b.stopConditionCode >= 0;
+                for (std::size_t d = 0; bothValid && d < a.translation.size(); ++d)
+                {
+                    squaredJump += (b.translation[d] - a.translation[d]) * (b.translation[d] - a.translation[d]);
+                }
+                if (!bothValid || std::sqrt(squaredJump) > sparse.maximumJumpMM)
+                {
+                    pending.push_back((previous + i) / 2);
+                }
+            }
+            previous = i;
+        }
+        if (pending.empty())
+        {
+            break;
+        }
+    }
+
+    //Interpolate the rest
+    std::vector<std::size_t> lower(numberOfSlices), upper(numberOfSlices);
+    std::vector<std::size_t> interpolated;
+    {
+        std::size_t previous = 0;
+        for (std::size_t i = 1; i < numberOfSlices; ++i)
+        {
+            if (!registered[i])
+            {
+                continue;
+            }
+            for (std::size_t j = previous + 1; j < i; ++j)
+            {
+                const double w = static_cast<double>(j - previous) / static_cast<double>(i - previous);
+                RegistrationResult &result = results[j];
+                result = RegistrationResult();
+                for (std::size_t d = 0; d < results[previous].translation.size(); ++d)
+                {
+                    result.translation.push_back((1.0 - w) * results[previous].translation[d] + w * results[i].translation[d]);
+                }
+                result.stopConditionCode = ResultsInterpolatedStopCondition;
+                result.stopCondition = "Interpolated between " + itksys::SystemTools::GetFilenameName(movingFiles[previous])
+                                       + " and " + itksys::SystemTools::GetFilenameName(movingFiles[i]);
+                lower[j] = previous;
+                upper[j] = i;
+                interpolated.push_back(j);
+            }
+            previous = i;
+        }
+    }
+
+    //One metric evaluation per interpolated slice and per registered slice
+    //bounding one. All evaluations share the base seed so they sample the
+    //same fixed image positions and can be compared.
+    std::vector<bool> needsCheck(numberOfSlices, false);
+    for (std::size_t k = 0; k < interpolated.size(); ++k)
+    {
+        needsCheck[interpolated[k]] = true;
+        needsCheck[lower[interpolated[k]]] = true;
+        needsCheck[upper[interpolated[k]]] = true;
+    }
+    std::vector<std::size_t> checks;
+    for (std::size_t i = 0; i < numberOfSlices; ++i)
+    {
+        if (needsCheck[i])
+        {
+            checks.push_back(i);
+        }
+    }
+
+    const std::chrono::steady_clock::time_point checkStart = std::chrono::steady_clock::now();
+    std::vector<double> checkValues(numberOfSlices, 0.0);
+    std::vector<char> checked(numberOfSlices, 0); //written from several threads, so not vector<bool>
+    std::mutex consoleMutex;
+    ParallelForSlices(checks, numberOfWorkers, [&](std::size_t i)
+    {
+        try
+        {
+            const typename TImage::Pointer movingImage = ReadImage<TImage>(movingFiles[i]);
+            checkValues[i] = EvaluateRegistrationMetric<TImage>(fixedImage, movingImage, results[i].translation, settings);
+            checked[i] = 1;
+        }
+        catch(itk::ExceptionObject &e)
+        {
+            std::lock_guard<std::mutex> lock(consoleMutex);
+            std::cerr << "Exception in metric check (" << movingFiles[i] << ")" << e << std::endl;
+        }
+        catch(std::exception &e)
+        {
+            std::lock_guard<std::mutex> lock(consoleMutex);
+            std::cerr << "Exception in metric check (" << movingFiles[i] << ")" << std::endl << e.what() << std::endl;
+        }
+    });
+    const double checkSeconds = SecondsSince(checkStart);
+
+    std::vector<std::size_t> fallbacks;
+    for (std::size_t k = 0; k < interpolated.size(); ++k)
+    {
+        const std::size_t j = interpolated[k];
+        const std::size_t a = lower[j];
+        const std::size_t b = upper[j];
+        bool accepted = checked[j] && checked[a] && checked[b];
+        if (accepted)
+        {
+            //The metrics are minimised: fail if clearly worse than the neighbours suggest
+            const double w = static_cast<double>(j - a) / static_cast<double>(b - a);
+            const double expected = (1.0 - w) * checkValues[a] + w * checkValues[b];
+            accepted = checkValues[j] <= expected + sparse.tolerance * std::fabs(expected);
+            results[j].metricValue = checkValues[j];
+        }
+        if (!accepted)
+        {
+            fallbacks.push_back(j);
+        }
+    }
+    RegisterSlices<TImage>(fixedImage, movingFiles, fallbacks, settings, options.seedMode, numberOfWorkers, results);
+
+    //Registration time summed over the slices of this run, so the figures do
+    //not depend on how well the workers overlapped
+    double registerSeconds = 0.0;
+    unsigned int registeredCount = 0;
+    for (std::size_t i = 0; i < numberOfSlices; ++i)
+    {
+        if (!resumed[i] && results[i].stopConditionCode >= 0 && results[i].stopConditionCode != ResultsInterpolatedStopCondition)
+        {
+            registerSeconds += results[i].registerSeconds;
+            ++registeredCount;
+        }
+    }
+
+    const unsigned int failures = RunBatch<TImage>(options, &results, ITK_NULLPTR, fixedImage.GetPointer());
+
+    std::cout << "////////////////////////////////////////////////////////////////////" << std::endl;
+    std::cout << "Slices = " << numberOfSlices << ": " << resumedSlices << " finished before, " << keySlices
+              << " registered as key slices (initial step " << step << "), " << interpolated.size() - fallbacks.size()
+              << " interpolated, " << fallbacks.size() << " registered after failing the check" << std::endl;
+    std::cout << "Registration = " << registerSeconds << " s, checks = " << checkSeconds << " s wall" << std::endl;
+    if (registeredCount > 0)
+    {
+        //Estimated from the mean time of the slices that were registered
+        const double allSeconds = registerSeconds / registeredCount * (numberOfSlices - resumedSlices);
+        std::cout << "Speed-up over registering every slice = " << allSeconds / (registerSeconds + checkSeconds)
+                  << "x (estimated " << allSeconds << " s)" << std::endl;
+    }
+
+    return failures;
+}
+
+#endif
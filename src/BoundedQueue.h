@@ -0,0 +1,142 @@
+/*
+    Implemented by Imran Irfan, and Evan Wong
+
+*/
+#ifndef BoundedQueue_h
+#define BoundedQueue_h
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            BOUNDED QUEUE
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+//Occupancy of one pipeline queue. Depth is sampled every time an item is pushed.
+struct QueueStatistics
+{
+    QueueStatistics() : capacity(0), pushes(0), maximumDepth(0), depthSum(0), producerWaitSeconds(0.0), consumerWaitSeconds(0.0) {}
+
+    double GetMeanDepth() const { return pushes ? static_cast<double>(depthSum) / pushes : 0.0; }
+
+    std::size_t capacity;
+    std::size_t pushes;
+    std::size_t maximumDepth;
+    std::size_t depthSum;
+    double producerWaitSeconds; //time spent blocked on a full queue (back-pressure)
+    double consumerWaitSeconds; //time spent blocked on an empty queue (starvation)
+};
+
+inline void PrintQueueStatistics(std::ostream &os, const std::string &name, const QueueStatistics &statistics)
+{
+    os << name << ": capacity " << statistics.capacity
+       << ", items " << statistics.pushes
+       << ", mean depth " << statistics.GetMeanDepth()
+       << ", max depth " << statistics.maximumDepth
+       << ", producers blocked " << statistics.producerWaitSeconds << " s"
+       << ", consumers blocked " << statistics.consumerWaitSeconds << " s" << std::endl;
+}
+
+//Fixed-capacity multi-producer / multi-consumer queue. Push blocks while the
+//queue is full so a fast stage cannot run arbitrarily far ahead of a slow one.
+//Close() wakes every waiter; Pop keeps draining until the queue is empty.
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(std::size_t capacity) : m_Capacity(capacity ? capacity : 1), m_Closed(false)
+    {
+        m_Statistics.capacity = m_Capacity;
+    }
+
+    //Returns false if the queue was closed before the item could be added.
+    bool Push(const T &item)
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        if (m_Items.size() >= m_Capacity && !m_Closed)
+        {
+            const Clock::time_point start = Clock::now();
+            m_NotFull.wait(lock, [this] { return m_Items.size() < m_Capacity || m_Closed; });
+            m_Statistics.producerWaitSeconds += Seconds(Clock::now() - start);
+        }
+        if (m_Closed)
+        {
+            return false;
+        }
+
+        m_Items.push_back(item);
+        ++m_Statistics.pushes;
+        m_Statistics.depthSum += m_Items.size();
+        if (m_Items.size() > m_Statistics.maximumDepth)
+        {
+            m_Statistics.maximumDepth = m_Items.size();
+        }
+        m_NotEmpty.notify_one();
+        return true;
+    }
+
+    //Returns false once the queue is closed and drained.
+    bool Pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        if (m_Items.empty() && !m_Closed)
+        {
+            const Clock::time_point start = Clock::now();
+            m_NotEmpty.wait(lock, [this] { return !m_Items.empty() || m_Closed; });
+            m_Statistics.consumerWaitSeconds += Seconds(Clock::now() - start);
+        }
+        if (m_Items.empty())
+        {
+            return false;
+        }
+
+        item = m_Items.front();
+        m_Items.pop_front();
+        m_NotFull.notify_one();
+        return true;
+    }
+
+    void Close()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Closed = true;
+        m_NotEmpty.notify_all();
+        m_NotFull.notify_all();
+    }
+
+    QueueStatistics GetStatistics() const
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_Statistics;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    static double Seconds(Clock::duration duration)
+    {
+        return std::chrono::duration_cast<std::chrono::duration<double> >(duration).count();
+    }
+
+    BoundedQueue(const BoundedQueue &);
+    void operator=(const BoundedQueue &);
+
+    const std::size_t m_Capacity;
+    bool m_Closed;
+    std::deque<T> m_Items;
+    mutable std::mutex m_Mutex;
+    std::condition_variable m_NotEmpty;
+    std::condition_variable m_NotFull;
+    QueueStatistics m_Statistics;
+};
+
+#endif
@@ -0,0 +1,132 @@
+/*
+    Implemented by Imran Irfan, and Evan Wong
+
+*/
+#ifndef CommandLine_h
+#define CommandLine_h
+
+#include "itkMacro.h"
+
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            COMMAND LINE
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+// Splits "--name value" / "--name=value" options out of argv and keeps the
+// remaining arguments, in order, as positionals so the original
+// "FixedImage MovingImage OutputImage ..." calling convention still works.
+// Names listed in flagNames never consume the following argument.
+class CommandLine
+{
+public:
+    CommandLine(int argc, char *argv[], const char * const flagNames[])
+    {
+        m_ProgramName = (argc > 0) ? argv[0] : "";
+
+        for (int i = 1; i < argc; ++i)
+        {
+            const std::string arg = argv[i];
+            if (arg.size() < 3 || arg.compare(0, 2, "--") != 0)
+            {
+                m_Positionals.push_back(arg);
+                continue;
+            }
+
+            const std::string::size_type equals = arg.find('=');
+            if (equals != std::string::npos)
+            {
+                m_Options[arg.substr(2, equals - 2)] = arg.substr(equals + 1);
+                continue;
+            }
+
+            const std::string name = arg.substr(2);
+            if (IsFlag(name, flagNames) || i + 1 >= argc || std::string(argv[i + 1]).compare(0, 2, "--") == 0)
+            {
+                m_Options[name] = "1";
+            }
+            else
+            {
+                m_Options[name] = argv[++i];
+            }
+        }
+    }
+
+    const std::string & GetProgramName() const { return m_ProgramName; }
+
+    std::size_t GetNumberOfPositionals() const { return m_Positionals.size(); }
+
+    std::string GetPositional(std::size_t i, const std::string & defaultValue = "") const
+    {
+        return (i < m_Positionals.size()) ? m_Positionals[i] : defaultValue;
+    }
+
+    bool Has(const std::string & name) const
+    {
+        return m_Options.find(name) != m_Options.end();
+    }
+
+    std::string GetString(const std::string & name, const std::string & defaultValue = "") const
+    {
+        std::map<std::string, std::string>::const_iterator it = m_Options.find(name);
+        return (it != m_Options.end()) ? it->second : defaultValue;
+    }
+
+    long GetInt(const std::string & name, long defaultValue) const
+    {
+        return Has(name) ? atol(GetString(name).c_str()) : defaultValue;
+    }
+
+    double GetDouble(const std::string & name, double defaultValue) const
+    {
+        return Has(name) ? atof(GetString(name).c_str()) : defaultValue;
+    }
+
+    // Comma separated values, "--name 32,64,128"; defaultValue if absent
+    std::vector<double> GetDoubleList(const std::string & name, const std::vector<double> & defaultValue) const
+    {
+        if (!Has(name))
+        {
+            return defaultValue;
+        }
+        std::vector<double> values;
+        const std::string list = GetString(name);
+        for (std::string::size_type begin = 0; begin <= list.size(); )
+        {
+            std::string::size_type end = list.find(',', begin);
+            end = (end == std::string::npos) ? list.size() : end;
+            if (end > begin)
+            {
+                values.push_back(atof(list.substr(begin, end - begin).c_str()));
+            }
+            begin = end + 1;
+        }
+        return values;
+    }
+
+private:
+    static bool IsFlag(const std::string & name, const char * const flagNames[])
+    {
+        for (unsigned int i = 0; flagNames != ITK_NULLPTR && flagNames[i] != ITK_NULLPTR; ++i)
+        {
+            if (name == flagNames[i])
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string m_ProgramName;
+    std::vector<std::string> m_Positionals;
+    std::map<std::string, std::string> m_Options;
+};
+
+#endif
@@ -0,0 +1,372 @@
+/*
+    Implemented by Imran Irfan, and Evan Wong
+
+*/
+#ifndef DicomSeriesIndex_h
+#define DicomSeriesIndex_h
+
+#include "gdcmScanner.h"
+#include "gdcmTag.h"
+#include "itksys/Directory.hxx"
+#include "itksys/SystemTools.hxx"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            DICOM SERIES INDEX
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+//The index of a directory groups its DICOM files by SeriesInstanceUID and
+//sorts each series along the slice normal. Files are read with gdcm::Scanner,
+//which parses the header only up to the last tag asked for and never reaches
+//PixelData. The index is kept in DicomIndexFileName next to the data with each
+//file's size and modification time; later runs only stat the files and scan
+//the ones that are new or changed, so an unchanged directory is never opened.
+
+const char * const DicomIndexFileName = ".dicomindex";
+const unsigned int DicomIndexVersion = 1;
+
+//What the index knows about one file of the directory
+struct DicomIndexEntry
+{
+    DicomIndexEntry() : fileSize(0), modifiedTime(0), instanceNumber(0), hasPosition(false)
+    {
+        std::fill(position, position + 3, 0.0);
+        std::fill(orientation, orientation + 6, 0.0);
+        orientation[0] = orientation[4] = 1.0;
+    }
+
+    std::string fileName;           //name within the directory
+    unsigned long fileSize;
+    long modifiedTime;              //seconds since the epoch
+    std::string seriesInstanceUID;  //"" if the file is not DICOM
+    long instanceNumber;
+    bool hasPosition;               //ImagePositionPatient and ImageOrientationPatient were present
+    double position[3];             //mm
+    double orientation[6];          //row and column direction cosines
+};
+
+//Files of one series, sorted along the slice normal
+struct DicomSeries
+{
+    std::string seriesInstanceUID;
+    std::vector<std::string> files; //full paths
+};
+
+struct DicomDirectoryIndex
+{
+    DicomDirectoryIndex() : numberOfScannedFiles(0), numberOfCachedFiles(0), seconds(0.0) {}
+
+    std::vector<DicomIndexEntry> entries;
+    std::vector<DicomSeries> series;    //largest first
+    unsigned int numberOfScannedFiles;  //headers read by this run
+    unsigned int numberOfCachedFiles;   //taken from the saved index
+    double seconds;
+};
+
+//Value of a scanned tag without DICOM padding; "" if the file lacks it
+inline std::string ScannedDicomValue(const gdcm::Scanner &scanner, const std::string &path, const gdcm::Tag &tag)
+{
+    const char *value = scanner.GetValue(path.c_str(), tag);
+    std::string text = value ? value : "";
+    const std::size_t end = text.find_last_not_of(std::string(" \0", 2));
+    return (end == std::string::npos) ? std::string("") : text.substr(0, end + 1);
+}
+
+//Parses a backslash separated multi-valued decimal string into count values
+inline bool ParseDicomDecimals(const std::string &text, double *values, unsigned int count)
+{
+    std::istringstream stream(text);
+    std::string item;
+    unsigned int parsed = 0;
+    while (parsed < count && std::getline(stream, item, '\\'))
+    {
+        char *end = nullptr;
+        values[parsed] = std::strtod(item.c_str(), &end);
+        if (end == item.c_str())
+        {
+            return false;
+        }
+        ++parsed;
+    }
+    return parsed == count;
+}
+
+//Reads the headers of the given files of directory into entries
+inline void ScanDicomHeaders(const std::string &directory, std::vector<DicomIndexEntry *> &entries)
+{
+    if (entries.empty())
+    {
+        return;
+    }
+
+    const gdcm::Tag seriesInstanceUIDTag(0x0020, 0x000e);
+    const gdcm::Tag instanceNumberTag(0x0020, 0x0013);
+    const gdcm::Tag imagePositionTag(0x0020, 0x0032);
+    const gdcm::Tag imageOrientationTag(0x0020, 0x0037);
+
+    gdcm::Scanner scanner;
+    scanner.AddTag(seriesInstanceUIDTag);
+    scanner.AddTag(instanceNumberTag);
+    scanner.AddTag(imagePositionTag);
+    scanner.AddTag(imageOrientationTag);
+
+    std::vector<std::string> paths;
+    for (std::size_t i = 0; i < entries.size(); ++i)
+    {
+        paths.push_back(directory + "/" + entries[i]->fileName);
+    }
+    scanner.Scan(paths);
+
+    for (std::size_t i = 0; i < entries.size(); ++i)
+    {
+        DicomIndexEntry &entry = *entries[i];
+        if (!scanner.IsKey(paths[i].c_str()))
+        {
+            entry.seriesInstanceUID = "";
+            continue;
+        }
+        entry.seriesInstanceUID = ScannedDicomValue(scanner, paths[i], seriesInstanceUIDTag);
+        if (entry.seriesInstanceUID == std::string(""))
+        {
+            entry.seriesInstanceUID = "unknown"; //DICOM without a series UID still forms a series
+        }
+        entry.instanceNumber = std::atol(ScannedDicomValue(scanner, paths[i], instanceNumberTag).c_str());
+        entry.hasPosition = ParseDicomDecimals(ScannedDicomValue(scanner, paths[i], imagePositionTag), entry.position, 3)
+                            && ParseDicomDecimals(ScannedDicomValue(scanner, paths[i], imageOrientationTag), entry.orientation, 6);
+    }
+}
+
+//Loads the saved index of directory; entries keyed by file name
+inline std::map<std::string, DicomIndexEntry> LoadDicomIndexFile(const std::string &directory)
+{
+    std::map<std::string, DicomIndexEntry> entries;
+    std::ifstream file((directory + "/" + DicomIndexFileName).c_str());
+    std::string line;
+    unsigned int version = 0;
+    if (!std::getline(file, line) || std::sscanf(line.c_str(), "DICOMINDEX %u", &version) != 1 || version != DicomIndexVersion)
+    {
+        return entries;
+    }
+
+    //name, size, mtime, series UID ("-" if not DICOM), instance number, has position, 3 positions, 6 cosines
+    while (std::getline(file, line))
+    {
+        const std::size_t tab = line.find('\t');
+        if (tab == std::string::npos)
+        {
+            continue;
+        }
+        DicomIndexEntry entry;
+        entry.fileName = line.substr(0, tab);
+        std::istringstream fields(line.substr(tab + 1));
+        int hasPosition = 0;
+        fields >> entry.fileSize >> entry.modifiedTime >> entry.seriesInstanceUID >> entry.instanceNumber >> hasPosition;
+        for (unsigned int i = 0; i < 3; ++i)
+        {
+            fields >> entry.position[i];
+        }
+        for (unsigned int i = 0; i < 6; ++i)
+        {
+            fields >> entry.orientation[i];
+        }
+        if (!fields)
+        {
+            continue;
+        }
+        entry.hasPosition = (hasPosition != 0);
+        if (entry.seriesInstanceUID == std::string("-"))
+        {
+            entry.seriesInstanceUID = "";
+        }
+        entries[entry.fileName] = entry;
+    }
+    return entries;
+}
+
+//Saves the index next to the data. Written to a temporary file and renamed,
+//so concurrent runs on the same directory never see half an index. False if
+//the directory is not writable; the index is then rebuilt by every run.
+inline bool SaveDicomIndexFile(const std::string &directory, const std::vector<DicomIndexEntry> &entries)
+{
+    std::ostringstream temporaryName;
+    temporaryName << directory << "/" << DicomIndexFileName << "." << getpid();
+    {
+        std::ofstream file(temporaryName.str().c_str());
+        if (!file)
+        {
+            return false;
+        }
+        file << "DICOMINDEX " << DicomIndexVersion << "\n" << std::setprecision(17);
+        for (std::size_t i = 0; i < entries.size(); ++i)
+        {
+            const DicomIndexEntry &entry = entries[i];
+            file << entry.fileName << '\t' << entry.fileSize << ' ' << entry.modifiedTime << ' '
+                 << (entry.seriesInstanceUID.empty() ? std::string("-") : entry.seriesInstanceUID) << ' '
+                 << entry.instanceNumber << ' ' << (entry.hasPosition ? 1 : 0);
+            for (unsigned int d = 0; d < 3; ++d)
+            {
+                file << ' ' << entry.position[d];
+            }
+            for (unsigned int d = 0; d < 6; ++d)
+            {
+                file << ' ' << entry.orientation[d];
+            }
+            file << '\n';
+        }
+        if (!file.flush())
+        {
+            std::remove(temporaryName.str().c_str());
+            return false;
+        }
+    }
+    return std::rename(temporaryName.str().c_str(), (directory + "/" + DicomIndexFileName).c_str()) == 0;
+}
+
+//Position of an entry along its slice normal (row x column cosines)
+inline double SliceLocation(const DicomIndexEntry &entry)
+{
+    const double *o = entry.orientation;
+    const double normal[3] = { o[1] * o[5] - o[2] * o[4], o[2] * o[3] - o[0] * o[5], o[0] * o[4] - o[1] * o[3] };
+    return normal[0] * entry.position[0] + normal[1] * entry.position[1] + normal[2] * entry.position[2];
+}
+
+//Slice order within a series: along the normal when every slice has a
+//position, by InstanceNumber otherwise, file name last
+struct DicomSliceOrder
+{
+    explicit DicomSliceOrder(bool usePosition) : m_UsePosition(usePosition) {}
+
+    bool operator()(const DicomIndexEntry *a, const DicomIndexEntry *b) const
+    {
+        if (m_UsePosition)
+        {
+            const double locationA = SliceLocation(*a);
+            const double locationB = SliceLocation(*b);
+            if (locationA != locationB)
+            {
+                return locationA < locationB;
+            }
+        }
+        if (a->instanceNumber != b->instanceNumber)
+        {
+            return a->instanceNumber < b->instanceNumber;
+        }
+        return a->fileName < b->fileName;
+    }
+
+    bool m_UsePosition;
+};
+
+//Index of every regular file of directory, reusing the saved index for files
+//whose size and modification time have not changed
+inline DicomDirectoryIndex IndexDicomDirectory(const std::string &directory, bool useSavedIndex = true)
+{
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    DicomDirectoryIndex index;
+
+    itksys::Directory listing;
+    if (!listing.Load(directory.c_str()))
+    {
+        return index;
+    }
+
+    std::vector<std::string> names;
+    for (unsigned long i = 0; i < listing.GetNumberOfFiles(); ++i)
+    {
+        const std::string name = listing.GetFile(i);
+        if (!name.empty() && name[0] != '.' && !itksys::SystemTools::FileIsDirectory((directory + "/" + name).c_str()))
+        {
+            names.push_back(name);
+        }
+    }
+    std::sort(names.begin(), names.end());
+
+    const std::map<std::string, DicomIndexEntry> saved = useSavedIndex ? LoadDicomIndexFile(directory)
+                                                                      : std::map<std::string, DicomIndexEntry>();
+    index.entries.resize(names.size());
+    std::vector<DicomIndexEntry *> toScan;
+    for (std::size_t i = 0; i < names.size(); ++i)
+    {
+        const std::string path = directory + "/" + names[i];
+        DicomIndexEntry &entry = index.entries[i];
+        entry.fileName = names[i];
+        entry.fileSize = itksys::SystemTools::FileLength(path);
+        entry.modifiedTime = itksys::SystemTools::ModifiedTime(path);
+
+        std::map<std::string, DicomIndexEntry>::const_iterator known = saved.find(names[i]);
+        if (known != saved.end() && known->second.fileSize == entry.fileSize && known->second.modifiedTime == entry.modifiedTime)
+        {
+            entry = known->second;
+        }
+        else
+        {
+            toScan.push_back(&entry);
+        }
+    }
+
+    ScanDicomHeaders(directory, toScan);
+    index.numberOfScannedFiles = static_cast<unsigned int>(toScan.size());
+    index.numberOfCachedFiles = static_cast<unsigned int>(names.size() - toScan.size());
+    if (!toScan.empty() || saved.size() != index.entries.size())
+    {
+        SaveDicomIndexFile(directory, index.entries);
+    }
+
+    //Group by series
+    std::map<std::string, std::vector<const DicomIndexEntry *> > groups;
+    for (std::size_t i = 0; i < index.entries.size(); ++i)
+    {
+        if (!index.entries[i].seriesInstanceUID.empty())
+        {
+            groups[index.entries[i].seriesInstanceUID].push_back(&index.entries[i]);
+        }
+    }
+    for (std::map<std::string, std::vector<const DicomIndexEntry *> >::iterator group = groups.begin(); group != groups.end(); ++group)
+    {
+        std::vector<const DicomIndexEntry *> &slices = group->second;
+        bool usePosition = true;
+        for (std::size_t i = 0; i < slices.size(); ++i)
+        {
+            usePosition = usePosition && slices[i]->hasPosition;
+        }
+        std::sort(slices.begin(), slices.end(), DicomSliceOrder(usePosition));
+
+        DicomSeries series;
+        series.seriesInstanceUID = group->first;
+        for (std::size_t i = 0; i < slices.size(); ++i)
+        {
+            series.files.push_back(directory + "/" + slices[i]->fileName);
+        }
+        index.series.push_back(series);
+    }
+    std::stable_sort(index.series.begin(), index.series.end(),
+                     [](const DicomSeries &a, const DicomSeries &b) { return a.files.size() > b.files.size(); });
+
+    index.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return index;
+}
+
+//Files of the largest series of directory in slice order; empty if it holds no DICOM
+inline std::vector<std::string> DicomSeriesFiles(const std::string &directory)
+{
+    const DicomDirectoryIndex index = IndexDicomDirectory(directory);
+    return index.series.empty() ? std::vector<std::string>() : index.series.front().files;
+}
+
+#endif
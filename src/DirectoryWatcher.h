@@ -0,0 +1,231 @@
+/*
+    Implemented by Imran Irfan, and Evan Wong
+
+*/
+#ifndef DirectoryWatcher_h
+#define DirectoryWatcher_h
+
+#include "itksys/Directory.hxx"
+#include "itksys/SystemTools.hxx"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            DIRECTORY WATCHER
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+//Reports the *.dcm files of a directory once each, as soon as they are
+//completely written. On Linux a file is complete when inotify sees the writer
+//close it (IN_CLOSE_WRITE) or when it is moved in whole (IN_MOVED_TO), the
+//usual way exporters publish a file. Files that were there before the watch
+//started, files missed because the kernel's event queue overflowed and, on
+//other systems, every file are polled instead: they count as complete once
+//their size and modification time have not changed for settleSeconds.
+class DirectoryWatcher
+{
+public:
+    explicit DirectoryWatcher(const std::string &directory, double settleSeconds = 1.0)
+        : m_Directory(directory), m_SettleSeconds(settleSeconds), m_InotifyFd(-1), m_NeedsRescan(true)
+    {
+#if defined(__linux__)
+        m_InotifyFd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+        if (m_InotifyFd >= 0 && inotify_add_watch(m_InotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+        {
+            close(m_InotifyFd);
+            m_InotifyFd = -1;
+        }
+#endif
+    }
+
+    ~DirectoryWatcher()
+    {
+#if defined(__linux__)
+        if (m_InotifyFd >= 0)
+        {
+            close(m_InotifyFd);
+        }
+#endif
+    }
+
+    bool IsUsingInotify() const { return m_InotifyFd >= 0; }
+
+    //Files completed since the last call, in the order they completed. Waits
+    //up to timeoutSeconds for the first one; returns empty on timeout.
+    std::vector<std::string> WaitForFiles(double timeoutSeconds)
+    {
+        const Clock::time_point deadline = Clock::now() + std::chrono::microseconds(static_cast<long long>(1e6 * timeoutSeconds));
+        std::vector<std::string> files;
+        for (;;)
+        {
+            //Short waits so files that are only polled still settle on time
+            const long long remainingMs = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+            const int waitMs = static_cast<int>(std::max(0LL, std::min(remainingMs, static_cast<long long>(PollIntervalMs))));
+
+            if (IsUsingInotify())
+            {
+                ReadEvents(files, waitMs);
+            }
+            else
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(waitMs));
+                m_NeedsRescan = true;
+            }
+            if (m_NeedsRescan)
+            {
+                Rescan();
+            }
+            SettlePendingFiles(files);
+
+            if (!files.empty() || Clock::now() >= deadline)
+            {
+                return files;
+            }
+        }
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    static const int PollIntervalMs = 200;
+
+    //A file seen by a scan but not yet known to be complete
+    struct PendingFile
+    {
+        unsigned long size;
+        long modifiedTime;
+        Clock::time_point unchangedSince;
+    };
+
+    static bool IsDicomFileName(const std::string &name)
+    {
+        return itksys::SystemTools::LowerCase(itksys::SystemTools::GetFilenameLastExtension(name)) == ".dcm";
+    }
+
+    void Report(const std::string &name, std::vector<std::string> &files)
+    {
+        m_Pending.erase(name);
+        if (m_Reported.insert(name).second)
+        {
+            files.push_back(m_Directory + "/" + name);
+        }
+    }
+
+#if defined(__linux__)
+    void ReadEvents(std::vector<std::string> &files, int waitMs)
+    {
+        struct pollfd descriptor;
+        descriptor.fd = m_InotifyFd;
+        descriptor.events = POLLIN;
+        descriptor.revents = 0;
+        if (poll(&descriptor, 1, waitMs) <= 0)
+        {
+            return;
+        }
+
+        alignas(struct inotify_event) char buffer[16384];
+        for (;;)
+        {
+            const ssize_t length = read(m_InotifyFd, buffer, sizeof(buffer));
+            if (length <= 0)
+            {
+                return;
+            }
+            for (ssize_t offset = 0; offset < length; )
+            {
+                const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(buffer + offset);
+                offset += static_cast<ssize_t>(sizeof(struct inotify_event) + event->len);
+                if (event->mask & IN_Q_OVERFLOW)
+                {
+                    //Events were dropped: whatever arrived meanwhile is found by scanning
+                    m_NeedsRescan = true;
+                }
+                else if (event->len > 0 && !(event->mask & IN_ISDIR) && IsDicomFileName(event->name))
+                {
+                    Report(event->name, files);
+                }
+            }
+        }
+    }
+#else
+    void ReadEvents(std::vector<std::string> &, int) {}
+#endif
+
+    //Adds the files of the directory that are neither reported nor pending
+    void Rescan()
+    {
+        m_NeedsRescan = false;
+        itksys::Directory listing;
+        if (!listing.Load(m_Directory.c_str()))
+        {
+            return;
+        }
+        for (unsigned long i = 0; i < listing.GetNumberOfFiles(); ++i)
+        {
+            const std::string name = listing.GetFile(i);
+            const std::string path = m_Directory + "/" + name;
+            if (!IsDicomFileName(name) || m_Reported.count(name) || m_Pending.count(name)
+                || itksys::SystemTools::FileIsDirectory(path.c_str()))
+            {
+                continue;
+            }
+            PendingFile pending;
+            pending.size = itksys::SystemTools::FileLength(path);
+            pending.modifiedTime = itksys::SystemTools::ModifiedTime(path);
+            pending.unchangedSince = Clock::now();
+            m_Pending[name] = pending;
+        }
+    }
+
+    //Reports pending files that stopped changing settleSeconds ago, oldest first
+    void SettlePendingFiles(std::vector<std::string> &files)
+    {
+        const Clock::time_point now = Clock::now();
+        std::vector<std::pair<Clock::time_point, std::string> > settled;
+        for (std::map<std::string, PendingFile>::iterator it = m_Pending.begin(); it != m_Pending.end(); ++it)
+        {
+            const std::string path = m_Directory + "/" + it->first;
+            const unsigned long size = itksys::SystemTools::FileLength(path);
+            const long modifiedTime = itksys::SystemTools::ModifiedTime(path);
+            if (size != it->second.size || modifiedTime != it->second.modifiedTime)
+            {
+                it->second.size = size;
+                it->second.modifiedTime = modifiedTime;
+                it->second.unchangedSince = now;
+            }
+            else if (std::chrono::duration<double>(now - it->second.unchangedSince).count() >= m_SettleSeconds)
+            {
+                settled.push_back(std::make_pair(it->second.unchangedSince, it->first));
+            }
+        }
+        std::sort(settled.begin(), settled.end());
+        for (std::size_t i = 0; i < settled.size(); ++i)
+        {
+            Report(settled[i].second, files);
+        }
+    }
+
+    std::string m_Directory;
+    double m_SettleSeconds;
+    int m_InotifyFd;
+    bool m_NeedsRescan;
+    std::set<std::string> m_Reported;
+    std::map<std::string, PendingFile> m_Pending;
+};
+
+#endif
@@ -0,0 +1,189 @@
+/*
+    Implemented by Imran Irfan, and Evan Wong
+
+*/
+#ifndef ImageBufferPool_h
+#define ImageBufferPool_h
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            IMAGE BUFFER POOL
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+//Counters of an ImageBufferPool. requests = allocations + reuses.
+struct ImageBufferPoolStatistics
+{
+    ImageBufferPoolStatistics()
+        : requests(0), allocations(0), bytesAllocated(0), reuses(0), bytesReused(0), frees(0), idleBytes(0), maximumIdleBytes(0) {}
+
+    //Counters accumulated since an earlier snapshot (idle sizes are kept as is)
+    ImageBufferPoolStatistics Since(const ImageBufferPoolStatistics &earlier) const
+    {
+        ImageBufferPoolStatistics difference = *this;
+        difference.requests -= earlier.requests;
+        difference.allocations -= earlier.allocations;
+        difference.bytesAllocated -= earlier.bytesAllocated;
+        difference.reuses -= earlier.reuses;
+        difference.bytesReused -= earlier.bytesReused;
+        difference.frees -= earlier.frees;
+        return difference;
+    }
+
+    std::size_t requests;         //buffers asked for
+    std::size_t allocations;      //requests served by operator new
+    std::size_t bytesAllocated;
+    std::size_t reuses;           //requests served from the pool
+    std::size_t bytesReused;
+    std::size_t frees;            //buffers given back to the system
+    std::size_t idleBytes;        //held by the pool right now
+    std::size_t maximumIdleBytes;
+};
+
+inline void PrintImageBufferPoolStatistics(std::ostream &os, const ImageBufferPoolStatistics &statistics, std::size_t slices)
+{
+    const double megabyte = 1024.0 * 1024.0;
+    os << "Image buffers: " << statistics.requests << " requests, "
+       << statistics.allocations << " allocated (" << statistics.bytesAllocated / megabyte << " MB), "
+       << statistics.reuses << " reused (" << statistics.bytesReused / megabyte << " MB)";
+    if (slices > 0)
+    {
+        os << "; per slice " << static_cast<double>(statistics.allocations) / slices << " allocations, "
+           << statistics.bytesAllocated / megabyte / slices << " MB";
+    }
+    os << "; pool peak " << statistics.maximumIdleBytes / megabyte << " MB" << std::endl;
+}
+
+//Process-wide cache of pixel buffers keyed by byte size. Every slice of a
+//batch asks for the same handful of sizes (decoded slice, float casts,
+//pyramid levels, gradient image, outputs), so after the first slice nearly
+//every request is served from the pool instead of the allocator.
+//
+//With the pool disabled buffers are allocated and freed as usual, but still
+//counted, which gives the baseline to compare against.
+class ImageBufferPool
+{
+public:
+    static ImageBufferPool & GetInstance()
+    {
+        static ImageBufferPool pool;
+        return pool;
+    }
+
+    void SetEnabled(bool enabled)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Enabled = enabled;
+    }
+
+    //Idle buffers beyond this many bytes are freed instead of kept
+    void SetMaximumIdleBytes(std::size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_MaximumIdleBytes = bytes;
+    }
+
+    //A buffer of at least bytes bytes, aligned for any pixel type. Throws std::bad_alloc.
+    void * Acquire(std::size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        ++m_Statistics.requests;
+
+        void *buffer = nullptr;
+        std::unordered_map<std::size_t, std::vector<void *> >::iterator idle = m_Idle.find(bytes);
+        if (m_Enabled && idle != m_Idle.end() && !idle->second.empty())
+        {
+            buffer = idle->second.back();
+            idle->second.pop_back();
+            m_Statistics.idleBytes -= bytes;
+            ++m_Statistics.reuses;
+            m_Statistics.bytesReused += bytes;
+        }
+        else
+        {
+            buffer = ::operator new(bytes);
+            ++m_Statistics.allocations;
+            m_Statistics.bytesAllocated += bytes;
+        }
+        m_Outstanding[buffer] = bytes;
+        return buffer;
+    }
+
+    //Takes back a buffer handed out by Acquire. Returns false (and does
+    //nothing) for any other pointer, so callers can fall back to their own
+    //deallocation.
+    bool Release(void *buffer)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        std::unordered_map<void *, std::size_t>::iterator outstanding = m_Outstanding.find(buffer);
+        if (outstanding == m_Outstanding.end())
+        {
+            return false;
+        }
+        const std::size_t bytes = outstanding->second;
+        m_Outstanding.erase(outstanding);
+
+        if (m_Enabled && m_Statistics.idleBytes + bytes <= m_MaximumIdleBytes)
+        {
+            m_Idle[bytes].push_back(buffer);
+            m_Statistics.idleBytes += bytes;
+            if (m_Statistics.idleBytes > m_Statistics.maximumIdleBytes)
+            {
+                m_Statistics.maximumIdleBytes = m_Statistics.idleBytes;
+            }
+        }
+        else
+        {
+            ::operator delete(buffer);
+            ++m_Statistics.frees;
+        }
+        return true;
+    }
+
+    //Frees every idle buffer
+    void Trim()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        for (std::unordered_map<std::size_t, std::vector<void *> >::iterator idle = m_Idle.begin(); idle != m_Idle.end(); ++idle)
+        {
+            for (std::size_t i = 0; i < idle->second.size(); ++i)
+            {
+                ::operator delete(idle->second[i]);
+                ++m_Statistics.frees;
+            }
+        }
+        m_Idle.clear();
+        m_Statistics.idleBytes = 0;
+    }
+
+    ImageBufferPoolStatistics GetStatistics() const
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_Statistics;
+    }
+
+private:
+    ImageBufferPool() : m_Enabled(true), m_MaximumIdleBytes(std::size_t(512) << 20) {}
+    ~ImageBufferPool() { Trim(); }
+
+    ImageBufferPool(const ImageBufferPool &);
+    void operator=(const ImageBufferPool &);
+
+    bool m_Enabled;
+    std::size_t m_MaximumIdleBytes;
+    std::unordered_map<std::size_t, std::vector<void *> > m_Idle;
+    std::unordered_map<void *, std::size_t> m_Outstanding;
+    ImageBufferPoolStatistics m_Statistics;
+    mutable std::mutex m_Mutex;
+};
+
+#endif
@@ -0,0 +1,214 @@
+/*
+    Implemented by Imran Irfan, and Evan Wong
+
+*/
+#ifndef MultiAtlasPipeline_h
+#define MultiAtlasPipeline_h
+
+#include "BatchPipeline.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            MULTI-ATLAS PIPELINE
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+//One moving image registered against several fixed references. The moving
+//image is read, cast and turned into a pyramid once; the registrations run
+//concurrently on that shared, read-only data and only read and cast their
+//own reference. The references are then ranked by final metric value.
+
+struct MultiAtlasOptions
+{
+    MultiAtlasOptions() : backgroundGL(100), numberOfWorkers(0), streamDivisions(1) {}
+
+    std::vector<std::string> fixedImageFiles;
+    std::string movingImageFile;
+    std::string outputDirectory;             //registered moving image per reference, "" to skip
+    double backgroundGL;
+    unsigned int numberOfWorkers;            //0 picks half the hardware threads
+    unsigned int streamDivisions;
+    std::string resultsLogFile;              //optional, "" to skip
+    RegistrationSettings settings;
+};
+
+//References given as a comma-separated list of images, or as a directory
+//whose *.dcm files are the references
+inline std::vector<std::string> ListAtlasReferences(const std::string &references)
+{
+    if (itksys::SystemTools::FileIsDirectory(references.c_str()))
+    {
+        return ListDicomFiles(references);
+    }
+
+    std::vector<std::string> fileNames;
+    std::istringstream list(references);
+    std::string fileName;
+    while (std::getline(list, fileName, ','))
+    {
+        if (fileName != std::string(""))
+        {
+            fileNames.push_back(fileName);
+        }
+    }
+    return fileNames;
+}
+
+//Registers options.movingImageFile against every reference on pyramids of
+//TInternalPixel, writes the outputs and prints the ranking. Returns the
+//number of references whose registration failed.
+template <typename TImage, typename TInternalPixel>
+unsigned int RunMultiAtlasAs(const MultiAtlasOptions &options)
+{
+    typedef itk::Image<TInternalPixel, TImage::ImageDimension> InternalImageType;
+    const std::size_t numberOfReferences = options.fixedImageFiles.size();
+
+    //Every reference gets the same seed so their metric values compare fairly
+    RegistrationSettings settings = options.settings;
+    settings.verbose = false;
+    const unsigned int numberOfWorkers = std::min<unsigned int>(ChooseBatchThreading(options.numberOfWorkers, settings),
+                                                                static_cast<unsigned int>(numberOfReferences));
+
+    std::chrono::steady_clock::time_point stageStart = std::chrono::steady_clock::now();
+    const typename TImage::Pointer movingImage = ReadImage<TImage>(options.movingImageFile);
+    const double readSeconds = SecondsSince(stageStart);
+
+    stageStart = std::chrono::steady_clock::now();
+    const PreparedMovingImage<InternalImageType> preparedMoving = PrepareMovingImage<TImage, InternalImageType>(movingImage, settings);
+    const double prepareSeconds = SecondsSince(stageStart);
+
+    std::cout << "Moving image read in " << readSeconds << " s, cast and pyramid (" << preparedMoving.levels.size()
+              << " levels) built once in " << prepareSeconds << " s" << std::endl;
+
+    ResultsLogWriter resultsLog;
+    if (options.resultsLogFile != std::string("") && !resultsLog.Open(options.resultsLogFile))
+    {
+        std::cerr << "Cannot open results log " << options.resultsLogFile << std::endl;
+        return static_cast<unsigned int>(numberOfReferences);
+    }
+
+    BatchResults results(numberOfReferences);
+    std::mutex consoleMutex;
+    std::mutex writerMutex;
+    stageStart = std::chrono::steady_clock::now();
+    ParallelForSlices(AllSlices(numberOfReferences), numberOfWorkers, [&](std::size_t i)
+    {
+        const std::string &fixedImageFile = options.fixedImageFiles[i];
+        try
+        {
+            const std::chrono::steady_clock::time_point readStart = std::chrono::steady_clock::now();
+            const typename TImage::Pointer fixedImage = ReadImage<TImage>(fixedImageFile);
+            const double fixedReadSeconds = SecondsSince(readStart);
+
+            RegistrationResult result = RegisterImagesAs<TImage, TInternalPixel>(fixedImage, movingImage, settings, &preparedMoving);
+            result.readSeconds = fixedReadSeconds;
+
+            if (options.outputDirectory != std::string(""))
+            {
+                typedef itk::RegistrationOutputImageFilter<TImage> OutputFilterType;
+                typename OutputFilterType::Pointer outputFilter = MakeRegistrationOutputFilter<TImage>(
+                    fixedImage, movingImage, result, static_cast<typename TImage::PixelType>(options.backgroundGL), settings.numberOfThreads);
+                const OutputFileList outputFiles = MakeOutputFileList<OutputFilterType>(
+                    OutputPathFor(options.outputDirectory, fixedImageFile), "", "", "");
+
+                //One writer at a time, as in batch mode
+                std::lock_guard<std::mutex> lock(writerMutex);
+                const std::chrono::steady_clock::time_point writeStart = std::chrono::steady_clock::now();
+                WriteRegistrationOutputs(outputFilter.GetPointer(), outputFiles, options.streamDivisions);
+                result.writeSeconds = SecondsSince(writeStart);
+            }
+            results[i] = result;
+        }
+        catch(itk::ExceptionObject &e)
+        {
+            results[i] = RegistrationResult();
+            std::lock_guard<std::mutex> lock(consoleMutex);
+            std::cerr << "Exception registration update (" << fixedImageFile << ")" << e << std::endl;
+        }
+        catch(std::exception &e)
+        {
+            results[i] = RegistrationResult();
+            std::lock_guard<std::mutex> lock(consoleMutex);
+            std::cerr << "Exception registration update (" << fixedImageFile << ")" << std::endl << e.what() << std::endl;
+        }
+    });
+    const double registerWallSeconds = SecondsSince(stageStart);
+
+    //Rank by final metric value; every metric here is minimised
+    std::vector<std::size_t> ranking;
+    unsigned int failures = 0;
+    for (std::size_t i = 0; i < numberOfReferences; ++i)
+    {
+        if (results[i].stopConditionCode >= 0)
+        {
+            ranking.push_back(i);
+        }
+        else
+        {
+            ++failures;
+        }
+    }
+    std::stable_sort(ranking.begin(), ranking.end(),
+                     [&results](std::size_t a, std::size_t b) { return results[a].metricValue < results[b].metricValue; });
+
+    std::cout << "////////////////////////////////////////////////////////////////////" << std::endl;
+    std::cout << "References ranked by " << MetricKindName(settings.metric) << " metric value (best first):" << std::endl;
+    for (std::size_t r = 0; r < ranking.size(); ++r)
+    {
+        const RegistrationResult &result = results[ranking[r]];
+        std::cout << std::setw(4) << r + 1 << "  " << itksys::SystemTools::GetFilenameName(options.fixedImageFiles[ranking[r]])
+                  << "  Metric Value = " << result.metricValue
+                  << "  X = " << result.translation[0]
+                  << "  Y = " << result.translation[1];
+        if (result.translation.size() > 2)
+        {
+            std::cout << "  Z = " << result.translation[2];
+        }
+        std::cout << "  Iterations = " << result.iterations << std::endl;
+
+        if (options.resultsLogFile != std::string(""))
+        {
+            resultsLog.Append(MakeResultsRecord(static_cast<unsigned int>(ranking[r]),
+                                                itksys::SystemTools::GetFilenameName(options.fixedImageFiles[ranking[r]]), result));
+        }
+    }
+    if (failures > 0)
+    {
+        std::cout << failures << " of " << numberOfReferences << " references failed" << std::endl;
+    }
+
+    double registerSeconds = 0.0;
+    for (std::size_t r = 0; r < ranking.size(); ++r)
+    {
+        registerSeconds += results[ranking[r]].registerSeconds;
+    }
+    std::cout << numberOfReferences << " registrations on " << numberOfWorkers << " workers in " << registerWallSeconds
+              << " s wall (" << registerSeconds << " s summed)" << std::endl;
+    PrintImageBufferPoolStatistics(std::cout, ImageBufferPool::GetInstance().GetStatistics(), numberOfReferences);
+    return failures;
+}
+
+//RunMultiAtlasAs on the internal pixel type selected in options.settings
+template <typename TImage>
+unsigned int RunMultiAtlas(const MultiAtlasOptions &options)
+{
+    if (options.fixedImageFiles.empty())
+    {
+        std::cerr << "No reference images given" << std::endl;
+        return 1;
+    }
+    if (options.settings.internalPixel == UInt16InternalPixel)
+    {
+        return RunMultiAtlasAs<TImage, typename SixteenBitInternalPixel<typename TImage::PixelType>::Type>(options);
+    }
+    return RunMultiAtlasAs<TImage, float>(options);
+}
+
+#endif
@@ -0,0 +1,164 @@
+/*
+    Implemented by Imran Irfan, and Evan Wong
+
+*/
+#ifndef RegistrationCostModel_h
+#define RegistrationCostModel_h
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            COST MODEL
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+//Seconds the stages of a registration take on this machine, fitted from a
+//few timed runs on a real image (CalibrateCostModel). A registration costs
+//  the casts and pyramids of both images     2 * pixels * (cast + levels * pyramid)
+//  at each level, the metric's Initialize    levelPixels * initializePerPixel + samples * initializePerSample
+//  and per iteration one value-and-derivative evaluation
+//                                            evaluation + samples * perSample + bins^2 * perBinSquared
+//where a level samples at most as many pixels as it has. The iteration caps
+//make the prediction an upper bound: most levels converge before them.
+struct RegistrationCostModel
+{
+    RegistrationCostModel()
+        : castSecondsPerPixel(0.0),
+          pyramidSecondsPerPixel(0.0),
+          initializeSecondsPerPixel(0.0),
+          initializeSecondsPerSample(0.0),
+          evaluationSeconds(0.0),
+          evaluationSecondsPerSample(0.0),
+          evaluationSecondsPerBinSquared(0.0)
+    {}
+
+    std::string configuration;              //metric, internal type, dimension and threads it was measured with
+    double castSecondsPerPixel;             //cast and statistics pass, per input pixel
+    double pyramidSecondsPerPixel;          //one pyramid level, per full resolution pixel
+    double initializeSecondsPerPixel;       //metric Initialize, per pixel of the level
+    double initializeSecondsPerSample;      //  and per sample it draws
+    double evaluationSeconds;               //one value-and-derivative evaluation: fixed part,
+    double evaluationSecondsPerSample;      //  per sample
+    double evaluationSecondsPerBinSquared;  //  and per joint histogram cell (mi and mattes)
+
+    bool IsCalibrated() const { return !configuration.empty(); }
+
+    //Casts and pyramids of a fixed and a moving image of pixels pixels each
+    double PredictSetupSeconds(double pixels, unsigned int numberOfLevels) const
+    {
+        return 2.0 * pixels * (castSecondsPerPixel + numberOfLevels * pyramidSecondsPerPixel);
+    }
+
+    //Metric Initialize at a level of levelPixels pixels
+    double PredictLevelSetupSeconds(double levelPixels, double samples) const
+    {
+        return levelPixels * initializeSecondsPerPixel + std::min(samples, levelPixels) * initializeSecondsPerSample;
+    }
+
+    //One optimizer iteration at a level of levelPixels pixels
+    double PredictIterationSeconds(double levelPixels, double samples, unsigned int bins) const
+    {
+        const double seconds = evaluationSeconds + std::min(samples, levelPixels) * evaluationSecondsPerSample
+                             + static_cast<double>(bins) * bins * evaluationSecondsPerBinSquared;
+        return std::max(seconds, 0.0);
+    }
+
+    //Whole registration with every level running to its iteration cap
+    double PredictRegistrationSeconds(double pixels, unsigned int dimension, double samples, unsigned int bins,
+                                      unsigned int numberOfLevels, unsigned int iterations) const
+    {
+        double seconds = PredictSetupSeconds(pixels, numberOfLevels);
+        for (unsigned int level = 0; level < numberOfLevels; ++level)
+        {
+            const double levelPixels = PyramidLevelPixels(pixels, dimension, numberOfLevels, level);
+            seconds += PredictLevelSetupSeconds(levelPixels, samples) + iterations * PredictIterationSeconds(levelPixels, samples, bins);
+        }
+        return seconds;
+    }
+
+    //Pixels of level (0 the coarsest) of ITK's default pyramid schedule,
+    //which halves every axis from one level to the next
+    static double PyramidLevelPixels(double pixels, unsigned int dimension, unsigned int numberOfLevels, unsigned int level)
+    {
+        return std::max(1.0, pixels / std::pow(2.0, static_cast<double>(dimension) * (numberOfLevels - 1 - level)));
+    }
+};
+
+const char * const CostModelMagic = "COSTMODEL 1";
+
+//Text file, one "name value" per line, so a calibration can be read and
+//edited by hand
+inline bool SaveCostModel(const std::string &fileName, const RegistrationCostModel &model)
+{
+    std::ofstream file(fileName.c_str());
+    file.precision(17);
+    file << CostModelMagic << '\n'
+         << "configuration " << model.configuration << '\n'
+         << "castSecondsPerPixel " << model.castSecondsPerPixel << '\n'
+         << "pyramidSecondsPerPixel " << model.pyramidSecondsPerPixel << '\n'
+         << "initializeSecondsPerPixel " << model.initializeSecondsPerPixel << '\n'
+         << "initializeSecondsPerSample " << model.initializeSecondsPerSample << '\n'
+         << "evaluationSeconds " << model.evaluationSeconds << '\n'
+         << "evaluationSecondsPerSample " << model.evaluationSecondsPerSample << '\n'
+         << "evaluationSecondsPerBinSquared " << model.evaluationSecondsPerBinSquared << '\n';
+    return static_cast<bool>(file);
+}
+
+//False if the file is missing or not a cost model; unknown names are ignored
+inline bool LoadCostModel(const std::string &fileName, RegistrationCostModel &model)
+{
+    std::ifstream file(fileName.c_str());
+    std::string line;
+    if (!std::getline(file, line) || line != CostModelMagic)
+    {
+        return false;
+    }
+
+    RegistrationCostModel loaded;
+    const std::pair<const char *, double *> fields[] = {
+        std::make_pair("castSecondsPerPixel", &loaded.castSecondsPerPixel),
+        std::make_pair("pyramidSecondsPerPixel", &loaded.pyramidSecondsPerPixel),
+        std::make_pair("initializeSecondsPerPixel", &loaded.initializeSecondsPerPixel),
+        std::make_pair("initializeSecondsPerSample", &loaded.initializeSecondsPerSample),
+        std::make_pair("evaluationSeconds", &loaded.evaluationSeconds),
+        std::make_pair("evaluationSecondsPerSample", &loaded.evaluationSecondsPerSample),
+        std::make_pair("evaluationSecondsPerBinSquared", &loaded.evaluationSecondsPerBinSquared)
+    };
+    while (std::getline(file, line))
+    {
+        const std::string::size_type space = line.find(' ');
+        if (space == std::string::npos)
+        {
+            continue;
+        }
+        const std::string name = line.substr(0, space);
+        const std::string value = line.substr(space + 1);
+        if (name == "configuration")
+        {
+            loaded.configuration = value;
+        }
+        for (std::size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i)
+        {
+            if (name == fields[i].first)
+            {
+                std::istringstream(value) >> *fields[i].second;
+            }
+        }
+    }
+    if (!loaded.IsCalibrated())
+    {
+        return false;
+    }
+    model = loaded;
+    return true;
+}
+
+#endif
@@ -0,0 +1,1886 @@
+/*
+    Implemented by Imran Irfan, and Evan Wong
+
+*/
+#ifndef RegistrationPipeline_h
+#define RegistrationPipeline_h
+
+#include "itkImage.h"
+#include "itkGDCMImageIO.h"
+#include "itkImageFileReader.h"
+#include "itkImageSeriesReader.h"
+#include "itkImageFileWriter.h"
+#include "itkRegularStepGradientDescentOptimizer.h"
+#include "itkTranslationTransform.h"
+#include "itkMattesMutualInformationImageToImageMetric.h"
+#include "itkBinnedMattesMutualInformationImageToImageMetric.h"
+#include "itkSampledNormalizedCorrelationImageToImageMetric.h"
+#include "itkSampledMeanSquaresImageToImageMetric.h"
+#include "itkMultiResolutionImageRegistrationMethod.h"
+#include "itkStatisticsCastImageFilter.h"
+#include "itkCommand.h"
+#include "itkMultiThreader.h"
+#include "itkImageIOFactory.h"
+#include "itkImageIORegion.h"
+#include "itkImageRegionSplitterSlowDimension.h"
+#include "itksys/SystemTools.hxx"
+
+#include "itkRegistrationOutputImageFilter.h"
+#include "itkPrecomputedPyramidImageFilter.h"
+#include "ResultsLog.h"
+#include "RegistrationCostModel.h"
+#include "DicomSeriesIndex.h"
+#include "TaskPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            COMMAND TEMPLATE
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+//Step lengths of the coarsest level; every finer level divides the maximum
+//by 4 and the minimum by 10
+const double CoarsestMaximumStepLength = 16.00;
+const double CoarsestMinimumStepLength = 0.01;
+
+//Fewest iterations worth starting a level for under a latency budget
+const unsigned int MinimumDeadlineIterations = 10;
+
+template <typename TRegistration>
+class RegistrationInterfaceCommand : public itk::Command
+{
+public:
+    typedef RegistrationInterfaceCommand Self;
+    typedef itk::Command Superclass;
+    typedef itk::SmartPointer<Self> Pointer;
+    itkNewMacro(Self);
+
+    //Print a banner at the start of every level
+    itkSetMacro(Verbose, bool);
+
+    //Level of the full pyramid the registration's first level is, when the
+    //coarser ones were run separately (multi-start); step lengths and
+    //banners follow the full pyramid
+    itkSetMacro(FirstLevel, unsigned int);
+
+    //Iterations of every level that has finished so far
+    const std::vector<unsigned int> & GetIterationsPerLevel() const { return m_IterationsPerLevel; }
+
+    //Latency budget. Every level is capped at the iterations it can pay for
+    //before deadline, leaving the later levels their predicted cost where
+    //possible; a level after the first that cannot pay for
+    //MinimumDeadlineIterations is not started and the previous level's result
+    //stands. levelSetupSeconds and iterationSeconds are the cost model's
+    //predictions for each level.
+    void SetDeadline(const std::chrono::steady_clock::time_point &deadline, unsigned int numberOfIterations,
+                     const std::vector<double> &levelSetupSeconds, const std::vector<double> &iterationSeconds)
+    {
+        m_HasDeadline = true;
+        m_Deadline = deadline;
+        m_NumberOfIterations = numberOfIterations;
+        m_LevelSetupSeconds = levelSetupSeconds;
+        m_IterationSeconds = iterationSeconds;
+    }
+
+    //True if the budget ran out before the last level
+    bool GetStoppedEarly() const { return m_StoppedEarly; }
+
+protected:
+    RegistrationInterfaceCommand() : m_Verbose(true), m_FirstLevel(0), m_HasDeadline(false), m_NumberOfIterations(0), m_StoppedEarly(false) {};
+
+public:
+    typedef TRegistration RegistrationType;
+    typedef RegistrationType * RegistrationPointer;
+    typedef itk::RegularStepGradientDescentOptimizer OptimizerType;
+    typedef OptimizerType * OptimizerPointer;
+
+    void Execute(itk::Object * object, const itk::EventObject & event) ITK_OVERRIDE
+    {
+        if (!(itk::IterationEvent().CheckEvent(&event)))
+        {
+            return;
+        }
+        RegistrationPointer registration = static_cast<RegistrationPointer>(object);
+        if (registration == ITK_NULLPTR)
+        {
+            return;
+        }
+        OptimizerPointer optimizer = static_cast<OptimizerPointer>(registration->GetModifiableOptimizer());
+
+        //The optimizer still holds the count of the level that just finished
+        if (registration->GetCurrentLevel() > 0)
+        {
+            m_IterationsPerLevel.push_back(optimizer->GetCurrentIteration());
+        }
+
+        if (m_HasDeadline && !FitLevelToDeadline(registration->GetCurrentLevel(), optimizer))
+        {
+            if (m_Verbose)
+            {
+                std::cout << "Latency budget spent, stopping before level " << m_FirstLevel + registration->GetCurrentLevel() << std::endl;
+            }
+            registration->StopRegistration();
+            m_StoppedEarly = true;
+            return;
+        }
+
+        if (m_Verbose)
+        {
+            std::cout << "////////////////////////////////////////////////////////////////////" << std::endl;
+            std::cout << "Multi-Res Level: " << m_FirstLevel + registration->GetCurrentLevel() << std::endl << std::endl;
+        }
+
+        if (registration->GetCurrentLevel() == 0)
+        {
+            double maximumStepLength = CoarsestMaximumStepLength;
+            double minimumStepLength = CoarsestMinimumStepLength;
+            for (unsigned int level = 0; level < m_FirstLevel; ++level)
+            {
+                maximumStepLength /= 4.0;
+                minimumStepLength /= 10.0;
+            }
+            optimizer->SetMaximumStepLength(maximumStepLength);
+            optimizer->SetMinimumStepLength(minimumStepLength);
+        }
+
+        else
+        {
+            optimizer->SetMaximumStepLength(optimizer->GetMaximumStepLength() / 4.0);
+            optimizer->SetMinimumStepLength(optimizer->GetMinimumStepLength() / 10.0);
+        }
+
+    }
+
+    void Execute(const itk::Object *, const itk::EventObject &) ITK_OVERRIDE
+    {
+        return;
+    }
+
+private:
+    //Sets the iteration cap of level; false if the level should not run
+    bool FitLevelToDeadline(unsigned int level, OptimizerPointer optimizer) const
+    {
+        if (level >= m_IterationSeconds.size())
+        {
+            return true;
+        }
+        const double remaining = std::chrono::duration<double>(m_Deadline - std::chrono::steady_clock::now()).count();
+        double laterLevels = 0.0;
+        for (std::size_t later = level + 1; later < m_IterationSeconds.size(); ++later)
+        {
+            laterLevels += m_LevelSetupSeconds[later] + m_NumberOfIterations * m_IterationSeconds[later];
+        }
+
+        const double iterationSeconds = std::max(m_IterationSeconds[level], 1e-9);
+        double affordable = (remaining - laterLevels - m_LevelSetupSeconds[level]) / iterationSeconds;
+        if (affordable < MinimumDeadlineIterations)
+        {
+            //Not enough for this level and the later ones: spend it all here
+            affordable = (remaining - m_LevelSetupSeconds[level]) / iterationSeconds;
+        }
+        if (affordable < MinimumDeadlineIterations)
+        {
+            if (level > 0)
+            {
+                return false;
+            }
+            affordable = MinimumDeadlineIterations;
+        }
+        optimizer->SetNumberOfIterations(static_cast<unsigned long>(std::min<double>(affordable, m_NumberOfIterations)));
+        return true;
+    }
+
+    bool m_Verbose;
+    unsigned int m_FirstLevel;
+    std::vector<unsigned int> m_IterationsPerLevel;
+
+    bool m_HasDeadline;
+    std::chrono::steady_clock::time_point m_Deadline;
+    unsigned int m_NumberOfIterations;
+    std::vector<double> m_LevelSetupSeconds;
+    std::vector<double> m_IterationSeconds;
+    bool m_StoppedEarly;
+};
+
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            OBSERVER
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+class CommandIterationUpdate : public itk::Command
+{
+public:
+    typedef CommandIterationUpdate Self;
+    typedef itk::Command Superclass;
+    typedef itk::SmartPointer<Self> Pointer;
+    itkNewMacro(Self);
+
+protected:
+    CommandIterationUpdate() {};
+
+public:
+    typedef itk::RegularStepGradientDescentOptimizer OptimizerType;
+    typedef const OptimizerType * OptimizerPointer;
+
+    void Execute(itk::Object *caller, const itk::EventObject & event) ITK_OVERRIDE
+    {
+        Execute( (const itk::Object *)caller, event);
+    }
+
+    void Execute(const itk::Object * object, const itk::EventObject & event) ITK_OVERRIDE
+    {
+        OptimizerPointer optimizer = static_cast<OptimizerPointer>(object);
+        if (!(itk::IterationEvent().CheckEvent(&event)))
+        {
+            return;
+        }
+        std::cout << optimizer->GetCurrentIteration() << "  ";
+        std::cout << optimizer->GetValue() << "  ";
+        std::cout << optimizer->GetCurrentPosition() << std::endl;
+
+    }
+};
+
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            OUTPUT WRITING
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+//(output index of the fused output filter, file name)
+typedef std::pair<unsigned int, std::string> OutputFile;
+typedef std::vector<OutputFile> OutputFileList;
+
+//Writes the requested outputs of a RegistrationOutputImageFilter. The filter runs
+//once per slab and every file is written from that run, so each fixed-grid pixel
+//is visited once no matter how many files are produced. If any of the formats
+//cannot paste a slab into a file (DICOM) everything is written in one piece.
+template <typename TOutputFilter>
+void WriteRegistrationOutputs(TOutputFilter *outputFilter, const OutputFileList &outputFiles, unsigned int streamDivisions)
+{
+    typedef typename TOutputFilter::ImageType ImageType;
+    typedef typename ImageType::RegionType RegionType;
+    typedef itk::ImageFileWriter<ImageType> WriterType;
+    const unsigned int Dimension = ImageType::ImageDimension;
+
+    outputFilter->UpdateOutputInformation();
+    const RegionType largestRegion = outputFilter->GetOutput()->GetLargestPossibleRegion();
+
+    std::vector<typename WriterType::Pointer> writers;
+    for (std::size_t i = 0; i < outputFiles.size(); ++i)
+    {
+        itk::ImageIOBase::Pointer imageIO = itk::ImageIOFactory::CreateImageIO(outputFiles[i].second.c_str(), itk::ImageIOFactory::WriteMode);
+        if (imageIO.IsNull() || !imageIO->CanStreamWrite())
+        {
+            streamDivisions = 1;
+        }
+
+        typename WriterType::Pointer writer = WriterType::New();
+        writer->SetFileName(outputFiles[i].second);
+        writer->SetInput(outputFilter->GetOutput(outputFiles[i].first));
+        writers.push_back(writer);
+    }
+
+    itk::ImageRegionSplitterSlowDimension::Pointer splitter = itk::ImageRegionSplitterSlowDimension::New();
+    const unsigned int numberOfPieces = splitter->GetNumberOfSplits(largestRegion, std::max(streamDivisions, 1u));
+
+    if (numberOfPieces > 1)
+    {
+        //Pieces are pasted into the files; start from scratch so stale headers are not reused
+        for (std::size_t i = 0; i < outputFiles.size(); ++i)
+        {
+            itksys::SystemTools::RemoveFile(outputFiles[i].second.c_str());
+        }
+    }
+
+    for (unsigned int piece = 0; piece < numberOfPieces; ++piece)
+    {
+        RegionType pieceRegion = largestRegion;
+        splitter->GetSplit(piece, numberOfPieces, pieceRegion);
+
+        outputFilter->GetOutput()->SetRequestedRegion(pieceRegion);
+        outputFilter->Update();
+
+        for (std::size_t i = 0; i < writers.size(); ++i)
+        {
+            if (numberOfPieces > 1)
+            {
+                itk::ImageIORegion ioRegion(Dimension);
+                itk::ImageIORegionAdaptor<Dimension>::Convert(pieceRegion, ioRegion, largestRegion.GetIndex());
+                writers[i]->SetIORegion(ioRegion);
+            }
+            writers[i]->Update();
+        }
+    }
+}
+
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            REGISTRATION
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+//Similarity measure driving the registration
+enum MetricKind
+{
+    MutualInformationMetric,     //mi: Mattes MI with precomputed bins (the default)
+    MattesReferenceMetric,       //mattes: ITK's own Mattes MI, the reference mi is checked against
+    NormalizedCorrelationMetric, //ncc: same-modality pairs, tolerates a linear intensity change
+    MeanSquaresMetric            //meansquares: same-modality pairs with matching intensities
+};
+
+inline const char * MetricKindName(MetricKind kind)
+{
+    switch (kind)
+    {
+    case MattesReferenceMetric: return "mattes";
+    case NormalizedCorrelationMetric: return "ncc";
+    case MeanSquaresMetric: return "meansquares";
+    default: return "mi";
+    }
+}
+
+//True for the metrics built on a joint histogram, whose cost depends on the bins
+inline bool MetricUsesHistogram(MetricKind kind)
+{
+    return kind == MutualInformationMetric || kind == MattesReferenceMetric;
+}
+
+//False if name is not one of mi, mattes, ncc, meansquares
+inline bool ParseMetricKind(const std::string &name, MetricKind &kind)
+{
+    const MetricKind kinds[] = { MutualInformationMetric, MattesReferenceMetric, NormalizedCorrelationMetric, MeanSquaresMetric };
+    for (unsigned int i = 0; i < 4; ++i)
+    {
+        if (name == MetricKindName(kinds[i]))
+        {
+            kind = kinds[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+//Pixel type the pyramids and the metric work on
+enum InternalPixelKind
+{
+    FloatInternalPixel,  //float: 4 bytes per pixel (the default)
+    UInt16InternalPixel  //unsigned short: half the memory traffic; interpolation still in double
+};
+
+inline const char * InternalPixelKindName(InternalPixelKind kind)
+{
+    return (kind == UInt16InternalPixel) ? "uint16" : "float";
+}
+
+//False if name is not one of float, uint16
+inline bool ParseInternalPixelKind(const std::string &name, InternalPixelKind &kind)
+{
+    const InternalPixelKind kinds[] = { FloatInternalPixel, UInt16InternalPixel };
+    for (unsigned int i = 0; i < 2; ++i)
+    {
+        if (name == InternalPixelKindName(kinds[i]))
+        {
+            kind = kinds[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+//Internal pixel type --internal-type uint16 stands for, per input pixel
+//type. Signed input (CT in Hounsfield units) keeps its sign in short, and
+//float input has no 16-bit type of the same range so it stays float.
+template <typename TPixel>
+struct SixteenBitInternalPixel
+{
+    typedef unsigned short Type;
+};
+
+template <>
+struct SixteenBitInternalPixel<short>
+{
+    typedef short Type;
+};
+
+template <>
+struct SixteenBitInternalPixel<float>
+{
+    typedef float Type;
+};
+
+//Everything that used to be hard-coded in main()
+struct RegistrationSettings
+{
+    RegistrationSettings()
+        : metric(MutualInformationMetric),
+          internalPixel(FloatInternalPixel),
+          numberOfHistogramBins(128),
+          numberOfSpatialSamples(50000),
+          numberOfLevels(3),
+          numberOfIterations(200),
+          relaxationFactor(0.9),
+          seed(76926294),
+          numberOfThreads(0),
+          orderedReduction(false),
+          foregroundRegion(false),
+          foregroundThreshold(0.0),
+          fixedRangeTail(0.0),
+          metricCacheTolerance(0.0),
+          deadlineSeconds(0.0),
+          numberOfStarts(1),
+          startOffset(20.0),
+          verbose(true)
+    {}
+
+    MetricKind metric;
+    InternalPixelKind internalPixel;
+    unsigned int numberOfHistogramBins;  //mi and mattes only
+    unsigned int numberOfSpatialSamples;
+    unsigned int numberOfLevels;
+    unsigned int numberOfIterations;
+    double relaxationFactor;
+    int seed;
+    unsigned int numberOfThreads; //threads per filter and metric, 0 keeps the ITK default
+    bool orderedReduction;        //metric partial sums always split and added the same way
+    bool foregroundRegion;        //sample the fixed image only inside its foreground bounding box
+    double foregroundThreshold;   //grey levels above this are foreground
+    double fixedRangeTail;        //mi: share of the fixed pixels left below and above its bins, 0 for the full range
+    double metricCacheTolerance;  //mm within which metric evaluations of a level are reused, 0 for none
+    double deadlineSeconds;       //registration latency budget, 0 for none (see FitSettingsToDeadline)
+    RegistrationCostModel costModel; //predicts the levels' cost against deadlineSeconds
+    unsigned int numberOfStarts;  //starting translations raced at the coarsest level (see RaceCoarsestLevel)
+    double startOffset;           //mm between the starts
+    bool verbose;                 //print per-level banners and per-iteration values
+};
+
+struct RegistrationResult
+{
+    RegistrationResult()
+        : iterations(0), metricValue(0.0), stopConditionCode(-1),
+          readSeconds(0.0), registerSeconds(0.0), outputSeconds(0.0), writeSeconds(0.0),
+          metricEvaluations(0), metricSeconds(0.0), metricThreadingSeconds(0.0),
+          metricCacheLookups(0), metricCacheHits(0), levelsSkipped(0),
+          winningStart(0), startsCancelled(0)
+    {}
+
+    std::vector<double> translation;
+    unsigned int iterations;                      //iterations of the last level
+    std::vector<unsigned int> iterationsPerLevel;
+    double metricValue;
+    std::string stopCondition;
+    int stopConditionCode;                        //RegularStepGradientDescentBaseOptimizer::StopConditionType
+
+    //Per-stage wall times, filled in by whoever runs the stage
+    double readSeconds;
+    double registerSeconds;
+    double outputSeconds;
+    double writeSeconds;
+
+    //Metric evaluations over all levels, their wall time and the part of it
+    //lost to threading (left at 0 for ITK's reference Mattes metric)
+    unsigned long metricEvaluations;
+    double metricSeconds;
+    double metricThreadingSeconds;
+
+    //Metric calls that looked in the evaluation cache, and those answered
+    //from it instead of being evaluated
+    unsigned long metricCacheLookups;
+    unsigned long metricCacheHits;
+
+    //Finest levels left out because the latency budget ran out
+    unsigned int levelsSkipped;
+
+    //Multi-start: the start that went on to the finer levels (0 is the
+    //untranslated one) and the starts stopped before converging
+    unsigned int winningStart;
+    unsigned int startsCancelled;
+};
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            REPRODUCIBILITY
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+//Number of partial joint histograms ITK's Mattes metric (--metric mattes) is
+//split into when reductions are ordered. It hands each of its threads a fixed
+//slice of the samples and adds the per-thread histograms in thread order, so
+//pinning the count makes its sums bit-identical on any machine. The other
+//metrics reduce per block of samples and need no such pinning.
+const unsigned int OrderedReductionWorkUnits = 8;
+
+//How a slice's sampling seed is chosen
+enum SeedMode
+{
+    FixedSeed, //the same seed for every slice (the original behaviour)
+    IndexSeed, //derived from the slice ID
+    HashSeed   //derived from the contents of the moving file
+};
+
+//64-bit FNV-1a of a file's bytes; 0 if it cannot be read
+inline unsigned long long FileContentHash(const std::string &fileName)
+{
+    std::ifstream file(fileName.c_str(), std::ios::binary);
+    if (!file)
+    {
+        return 0;
+    }
+
+    unsigned long long hash = 14695981039346656037ULL;
+    char buffer[65536];
+    while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0)
+    {
+        const std::streamsize count = file.gcount();
+        for (std::streamsize i = 0; i < count; ++i)
+        {
+            hash ^= static_cast<unsigned char>(buffer[i]);
+            hash *= 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+//Mixes a per-slice key into the base seed. The result is a positive int as
+//ImageToImageMetric::ReinitializeSeed expects.
+inline int DeriveSliceSeed(int baseSeed, unsigned long long key)
+{
+    unsigned long long x = key + 0x9E3779B97F4A7C15ULL * (static_cast<unsigned long long>(baseSeed) + 1);
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+
+    const int seed = static_cast<int>(x & 0x7fffffffULL);
+    return seed ? seed : baseSeed;
+}
+
+//Sampling seed of one slice under the given mode
+inline int SliceSeed(SeedMode mode, int baseSeed, unsigned long long sliceId, const std::string &movingFile)
+{
+    switch (mode)
+    {
+    case IndexSeed:
+        return DeriveSliceSeed(baseSeed, sliceId);
+    case HashSeed:
+        return DeriveSliceSeed(baseSeed, FileContentHash(movingFile));
+    default:
+        return baseSeed;
+    }
+}
+
+//Seconds elapsed since start
+inline double SecondsSince(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+//Fixed-width results log record for one slice
+inline ResultsRecord MakeResultsRecord(unsigned int sliceId, const std::string &sliceName, const RegistrationResult &result)
+{
+    ResultsRecord record;
+    InitializeResultsRecord(record);
+    record.sliceId = sliceId;
+    SetResultsRecordName(record, sliceName);
+    record.stopCondition = static_cast<int16_t>(result.stopConditionCode);
+    for (std::size_t i = 0; i < result.translation.size() && i < 3; ++i)
+    {
+        record.translation[i] = result.translation[i];
+    }
+    record.metricValue = result.metricValue;
+    record.numberOfLevels = static_cast<uint16_t>(std::min<std::size_t>(result.iterationsPerLevel.size(), ResultsMaximumLevels));
+    for (unsigned int level = 0; level < record.numberOfLevels; ++level)
+    {
+        record.iterationsPerLevel[level] = static_cast<uint16_t>(std::min(result.iterationsPerLevel[level], 65535u));
+    }
+    record.readSeconds = result.readSeconds;
+    record.registerSeconds = result.registerSeconds;
+    record.outputSeconds = result.outputSeconds;
+    record.writeSeconds = result.writeSeconds;
+    return record;
+}
+
+inline void PrintRegistrationResult(std::ostream &os, const RegistrationResult &result)
+{
+    os << "Result = " << std::endl;
+    os << "Translation along X = " << result.translation[0] << std::endl;
+    os << "Translation along Y = " << result.translation[1] << std::endl;
+    if (result.translation.size() > 2)
+    {
+        os << "Translation along Z = " << result.translation[2] << std::endl;
+    }
+    os << "Iterations = " << result.iterations << std::endl;
+    os << "Metric Value = " << result.metricValue << std::endl;
+}
+
+//Mean cost of one metric evaluation and how much of it went to threading
+inline void PrintMetricTiming(std::ostream &os, unsigned long evaluations, double seconds, double threadingSeconds)
+{
+    if (evaluations == 0)
+    {
+        return;
+    }
+    os << "Metric evaluations = " << evaluations
+       << ", mean " << 1e6 * seconds / evaluations << " us"
+       << ", threading overhead " << 1e6 * threadingSeconds / evaluations << " us per evaluation" << std::endl;
+}
+
+//Hit rate of the metric evaluation cache and the evaluations it avoided
+inline void PrintMetricCacheStatistics(std::ostream &os, unsigned long lookups, unsigned long hits, double seconds, unsigned long evaluations)
+{
+    if (lookups == 0)
+    {
+        return;
+    }
+    os << "Metric cache hits = " << hits << " of " << lookups << " calls (" << 100.0 * hits / lookups << "%)"
+       << ", evaluations avoided = " << hits;
+    if (evaluations > 0)
+    {
+        os << " (about " << seconds * hits / evaluations << " s)";
+    }
+    os << std::endl;
+}
+
+//Reads a single file, or the largest DICOM series of a directory as a volume,
+//with GDCM and detaches it from its reader
+template <typename TImage>
+typename TImage::Pointer ReadImage(const std::string &fileName)
+{
+    typename TImage::Pointer image;
+    if (itksys::SystemTools::FileIsDirectory(fileName.c_str()))
+    {
+        typedef itk::ImageSeriesReader<TImage> SeriesReaderType;
+        typename SeriesReaderType::Pointer reader = SeriesReaderType::New();
+        reader->SetFileNames(DicomSeriesFiles(fileName));
+        reader->SetImageIO(itk::GDCMImageIO::New());
+        reader->Update();
+        image = reader->GetOutput();
+    }
+    else
+    {
+        typedef itk::ImageFileReader<TImage> ReaderType;
+        typename ReaderType::Pointer reader = ReaderType::New();
+        reader->SetFileName(fileName);
+        reader->SetImageIO(itk::GDCMImageIO::New());
+        reader->Update();
+        image = reader->GetOutput();
+    }
+
+    image->DisconnectPipeline();
+    return image;
+}
+
+//A new image object sharing the pixel buffer of the given one. Each
+//registration works on its own copy so concurrent pipelines never touch the
+//same requested/buffered region bookkeeping of a shared input.
+template <typename TImage>
+typename TImage::Pointer ShallowCopy(const TImage *image)
+{
+    typename TImage::Pointer copy = TImage::New();
+    copy->Graft(image);
+    return copy;
+}
+
+//Applies the sampling, threading and reduction settings to one of the
+//SampledImageToImageMetric metrics
+template <typename TMetric>
+void ConfigureSampledMetric(TMetric *metric, const RegistrationSettings &settings)
+{
+    metric->SetNumberOfSpatialSamples(settings.numberOfSpatialSamples);
+    metric->ReinitializeSeed(settings.seed);
+    if (settings.numberOfThreads > 0)
+    {
+        metric->SetNumberOfThreads(settings.numberOfThreads);
+    }
+    //Ordered: one partial sum per block of samples, added in block order, so
+    //the sums (and the whole registration) are bit-identical on any machine.
+    //Otherwise one partial per thread, which is cheaper to reduce.
+    metric->SetDeterministicReduction(settings.orderedReduction);
+    metric->SetCacheTolerance(settings.metricCacheTolerance);
+}
+
+//The metric selected by settings.metric, configured and ready to be plugged
+//into a registration method
+template <typename TInternalImage>
+typename itk::ImageToImageMetric<TInternalImage, TInternalImage>::Pointer
+MakeMetric(const RegistrationSettings &settings)
+{
+    typedef itk::ImageToImageMetric<TInternalImage, TInternalImage> MetricBaseType;
+
+    switch (settings.metric)
+    {
+    case MattesReferenceMetric:
+    {
+        typedef itk::MattesMutualInformationImageToImageMetric<TInternalImage, TInternalImage> MetricType;
+        typename MetricType::Pointer metric = MetricType::New();
+        metric->SetNumberOfHistogramBins(settings.numberOfHistogramBins);
+        metric->SetNumberOfSpatialSamples(settings.numberOfSpatialSamples);
+        metric->ReinitializeSeed(settings.seed);
+        if (settings.numberOfThreads > 0)
+        {
+            metric->SetNumberOfThreads(settings.numberOfThreads);
+        }
+        if (settings.orderedReduction)
+        {
+            metric->SetNumberOfThreads(OrderedReductionWorkUnits);
+        }
+        return typename MetricBaseType::Pointer(metric.GetPointer());
+    }
+    case NormalizedCorrelationMetric:
+    {
+        typedef itk::SampledNormalizedCorrelationImageToImageMetric<TInternalImage, TInternalImage> MetricType;
+        typename MetricType::Pointer metric = MetricType::New();
+        ConfigureSampledMetric(metric.GetPointer(), settings);
+        return typename MetricBaseType::Pointer(metric.GetPointer());
+    }
+    case MeanSquaresMetric:
+    {
+        typedef itk::SampledMeanSquaresImageToImageMetric<TInternalImage, TInternalImage> MetricType;
+        typename MetricType::Pointer metric = MetricType::New();
+        ConfigureSampledMetric(metric.GetPointer(), settings);
+        return typename MetricBaseType::Pointer(metric.GetPointer());
+    }
+    default:
+    {
+        typedef itk::BinnedMattesMutualInformationImageToImageMetric<TInternalImage, TInternalImage> MetricType;
+        typename MetricType::Pointer metric = MetricType::New();
+        metric->SetNumberOfHistogramBins(settings.numberOfHistogramBins);
+        ConfigureSampledMetric(metric.GetPointer(), settings);
+        return typename MetricBaseType::Pointer(metric.GetPointer());
+    }
+    }
+}
+
+//Casts an input image to the internal pixel type. The cast also gathers the
+//image's range, histogram and foreground box, which travel with the output
+//(see GetImageIntensityStatistics) so nothing downstream rescans the pixels.
+template <typename TImage, typename TInternalImage>
+typename itk::StatisticsCastImageFilter<TImage, TInternalImage>::Pointer
+MakeStatisticsCaster(const TImage *image, const RegistrationSettings &settings)
+{
+    typedef itk::StatisticsCastImageFilter<TImage, TInternalImage> CastFilterType;
+    typename CastFilterType::Pointer caster = CastFilterType::New();
+    caster->SetInput(ShallowCopy(image));
+    caster->SetForegroundThreshold(static_cast<typename TImage::PixelType>(settings.foregroundThreshold));
+    if (settings.numberOfThreads > 0)
+    {
+        caster->SetNumberOfThreads(settings.numberOfThreads);
+    }
+    return caster;
+}
+
+//Region of the cast fixed image the metric samples: the whole image, or its
+//foreground bounding box with settings.foregroundRegion
+template <typename TInternalImage>
+typename TInternalImage::RegionType FixedRegionFor(const TInternalImage *fixedImage, const RegistrationSettings &settings)
+{
+    itk::ImageIntensityStatistics<TInternalImage::ImageDimension> statistics;
+    if (settings.foregroundRegion && GetImageIntensityStatistics(fixedImage, statistics)
+        && statistics.Foreground.GetNumberOfPixels() > 0)
+    {
+        return statistics.Foreground;
+    }
+    return fixedImage->GetBufferedRegion();
+}
+
+//Grey levels with at most tailFraction of the pixels below lower and above
+//upper, to the cast histogram's bin width and within [Minimum, Maximum].
+//False without a histogram (input pixels wider than 16 bits or floating).
+template <unsigned int VDimension>
+bool HistogramIntensityRange(const itk::ImageIntensityStatistics<VDimension> &statistics, double tailFraction,
+                             double &lower, double &upper)
+{
+    const std::vector<itk::SizeValueType> &histogram = statistics.Histogram;
+    if (histogram.empty() || statistics.NumberOfPixels == 0)
+    {
+        return false;
+    }
+    const double tail = tailFraction * static_cast<double>(statistics.NumberOfPixels);
+    std::size_t first = 0;
+    for (double below = 0.0; first + 1 < histogram.size() && below + histogram[first] <= tail; ++first)
+    {
+        below += histogram[first];
+    }
+    std::size_t last = histogram.size() - 1;
+    for (double above = 0.0; last > first && above + histogram[last] <= tail; --last)
+    {
+        above += histogram[last];
+    }
+    lower = std::max(statistics.Minimum, statistics.HistogramMinimum + first * statistics.HistogramBinWidth);
+    upper = std::min(statistics.Maximum, statistics.HistogramMinimum + (last + 1) * statistics.HistogramBinWidth);
+    return upper > lower;
+}
+
+//Hands the ranges found by the casts to the metric, so its Initialize() at
+//each pyramid level does not scan the images. ITK's reference Mattes metric
+//has no such input and keeps scanning. With settings.fixedRangeTail the mi
+//metric spreads its fixed bins over the bulk of the fixed histogram only:
+//the few outlying pixels (burned-in text, metal) land in the edge bins
+//instead of squeezing the tissue into a handful of bins.
+template <typename TInternalImage>
+void SetMetricIntensityRanges(itk::ImageToImageMetric<TInternalImage, TInternalImage> *metric,
+                              const TInternalImage *fixedImage, const TInternalImage *movingImage,
+                              const RegistrationSettings &settings)
+{
+    typedef itk::SampledImageToImageMetric<TInternalImage, TInternalImage> SampledMetricType;
+    SampledMetricType *sampledMetric = dynamic_cast<SampledMetricType *>(metric);
+    if (!sampledMetric)
+    {
+        return;
+    }
+    itk::ImageIntensityStatistics<TInternalImage::ImageDimension> statistics;
+    if (GetImageIntensityStatistics(fixedImage, statistics))
+    {
+        double lower = statistics.Minimum;
+        double upper = statistics.Maximum;
+        if (settings.fixedRangeTail > 0.0 && settings.metric == MutualInformationMetric)
+        {
+            HistogramIntensityRange(statistics, settings.fixedRangeTail, lower, upper);
+        }
+        sampledMetric->SetFixedImageIntensityRange(lower, upper);
+    }
+    if (GetImageIntensityStatistics(movingImage, statistics))
+    {
+        sampledMetric->SetMovingImageIntensityRange(statistics.Minimum, statistics.Maximum);
+    }
+}
+
+//An image cast to the internal type and its pyramid, built once: a moving
+//image shared read-only by several registrations of it (--multi-atlas), or
+//either image of a multi-start registration
+template <typename TInternalImage>
+struct PreparedMovingImage
+{
+    typedef itk::PrecomputedPyramidImageFilter<TInternalImage, TInternalImage> PyramidType;
+
+    typename TInternalImage::Pointer image;              //the cast, carrying its intensity statistics
+    typename PyramidType::LevelContainerType levels;     //coarsest first
+    typename PyramidType::ScheduleType schedule;
+};
+
+//Builds the pyramid of prepared.image the registration method would build
+//with settings.numberOfLevels levels
+template <typename TInternalImage>
+void BuildPyramidLevels(PreparedMovingImage<TInternalImage> &prepared, const RegistrationSettings &settings)
+{
+    typedef itk::MultiResolutionPyramidImageFilter<TInternalImage, TInternalImage> PyramidType;
+
+    typename PyramidType::Pointer pyramid = PyramidType::New();
+    pyramid->SetInput(prepared.image);
+    pyramid->SetNumberOfLevels(settings.numberOfLevels);
+    if (settings.numberOfThreads > 0)
+    {
+        pyramid->SetNumberOfThreads(settings.numberOfThreads);
+    }
+    pyramid->UpdateLargestPossibleRegion();
+
+    prepared.schedule = pyramid->GetSchedule();
+    for (unsigned int level = 0; level < pyramid->GetNumberOfLevels(); ++level)
+    {
+        typename TInternalImage::Pointer levelImage = pyramid->GetOutput(level);
+        levelImage->DisconnectPipeline();
+        prepared.levels.push_back(levelImage);
+    }
+}
+
+//Casts movingImage and builds its pyramid
+template <typename TImage, typename TInternalImage>
+PreparedMovingImage<TInternalImage> PrepareMovingImage(const TImage *movingImage, const RegistrationSettings &settings)
+{
+    PreparedMovingImage<TInternalImage> prepared;
+    typename itk::StatisticsCastImageFilter<TImage, TInternalImage>::Pointer caster = MakeStatisticsCaster<TImage, TInternalImage>(movingImage, settings);
+    caster->Update();
+    prepared.image = caster->GetOutput();
+    prepared.image->DisconnectPipeline();
+    BuildPyramidLevels(prepared, settings);
+    return prepared;
+}
+
+//A pyramid filter handing levels firstLevel, firstLevel + 1, ... of prepared
+//to a registration method with that many fewer levels
+template <typename TInternalImage>
+typename itk::PrecomputedPyramidImageFilter<TInternalImage, TInternalImage>::Pointer
+MakePrecomputedPyramid(const PreparedMovingImage<TInternalImage> &prepared, unsigned int firstLevel)
+{
+    typedef itk::PrecomputedPyramidImageFilter<TInternalImage, TInternalImage> PyramidType;
+
+    const typename PyramidType::LevelContainerType levels(prepared.levels.begin() + firstLevel, prepared.levels.end());
+    typename PyramidType::ScheduleType schedule(prepared.schedule.rows() - firstLevel, prepared.schedule.cols());
+    for (unsigned int level = 0; level < schedule.rows(); ++level)
+    {
+        for (unsigned int axis = 0; axis < schedule.cols(); ++axis)
+        {
+            schedule[level][axis] = prepared.schedule[firstLevel + level][axis];
+        }
+    }
+
+    typename PyramidType::Pointer pyramid = PyramidType::New();
+    pyramid->SetLevels(levels, schedule);
+    return pyramid;
+}
+
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            MULTI-START
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+//Iterations every surviving start runs between two rankings
+const unsigned int MultiStartRoundIterations = 10;
+
+//numberOfStarts starting translations: the untranslated one first, then the
+//points of a cube grid spacing mm apart, ring by ring, axis neighbours
+//before diagonal ones
+inline std::vector<std::vector<double> > MultiStartTranslations(unsigned int dimension, unsigned int numberOfStarts, double spacing)
+{
+    std::vector<std::vector<int> > ring;
+    unsigned int combinations = 1;
+    for (unsigned int axis = 0; axis < dimension; ++axis)
+    {
+        combinations *= 3;
+    }
+    for (unsigned int code = 0; code < combinations; ++code)
+    {
+        std::vector<int> direction(dimension);
+        unsigned int rest = code;
+        for (unsigned int axis = 0; axis < dimension; ++axis)
+        {
+            direction[axis] = static_cast<int>(rest % 3) - 1;
+            rest /= 3;
+        }
+        if (std::count(direction.begin(), direction.end(), 0) < static_cast<long>(dimension))
+        {
+            ring.push_back(direction);
+        }
+    }
+    std::stable_sort(ring.begin(), ring.end(), [](const std::vector<int> &a, const std::vector<int> &b)
+    {
+        return std::count(a.begin(), a.end(), 0) > std::count(b.begin(), b.end(), 0);
+    });
+
+    std::vector<std::vector<double> > starts(1, std::vector<double>(dimension, 0.0));
+    for (unsigned int radius = 1; starts.size() < numberOfStarts; ++radius)
+    {
+        for (std::size_t i = 0; i < ring.size() && starts.size() < numberOfStarts; ++i)
+        {
+            std::vector<double> start(dimension);
+            for (unsigned int axis = 0; axis < dimension; ++axis)
+            {
+                start[axis] = radius * spacing * ring[i][axis];
+            }
+            starts.push_back(start);
+        }
+    }
+    return starts;
+}
+
+//The part of levelImage covering region of fullImage, as the registration
+//method maps the fixed region onto a pyramid level
+template <typename TInternalImage>
+typename TInternalImage::RegionType LevelRegionFor(const TInternalImage *fullImage, const typename TInternalImage::RegionType &region,
+                                                   const TInternalImage *levelImage)
+{
+    const unsigned int Dimension = TInternalImage::ImageDimension;
+    typename TInternalImage::IndexType lastIndex = region.GetIndex();
+    for (unsigned int axis = 0; axis < Dimension; ++axis)
+    {
+        lastIndex[axis] += static_cast<typename TInternalImage::IndexValueType>(region.GetSize(axis)) - 1;
+    }
+    typename TInternalImage::PointType firstPoint;
+    typename TInternalImage::PointType lastPoint;
+    fullImage->TransformIndexToPhysicalPoint(region.GetIndex(), firstPoint);
+    fullImage->TransformIndexToPhysicalPoint(lastIndex, lastPoint);
+
+    itk::ContinuousIndex<double, Dimension> first;
+    itk::ContinuousIndex<double, Dimension> last;
+    levelImage->TransformPhysicalPointToContinuousIndex(firstPoint, first);
+    levelImage->TransformPhysicalPointToContinuousIndex(lastPoint, last);
+
+    typename TInternalImage::RegionType levelRegion;
+    for (unsigned int axis = 0; axis < Dimension; ++axis)
+    {
+        const double low = std::floor(std::min(first[axis], last[axis]));
+        const double high = std::ceil(std::max(first[axis], last[axis]));
+        levelRegion.SetIndex(axis, static_cast<typename TInternalImage::IndexValueType>(low));
+        levelRegion.SetSize(axis, static_cast<typename TInternalImage::SizeValueType>(high - low) + 1);
+    }
+    if (!levelRegion.Crop(levelImage->GetBufferedRegion()))
+    {
+        return levelImage->GetBufferedRegion();
+    }
+    return levelRegion;
+}
+
+struct MultiStartResult
+{
+    MultiStartResult()
+        : value(0.0), iterations(0), stopConditionCode(-1), winner(0), cancelled(0), rounds(0),
+          metricEvaluations(0), metricSeconds(0.0), metricThreadingSeconds(0.0), metricCacheLookups(0), metricCacheHits(0)
+    {}
+
+    std::vector<double> position;  //where the winner ended the level
+    double value;
+    unsigned int iterations;
+    std::string stopCondition;
+    int stopConditionCode;
+    unsigned int winner;           //index of the winning start
+    unsigned int cancelled;        //starts stopped before converging
+    unsigned int rounds;
+
+    //Summed over every start
+    unsigned long metricEvaluations;
+    double metricSeconds;
+    double metricThreadingSeconds;
+    unsigned long metricCacheLookups;
+    unsigned long metricCacheHits;
+};
+
+//Runs the coarsest level from every start at once, each with its own metric
+//and optimizer, as tasks of the process's TaskPool on at most
+//settings.numberOfThreads threads. The metrics share settings.seed and so
+//the same samples, which makes their values comparable. After every
+//MultiStartRoundIterations iterations the starts still in the race are
+//ranked by metric value and the worse half is cancelled; the race ends when
+//one start is left, which then runs to convergence alone, or when every
+//start left has converged. fixedImage and movingImage are the full
+//resolution casts, for the metric's intensity ranges. Throws
+//itk::ExceptionObject if a start fails.
+template <typename TInternalImage>
+MultiStartResult RaceCoarsestLevel(const TInternalImage *fixedImage, const TInternalImage *movingImage,
+                                   const TInternalImage *fixedLevel, const TInternalImage *movingLevel,
+                                   const typename TInternalImage::RegionType &fixedLevelRegion,
+                                   const std::vector<std::vector<double> > &starts, const RegistrationSettings &settings)
+{
+    const unsigned int Dimension = TInternalImage::ImageDimension;
+    typedef itk::TranslationTransform<double, Dimension> TransformType;
+    typedef itk::RegularStepGradientDescentOptimizer OptimizerType;
+    typedef itk::LinearInterpolateImageFunction<TInternalImage, double> InterpolatorType;
+    typedef itk::ImageToImageMetric<TInternalImage, TInternalImage> MetricType;
+    typedef itk::SampledImageToImageMetric<TInternalImage, TInternalImage> SampledMetricType;
+
+    struct Start
+    {
+        Start() : running(true), cancelled(false) {}
+
+        typename TInternalImage::Pointer fixedLevel;    //the start's own copies of the shared levels
+        typename TInternalImage::Pointer movingLevel;
+        typename MetricType::Pointer metric;
+        typename OptimizerType::Pointer optimizer;
+        bool running;    //neither converged nor cancelled
+        bool cancelled;
+    };
+
+    std::vector<Start> race(starts.size());
+    std::vector<std::size_t> alive;
+    for (std::size_t i = 0; i < starts.size(); ++i)
+    {
+        alive.push_back(i);
+    }
+
+    //Metrics are set up one after another before the race: Initialize runs a
+    //gradient filter on the moving level, and the levels may be shared with
+    //other registrations (multi-atlas), so each start works on its own copies
+    const auto setUp = [&](Start &start, const std::vector<double> &translation)
+    {
+        typename TransformType::Pointer transform = TransformType::New();
+        typename InterpolatorType::Pointer interpolator = InterpolatorType::New();
+        start.fixedLevel = ShallowCopy(fixedLevel);
+        start.movingLevel = ShallowCopy(movingLevel);
+        start.metric = MakeMetric<TInternalImage>(settings);
+        start.metric->SetFixedImage(start.fixedLevel);
+        start.metric->SetMovingImage(start.movingLevel);
+        start.metric->SetFixedImageRegion(fixedLevelRegion);
+        SetMetricIntensityRanges(start.metric.GetPointer(), fixedImage, movingImage, settings);
+        start.metric->SetTransform(transform);
+        start.metric->SetInterpolator(interpolator);
+        start.metric->Initialize();
+
+        typename OptimizerType::ParametersType initialPosition(transform->GetNumberOfParameters());
+        for (unsigned int axis = 0; axis < initialPosition.GetSize(); ++axis)
+        {
+            initialPosition[axis] = translation[axis];
+        }
+        start.optimizer = OptimizerType::New();
+        start.optimizer->SetCostFunction(start.metric);
+        start.optimizer->SetInitialPosition(initialPosition);
+        start.optimizer->SetMaximumStepLength(CoarsestMaximumStepLength);
+        start.optimizer->SetMinimumStepLength(CoarsestMinimumStepLength);
+        start.optimizer->SetRelaxationFactor(settings.relaxationFactor);
+    };
+    for (std::size_t i = 0; i < race.size(); ++i)
+    {
+        setUp(race[i], starts[i]);
+    }
+
+    //The starts run on this registration's share of the cores: in a batch
+    //settings.numberOfThreads is what ChooseBatchThreading left each worker,
+    //so the race does not take cores from the other workers
+    const unsigned int slots = std::max(1u, (settings.numberOfThreads > 0) ? settings.numberOfThreads : std::thread::hardware_concurrency());
+
+    MultiStartResult result;
+    unsigned int roundEnd = 0;
+    for (;;)
+    {
+        //A lone survivor runs to the end of the level
+        roundEnd = (alive.size() == 1) ? settings.numberOfIterations : std::min(roundEnd + MultiStartRoundIterations, settings.numberOfIterations);
+        ++result.rounds;
+
+        //The starts still running this round, each one a task of the process's pool
+        std::vector<std::size_t> running;
+        for (std::size_t k = 0; k < alive.size(); ++k)
+        {
+            if (race[alive[k]].running)
+            {
+                running.push_back(alive[k]);
+            }
+        }
+        const auto runStart = [&](std::size_t k, unsigned int)
+        {
+            Start &start = race[running[k]];
+            start.optimizer->SetNumberOfIterations(roundEnd);
+            if (result.rounds == 1)
+            {
+                start.optimizer->StartOptimization();
+            }
+            else
+            {
+                start.optimizer->ResumeOptimization();
+            }
+            //Stopped by the round's cap rather than by converging: still running
+            start.running = start.optimizer->GetStopCondition() == OptimizerType::MaximumNumberOfIterations
+                            && start.optimizer->GetCurrentIteration() < settings.numberOfIterations;
+        };
+
+        TaskPool *pool = TaskPool::GetGlobal();
+        if (pool)
+        {
+            pool->ParallelFor(running.size(), slots, runStart);
+        }
+        else
+        {
+            //No process-wide pool: start and join this round's own threads
+            std::atomic<std::size_t> next(0);
+            std::vector<std::exception_ptr> errors(slots);
+            const auto worker = [&](unsigned int slot)
+            {
+                try
+                {
+                    for (std::size_t k = next++; k < running.size(); k = next++)
+                    {
+                        runStart(k, slot);
+                    }
+                }
+                catch(...)
+                {
+                    errors[slot] = std::current_exception();
+                    next = running.size();
+                }
+            };
+            std::vector<std::thread> threads;
+            for (unsigned int slot = 1; slot < std::min<std::size_t>(slots, running.size()); ++slot)
+            {
+                threads.push_back(std::thread(worker, slot));
+            }
+            worker(0);
+            for (std::size_t t = 0; t < threads.size(); ++t)
+            {
+                threads[t].join();
+            }
+            for (std::size_t slot = 0; slot < errors.size(); ++slot)
+            {
+                if (errors[slot])
+                {
+                    std::rethrow_exception(errors[slot]);
+                }
+            }
+        }
+
+        //Every metric here is minimised
+        std::stable_sort(alive.begin(), alive.end(), [&race](std::size_t a, std::size_t b)
+        {
+            return race[a].optimizer->GetValue() < race[b].optimizer->GetValue();
+        });
+        bool anyRunning = false;
+        for (std::size_t k = 0; k < alive.size(); ++k)
+        {
+            anyRunning = anyRunning || race[alive[k]].running;
+        }
+        if (alive.size() == 1 || !anyRunning)
+        {
+            break;
+        }
+        const std::size_t keep = (alive.size() + 1) / 2;
+        for (std::size_t k = keep; k < alive.size(); ++k)
+        {
+            race[alive[k]].cancelled = race[alive[k]].running;
+            race[alive[k]].running = false;
+        }
+        alive.resize(keep);
+    }
+
+    const OptimizerType *winner = race[alive.front()].optimizer.GetPointer();
+    result.winner = static_cast<unsigned int>(alive.front());
+    for (unsigned int axis = 0; axis < winner->GetCurrentPosition().GetSize(); ++axis)
+    {
+        result.position.push_back(winner->GetCurrentPosition()[axis]);
+    }
+    result.value = winner->GetValue();
+    result.iterations = static_cast<unsigned int>(winner->GetCurrentIteration());
+    result.stopCondition = winner->GetStopConditionDescription();
+    result.stopConditionCode = static_cast<int>(winner->GetStopCondition());
+
+    for (std::size_t i = 0; i < race.size(); ++i)
+    {
+        result.cancelled += race[i].cancelled ? 1 : 0;
+        if (const SampledMetricType *sampledMetric = dynamic_cast<const SampledMetricType *>(race[i].metric.GetPointer()))
+        {
+            result.metricEvaluations += sampledMetric->GetNumberOfEvaluations();
+            result.metricSeconds += sampledMetric->GetEvaluationSeconds();
+            result.metricThreadingSeconds += sampledMetric->GetThreadingOverheadSeconds();
+            result.metricCacheLookups += sampledMetric->GetNumberOfCacheLookups();
+            result.metricCacheHits += sampledMetric->GetNumberOfCacheHits();
+        }
+    }
+    return result;
+}
+
+//Share of the slices whose winning start was not the untranslated one
+inline void PrintMultiStartStatistics(std::ostream &os, unsigned int numberOfStarts, std::size_t slices,
+                                      std::size_t movedStarts, std::size_t cancelled)
+{
+    if (numberOfStarts <= 1 || slices == 0)
+    {
+        return;
+    }
+    os << "Multi-start (" << numberOfStarts << " starts): " << movedStarts << " of " << slices
+       << " slices won from a translated start, " << cancelled << " starts cancelled early" << std::endl;
+}
+
+//Multi-resolution translation registration of movingImage onto fixedImage
+//with the metric selected in settings, on pyramids of TInternalPixel. With
+//preparedMoving the moving cast and pyramid are taken from it instead of
+//being computed from movingImage. Throws itk::ExceptionObject on failure.
+template <typename TImage, typename TInternalPixel>
+RegistrationResult RegisterImagesAs(const TImage *fixedImage, const TImage *movingImage, const RegistrationSettings &settings,
+                                    const PreparedMovingImage<itk::Image<TInternalPixel, TImage::ImageDimension> > *preparedMoving = ITK_NULLPTR)
+{
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const unsigned int Dimension = TImage::ImageDimension;
+
+    typedef TInternalPixel InternalPixelType;
+    typedef itk::Image<InternalPixelType, Dimension> InternalImageType;
+
+    //Component Declaration
+    typedef itk::TranslationTransform<double, Dimension> TransformType;
+    typedef itk::RegularStepGradientDescentOptimizer OptimizerType;
+    typedef itk::LinearInterpolateImageFunction<InternalImageType, double> InterpolatorType;
+    typedef itk::MultiResolutionImageRegistrationMethod<InternalImageType, InternalImageType> RegistrationType;
+
+    //Filter Declaration
+    typedef itk::MultiResolutionPyramidImageFilter<InternalImageType, InternalImageType> FixedImagePyramidType;
+    typedef itk::MultiResolutionPyramidImageFilter<InternalImageType, InternalImageType> MovingImagePyramidType;
+
+    //Component Instantiation
+    typename TransformType::Pointer transform = TransformType::New();
+    typename OptimizerType::Pointer optimizer = OptimizerType::New();
+    typename InterpolatorType::Pointer interpolator = InterpolatorType::New();
+    typename RegistrationType::Pointer registration = RegistrationType::New();
+    typename itk::ImageToImageMetric<InternalImageType, InternalImageType>::Pointer metric = MakeMetric<InternalImageType>(settings);
+
+    //Filter Instantiation
+    typename FixedImagePyramidType::Pointer fixedImagePyramid = FixedImagePyramidType::New();
+    typename MovingImagePyramidType::Pointer movingImagePyramid;
+    if (preparedMoving)
+    {
+        movingImagePyramid = MakePrecomputedPyramid(*preparedMoving, 0).GetPointer();
+    }
+    else
+    {
+        movingImagePyramid = MovingImagePyramidType::New();
+    }
+
+    //Connect Components to Registration Object
+    registration->SetOptimizer(optimizer);
+    registration->SetTransform(transform);
+    registration->SetInterpolator(interpolator);
+    registration->SetMetric(metric);
+
+    //Cast to Internal Image Type, gathering each image's statistics on the way
+    typedef itk::StatisticsCastImageFilter<TImage, InternalImageType> CastFilterType;
+    typename CastFilterType::Pointer fixedCaster = MakeStatisticsCaster<TImage, InternalImageType>(fixedImage, settings);
+    typename CastFilterType::Pointer movingCaster;
+    typename InternalImageType::Pointer movingInternalImage;
+    if (preparedMoving)
+    {
+        //Own copy of the shared cast, so concurrent registrations keep separate region bookkeeping
+        movingInternalImage = ShallowCopy(preparedMoving->image.GetPointer());
+        movingInternalImage->SetMetaDataDictionary(preparedMoving->image->GetMetaDataDictionary());
+    }
+    else
+    {
+        movingCaster = MakeStatisticsCaster<TImage, InternalImageType>(movingImage, settings);
+        movingInternalImage = movingCaster->GetOutput();
+    }
+
+    registration->SetFixedImage(fixedCaster->GetOutput());
+    registration->SetMovingImage(movingInternalImage);
+
+    fixedCaster->Update();
+    if (movingCaster)
+    {
+        movingCaster->Update();
+    }
+
+    if (settings.verbose)
+    {
+        std::cout << "Fixed Caster Update Successful" << std::endl;
+    }
+
+    const typename InternalImageType::RegionType fixedRegion = FixedRegionFor(fixedCaster->GetOutput(), settings);
+    registration->SetFixedImageRegion(fixedRegion);
+    SetMetricIntensityRanges(metric.GetPointer(), fixedCaster->GetOutput(), movingInternalImage.GetPointer(), settings);
+
+    //Initial Parameters Set Up
+    typedef typename RegistrationType::ParametersType ParametersType;
+    ParametersType initialParameters(transform->GetNumberOfParameters());
+    initialParameters.Fill(0.0); //Initial offset in mm along each axis
+
+    //Multi-start: the coarsest level is raced from several translations
+    //outside the registration method, which then starts from the winner at
+    //the next level on the same pyramids
+    unsigned int firstLevel = 0;
+    MultiStartResult race;
+    if (settings.numberOfStarts > 1 && settings.numberOfLevels > 1)
+    {
+        PreparedMovingImage<InternalImageType> fixedPrepared;
+        fixedPrepared.image = fixedCaster->GetOutput();
+        BuildPyramidLevels(fixedPrepared, settings);
+        PreparedMovingImage<InternalImageType> movingPrepared;
+        if (!preparedMoving)
+        {
+            movingPrepared.image = movingInternalImage;
+            BuildPyramidLevels(movingPrepared, settings);
+        }
+        const PreparedMovingImage<InternalImageType> &movingLevels = preparedMoving ? *preparedMoving : movingPrepared;
+
+        race = RaceCoarsestLevel<InternalImageType>(fixedCaster->GetOutput(), movingInternalImage.GetPointer(),
+                                                    fixedPrepared.levels[0].GetPointer(), movingLevels.levels[0].GetPointer(),
+                                                    LevelRegionFor<InternalImageType>(fixedCaster->GetOutput(), fixedRegion, fixedPrepared.levels[0].GetPointer()),
+                                                    MultiStartTranslations(Dimension, settings.numberOfStarts, settings.startOffset), settings);
+        for (unsigned int i = 0; i < initialParameters.GetSize(); ++i)
+        {
+            initialParameters[i] = race.position[i];
+        }
+
+        firstLevel = 1;
+        fixedImagePyramid = MakePrecomputedPyramid(fixedPrepared, firstLevel).GetPointer();
+        movingImagePyramid = MakePrecomputedPyramid(movingLevels, firstLevel).GetPointer();
+
+        if (settings.verbose)
+        {
+            std::cout << "Multi-start: start " << race.winner << " of " << settings.numberOfStarts << " won level 0 with "
+                      << race.value << " after " << race.iterations << " iterations (" << race.rounds << " rounds, "
+                      << race.cancelled << " starts cancelled)" << std::endl;
+        }
+    }
+
+    //Connect Filter Components to Registration Object
+    registration->SetFixedImagePyramid(fixedImagePyramid);
+    registration->SetMovingImagePyramid(movingImagePyramid);
+    if (settings.numberOfThreads > 0)
+    {
+        fixedImagePyramid->SetNumberOfThreads(settings.numberOfThreads);
+        movingImagePyramid->SetNumberOfThreads(settings.numberOfThreads);
+    }
+
+    registration->SetInitialTransformParameters(initialParameters);
+
+    optimizer->SetNumberOfIterations(settings.numberOfIterations);
+    optimizer->SetRelaxationFactor(settings.relaxationFactor);
+
+    //Create Command observer, connect with optimizer
+    if (settings.verbose)
+    {
+        CommandIterationUpdate::Pointer observer = CommandIterationUpdate::New();
+        optimizer->AddObserver(itk::IterationEvent(), observer);
+    }
+
+    //Instance of Interface Command and connect it to the registration object
+    typedef RegistrationInterfaceCommand<RegistrationType> CommandType;
+    typename CommandType::Pointer command = CommandType::New();
+    command->SetVerbose(settings.verbose);
+    command->SetFirstLevel(firstLevel);
+    registration->AddObserver(itk::IterationEvent(), command);
+
+    //Latency budget, counted from the start of the registration: the cost
+    //model's prediction for each level lets the command cap its iterations
+    //or skip it
+    if (settings.deadlineSeconds > 0.0 && settings.costModel.IsCalibrated())
+    {
+        const double pixels = static_cast<double>(fixedImage->GetBufferedRegion().GetNumberOfPixels());
+        const unsigned int bins = MetricUsesHistogram(settings.metric) ? settings.numberOfHistogramBins : 0;
+        std::vector<double> levelSetupSeconds;
+        std::vector<double> iterationSeconds;
+        for (unsigned int level = firstLevel; level < settings.numberOfLevels; ++level)
+        {
+            const double levelPixels = RegistrationCostModel::PyramidLevelPixels(pixels, Dimension, settings.numberOfLevels, level);
+            levelSetupSeconds.push_back(settings.costModel.PredictLevelSetupSeconds(levelPixels, settings.numberOfSpatialSamples));
+            iterationSeconds.push_back(settings.costModel.PredictIterationSeconds(levelPixels, settings.numberOfSpatialSamples, bins));
+        }
+        command->SetDeadline(start + std::chrono::microseconds(static_cast<long long>(1e6 * settings.deadlineSeconds)),
+                             settings.numberOfIterations, levelSetupSeconds, iterationSeconds);
+    }
+
+    //Set number of resolution levels
+    registration->SetNumberOfLevels(settings.numberOfLevels - firstLevel);
+
+    registration->Update();
+
+    RegistrationResult result;
+    result.stopCondition = registration->GetOptimizer()->GetStopConditionDescription();
+    result.stopConditionCode = static_cast<int>(optimizer->GetStopCondition());
+
+    if (settings.verbose)
+    {
+        std::cout << "Optimizer stop condition: " << result.stopCondition << std::endl;
+        std::cout << "Registration Update Successful" << std::endl;
+    }
+
+    //Get Final Transform parameters
+    ParametersType finalParameters = registration->GetLastTransformParameters();
+    for (unsigned int i = 0; i < finalParameters.GetSize(); ++i)
+    {
+        result.translation.push_back(finalParameters[i]);
+    }
+
+    //Get the number of total iterations and best optimizer value
+    result.iterations = optimizer->GetCurrentIteration();
+    result.metricValue = optimizer->GetValue();
+    result.iterationsPerLevel = command->GetIterationsPerLevel();
+    if (!command->GetStoppedEarly())
+    {
+        result.iterationsPerLevel.push_back(result.iterations);
+    }
+    if (firstLevel > 0)
+    {
+        result.iterationsPerLevel.insert(result.iterationsPerLevel.begin(), race.iterations);
+        result.winningStart = race.winner;
+        result.startsCancelled = race.cancelled;
+    }
+    result.levelsSkipped = settings.numberOfLevels - static_cast<unsigned int>(result.iterationsPerLevel.size());
+    result.registerSeconds = SecondsSince(start);
+
+    typedef itk::SampledImageToImageMetric<InternalImageType, InternalImageType> SampledMetricType;
+    if (const SampledMetricType *sampledMetric = dynamic_cast<const SampledMetricType *>(metric.GetPointer()))
+    {
+        result.metricEvaluations = sampledMetric->GetNumberOfEvaluations();
+        result.metricSeconds = sampledMetric->GetEvaluationSeconds();
+        result.metricThreadingSeconds = sampledMetric->GetThreadingOverheadSeconds();
+        result.metricCacheLookups = sampledMetric->GetNumberOfCacheLookups();
+        result.metricCacheHits = sampledMetric->GetNumberOfCacheHits();
+    }
+    result.metricEvaluations += race.metricEvaluations;
+    result.metricSeconds += race.metricSeconds;
+    result.metricThreadingSeconds += race.metricThreadingSeconds;
+    result.metricCacheLookups += race.metricCacheLookups;
+    result.metricCacheHits += race.metricCacheHits;
+
+    //The internal casts and both pyramids go out of scope here, before any output is produced
+    return result;
+}
+
+//RegisterImagesAs on the internal pixel type selected in settings. 16-bit
+//pyramids (see SixteenBitInternalPixel) are smoothed in double but stored
+//truncated to whole grey levels, and the interpolator converts to double as
+//it reads, so only the stored levels lose precision
+//(scripts/compare_internal_types.sh checks the translations against float).
+template <typename TImage>
+RegistrationResult RegisterImages(const TImage *fixedImage, const TImage *movingImage, const RegistrationSettings &settings)
+{
+    if (settings.internalPixel == UInt16InternalPixel)
+    {
+        return RegisterImagesAs<TImage, typename SixteenBitInternalPixel<typename TImage::PixelType>::Type>(fixedImage, movingImage, settings);
+    }
+    return RegisterImagesAs<TImage, float>(fixedImage, movingImage, settings);
+}
+
+//One evaluation of the selected metric at a given translation, on the full
+//resolution images: no pyramid, no optimizer and no gradient image. Throws
+//itk::ExceptionObject on failure.
+template <typename TImage, typename TInternalPixel>
+double EvaluateRegistrationMetricAs(const TImage *fixedImage, const TImage *movingImage,
+                                    const std::vector<double> &translation, const RegistrationSettings &settings)
+{
+    const unsigned int Dimension = TImage::ImageDimension;
+    typedef itk::Image<TInternalPixel, Dimension> InternalImageType;
+    typedef itk::TranslationTransform<double, Dimension> TransformType;
+    typedef itk::LinearInterpolateImageFunction<InternalImageType, double> InterpolatorType;
+    typedef itk::StatisticsCastImageFilter<TImage, InternalImageType> CastFilterType;
+
+    typename CastFilterType::Pointer fixedCaster = MakeStatisticsCaster<TImage, InternalImageType>(fixedImage, settings);
+    typename CastFilterType::Pointer movingCaster = MakeStatisticsCaster<TImage, InternalImageType>(movingImage, settings);
+    fixedCaster->Update();
+    movingCaster->Update();
+
+    typename TransformType::Pointer transform = TransformType::New();
+    typename InterpolatorType::Pointer interpolator = InterpolatorType::New();
+    typename itk::ImageToImageMetric<InternalImageType, InternalImageType>::Pointer metric = MakeMetric<InternalImageType>(settings);
+    metric->SetFixedImage(fixedCaster->GetOutput());
+    metric->SetMovingImage(movingCaster->GetOutput());
+    metric->SetFixedImageRegion(FixedRegionFor(fixedCaster->GetOutput(), settings));
+    SetMetricIntensityRanges(metric.GetPointer(), fixedCaster->GetOutput(), movingCaster->GetOutput(), settings);
+    metric->SetTransform(transform);
+    metric->SetInterpolator(interpolator);
+    metric->SetComputeGradient(false);
+    metric->Initialize();
+
+    typename TransformType::ParametersType parameters(transform->GetNumberOfParameters());
+    parameters.Fill(0.0);
+    for (unsigned int i = 0; i < parameters.GetSize() && i < translation.size(); ++i)
+    {
+        parameters[i] = translation[i];
+    }
+    return metric->GetValue(parameters);
+}
+
+template <typename TImage>
+double EvaluateRegistrationMetric(const TImage *fixedImage, const TImage *movingImage,
+                                  const std::vector<double> &translation, const RegistrationSettings &settings)
+{
+    if (settings.internalPixel == UInt16InternalPixel)
+    {
+        return EvaluateRegistrationMetricAs<TImage, typename SixteenBitInternalPixel<typename TImage::PixelType>::Type>(fixedImage, movingImage, translation, settings);
+    }
+    return EvaluateRegistrationMetricAs<TImage, float>(fixedImage, movingImage, translation, settings);
+}
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            LATENCY BUDGET
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+//Timed value-and-derivative evaluations per calibration point
+const unsigned int CalibrationEvaluations = 5;
+
+//Part of the budget the predicted worst case may use; the rest absorbs the
+//model's error and whatever else the machine is doing
+const double DeadlineSafetyFraction = 0.85;
+
+//What a cost model was measured with; it predicts nothing for other settings
+inline std::string CostModelConfiguration(const RegistrationSettings &settings, unsigned int dimension)
+{
+    std::ostringstream configuration;
+    configuration << MetricKindName(settings.metric) << " " << InternalPixelKindName(settings.internalPixel) << " "
+                  << dimension << "D " << ((settings.numberOfThreads > 0) ? settings.numberOfThreads : itk::MultiThreader::GetGlobalDefaultNumberOfThreads())
+                  << " threads";
+    return configuration.str();
+}
+
+//Times the stages of a registration on image, registered against itself,
+//and fits a RegistrationCostModel to them: the cast, a two-level pyramid,
+//and the metric's Initialize and evaluations at two sample counts and, for
+//the histogram metrics, two bin counts. The moving images registered later
+//are assumed to be the size of this one. Throws itk::ExceptionObject on
+//failure.
+template <typename TImage, typename TInternalPixel>
+RegistrationCostModel CalibrateCostModelAs(const TImage *image, const RegistrationSettings &settings)
+{
+    const unsigned int Dimension = TImage::ImageDimension;
+    typedef itk::Image<TInternalPixel, Dimension> InternalImageType;
+    typedef itk::TranslationTransform<double, Dimension> TransformType;
+    typedef itk::LinearInterpolateImageFunction<InternalImageType, double> InterpolatorType;
+    typedef itk::MultiResolutionPyramidImageFilter<InternalImageType, InternalImageType> PyramidType;
+    typedef itk::ImageToImageMetric<InternalImageType, InternalImageType> MetricType;
+
+    RegistrationCostModel model;
+    model.configuration = CostModelConfiguration(settings, Dimension);
+    const double pixels = static_cast<double>(image->GetBufferedRegion().GetNumberOfPixels());
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    typename itk::StatisticsCastImageFilter<TImage, InternalImageType>::Pointer caster = MakeStatisticsCaster<TImage, InternalImageType>(image, settings);
+    caster->Update();
+    model.castSecondsPerPixel = SecondsSince(start) / pixels;
+    const InternalImageType *internalImage = caster->GetOutput();
+
+    //Every level smooths the full resolution image, whatever its own size
+    typename PyramidType::Pointer pyramid = PyramidType::New();
+    pyramid->SetInput(internalImage);
+    pyramid->SetNumberOfLevels(2);
+    if (settings.numberOfThreads > 0)
+    {
+        pyramid->SetNumberOfThreads(settings.numberOfThreads);
+    }
+    start = std::chrono::steady_clock::now();
+    pyramid->UpdateLargestPossibleRegion();
+    model.pyramidSecondsPerPixel = SecondsSince(start) / (2.0 * pixels);
+
+    //Off the pixel grid, so the interpolator does its full work
+    typename TransformType::Pointer transform = TransformType::New();
+    typename TransformType::ParametersType parameters(transform->GetNumberOfParameters());
+    parameters.Fill(0.5);
+
+    const auto timeMetric = [&](double samples, unsigned int bins, double &initializeSeconds, double &evaluationSeconds)
+    {
+        RegistrationSettings metricSettings = settings;
+        metricSettings.numberOfSpatialSamples = static_cast<unsigned int>(samples);
+        metricSettings.numberOfHistogramBins = bins;
+        metricSettings.metricCacheTolerance = 0.0;
+        typename MetricType::Pointer metric = MakeMetric<InternalImageType>(metricSettings);
+        metric->SetFixedImage(internalImage);
+        metric->SetMovingImage(internalImage);
+        metric->SetFixedImageRegion(internalImage->GetBufferedRegion());
+        SetMetricIntensityRanges(metric.GetPointer(), internalImage, internalImage, metricSettings);
+        typename InterpolatorType::Pointer interpolator = InterpolatorType::New();
+        metric->SetTransform(transform);
+        metric->SetInterpolator(interpolator);
+
+        std::chrono::steady_clock::time_point metricStart = std::chrono::steady_clock::now();
+        metric->Initialize();
+        initializeSeconds = SecondsSince(metricStart);
+
+        //The first evaluation warms the caches and the thread pool
+        typename MetricType::MeasureType value;
+        typename MetricType::DerivativeType derivative;
+        metric->GetValueAndDerivative(parameters, value, derivative);
+        metricStart = std::chrono::steady_clock::now();
+        for (unsigned int i = 0; i < CalibrationEvaluations; ++i)
+        {
+            metric->GetValueAndDerivative(parameters, value, derivative);
+        }
+        evaluationSeconds = SecondsSince(metricStart) / CalibrationEvaluations;
+    };
+
+    const double fewSamples = std::min(2000.0, pixels);
+    const double manySamples = std::min(20000.0, pixels);
+    const unsigned int fewBins = 32;
+    const unsigned int manyBins = 128;
+    double initializeFew = 0.0, evaluationFew = 0.0, initializeMany = 0.0, evaluationMany = 0.0;
+    timeMetric(fewSamples, fewBins, initializeFew, evaluationFew);
+    timeMetric(manySamples, fewBins, initializeMany, evaluationMany);
+    if (manySamples > fewSamples)
+    {
+        model.initializeSecondsPerSample = std::max(0.0, (initializeMany - initializeFew) / (manySamples - fewSamples));
+        model.evaluationSecondsPerSample = std::max(0.0, (evaluationMany - evaluationFew) / (manySamples - fewSamples));
+    }
+    else
+    {
+        model.evaluationSecondsPerSample = evaluationFew / fewSamples;
+    }
+    model.initializeSecondsPerPixel = std::max(0.0, initializeFew - fewSamples * model.initializeSecondsPerSample) / pixels;
+
+    if (MetricUsesHistogram(settings.metric))
+    {
+        double initializeBins = 0.0, evaluationBins = 0.0;
+        timeMetric(fewSamples, manyBins, initializeBins, evaluationBins);
+        model.evaluationSecondsPerBinSquared = std::max(0.0, (evaluationBins - evaluationFew) / (manyBins * manyBins - fewBins * fewBins));
+    }
+    model.evaluationSeconds = std::max(0.0, evaluationFew - fewSamples * model.evaluationSecondsPerSample
+                                            - fewBins * fewBins * model.evaluationSecondsPerBinSquared);
+    return model;
+}
+
+template <typename TImage>
+RegistrationCostModel CalibrateCostModel(const TImage *image, const RegistrationSettings &settings)
+{
+    if (settings.internalPixel == UInt16InternalPixel)
+    {
+        return CalibrateCostModelAs<TImage, typename SixteenBitInternalPixel<typename TImage::PixelType>::Type>(image, settings);
+    }
+    return CalibrateCostModelAs<TImage, float>(image, settings);
+}
+
+//A setting FitSettingsToDeadline lowers and the value it lowers it to
+struct DeadlineStep
+{
+    enum Setting { Iterations, Samples, Bins, Levels };
+    Setting setting;
+    unsigned int value;
+};
+
+//Cheapest losses first: iteration caps (most levels converge well before
+//them), then samples and bins, which cost accuracy gradually, and last the
+//coarse pyramid levels, whose loss shortens the capture range
+const DeadlineStep DeadlineLadder[] =
+{
+    { DeadlineStep::Iterations, 100 }, { DeadlineStep::Samples, 25000 }, { DeadlineStep::Bins, 64 },
+    { DeadlineStep::Samples, 12000 }, { DeadlineStep::Iterations, 50 }, { DeadlineStep::Samples, 6000 },
+    { DeadlineStep::Bins, 32 }, { DeadlineStep::Levels, 2 }, { DeadlineStep::Samples, 3000 },
+    { DeadlineStep::Iterations, 25 }, { DeadlineStep::Samples, 1500 }, { DeadlineStep::Levels, 1 }
+};
+
+//Worst case the cost model predicts for settings on an image of pixels pixels
+inline double PredictRegistrationSeconds(const RegistrationSettings &settings, double pixels, unsigned int dimension)
+{
+    return settings.costModel.PredictRegistrationSeconds(pixels, dimension, settings.numberOfSpatialSamples,
+                                                         MetricUsesHistogram(settings.metric) ? settings.numberOfHistogramBins : 0,
+                                                         settings.numberOfLevels, settings.numberOfIterations);
+}
+
+//Walks down DeadlineLadder from settings until the predicted worst case for
+//an image of pixels pixels is within DeadlineSafetyFraction of
+//settings.deadlineSeconds; settings already below a step keep their value.
+//If even the bottom of the ladder does not fit it is returned anyway, and
+//predictedSeconds shows by how much it misses.
+inline RegistrationSettings FitSettingsToDeadline(const RegistrationSettings &settings, double pixels, unsigned int dimension,
+                                                  double &predictedSeconds)
+{
+    RegistrationSettings fitted = settings;
+    if (fitted.numberOfSpatialSamples == 0)
+    {
+        //0 samples every pixel
+        fitted.numberOfSpatialSamples = static_cast<unsigned int>(std::min(pixels, 4e9));
+    }
+
+    predictedSeconds = PredictRegistrationSeconds(fitted, pixels, dimension);
+    for (std::size_t i = 0; i < sizeof(DeadlineLadder) / sizeof(DeadlineLadder[0]); ++i)
+    {
+        if (predictedSeconds <= DeadlineSafetyFraction * settings.deadlineSeconds)
+        {
+            break;
+        }
+        unsigned int *value = &fitted.numberOfIterations;
+        switch (DeadlineLadder[i].setting)
+        {
+        case DeadlineStep::Samples: value = &fitted.numberOfSpatialSamples; break;
+        case DeadlineStep::Bins: value = &fitted.numberOfHistogramBins; break;
+        case DeadlineStep::Levels: value = &fitted.numberOfLevels; break;
+        default: break;
+        }
+        *value = std::min(*value, DeadlineLadder[i].value);
+        predictedSeconds = PredictRegistrationSeconds(fitted, pixels, dimension);
+    }
+    return fitted;
+}
+
+//The settings FitSettingsToDeadline chose
+inline void PrintDeadlinePlan(std::ostream &os, const RegistrationSettings &settings, double predictedSeconds)
+{
+    os << "Latency budget = " << 1e3 * settings.deadlineSeconds << " ms: " << settings.numberOfSpatialSamples << " samples, ";
+    if (MetricUsesHistogram(settings.metric))
+    {
+        os << settings.numberOfHistogramBins << " bins, ";
+    }
+    os << settings.numberOfLevels << " levels, at most " << settings.numberOfIterations << " iterations per level"
+       << " (predicted worst case " << 1e3 * predictedSeconds << " ms)" << std::endl;
+    if (predictedSeconds > settings.deadlineSeconds)
+    {
+        os << "Even the cheapest settings are predicted to exceed the budget; levels will be skipped" << std::endl;
+    }
+}
+
+//Achieved latency of one registration against its budget
+inline void PrintDeadlineResult(std::ostream &os, const RegistrationSettings &settings, const RegistrationResult &result)
+{
+    if (settings.deadlineSeconds <= 0.0)
+    {
+        return;
+    }
+    os << "Latency = " << 1e3 * result.registerSeconds << " ms of " << 1e3 * settings.deadlineSeconds << " ms ("
+       << ((result.registerSeconds <= settings.deadlineSeconds) ? "met" : "missed") << "), Metric Value = " << result.metricValue;
+    if (result.levelsSkipped > 0)
+    {
+        os << ", finest " << result.levelsSkipped << " level(s) skipped";
+    }
+    os << std::endl;
+}
+
+//Budget misses over several slices
+inline void PrintDeadlineStatistics(std::ostream &os, double deadlineSeconds, std::size_t slices,
+                                    std::size_t missed, std::size_t cutShort, double worstSeconds)
+{
+    if (deadlineSeconds <= 0.0 || slices == 0)
+    {
+        return;
+    }
+    os << "Latency budget " << 1e3 * deadlineSeconds << " ms: missed by " << missed << " of " << slices << " slices, "
+       << cutShort << " stopped before the finest level, worst " << 1e3 * worstSeconds << " ms" << std::endl;
+}
+
+//The fused output filter for a finished registration, ready to be written
+template <typename TImage>
+typename itk::RegistrationOutputImageFilter<TImage>::Pointer
+MakeRegistrationOutputFilter(const TImage *fixedImage, const TImage *movingImage, const RegistrationResult &result,
+                             typename TImage::PixelType backgroundGL, unsigned int numberOfThreads = 0)
+{
+    const unsigned int Dimension = TImage::ImageDimension;
+    typedef itk::TranslationTransform<double, Dimension> TransformType;
+    typedef itk::RegistrationOutputImageFilter<TImage> OutputFilterType;
+
+    typename TransformType::Pointer finalTransform = TransformType::New();
+    typename TransformType::ParametersType finalParameters(finalTransform->GetNumberOfParameters());
+    for (unsigned int i = 0; i < finalParameters.GetSize(); ++i)
+    {
+        finalParameters[i] = result.translation[i];
+    }
+    finalTransform->SetParameters(finalParameters);
+
+    //One pass over the fixed grid produces the registered image, the identity-sampled
+    //moving image and both checkerboards.
+    typename OutputFilterType::Pointer outputFilter = OutputFilterType::New();
+    outputFilter->SetFixedImage(ShallowCopy(fixedImage));
+    outputFilter->SetMovingImage(ShallowCopy(movingImage));
+    outputFilter->SetTransform(finalTransform);
+    outputFilter->SetDefaultPixelValue(backgroundGL); //This would be the background gray level. By default it is 100.
+    if (numberOfThreads > 0)
+    {
+        outputFilter->SetNumberOfThreads(numberOfThreads);
+    }
+    return outputFilter;
+}
+
+//Output file list for one slice; empty names are skipped
+template <typename TOutputFilter>
+OutputFileList
+MakeOutputFileList(const std::string &outputImageFile, const std::string &identityOutputFile,
+                   const std::string &checkerboardBefore, const std::string &checkerboardAfter)
+{
+    OutputFileList outputFiles;
+    outputFiles.push_back(OutputFile(TOutputFilter::RegisteredOutput, outputImageFile));
+    if (identityOutputFile != std::string(""))
+    {
+        outputFiles.push_back(OutputFile(TOutputFilter::IdentityOutput, identityOutputFile));
+    }
+    if (checkerboardBefore != std::string(""))
+    {
+        outputFiles.push_back(OutputFile(TOutputFilter::CheckerboardBeforeOutput, checkerboardBefore));
+    }
+    if (checkerboardAfter != std::string(""))
+    {
+        outputFiles.push_back(OutputFile(TOutputFilter::CheckerboardAfterOutput, checkerboardAfter));
+    }
+    return outputFiles;
+}
+
+#endif
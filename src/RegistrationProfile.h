@@ -0,0 +1,123 @@
+/*
+    Implemented by Imran Irfan, and Evan Wong
+
+*/
+#ifndef RegistrationProfile_h
+#define RegistrationProfile_h
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            REGISTRATION PROFILE
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+//The registration settings --autotune chose for a calibration set, and what
+//they achieved on it. Loaded with --profile in place of the built-in
+//128 bins, 50000 samples, 3 levels, 200 iterations and relaxation 0.9.
+struct RegistrationProfile
+{
+    RegistrationProfile()
+        : numberOfHistogramBins(128),
+          numberOfSpatialSamples(50000),
+          numberOfLevels(3),
+          numberOfIterations(200),
+          relaxationFactor(0.9),
+          meanSeconds(0.0),
+          meanErrorMm(0.0),
+          maximumErrorMm(0.0)
+    {}
+
+    std::string metric;                  //MetricKindName of the metric it was tuned for
+    double numberOfHistogramBins;        //stored as doubles so one table reads every field
+    double numberOfSpatialSamples;
+    double numberOfLevels;
+    double numberOfIterations;
+    double relaxationFactor;
+
+    //Measured on the calibration set
+    double meanSeconds;                  //per registration
+    double meanErrorMm;                  //distance to the reference translation
+    double maximumErrorMm;
+};
+
+const char * const ProfileMagic = "PROFILE 1";
+
+//Text file, one "name value" per line like the cost model, so a profile can
+//be read and edited by hand
+inline bool SaveRegistrationProfile(const std::string &fileName, const RegistrationProfile &profile)
+{
+    std::ofstream file(fileName.c_str());
+    file.precision(10);
+    file << ProfileMagic << '\n'
+         << "metric " << profile.metric << '\n'
+         << "numberOfHistogramBins " << profile.numberOfHistogramBins << '\n'
+         << "numberOfSpatialSamples " << profile.numberOfSpatialSamples << '\n'
+         << "numberOfLevels " << profile.numberOfLevels << '\n'
+         << "numberOfIterations " << profile.numberOfIterations << '\n'
+         << "relaxationFactor " << profile.relaxationFactor << '\n'
+         << "meanSeconds " << profile.meanSeconds << '\n'
+         << "meanErrorMm " << profile.meanErrorMm << '\n'
+         << "maximumErrorMm " << profile.maximumErrorMm << '\n';
+    return static_cast<bool>(file);
+}
+
+//False if the file is missing or not a profile; unknown names are ignored
+//and missing ones keep their defaults
+inline bool LoadRegistrationProfile(const std::string &fileName, RegistrationProfile &profile)
+{
+    std::ifstream file(fileName.c_str());
+    std::string line;
+    if (!std::getline(file, line) || line != ProfileMagic)
+    {
+        return false;
+    }
+
+    RegistrationProfile loaded;
+    const std::pair<const char *, double *> fields[] = {
+        std::make_pair("numberOfHistogramBins", &loaded.numberOfHistogramBins),
+        std::make_pair("numberOfSpatialSamples", &loaded.numberOfSpatialSamples),
+        std::make_pair("numberOfLevels", &loaded.numberOfLevels),
+        std::make_pair("numberOfIterations", &loaded.numberOfIterations),
+        std::make_pair("relaxationFactor", &loaded.relaxationFactor),
+        std::make_pair("meanSeconds", &loaded.meanSeconds),
+        std::make_pair("meanErrorMm", &loaded.meanErrorMm),
+        std::make_pair("maximumErrorMm", &loaded.maximumErrorMm)
+    };
+    while (std::getline(file, line))
+    {
+        const std::string::size_type space = line.find(' ');
+        if (space == std::string::npos)
+        {
+            continue;
+        }
+        const std::string name = line.substr(0, space);
+        const std::string value = line.substr(space + 1);
+        if (name == "metric")
+        {
+            loaded.metric = value;
+        }
+        for (std::size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i)
+        {
+            if (name == fields[i].first)
+            {
+                std::istringstream(value) >> *fields[i].second;
+            }
+        }
+    }
+    if (loaded.numberOfHistogramBins < 1.0 || loaded.numberOfSpatialSamples < 1.0 || loaded.numberOfLevels < 1.0
+        || loaded.numberOfIterations < 1.0 || loaded.relaxationFactor <= 0.0 || loaded.relaxationFactor >= 1.0)
+    {
+        return false;
+    }
+    profile = loaded;
+    return true;
+}
+
+#endif
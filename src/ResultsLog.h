@@ -0,0 +1,327 @@
+/*
+    Implemented by Imran Irfan, and Evan Wong
+
+*/
+#ifndef ResultsLog_h
+#define ResultsLog_h
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            RESULTS LOG
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+//A results log is a 16 byte header followed by fixed-width records, one per
+//registered slice, in host byte order. Every run appends to the same file, so
+//a batch of thousands of runs is post-processed by reading records back to
+//back instead of scraping stdout.
+
+const unsigned int ResultsLogVersion = 1;
+const unsigned int ResultsMaximumLevels = 8;
+const unsigned int ResultsSliceNameLength = 48;
+
+struct ResultsLogHeader
+{
+    char magic[8];         //"IBRLOG\0\0"
+    uint32_t version;
+    uint32_t recordSize;
+};
+
+struct ResultsRecord
+{
+    uint32_t sliceId;
+    uint16_t numberOfLevels;
+    int16_t stopCondition;                       //RegularStepGradientDescentBaseOptimizer::StopConditionType, -1 if the slice failed
+    double translation[3];                       //mm, unused axes are 0
+    double metricValue;
+    uint16_t iterationsPerLevel[ResultsMaximumLevels];
+    double readSeconds;
+    double registerSeconds;
+    double outputSeconds;                        //computing the fused outputs
+    double writeSeconds;
+    char sliceName[ResultsSliceNameLength];      //file name of the moving slice, truncated, NUL padded
+};
+
+static_assert(sizeof(ResultsLogHeader) == 16, "results log header must stay 16 bytes");
+static_assert(sizeof(ResultsRecord) == 136, "results record layout changed; bump ResultsLogVersion");
+
+inline void InitializeResultsRecord(ResultsRecord &record)
+{
+    std::memset(&record, 0, sizeof(record));
+    record.stopCondition = -1;
+}
+
+inline void SetResultsRecordName(ResultsRecord &record, const std::string &name)
+{
+    std::memset(record.sliceName, 0, sizeof(record.sliceName));
+    std::strncpy(record.sliceName, name.c_str(), sizeof(record.sliceName) - 1);
+}
+
+inline std::string GetResultsRecordName(const ResultsRecord &record)
+{
+    return std::string(record.sliceName, strnlen(record.sliceName, sizeof(record.sliceName)));
+}
+
+//stopCondition of a slice whose translation was interpolated from registered
+//neighbours instead of optimised (--sparse)
+const int ResultsInterpolatedStopCondition = 100;
+
+//Names of RegularStepGradientDescentBaseOptimizer::StopConditionType values
+inline const char * StopConditionName(int stopCondition)
+{
+    switch (stopCondition)
+    {
+    case ResultsInterpolatedStopCondition: return "Interpolated";
+    case 1: return "GradientMagnitudeTolerance";
+    case 2: return "StepTooSmall";
+    case 3: return "ImageNotAvailable";
+    case 4: return "CostFunctionError";
+    case 5: return "MaximumNumberOfIterations";
+    case 6: return "Unknown";
+    case -1: return "Failed";
+    default: return "Invalid";
+    }
+}
+
+inline void InitializeResultsLogHeader(ResultsLogHeader &header)
+{
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "IBRLOG", 6);
+    header.version = ResultsLogVersion;
+    header.recordSize = sizeof(ResultsRecord);
+}
+
+inline bool IsValidResultsLogHeader(const ResultsLogHeader &header)
+{
+    ResultsLogHeader expected;
+    InitializeResultsLogHeader(expected);
+    return std::memcmp(&header, &expected, sizeof(header)) == 0;
+}
+
+//Appends records to a results log, creating it if needed. Each record goes
+//out in a single write() on an O_APPEND descriptor, so several processes of a
+//bash loop can share one log. Opening takes an exclusive flock() on the log
+//and every append a shared one, so a process opening the log never sees a
+//header still being written nor cuts off a record still being appended.
+class ResultsLogWriter
+{
+public:
+    ResultsLogWriter() : m_FileDescriptor(-1) {}
+    ~ResultsLogWriter() { Close(); }
+
+    bool Open(const std::string &fileName)
+    {
+        Close();
+        m_FileName = fileName;
+
+        const int fd = open(fileName.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (fd < 0)
+        {
+            return false;
+        }
+        if (flock(fd, LOCK_EX) != 0)
+        {
+            close(fd);
+            return false;
+        }
+        const bool ready = PrepareForAppending(fd);
+        flock(fd, LOCK_UN);
+        if (!ready)
+        {
+            close(fd);
+            return false;
+        }
+        m_FileDescriptor = fd;
+        return true;
+    }
+
+    bool Append(const ResultsRecord &record)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (m_FileDescriptor < 0 || flock(m_FileDescriptor, LOCK_SH) != 0)
+        {
+            return false;
+        }
+        const bool written = WriteAll(m_FileDescriptor, &record, sizeof(record));
+        flock(m_FileDescriptor, LOCK_UN);
+        return written;
+    }
+
+    void Close()
+    {
+        if (m_FileDescriptor >= 0)
+        {
+            close(m_FileDescriptor);
+            m_FileDescriptor = -1;
+        }
+    }
+
+    const std::string & GetFileName() const { return m_FileName; }
+
+    static bool WriteAll(int fd, const void *buffer, std::size_t size)
+    {
+        const char *bytes = static_cast<const char *>(buffer);
+        while (size > 0)
+        {
+            const ssize_t written = write(fd, bytes, size);
+            if (written < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (written <= 0)
+            {
+                return false;
+            }
+            bytes += written;
+            size -= static_cast<std::size_t>(written);
+        }
+        return true;
+    }
+
+    static bool ReadAll(int fd, void *buffer, std::size_t size)
+    {
+        char *bytes = static_cast<char *>(buffer);
+        while (size > 0)
+        {
+            const ssize_t count = read(fd, bytes, size);
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count <= 0)
+            {
+                return false;
+            }
+            bytes += count;
+            size -= static_cast<std::size_t>(count);
+        }
+        return true;
+    }
+
+private:
+    //Under the exclusive lock: writes the header of a new (empty) log, or
+    //checks the header of an existing one. A run killed in the middle of a
+    //write leaves part of a record at the end of the log; appending after it
+    //would shift every later record, so the partial record is cut off.
+    static bool PrepareForAppending(int fd)
+    {
+        ResultsLogHeader header;
+        InitializeResultsLogHeader(header);
+
+        struct stat status;
+        if (fstat(fd, &status) != 0)
+        {
+            return false;
+        }
+        if (status.st_size == 0)
+        {
+            return WriteAll(fd, &header, sizeof(header));
+        }
+
+        ResultsLogHeader existing;
+        if (!ReadAll(fd, &existing, sizeof(existing)) || !IsValidResultsLogHeader(existing))
+        {
+            return false;
+        }
+        const off_t records = (status.st_size - static_cast<off_t>(sizeof(ResultsLogHeader))) / static_cast<off_t>(sizeof(ResultsRecord));
+        const off_t wholeSize = static_cast<off_t>(sizeof(ResultsLogHeader)) + records * static_cast<off_t>(sizeof(ResultsRecord));
+        return wholeSize == status.st_size || ftruncate(fd, wholeSize) == 0;
+    }
+
+    ResultsLogWriter(const ResultsLogWriter &);
+    void operator=(const ResultsLogWriter &);
+
+    int m_FileDescriptor;
+    std::string m_FileName;
+    std::mutex m_Mutex;
+};
+
+//Sequential reader; records are fetched in blocks through stdio buffering
+class ResultsLogReader
+{
+public:
+    ResultsLogReader() : m_File(nullptr) {}
+    ~ResultsLogReader() { Close(); }
+
+    bool Open(const std::string &fileName)
+    {
+        Close();
+        m_File = std::fopen(fileName.c_str(), "rb");
+        if (m_File == nullptr)
+        {
+            return false;
+        }
+        std::setvbuf(m_File, nullptr, _IOFBF, 1 << 20);
+
+        ResultsLogHeader header;
+        if (std::fread(&header, sizeof(header), 1, m_File) != 1 || !IsValidResultsLogHeader(header))
+        {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    //False at the end of the log. A truncated trailing record (a run killed
+    //mid-write) is ignored.
+    bool Read(ResultsRecord &record)
+    {
+        return m_File != nullptr && std::fread(&record, sizeof(record), 1, m_File) == 1;
+    }
+
+    void Close()
+    {
+        if (m_File != nullptr)
+        {
+            std::fclose(m_File);
+            m_File = nullptr;
+        }
+    }
+
+private:
+    ResultsLogReader(const ResultsLogReader &);
+    void operator=(const ResultsLogReader &);
+
+    std::FILE *m_File;
+};
+
+inline void WriteResultsCsvHeader(std::ostream &os)
+{
+    os << "slice_id,slice_name,translation_x,translation_y,translation_z,metric_value,levels";
+    for (unsigned int level = 0; level < ResultsMaximumLevels; ++level)
+    {
+        os << ",iterations_level_" << level;
+    }
+    os << ",stop_condition,read_s,register_s,output_s,write_s" << '\n';
+}
+
+inline void WriteResultsCsvRow(std::ostream &os, const ResultsRecord &record)
+{
+    os << record.sliceId << ',' << GetResultsRecordName(record) << ','
+       << record.translation[0] << ',' << record.translation[1] << ',' << record.translation[2] << ','
+       << record.metricValue << ',' << record.numberOfLevels;
+    for (unsigned int level = 0; level < ResultsMaximumLevels; ++level)
+    {
+        os << ',' << record.iterationsPerLevel[level];
+    }
+    os << ',' << StopConditionName(record.stopCondition)
+       << ',' << record.readSeconds << ',' << record.registerSeconds
+       << ',' << record.outputSeconds << ',' << record.writeSeconds << '\n';
+}
+
+#endif
@@ -0,0 +1,115 @@
+/*
+    Implemented by Imran Irfan, and Evan Wong
+
+*/
+#ifndef RunPipeline_h
+#define RunPipeline_h
+
+#include "RegistrationPipeline.h"
+#include "MultiAtlasPipeline.h"
+#include "CommandLine.h"
+
+#include <iostream>
+#include <string>
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            PIXEL TYPE DISPATCH
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+//Whole registration run (single or --batch) on images of TPixel in
+//VDimension dimensions, defined in RunPipeline.hxx. Returns the exit code.
+template <typename TPixel, unsigned int VDimension>
+int RunPipeline(const CommandLine &commandLine, RegistrationSettings settings, SeedMode seedMode);
+
+//Every pixel type and dimension the header can dispatch to is compiled once,
+//in RunPipeline2D.cxx and RunPipeline3D.cxx, so project.cxx only pays for
+//the dispatch and these translation units build in parallel.
+extern template int RunPipeline<unsigned char, 2>(const CommandLine &, RegistrationSettings, SeedMode);
+extern template int RunPipeline<short, 2>(const CommandLine &, RegistrationSettings, SeedMode);
+extern template int RunPipeline<unsigned short, 2>(const CommandLine &, RegistrationSettings, SeedMode);
+extern template int RunPipeline<float, 2>(const CommandLine &, RegistrationSettings, SeedMode);
+extern template int RunPipeline<unsigned char, 3>(const CommandLine &, RegistrationSettings, SeedMode);
+extern template int RunPipeline<short, 3>(const CommandLine &, RegistrationSettings, SeedMode);
+extern template int RunPipeline<unsigned short, 3>(const CommandLine &, RegistrationSettings, SeedMode);
+extern template int RunPipeline<float, 3>(const CommandLine &, RegistrationSettings, SeedMode);
+
+//Pixel component type and dimension of an image file, or of the largest
+//DICOM series of a directory (always a volume). A file whose third axis has a
+//single sample is 2D. False if the header cannot be read.
+inline bool ReadImageHeader(const std::string &fileName, itk::ImageIOBase::IOComponentType &componentType, unsigned int &dimension)
+{
+    itk::GDCMImageIO::Pointer imageIO = itk::GDCMImageIO::New();
+    std::string headerFile = fileName;
+    dimension = 2;
+
+    if (itksys::SystemTools::FileIsDirectory(fileName.c_str()))
+    {
+        const std::vector<std::string> seriesFiles = DicomSeriesFiles(fileName);
+        if (seriesFiles.empty())
+        {
+            return false;
+        }
+        headerFile = seriesFiles.front();
+        dimension = 3;
+    }
+
+    try
+    {
+        imageIO->SetFileName(headerFile);
+        imageIO->ReadImageInformation();
+    }
+    catch(itk::ExceptionObject &)
+    {
+        return false;
+    }
+
+    componentType = imageIO->GetComponentType();
+    if (imageIO->GetNumberOfDimensions() >= 3 && imageIO->GetDimensions(2) > 1)
+    {
+        dimension = 3;
+    }
+    return true;
+}
+
+//Runs the precompiled pipeline matching the fixed image's header. Pixel
+//types without one of their own (signed char, 32-bit integers, double) are
+//read as float, which holds all of them closely enough for registration.
+inline int DispatchPipeline(itk::ImageIOBase::IOComponentType componentType, unsigned int dimension,
+                            const CommandLine &commandLine, const RegistrationSettings &settings, SeedMode seedMode)
+{
+    std::cout << "Pixel type = " << itk::ImageIOBase::GetComponentTypeAsString(componentType)
+              << ", dimension = " << dimension << std::endl;
+
+    if (dimension == 3)
+    {
+        switch (componentType)
+        {
+        case itk::ImageIOBase::UCHAR:
+            return RunPipeline<unsigned char, 3>(commandLine, settings, seedMode);
+        case itk::ImageIOBase::SHORT:
+            return RunPipeline<short, 3>(commandLine, settings, seedMode);
+        case itk::ImageIOBase::USHORT:
+            return RunPipeline<unsigned short, 3>(commandLine, settings, seedMode);
+        default:
+            return RunPipeline<float, 3>(commandLine, settings, seedMode);
+        }
+    }
+
+    switch (componentType)
+    {
+    case itk::ImageIOBase::UCHAR:
+        return RunPipeline<unsigned char, 2>(commandLine, settings, seedMode);
+    case itk::ImageIOBase::SHORT:
+        return RunPipeline<short, 2>(commandLine, settings, seedMode);
+    case itk::ImageIOBase::USHORT:
+        return RunPipeline<unsigned short, 2>(commandLine, settings, seedMode);
+    default:
+        return RunPipeline<float, 2>(commandLine, settings, seedMode);
+    }
+}
+
+#endif
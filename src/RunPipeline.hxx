@@ -0,0 +1,492 @@
+/*
+    Implemented by Imran Irfan, and Evan Wong
+
+*/
+#ifndef RunPipeline_hxx
+#define RunPipeline_hxx
+
+#include "RunPipeline.h"
+#include "BatchPipeline.h"
+#include "MultiAtlasPipeline.h"
+#include "WatchFolderPipeline.h"
+#include "ShardedBatchPipeline.h"
+#include "AutotunePipeline.h"
+
+#include <sys/resource.h>
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            PIPELINE
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+//Peak resident set size of this process in kilobytes
+inline long PeakResidentSetSizeKB()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return 0;
+    }
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1024; //bytes on OS X
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+//--deadline-ms: takes the cost model from --cost-model if it was measured
+//with the same configuration, otherwise calibrates it on referenceImage (and
+//saves it there), then lowers settings until the predicted worst case fits
+//the budget. False if the budget is not positive or the model cannot be
+//saved. Throws itk::ExceptionObject if the calibration fails.
+template <typename TImage>
+bool ApplyDeadline(const CommandLine &commandLine, const TImage *referenceImage, RegistrationSettings &settings)
+{
+    settings.deadlineSeconds = commandLine.GetDouble("deadline-ms", 0.0) / 1e3;
+    if (settings.deadlineSeconds <= 0.0)
+    {
+        std::cerr << "--deadline-ms must be positive" << std::endl;
+        return false;
+    }
+
+    const std::string costModelFile = commandLine.GetString("cost-model");
+    const std::string configuration = CostModelConfiguration(settings, TImage::ImageDimension);
+    if (costModelFile != std::string("") && LoadCostModel(costModelFile, settings.costModel)
+        && settings.costModel.configuration == configuration)
+    {
+        std::cout << "Cost model (" << configuration << ") loaded from " << costModelFile << std::endl;
+    }
+    else
+    {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        settings.costModel = CalibrateCostModel<TImage>(referenceImage, settings);
+        std::cout << "Cost model (" << configuration << ") calibrated in " << SecondsSince(start) << " s" << std::endl;
+        if (costModelFile != std::string("") && !SaveCostModel(costModelFile, settings.costModel))
+        {
+            std::cerr << "Cannot write the cost model to " << costModelFile << std::endl;
+            return false;
+        }
+    }
+
+    double predictedSeconds = 0.0;
+    const double pixels = static_cast<double>(referenceImage->GetBufferedRegion().GetNumberOfPixels());
+    settings = FitSettingsToDeadline(settings, pixels, TImage::ImageDimension, predictedSeconds);
+    PrintDeadlinePlan(std::cout, settings, predictedSeconds);
+    return true;
+}
+
+//Single or batch registration of images with TPixel pixels in VDimension
+//dimensions; everything after the command line has been parsed. Returns the
+//process exit code.
+template <typename TPixel, unsigned int VDimension>
+int RunPipeline(const CommandLine &commandLine, RegistrationSettings settings, SeedMode seedMode)
+{
+    typedef TPixel PixelType;
+    const unsigned int Dimension = VDimension;
+    typedef itk::Image<PixelType, Dimension> ImageType;
+
+    const std::string fixedImageDirectory = commandLine.GetPositional(0);
+    const std::string movingImageDirectory = commandLine.GetPositional(1);
+    const std::string outputImageFile = commandLine.GetPositional(2);
+    const PixelType backgroundGL = static_cast<PixelType>((commandLine.GetNumberOfPositionals() > 3) ? atof(commandLine.GetPositional(3).c_str()) : 100.0);
+    const std::string checkerboardBefore = commandLine.GetPositional(4);
+    const std::string checkerboardAfter = commandLine.GetPositional(5);
+    const std::string identityOutputFile = commandLine.GetString("identity-output");
+
+    //Number of slabs the output chain is streamed in. Formats that cannot
+    //stream (DICOM) are silently written in a single piece by the writer.
+    const long streamDivisions = commandLine.GetInt("stream-divisions", 1);
+    if (streamDivisions < 1)
+    {
+        std::cerr << "--stream-divisions must be at least 1" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (commandLine.Has("autotune"))
+    {
+        AutotuneOptions options;
+        options.fixedImageFile = fixedImageDirectory;
+        options.movingDirectory = movingImageDirectory;
+        options.profileFile = outputImageFile;
+        options.referenceFile = commandLine.GetString("reference");
+        options.numberOfSyntheticShifts = static_cast<unsigned int>(std::max(0L, commandLine.GetInt("synthetic", 0)));
+        options.maximumShiftMm = commandLine.GetDouble("synthetic-max-mm", options.maximumShiftMm);
+        options.targetErrorMm = commandLine.GetDouble("target-error-mm", options.targetErrorMm);
+        options.paretoFile = commandLine.GetString("pareto", outputImageFile + ".pareto.csv");
+        options.numberOfWorkers = static_cast<unsigned int>(std::max(0L, commandLine.GetInt("workers", 0)));
+        options.seedMode = seedMode;
+        options.settings = settings;
+
+        //About the hand-picked 128 bins, 50000 samples, 3 levels, 200 iterations and relaxation 0.9
+        const double bins[] = { 32, 64, 128 };
+        const double samples[] = { 5000, 20000, 50000 };
+        const double levels[] = { 2, 3, 4 };
+        const double iterations[] = { 50, 100, 200 };
+        const double relaxationFactors[] = { 0.5, 0.7, 0.9 };
+        options.histogramBins = commandLine.GetDoubleList("tune-bins", std::vector<double>(bins, bins + 3));
+        options.spatialSamples = commandLine.GetDoubleList("tune-samples", std::vector<double>(samples, samples + 3));
+        options.levels = commandLine.GetDoubleList("tune-levels", std::vector<double>(levels, levels + 3));
+        options.iterations = commandLine.GetDoubleList("tune-iterations", std::vector<double>(iterations, iterations + 3));
+        options.relaxationFactors = commandLine.GetDoubleList("tune-relaxation", std::vector<double>(relaxationFactors, relaxationFactors + 3));
+
+        if (options.numberOfSyntheticShifts == 0 && options.referenceFile == std::string(""))
+        {
+            std::cerr << "--autotune needs --reference or --synthetic" << std::endl;
+            return EXIT_FAILURE;
+        }
+        const std::vector<double> * const lists[] = { &options.histogramBins, &options.spatialSamples, &options.levels, &options.iterations };
+        for (std::size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); ++i)
+        {
+            if (lists[i]->empty() || *std::min_element(lists[i]->begin(), lists[i]->end()) < 1.0)
+            {
+                std::cerr << "--tune-bins, --tune-samples, --tune-levels and --tune-iterations need values of at least 1" << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        if (options.relaxationFactors.empty() || *std::min_element(options.relaxationFactors.begin(), options.relaxationFactors.end()) <= 0.0
+            || *std::max_element(options.relaxationFactors.begin(), options.relaxationFactors.end()) >= 1.0)
+        {
+            std::cerr << "--tune-relaxation needs values between 0 and 1" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        unsigned int problems = 0;
+        try
+        {
+            problems = RunAutotune<ImageType>(options);
+        }
+        catch(itk::ExceptionObject &e)
+        {
+            std::cerr << "Exception in autotune " << std::endl << e << std::endl;
+            return EXIT_FAILURE;
+        }
+        catch(std::exception &e)
+        {
+            std::cerr << "Exception in autotune " << std::endl << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        return (problems == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    //The single registration fits its latency budget after reading its images;
+    //the other modes read their (first) reference image for it here
+    const bool singleRegistration = !commandLine.Has("multi-atlas") && !commandLine.Has("watch") && !commandLine.Has("batch");
+    if (commandLine.Has("deadline-ms") && !singleRegistration)
+    {
+        std::string referenceFile = fixedImageDirectory;
+        const std::vector<std::string> referenceFiles = commandLine.Has("multi-atlas") ? ListAtlasReferences(fixedImageDirectory)
+                                                      : commandLine.Has("match-fixed") ? DicomSeriesFiles(fixedImageDirectory)
+                                                      : std::vector<std::string>();
+        if (!referenceFiles.empty())
+        {
+            referenceFile = referenceFiles.front();
+        }
+        try
+        {
+            typename ImageType::Pointer referenceImage = ReadImage<ImageType>(referenceFile);
+            if (!ApplyDeadline<ImageType>(commandLine, referenceImage.GetPointer(), settings))
+            {
+                return EXIT_FAILURE;
+            }
+        }
+        catch(itk::ExceptionObject &e)
+        {
+            std::cerr << "Exception in cost model calibration " << std::endl << e << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (commandLine.Has("multi-atlas"))
+    {
+        MultiAtlasOptions options;
+        options.fixedImageFiles = ListAtlasReferences(fixedImageDirectory);
+        options.movingImageFile = movingImageDirectory;
+        options.outputDirectory = outputImageFile;
+        options.backgroundGL = backgroundGL;
+        options.numberOfWorkers = static_cast<unsigned int>(std::max(0L, commandLine.GetInt("workers", 0)));
+        options.streamDivisions = static_cast<unsigned int>(streamDivisions);
+        options.resultsLogFile = commandLine.GetString("results-log");
+        options.settings = settings;
+
+        unsigned int failures = 0;
+        try
+        {
+            failures = RunMultiAtlas<ImageType>(options);
+        }
+        catch(itk::ExceptionObject &e)
+        {
+            std::cerr << "Exception in multi-atlas registration " << std::endl << e << std::endl;
+            return EXIT_FAILURE;
+        }
+        catch(std::exception &e)
+        {
+            std::cerr << "Exception in multi-atlas registration " << std::endl << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        std::cout << "Peak RSS (KB) = " << PeakResidentSetSizeKB() << std::endl;
+        return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (commandLine.Has("watch"))
+    {
+        WatchOptions options;
+        options.fixedImageFile = fixedImageDirectory;
+        options.watchDirectory = movingImageDirectory;
+        options.outputDirectory = outputImageFile;
+        options.identityOutputDirectory = identityOutputFile;
+        options.checkerboardBeforeDirectory = checkerboardBefore;
+        options.checkerboardAfterDirectory = checkerboardAfter;
+        options.backgroundGL = backgroundGL;
+        options.numberOfWorkers = static_cast<unsigned int>(std::max(0L, commandLine.GetInt("workers", 0)));
+        options.queueDepth = static_cast<unsigned int>(std::max(1L, commandLine.GetInt("queue-depth", 4)));
+        options.streamDivisions = static_cast<unsigned int>(streamDivisions);
+        options.resultsLogFile = commandLine.GetString("results-log");
+        options.seedMode = seedMode;
+        options.settings = settings;
+        options.idleSeconds = std::max(0.0, commandLine.GetDouble("watch-idle-s", 0.0));
+        options.maximumSlices = static_cast<unsigned int>(std::max(0L, commandLine.GetInt("watch-count", 0)));
+        options.settleSeconds = std::max(0.0, commandLine.GetDouble("watch-settle-s", options.settleSeconds));
+
+        unsigned int failures = 0;
+        try
+        {
+            failures = RunWatchFolder<ImageType>(options);
+        }
+        catch(itk::ExceptionObject &e)
+        {
+            std::cerr << "Exception in watch mode " << std::endl << e << std::endl;
+            return EXIT_FAILURE;
+        }
+        catch(std::exception &e)
+        {
+            std::cerr << "Exception in watch mode " << std::endl << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        std::cout << "Peak RSS (KB) = " << PeakResidentSetSizeKB() << std::endl;
+        return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (commandLine.Has("batch"))
+    {
+        BatchOptions options;
+        options.fixedImageFile = fixedImageDirectory;
+        options.movingDirectory = movingImageDirectory;
+        options.outputDirectory = outputImageFile;
+        options.identityOutputDirectory = identityOutputFile;
+        options.checkerboardBeforeDirectory = checkerboardBefore;
+        options.checkerboardAfterDirectory = checkerboardAfter;
+        options.backgroundGL = backgroundGL;
+        options.numberOfWorkers = static_cast<unsigned int>(std::max(0L, commandLine.GetInt("workers", 0)));
+        options.queueDepth = static_cast<unsigned int>(std::max(1L, commandLine.GetInt("queue-depth", 4)));
+        options.streamDivisions = static_cast<unsigned int>(streamDivisions);
+        options.resultsLogFile = commandLine.GetString("results-log");
+        options.seedMode = seedMode;
+        options.settings = settings;
+        options.matchFixedSlices = commandLine.Has("match-fixed");
+        options.matchCandidates = static_cast<unsigned int>(std::max(1L, commandLine.GetInt("match-candidates", 1)));
+        options.journalFile = commandLine.GetString("journal", outputImageFile + "/" + BatchJournalFileName);
+        options.resume = commandLine.Has("resume");
+
+        unsigned int failures = 0;
+        try
+        {
+            if (commandLine.Has("tiered") && commandLine.Has("sparse"))
+            {
+                std::cerr << "--tiered and --sparse cannot be combined" << std::endl;
+                return EXIT_FAILURE;
+            }
+            if (options.matchFixedSlices && (commandLine.Has("tiered") || commandLine.Has("sparse")))
+            {
+                std::cerr << "--match-fixed cannot be combined with --tiered or --sparse" << std::endl;
+                return EXIT_FAILURE;
+            }
+            if (commandLine.Has("shard-dir"))
+            {
+                if (commandLine.Has("tiered") || commandLine.Has("sparse"))
+                {
+                    std::cerr << "--shard-dir cannot be combined with --tiered or --sparse" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                ShardOptions sharding;
+                sharding.directory = commandLine.GetString("shard-dir");
+                sharding.shardSize = static_cast<unsigned int>(std::max(1L, commandLine.GetInt("shard-size", sharding.shardSize)));
+                sharding.timeoutSeconds = std::max(1.0, commandLine.GetDouble("shard-timeout-s", sharding.timeoutSeconds));
+
+                failures = RunShardedBatch<ImageType>(options, sharding);
+            }
+            else if (commandLine.Has("sparse"))
+            {
+                SparseOptions sparse;
+                sparse.step = static_cast<unsigned int>(std::max(1L, commandLine.GetInt("sparse-step", sparse.step)));
+                sparse.maximumJumpMM = commandLine.GetDouble("sparse-max-jump", sparse.maximumJumpMM);
+                sparse.tolerance = commandLine.GetDouble("sparse-tolerance", sparse.tolerance);
+
+                failures = RunSparseBatch<ImageType>(options, sparse);
+            }
+            else if (commandLine.Has("tiered"))
+            {
+                //First pass: a tenth of the samples, half the bins and half the iterations
+                RegistrationSettings cheapSettings = settings;
+                cheapSettings.numberOfSpatialSamples = static_cast<unsigned int>(std::max(1L, commandLine.GetInt("cheap-samples", 5000)));
+                cheapSettings.numberOfHistogramBins = static_cast<unsigned int>(std::max(5L, commandLine.GetInt("cheap-bins", 64)));
+                cheapSettings.numberOfIterations = static_cast<unsigned int>(std::max(1L, commandLine.GetInt("cheap-iterations", 100)));
+
+                EscalationCriteria criteria;
+                criteria.translationToleranceMM = commandLine.GetDouble("escalate-mm", criteria.translationToleranceMM);
+
+                failures = RunTieredBatch<ImageType>(options, cheapSettings, criteria);
+            }
+            else
+            {
+                failures = RunBatch<ImageType>(options);
+            }
+        }
+        catch(itk::ExceptionObject &e)
+        {
+            std::cerr << "Exception in batch " << std::endl << e << std::endl;
+            return EXIT_FAILURE;
+        }
+        catch(std::exception &e)
+        {
+            std::cerr << "Exception in batch " << std::endl << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        std::cout << "Peak RSS (KB) = " << PeakResidentSetSizeKB() << std::endl;
+        return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    typename ImageType::Pointer fixedImage;
+    typename ImageType::Pointer movingImage;
+
+    std::chrono::steady_clock::time_point stageStart = std::chrono::steady_clock::now();
+
+    //Attempt to read
+    try
+    {
+        fixedImage = ReadImage<ImageType>(fixedImageDirectory);
+        movingImage = ReadImage<ImageType>(movingImageDirectory);
+    }
+    catch(itk::ExceptionObject &e)
+    {
+        std::cerr << "Exception in File Reader " << std::endl << e << std::endl;
+        return EXIT_FAILURE;
+    }
+    catch(std::exception &e)
+    {
+        std::cerr << "Exception in File Reader " << std::endl << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Read Successful." << std::endl;
+
+    const double readSeconds = SecondsSince(stageStart);
+
+    if (commandLine.Has("deadline-ms"))
+    {
+        try
+        {
+            if (!ApplyDeadline<ImageType>(commandLine, fixedImage.GetPointer(), settings))
+            {
+                return EXIT_FAILURE;
+            }
+        }
+        catch(itk::ExceptionObject &e)
+        {
+            std::cerr << "Exception in cost model calibration " << std::endl << e << std::endl;
+            return EXIT_FAILURE;
+        }
+        catch(std::exception &e)
+        {
+            std::cerr << "Exception in cost model calibration " << std::endl << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    //Slice ID: explicit, or the number in a name like 000012.dcm
+    const std::string movingName = itksys::SystemTools::GetFilenameName(movingImageDirectory);
+    const long sliceId = commandLine.GetInt("slice-id", atol(itksys::SystemTools::GetFilenameWithoutExtension(movingName).c_str()));
+
+    settings.seed = SliceSeed(seedMode, settings.seed, static_cast<unsigned long long>(sliceId), movingImageDirectory);
+    if (seedMode != FixedSeed)
+    {
+        std::cout << "Sampling seed = " << settings.seed << std::endl;
+    }
+
+    RegistrationResult result;
+    try
+    {
+        result = RegisterImages<ImageType>(fixedImage, movingImage, settings);
+        result.readSeconds = readSeconds;
+    }
+    catch(itk::ExceptionObject &e)
+    {
+        std::cerr << "Exception registration update" << e << std::endl;
+        return EXIT_FAILURE;
+    }
+    catch(std::exception &e)
+    {
+        std::cerr << "Exception registration update" << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    //print the results
+    PrintRegistrationResult(std::cout, result);
+    PrintDeadlineResult(std::cout, settings, result);
+    PrintMetricTiming(std::cout, result.metricEvaluations, result.metricSeconds, result.metricThreadingSeconds);
+    PrintMetricCacheStatistics(std::cout, result.metricCacheLookups, result.metricCacheHits, result.metricSeconds, result.metricEvaluations);
+
+    //Output Process
+    typedef itk::RegistrationOutputImageFilter<ImageType> OutputFilterType;
+    typename OutputFilterType::Pointer outputFilter = MakeRegistrationOutputFilter<ImageType>(fixedImage, movingImage, result, backgroundGL);
+
+    //Writer
+    //Setting up file output. Outputs keep the input pixel type
+    const OutputFileList outputFiles = MakeOutputFileList<OutputFilterType>(outputImageFile, identityOutputFile,
+                                                                            checkerboardBefore, checkerboardAfter);
+
+    try
+    {
+        //With a single piece the outputs are computed before the writers run, so the two stages can be timed apart
+        stageStart = std::chrono::steady_clock::now();
+        if (streamDivisions <= 1)
+        {
+            outputFilter->Update();
+        }
+        result.outputSeconds = SecondsSince(stageStart);
+
+        stageStart = std::chrono::steady_clock::now();
+        WriteRegistrationOutputs(outputFilter.GetPointer(), outputFiles, static_cast<unsigned int>(streamDivisions));
+        result.writeSeconds = SecondsSince(stageStart);
+    }
+    catch(itk::ExceptionObject &e)
+    {
+        std::cerr << "Exception in File Writer " << std::endl << e << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Writer Update Successful" << std::endl;
+    PrintImageBufferPoolStatistics(std::cout, ImageBufferPool::GetInstance().GetStatistics(), 1);
+
+    const std::string resultsLogFile = commandLine.GetString("results-log");
+    if (resultsLogFile != std::string(""))
+    {
+        ResultsLogWriter resultsLog;
+        if (!resultsLog.Open(resultsLogFile) || !resultsLog.Append(MakeResultsRecord(static_cast<unsigned int>(sliceId), movingName, result)))
+        {
+            std::cerr << "Cannot append to results log " << resultsLogFile << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::cout << "Peak RSS (KB) = " << PeakResidentSetSizeKB() << std::endl;
+
+    return EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,11 @@
+/*
+    Implemented by Imran Irfan, and Evan Wong
+
+*/
+#include "RunPipeline.hxx"
+
+//2D pipelines for every pixel type DispatchPipeline selects
+template int RunPipeline<unsigned char, 2>(const CommandLine &, RegistrationSettings, SeedMode);
+template int RunPipeline<short, 2>(const CommandLine &, RegistrationSettings, SeedMode);
+template int RunPipeline<unsigned short, 2>(const CommandLine &, RegistrationSettings, SeedMode);
+template int RunPipeline<float, 2>(const CommandLine &, RegistrationSettings, SeedMode);
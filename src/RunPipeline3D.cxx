@@ -0,0 +1,11 @@
+/*
+    Implemented by Imran Irfan, and Evan Wong
+
+*/
+#include "RunPipeline.hxx"
+
+//3D pipelines for every pixel type DispatchPipeline selects
+template int RunPipeline<unsigned char, 3>(const CommandLine &, RegistrationSettings, SeedMode);
+template int RunPipeline<short, 3>(const CommandLine &, RegistrationSettings, SeedMode);
+template int RunPipeline<unsigned short, 3>(const CommandLine &, RegistrationSettings, SeedMode);
+template int RunPipeline<float, 3>(const CommandLine &, RegistrationSettings, SeedMode);
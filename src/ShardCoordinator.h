@@ -0,0 +1,332 @@
+/*
+    Implemented by Imran Irfan, and Evan Wong
+
+*/
+#ifndef ShardCoordinator_h
+#define ShardCoordinator_h
+
+#include "ResultsLog.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            SHARD COORDINATOR
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+//Splits a batch into shards of consecutive slices that independent processes,
+//on one machine or on several sharing a filesystem, claim through files in a
+//shared directory. No process is in charge:
+//  shards.manifest         the slice list and shard size, written by whichever process comes first
+//  shard-NNNNN.lock        held by the process working on the shard, created with O_EXCL; its
+//                          modification time is the holder's heartbeat
+//  shard-NNNNN.takeover    flock()ed around taking a stale lock over, so only one process does
+//  shard-NNNNN.done        the shard is finished
+//  shard-NNNNN.log         results log of the shard's slices
+//  shard-NNNNN.journal     batch journal, so a shard taken over resumes where its holder stopped
+//A lock whose heartbeat is older than the timeout belongs to a process that
+//died; the first process to take the takeover guard replaces it. The
+//timeout must exceed both the heartbeat interval and any clock skew between
+//machines.
+
+const char * const ShardManifestFileName = "shards.manifest";
+const char * const ShardManifestMagic = "SHARDS 1";
+
+class ShardCoordinator
+{
+public:
+    ShardCoordinator(const std::string &directory, double timeoutSeconds)
+        : m_Directory(directory), m_TimeoutSeconds(timeoutSeconds), m_ShardSize(1)
+    {
+        std::ostringstream owner;
+        char host[256] = { 0 };
+        gethostname(host, sizeof(host) - 1);
+        owner << host << ":" << getpid();
+        m_Owner = owner.str();
+    }
+
+    //Writes the manifest unless another process already did, then reads it
+    //back: every process works on the slice list of the first one. Without
+    //sliceFiles only an existing manifest is read.
+    bool Initialize(const std::vector<std::string> &sliceFiles, unsigned int shardSize)
+    {
+        mkdir(m_Directory.c_str(), 0755);
+        const std::string manifest = GetPath(ShardManifestFileName);
+        if (!sliceFiles.empty() && access(manifest.c_str(), F_OK) != 0)
+        {
+            //Written aside and linked into place: link() fails if it exists, so one manifest wins
+            const std::string temporary = manifest + "." + m_Owner;
+            {
+                std::ofstream file(temporary.c_str());
+                file << ShardManifestMagic << '\n' << std::max(shardSize, 1u) << '\n' << sliceFiles.size() << '\n';
+                for (std::size_t i = 0; i < sliceFiles.size(); ++i)
+                {
+                    file << sliceFiles[i] << '\n';
+                }
+                if (!file)
+                {
+                    std::remove(temporary.c_str());
+                    return false;
+                }
+            }
+            if (link(temporary.c_str(), manifest.c_str()) != 0 && errno != EEXIST)
+            {
+                std::remove(temporary.c_str());
+                return false;
+            }
+            std::remove(temporary.c_str());
+        }
+        return ReadManifest(manifest);
+    }
+
+    const std::string & GetOwner() const { return m_Owner; }
+    const std::vector<std::string> & GetSliceFiles() const { return m_SliceFiles; }
+    unsigned int GetShardSize() const { return m_ShardSize; }
+
+    unsigned int GetNumberOfShards() const
+    {
+        return static_cast<unsigned int>((m_SliceFiles.size() + m_ShardSize - 1) / m_ShardSize);
+    }
+
+    //Slices [GetShardBegin(shard), GetShardEnd(shard)) of the manifest
+    std::size_t GetShardBegin(unsigned int shard) const { return static_cast<std::size_t>(shard) * m_ShardSize; }
+    std::size_t GetShardEnd(unsigned int shard) const
+    {
+        return std::min(m_SliceFiles.size(), GetShardBegin(shard) + m_ShardSize);
+    }
+
+    //directory/shard-NNNNN<extension>
+    std::string GetShardPath(unsigned int shard, const std::string &extension) const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "shard-%05u", shard);
+        return GetPath(name + extension);
+    }
+
+    bool IsShardDone(unsigned int shard) const
+    {
+        return access(GetShardPath(shard, ".done").c_str(), F_OK) == 0;
+    }
+
+    unsigned int GetNumberOfDoneShards() const
+    {
+        unsigned int done = 0;
+        for (unsigned int shard = 0; shard < GetNumberOfShards(); ++shard)
+        {
+            done += IsShardDone(shard) ? 1 : 0;
+        }
+        return done;
+    }
+
+    //Claims the first shard that is neither done nor held by a live process.
+    //takenOver is set if its previous holder had stopped its heartbeat.
+    //False if there is none right now.
+    bool ClaimShard(unsigned int &shard, bool &takenOver)
+    {
+        for (unsigned int s = 0; s < GetNumberOfShards(); ++s)
+        {
+            if (IsShardDone(s))
+            {
+                continue;
+            }
+            const std::string lock = GetShardPath(s, ".lock");
+            takenOver = false;
+            if (!CreateLock(lock))
+            {
+                //Held: take it over only if the holder's heartbeat stopped
+                if (!TakeOverStaleLock(s))
+                {
+                    continue;
+                }
+                takenOver = true;
+            }
+            //The shard may have been finished between the check and the claim
+            if (IsShardDone(s))
+            {
+                std::remove(lock.c_str());
+                continue;
+            }
+            shard = s;
+            return true;
+        }
+        return false;
+    }
+
+    //Heartbeat. False if the lock is no longer ours (it was taken over).
+    bool RefreshClaim(unsigned int shard) const
+    {
+        const std::string lock = GetShardPath(shard, ".lock");
+        if (ReadFirstLine(lock) != m_Owner)
+        {
+            return false;
+        }
+        return utime(lock.c_str(), NULL) == 0;
+    }
+
+    //Marks the shard done, recording how many of its slices failed, and
+    //releases the lock
+    void CompleteShard(unsigned int shard, unsigned int failures) const
+    {
+        const std::string done = GetShardPath(shard, ".done");
+        const std::string temporary = done + "." + m_Owner;
+        {
+            std::ofstream file(temporary.c_str());
+            file << m_Owner << '\n' << failures << '\n';
+        }
+        std::rename(temporary.c_str(), done.c_str());
+        if (ReadFirstLine(GetShardPath(shard, ".lock")) == m_Owner)
+        {
+            std::remove(GetShardPath(shard, ".lock").c_str());
+        }
+    }
+
+private:
+    std::string GetPath(const std::string &name) const
+    {
+        return m_Directory + "/" + name;
+    }
+
+    //Replaces the shard's lock with ours if its heartbeat is older than the
+    //timeout. Staleness is checked again under the shard's takeover guard:
+    //two processes that both saw the old lock as stale would otherwise both
+    //replace it, the second one removing the first one's fresh lock.
+    bool TakeOverStaleLock(unsigned int shard) const
+    {
+        const std::string lock = GetShardPath(shard, ".lock");
+        struct stat status;
+        if (stat(lock.c_str(), &status) != 0 || std::difftime(std::time(NULL), status.st_mtime) < m_TimeoutSeconds)
+        {
+            return false;
+        }
+
+        const int guard = open(GetShardPath(shard, ".takeover").c_str(), O_RDWR | O_CREAT, 0644);
+        if (guard < 0)
+        {
+            return false;
+        }
+        bool claimed = false;
+        if (flock(guard, LOCK_EX) == 0)
+        {
+            //A lock that vanished was released by its holder; leave the shard to the next scan
+            claimed = stat(lock.c_str(), &status) == 0 && std::difftime(std::time(NULL), status.st_mtime) >= m_TimeoutSeconds
+                      && std::remove(lock.c_str()) == 0 && CreateLock(lock);
+            flock(guard, LOCK_UN);
+        }
+        close(guard);
+        return claimed;
+    }
+
+    bool CreateLock(const std::string &lock) const
+    {
+        const int fd = open(lock.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (fd < 0)
+        {
+            return false;
+        }
+        const std::string content = m_Owner + "\n";
+        const bool written = ResultsLogWriter::WriteAll(fd, content.data(), content.size());
+        close(fd);
+        return written;
+    }
+
+    static std::string ReadFirstLine(const std::string &fileName)
+    {
+        std::ifstream file(fileName.c_str());
+        std::string line;
+        std::getline(file, line);
+        return line;
+    }
+
+    bool ReadManifest(const std::string &manifest)
+    {
+        std::ifstream file(manifest.c_str());
+        std::string magic;
+        std::size_t numberOfSlices = 0;
+        if (!std::getline(file, magic) || magic != ShardManifestMagic || !(file >> m_ShardSize >> numberOfSlices) || m_ShardSize == 0)
+        {
+            return false;
+        }
+        file.ignore(1, '\n');
+
+        m_SliceFiles.clear();
+        std::string line;
+        while (m_SliceFiles.size() < numberOfSlices && std::getline(file, line))
+        {
+            m_SliceFiles.push_back(line);
+        }
+        return m_SliceFiles.size() == numberOfSlices;
+    }
+
+    std::string m_Directory;
+    double m_TimeoutSeconds;
+    std::string m_Owner;
+    unsigned int m_ShardSize;
+    std::vector<std::string> m_SliceFiles;
+};
+
+//Combines the results logs of every shard of directory into outputFile, one
+//record per slice in slice order; where a shard was taken over and a slice
+//was logged twice the later record counts. Returns false if the manifest or
+//the output cannot be read or written. missingShards receives the number of
+//shards not yet done.
+inline bool MergeShardResults(const std::string &directory, const std::string &outputFile,
+                              unsigned long &records, unsigned int &missingShards)
+{
+    ShardCoordinator coordinator(directory, 0.0);
+    if (!coordinator.Initialize(std::vector<std::string>(), 1))
+    {
+        return false;
+    }
+
+    std::map<uint32_t, ResultsRecord> slices;
+    missingShards = 0;
+    for (unsigned int shard = 0; shard < coordinator.GetNumberOfShards(); ++shard)
+    {
+        missingShards += coordinator.IsShardDone(shard) ? 0 : 1;
+        ResultsLogReader reader;
+        if (!reader.Open(coordinator.GetShardPath(shard, ".log")))
+        {
+            continue;
+        }
+        ResultsRecord record;
+        while (reader.Read(record))
+        {
+            slices[record.sliceId] = record;
+        }
+    }
+
+    std::remove(outputFile.c_str());
+    ResultsLogWriter writer;
+    if (!writer.Open(outputFile))
+    {
+        return false;
+    }
+    for (std::map<uint32_t, ResultsRecord>::const_iterator it = slices.begin(); it != slices.end(); ++it)
+    {
+        if (!writer.Append(it->second))
+        {
+            return false;
+        }
+    }
+    records = static_cast<unsigned long>(slices.size());
+    return true;
+}
+
+#endif
@@ -0,0 +1,160 @@
+/*
+    Implemented by Imran Irfan, and Evan Wong
+
+*/
+#ifndef ShardedBatchPipeline_h
+#define ShardedBatchPipeline_h
+
+#include "BatchPipeline.h"
+#include "ShardCoordinator.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            SHARDED BATCH PIPELINE
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+struct ShardOptions
+{
+    ShardOptions() : shardSize(16), timeoutSeconds(600.0) {}
+
+    std::string directory;   //shared coordination directory (see ShardCoordinator)
+    unsigned int shardSize;  //slices per shard
+    double timeoutSeconds;   //a lock not refreshed for this long is taken over
+};
+
+//One worker process of a sharded batch. Claims shards through the
+//coordination directory and runs each through RunBatch, with the shard's own
+//results log and journal, until every shard is done. While others still hold
+//shards it waits rather than exits, so a shard whose holder dies is taken
+//over once its lock times out. Returns the number of slices that failed in
+//the shards this process finished.
+template <typename TImage>
+unsigned int RunShardedBatch(const BatchOptions &options, const ShardOptions &sharding)
+{
+    ShardCoordinator coordinator(sharding.directory, sharding.timeoutSeconds);
+
+    //Only the first process's listing counts, but each lists in case it is first
+    const std::vector<std::string> movingFiles = ListBatchSlices(options.movingDirectory);
+    if (!coordinator.Initialize(movingFiles, sharding.shardSize))
+    {
+        std::cerr << "Cannot read or write the shard manifest in " << sharding.directory << std::endl;
+        return static_cast<unsigned int>(std::max<std::size_t>(movingFiles.size(), 1));
+    }
+    const unsigned int numberOfShards = coordinator.GetNumberOfShards();
+    std::cout << "Worker " << coordinator.GetOwner() << ": " << coordinator.GetSliceFiles().size() << " slices in "
+              << numberOfShards << " shards of " << coordinator.GetShardSize() << std::endl;
+
+    //Heartbeats at a quarter of the timeout, so a busy holder is never mistaken for a dead one
+    const std::chrono::milliseconds heartbeatInterval(static_cast<long long>(250.0 * sharding.timeoutSeconds));
+    const std::chrono::milliseconds waitInterval(std::min<long long>(heartbeatInterval.count(), 5000));
+
+    //Decoded once here rather than by every shard's RunBatch
+    typename TImage::Pointer fixedImage;
+    if (!options.matchFixedSlices)
+    {
+        fixedImage = ReadImage<TImage>(options.fixedImageFile);
+    }
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    unsigned int failures = 0;
+    unsigned int shardsDone = 0;
+    unsigned int shardsTakenOver = 0;
+    std::size_t slicesDone = 0;
+    while (coordinator.GetNumberOfDoneShards() < numberOfShards)
+    {
+        unsigned int shard = 0;
+        bool takenOver = false;
+        if (!coordinator.ClaimShard(shard, takenOver))
+        {
+            std::this_thread::sleep_for(waitInterval);
+            continue;
+        }
+
+        const std::size_t begin = coordinator.GetShardBegin(shard);
+        const std::size_t end = coordinator.GetShardEnd(shard);
+        std::cout << "Shard " << shard << " (slices " << begin << " to " << end - 1 << ")"
+                  << (takenOver ? ", taken over from a worker that stopped" : "") << std::endl;
+
+        //A shard taken over resumes from the journal its previous holder left
+        BatchOptions shardOptions = options;
+        shardOptions.sliceFiles.assign(coordinator.GetSliceFiles().begin() + begin, coordinator.GetSliceFiles().begin() + end);
+        shardOptions.firstSliceIndex = begin;
+        shardOptions.resultsLogFile = coordinator.GetShardPath(shard, ".log");
+        shardOptions.journalFile = coordinator.GetShardPath(shard, ".journal");
+        shardOptions.resume = true;
+
+        //Set by the heartbeat when another worker took the shard over; the
+        //batch then stops reading slices and the shard is left to that worker
+        std::atomic<bool> claimLost(false);
+        shardOptions.cancel = &claimLost;
+
+        std::mutex heartbeatMutex;
+        std::condition_variable heartbeatStop;
+        bool shardFinished = false;
+        std::thread heartbeat([&]()
+        {
+            std::unique_lock<std::mutex> lock(heartbeatMutex);
+            while (!heartbeatStop.wait_for(lock, heartbeatInterval, [&shardFinished] { return shardFinished; }))
+            {
+                if (!coordinator.RefreshClaim(shard))
+                {
+                    std::cerr << "Shard " << shard << " was taken over by another worker" << std::endl;
+                    claimLost = true;
+                    return;
+                }
+            }
+        });
+
+        const auto stopHeartbeat = [&]()
+        {
+            {
+                std::lock_guard<std::mutex> lock(heartbeatMutex);
+                shardFinished = true;
+            }
+            heartbeatStop.notify_one();
+            heartbeat.join();
+        };
+
+        unsigned int shardFailures = 0;
+        try
+        {
+            shardFailures = RunBatch<TImage>(shardOptions, ITK_NULLPTR, ITK_NULLPTR, fixedImage.GetPointer());
+        }
+        catch(...)
+        {
+            stopHeartbeat();
+            throw;
+        }
+        stopHeartbeat();
+
+        if (claimLost)
+        {
+            std::cout << "Shard " << shard << " abandoned; its new holder finishes and completes it" << std::endl;
+            continue;
+        }
+        coordinator.CompleteShard(shard, shardFailures);
+        failures += shardFailures;
+        ++shardsDone;
+        shardsTakenOver += takenOver ? 1 : 0;
+        slicesDone += end - begin;
+    }
+
+    const double wallSeconds = SecondsSince(start);
+    std::cout << "////////////////////////////////////////////////////////////////////" << std::endl;
+    std::cout << "Worker " << coordinator.GetOwner() << ": " << shardsDone << " shards (" << shardsTakenOver
+              << " taken over), " << slicesDone << " slices, " << failures << " failed, in " << wallSeconds << " s ("
+              << (wallSeconds > 0.0 ? slicesDone / wallSeconds : 0.0) << " slices/s)" << std::endl;
+    std::cout << "All " << numberOfShards << " shards done; merge their results with: resultslog merge "
+              << sharding.directory << " OUT.log" << std::endl;
+    return failures;
+}
+
+#endif
@@ -0,0 +1,162 @@
+/*
+    Implemented by Imran Irfan, and Evan Wong
+
+*/
+#ifndef SliceSignature_h
+#define SliceSignature_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            SLICE SIGNATURES
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+//A slice reduced to a SliceSignatureSize x SliceSignatureSize thumbnail of
+//block means, each quantised to one of SliceSignatureBins grey levels over
+//the thumbnail's own range. Comparing two signatures costs one small joint
+//histogram instead of a registration.
+const unsigned int SliceSignatureSize = 32;
+const unsigned int SliceSignatureBins = 16;
+
+struct SliceSignature
+{
+    std::vector<unsigned char> cells; //row-major, SliceSignatureSize^2 entries
+};
+
+//Signature of an image's buffered region. Axes beyond the second are folded
+//into the same thumbnail.
+template <typename TImage>
+SliceSignature ComputeSliceSignature(const TImage *image)
+{
+    const unsigned int cellsPerSide = SliceSignatureSize;
+    const typename TImage::RegionType region = image->GetBufferedRegion();
+    const std::size_t sizeX = region.GetSize(0);
+    const std::size_t sizeY = (TImage::ImageDimension > 1) ? region.GetSize(1) : 1;
+    const std::size_t numberOfPixels = region.GetNumberOfPixels();
+    const typename TImage::PixelType *pixels = image->GetBufferPointer();
+
+    std::vector<double> sums(cellsPerSide * cellsPerSide, 0.0);
+    std::vector<std::size_t> counts(cellsPerSide * cellsPerSide, 0);
+    std::vector<std::size_t> cellOfColumn(sizeX);
+    for (std::size_t x = 0; x < sizeX; ++x)
+    {
+        cellOfColumn[x] = x * cellsPerSide / sizeX;
+    }
+
+    for (std::size_t i = 0; i < numberOfPixels; i += sizeX)
+    {
+        const std::size_t rowCell = ((i / sizeX) % sizeY) * cellsPerSide / sizeY;
+        double *rowSums = &sums[rowCell * cellsPerSide];
+        std::size_t *rowCounts = &counts[rowCell * cellsPerSide];
+        for (std::size_t x = 0; x < sizeX; ++x)
+        {
+            rowSums[cellOfColumn[x]] += static_cast<double>(pixels[i + x]);
+            ++rowCounts[cellOfColumn[x]];
+        }
+    }
+
+    double minimum = 0.0;
+    double maximum = 0.0;
+    bool first = true;
+    for (std::size_t c = 0; c < sums.size(); ++c)
+    {
+        sums[c] = counts[c] ? sums[c] / counts[c] : 0.0;
+        minimum = first ? sums[c] : std::min(minimum, sums[c]);
+        maximum = first ? sums[c] : std::max(maximum, sums[c]);
+        first = false;
+    }
+
+    SliceSignature signature;
+    signature.cells.resize(sums.size());
+    const double scale = (maximum > minimum) ? (SliceSignatureBins - 1e-9) / (maximum - minimum) : 0.0;
+    for (std::size_t c = 0; c < sums.size(); ++c)
+    {
+        signature.cells[c] = static_cast<unsigned char>((sums[c] - minimum) * scale);
+    }
+    return signature;
+}
+
+//Mutual information in nats of two signatures, cell against cell. Higher is
+//more alike; like the registration metric it does not assume both slices
+//come from the same modality.
+inline double SignatureMutualInformation(const SliceSignature &a, const SliceSignature &b)
+{
+    const unsigned int bins = SliceSignatureBins;
+    const std::size_t count = std::min(a.cells.size(), b.cells.size());
+    if (count == 0)
+    {
+        return 0.0;
+    }
+
+    unsigned int joint[SliceSignatureBins * SliceSignatureBins] = { 0 };
+    unsigned int marginalA[SliceSignatureBins] = { 0 };
+    unsigned int marginalB[SliceSignatureBins] = { 0 };
+    for (std::size_t c = 0; c < count; ++c)
+    {
+        ++joint[a.cells[c] * bins + b.cells[c]];
+        ++marginalA[a.cells[c]];
+        ++marginalB[b.cells[c]];
+    }
+
+    double information = 0.0;
+    for (unsigned int i = 0; i < bins; ++i)
+    {
+        for (unsigned int j = 0; j < bins; ++j)
+        {
+            const unsigned int n = joint[i * bins + j];
+            if (n > 0)
+            {
+                information += n * std::log(static_cast<double>(n) * count / (static_cast<double>(marginalA[i]) * marginalB[j]));
+            }
+        }
+    }
+    return information / count;
+}
+
+//In-memory signatures of the slices of a reference series
+class SliceSignatureIndex
+{
+public:
+    void Add(const std::string &fileName, const SliceSignature &signature)
+    {
+        m_FileNames.push_back(fileName);
+        m_Signatures.push_back(signature);
+    }
+
+    std::size_t GetNumberOfSlices() const { return m_Signatures.size(); }
+    const std::string & GetFileName(std::size_t slice) const { return m_FileNames[slice]; }
+
+    //Indices of the count slices most alike signature, best first, each with
+    //its mutual information
+    std::vector<std::pair<std::size_t, double> > FindBestMatches(const SliceSignature &signature, unsigned int count) const
+    {
+        std::vector<std::pair<std::size_t, double> > matches;
+        for (std::size_t s = 0; s < m_Signatures.size(); ++s)
+        {
+            matches.push_back(std::make_pair(s, SignatureMutualInformation(signature, m_Signatures[s])));
+        }
+        const std::size_t kept = std::min<std::size_t>(count, matches.size());
+        std::partial_sort(matches.begin(), matches.begin() + kept, matches.end(),
+                          [](const std::pair<std::size_t, double> &a, const std::pair<std::size_t, double> &b)
+                          {
+                              return a.second > b.second || (a.second == b.second && a.first < b.first);
+                          });
+        matches.resize(kept);
+        return matches;
+    }
+
+private:
+    std::vector<std::string> m_FileNames;
+    std::vector<SliceSignature> m_Signatures;
+};
+
+#endif
@@ -0,0 +1,441 @@
+/*
+    Implemented by Imran Irfan, and Evan Wong
+
+*/
+#ifndef SyntheticDataset_h
+#define SyntheticDataset_h
+
+#include "RunPipeline.h"
+
+#include "itkResampleImageFilter.h"
+#include "itkEuler2DTransform.h"
+#include "itkEuler3DTransform.h"
+#include "itkImageRegionIterator.h"
+#include "itkImageSeriesWriter.h"
+#include "itkMinimumMaximumImageCalculator.h"
+#include "itkMetaDataObject.h"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <random>
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            SYNTHETIC DATASET
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+//A registration benchmark with known answers, laid out like bin/:
+//  OUTPUT/Fixed/000000.dcm      the source, resampled to the requested size
+//                               (a 3D dataset has a series directory OUTPUT/Fixed/ instead)
+//  OUTPUT/Moving/NNNNNN.dcm     moved copies of it, one DICOM series; for 3D a
+//                               series directory OUTPUT/Moving/NNNNNN/ per volume
+//  OUTPUT/ground_truth.txt      "name x y [z]" per moving image, the translation
+//                               registration should find, then its rotation as a
+//                               comment; project --autotune --reference reads it
+//A moving image is moving(x) = remap(fixed(R(x - c) + c - t)) + noise with c
+//the image centre, so t is its translation and R its rigid rotation.
+
+enum IntensityRemapKind
+{
+    NoRemap,
+    InvertRemap,      //bright becomes dark
+    GammaRemap,       //monotonic but non-linear, a different scanner's windowing
+    MRLikeRemap       //non-monotonic, mid grey brightest, so only mutual information still matches
+};
+
+inline bool ParseIntensityRemapKind(const std::string &name, IntensityRemapKind &kind)
+{
+    const char * const names[] = { "none", "invert", "gamma", "mr" };
+    const IntensityRemapKind kinds[] = { NoRemap, InvertRemap, GammaRemap, MRLikeRemap };
+    for (unsigned int i = 0; i < 4; ++i)
+    {
+        if (name == names[i])
+        {
+            kind = kinds[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+struct DatasetOptions
+{
+    DatasetOptions()
+        : sourceDimension(2), numberOfImages(16), depth(1), twistDegrees(2.0), maximumShiftMm(10.0),
+          maximumRotationDegrees(0.0), noiseSigma(0.0), remap(NoRemap), gamma(0.5), seed(1)
+    {}
+
+    std::string sourceFile;              //a slice, a volume file or a DICOM series directory
+    unsigned int sourceDimension;
+    std::string outputDirectory;
+    unsigned int numberOfImages;         //moving images
+    std::vector<unsigned int> size;      //voxels along each axis, empty for the source's own grid
+    unsigned int depth;                  //>1 stacks a 2D source into a volume of this many slices
+    double twistDegrees;                 //  each slice turned this much further than the one below
+    double maximumShiftMm;               //translations uniform in [-max, max] along each axis
+    double maximumRotationDegrees;       //rotations uniform in [-max, max] about each axis, 0 for translations only
+    double noiseSigma;                   //Gaussian noise in grey levels, added to every image
+    IntensityRemapKind remap;            //applied to the moving images only
+    double gamma;
+    unsigned int seed;
+};
+
+//Rigid transform of a dimension and how to set its rotation
+template <unsigned int VDimension> struct RigidTransformOf;
+
+template <>
+struct RigidTransformOf<2>
+{
+    typedef itk::Euler2DTransform<double> Type;
+    static const unsigned int NumberOfAngles = 1;
+    static void SetAngles(Type *transform, const std::vector<double> &radians) { transform->SetAngle(radians[0]); }
+};
+
+template <>
+struct RigidTransformOf<3>
+{
+    typedef itk::Euler3DTransform<double> Type;
+    static const unsigned int NumberOfAngles = 3;
+    static void SetAngles(Type *transform, const std::vector<double> &radians) { transform->SetRotation(radians[0], radians[1], radians[2]); }
+};
+
+//Physical centre of an image's buffer
+template <typename TImage>
+typename TImage::PointType ImageCentre(const TImage *image)
+{
+    const typename TImage::RegionType region = image->GetBufferedRegion();
+    itk::ContinuousIndex<double, TImage::ImageDimension> centre;
+    for (unsigned int axis = 0; axis < TImage::ImageDimension; ++axis)
+    {
+        centre[axis] = region.GetIndex(axis) + 0.5 * (region.GetSize(axis) - 1.0);
+    }
+    typename TImage::PointType point;
+    image->TransformContinuousIndexToPhysicalPoint(centre, point);
+    return point;
+}
+
+//image on a grid of size voxels covering the same physical extent, or moved
+//rigidly when transform is given (output(x) = image(transform(x))). Voxels
+//moved in from outside take the image minimum.
+template <typename TImage>
+typename TImage::Pointer ResampleDatasetImage(const TImage *image, const std::vector<unsigned int> &size,
+                                              const itk::Transform<double, TImage::ImageDimension, TImage::ImageDimension> *transform = ITK_NULLPTR)
+{
+    typedef itk::ResampleImageFilter<TImage, TImage> ResampleFilterType;
+    typedef itk::MinimumMaximumImageCalculator<TImage> CalculatorType;
+
+    typename CalculatorType::Pointer calculator = CalculatorType::New();
+    calculator->SetImage(image);
+    calculator->ComputeMinimum();
+
+    typename ResampleFilterType::Pointer resampler = ResampleFilterType::New();
+    resampler->SetInput(image);
+    if (transform)
+    {
+        resampler->SetTransform(transform);
+    }
+    resampler->SetDefaultPixelValue(calculator->GetMinimum());
+
+    const typename TImage::RegionType region = image->GetBufferedRegion();
+    typename TImage::SizeType outputSize = region.GetSize();
+    typename TImage::SpacingType spacing = image->GetSpacing();
+    typename TImage::PointType origin = image->GetOrigin();
+    if (!size.empty())
+    {
+        //Same extent: the first and last voxel centres stay where they were
+        for (unsigned int axis = 0; axis < TImage::ImageDimension; ++axis)
+        {
+            outputSize[axis] = size[axis];
+            spacing[axis] *= (size[axis] > 1) ? (region.GetSize(axis) - 1.0) / (size[axis] - 1.0) : 1.0;
+        }
+        image->TransformIndexToPhysicalPoint(region.GetIndex(), origin);
+    }
+    resampler->SetSize(outputSize);
+    resampler->SetOutputSpacing(spacing);
+    resampler->SetOutputOrigin(origin);
+    resampler->SetOutputDirection(image->GetDirection());
+    resampler->Update();
+
+    typename TImage::Pointer output = resampler->GetOutput();
+    output->DisconnectPipeline();
+    return output;
+}
+
+//A volume of depth copies of slice, each turned twistDegrees further about
+//the slice centre than the one below, so the volume has structure along all
+//three axes. Slices are as far apart as the slice's pixels.
+template <typename TPixel>
+typename itk::Image<TPixel, 3>::Pointer StackSlice(const itk::Image<TPixel, 2> *slice, unsigned int depth, double twistDegrees)
+{
+    typedef itk::Image<TPixel, 2> SliceType;
+    typedef itk::Image<TPixel, 3> VolumeType;
+
+    const typename SliceType::RegionType sliceRegion = slice->GetBufferedRegion();
+    typename VolumeType::RegionType region;
+    typename VolumeType::SpacingType spacing;
+    typename VolumeType::PointType origin;
+    for (unsigned int axis = 0; axis < 2; ++axis)
+    {
+        region.SetSize(axis, sliceRegion.GetSize(axis));
+        spacing[axis] = slice->GetSpacing()[axis];
+        origin[axis] = slice->GetOrigin()[axis];
+    }
+    region.SetSize(2, depth);
+    spacing[2] = slice->GetSpacing()[0];
+    origin[2] = 0.0;
+
+    typename VolumeType::Pointer volume = VolumeType::New();
+    volume->SetRegions(region);
+    volume->SetSpacing(spacing);
+    volume->SetOrigin(origin);
+    volume->Allocate();
+
+    typedef RigidTransformOf<2>::Type TransformType;
+    for (unsigned int k = 0; k < depth; ++k)
+    {
+        TransformType::Pointer transform = TransformType::New();
+        transform->SetCenter(ImageCentre(slice));
+        transform->SetAngle((k - 0.5 * (depth - 1.0)) * twistDegrees * itk::Math::pi / 180.0);
+        const typename SliceType::Pointer turned = ResampleDatasetImage<SliceType>(slice, std::vector<unsigned int>(), transform.GetPointer());
+
+        itk::ImageRegionConstIterator<SliceType> input(turned, turned->GetBufferedRegion());
+        typename VolumeType::RegionType plane = region;
+        plane.SetIndex(2, k);
+        plane.SetSize(2, 1);
+        itk::ImageRegionIterator<VolumeType> output(volume, plane);
+        for (; !input.IsAtEnd(); ++input, ++output)
+        {
+            output.Set(input.Get());
+        }
+    }
+    return volume;
+}
+
+//The source as an image of VDimension dimensions: read as it is, or a 2D
+//slice stacked into a volume
+template <typename TPixel>
+typename itk::Image<TPixel, 2>::Pointer ReadDatasetSource(const DatasetOptions &options, const itk::Image<TPixel, 2> *)
+{
+    return ReadImage<itk::Image<TPixel, 2> >(options.sourceFile);
+}
+
+template <typename TPixel>
+typename itk::Image<TPixel, 3>::Pointer ReadDatasetSource(const DatasetOptions &options, const itk::Image<TPixel, 3> *)
+{
+    if (options.sourceDimension == 3)
+    {
+        return ReadImage<itk::Image<TPixel, 3> >(options.sourceFile);
+    }
+    const typename itk::Image<TPixel, 2>::Pointer slice = ReadImage<itk::Image<TPixel, 2> >(options.sourceFile);
+    return StackSlice<TPixel>(slice.GetPointer(), options.depth, options.twistDegrees);
+}
+
+//Remaps the intensities of image within its own range and adds noise,
+//clamping to the pixel type
+template <typename TImage>
+void ApplyIntensityModel(TImage *image, IntensityRemapKind remap, double gamma, double noiseSigma, std::mt19937 &generator)
+{
+    typedef typename TImage::PixelType PixelType;
+    itk::ImageRegionIterator<TImage> it(image, image->GetBufferedRegion());
+
+    double minimum = itk::NumericTraits<double>::max();
+    double maximum = itk::NumericTraits<double>::NonpositiveMin();
+    for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+    {
+        minimum = std::min(minimum, static_cast<double>(it.Get()));
+        maximum = std::max(maximum, static_cast<double>(it.Get()));
+    }
+    const double range = std::max(maximum - minimum, 1e-12);
+
+    std::normal_distribution<double> noise(0.0, std::max(noiseSigma, 0.0));
+    const double lowest = static_cast<double>(itk::NumericTraits<PixelType>::NonpositiveMin());
+    const double highest = static_cast<double>(itk::NumericTraits<PixelType>::max());
+    const bool integral = itk::NumericTraits<PixelType>::is_integer;
+    for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+    {
+        double value = (static_cast<double>(it.Get()) - minimum) / range;
+        switch (remap)
+        {
+        case InvertRemap:
+            value = 1.0 - value;
+            break;
+        case GammaRemap:
+            value = std::pow(value, gamma);
+            break;
+        case MRLikeRemap:
+            value = 4.0 * value * (1.0 - value);
+            break;
+        default:
+            break;
+        }
+        value = minimum + value * range + (noiseSigma > 0.0 ? noise(generator) : 0.0);
+        value = std::max(lowest, std::min(highest, integral ? std::floor(value + 0.5) : value));
+        it.Set(static_cast<PixelType>(value));
+    }
+}
+
+//A slice as one DICOM file. imageIO is shared by every slice of a series, so
+//they get its series UID; instanceNumber orders them.
+template <typename TPixel>
+void WriteDatasetImage(const itk::Image<TPixel, 2> *image, const std::string &path, itk::GDCMImageIO *imageIO, unsigned int instanceNumber)
+{
+    typedef itk::Image<TPixel, 2> ImageType;
+    typename ImageType::Pointer copy = ShallowCopy(image);
+    std::ostringstream instance;
+    instance << instanceNumber;
+    itk::EncapsulateMetaData<std::string>(copy->GetMetaDataDictionary(), "0020|0013", instance.str());
+
+    typedef itk::ImageFileWriter<ImageType> WriterType;
+    typename WriterType::Pointer writer = WriterType::New();
+    writer->SetInput(copy);
+    writer->SetFileName(path);
+    writer->SetImageIO(imageIO);
+    writer->Update();
+}
+
+//A volume as a DICOM series of NNNNNN.dcm slices in directory path, with
+//its own series UID (a fresh imageIO per volume)
+template <typename TPixel>
+void WriteDatasetImage(const itk::Image<TPixel, 3> *image, const std::string &path, itk::GDCMImageIO *, unsigned int)
+{
+    typedef itk::Image<TPixel, 3> VolumeType;
+    typedef itk::Image<TPixel, 2> SliceType;
+    typedef itk::ImageSeriesWriter<VolumeType, SliceType> SeriesWriterType;
+
+    itksys::SystemTools::MakeDirectory(path.c_str());
+    itk::GDCMImageIO::Pointer imageIO = itk::GDCMImageIO::New();
+    const unsigned int depth = static_cast<unsigned int>(image->GetBufferedRegion().GetSize(2));
+
+    //Each slice carries its own position and instance number, as a scanner's export does
+    typename SeriesWriterType::DictionaryArrayType dictionaries;
+    std::vector<itk::MetaDataDictionary> slices(depth);
+    std::vector<std::string> fileNames;
+    for (unsigned int k = 0; k < depth; ++k)
+    {
+        typename VolumeType::IndexType index = image->GetBufferedRegion().GetIndex();
+        index[2] += k;
+        typename VolumeType::PointType position;
+        image->TransformIndexToPhysicalPoint(index, position);
+
+        std::ostringstream value;
+        value << position[0] << "\\" << position[1] << "\\" << position[2];
+        itk::EncapsulateMetaData<std::string>(slices[k], "0020|0032", value.str());
+        value.str("");
+        value << k + 1;
+        itk::EncapsulateMetaData<std::string>(slices[k], "0020|0013", value.str());
+        value.str("");
+        value << image->GetSpacing()[2];
+        itk::EncapsulateMetaData<std::string>(slices[k], "0018|0050", value.str());
+        dictionaries.push_back(&slices[k]);
+
+        char name[32];
+        std::snprintf(name, sizeof(name), "/%06u.dcm", k);
+        fileNames.push_back(path + name);
+    }
+
+    typename SeriesWriterType::Pointer writer = SeriesWriterType::New();
+    writer->SetInput(image);
+    writer->SetImageIO(imageIO);
+    writer->SetFileNames(fileNames);
+    writer->SetMetaDataDictionaryArray(&dictionaries);
+    writer->Update();
+}
+
+//Path of the index-th image of directory: NNNNNN.dcm for a slice, NNNNNN/ for a volume
+inline std::string DatasetImagePath(const std::string &directory, unsigned int index, unsigned int dimension)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), (dimension == 2) ? "/%06u.dcm" : "/%06u", index);
+    return directory + name;
+}
+
+//Writes the dataset of options with TPixel pixels in VDimension dimensions.
+//Returns false if the output cannot be written; throws
+//itk::ExceptionObject if the source cannot be read or an image not written.
+template <typename TPixel, unsigned int VDimension>
+bool GenerateDataset(const DatasetOptions &options)
+{
+    typedef itk::Image<TPixel, VDimension> ImageType;
+    typedef RigidTransformOf<VDimension> RigidType;
+    typedef typename RigidType::Type TransformType;
+
+    const std::string fixedDirectory = options.outputDirectory + "/Fixed";
+    const std::string movingDirectory = options.outputDirectory + "/Moving";
+    itksys::SystemTools::MakeDirectory(fixedDirectory.c_str());
+    itksys::SystemTools::MakeDirectory(movingDirectory.c_str());
+
+    std::mt19937 generator(options.seed);
+    typename ImageType::Pointer fixedImage = ResampleDatasetImage<ImageType>(
+        ReadDatasetSource<TPixel>(options, static_cast<const ImageType *>(ITK_NULLPTR)).GetPointer(), options.size);
+    const typename ImageType::SizeType size = fixedImage->GetBufferedRegion().GetSize();
+    std::cout << "Fixed image: " << size << " voxels of " << fixedImage->GetSpacing() << " mm" << std::endl;
+
+    //The moving images are computed from the noise-free fixed image, so the written one gets noise on a copy
+    typename ImageType::Pointer noisyFixed = fixedImage;
+    if (options.noiseSigma > 0.0)
+    {
+        noisyFixed = ResampleDatasetImage<ImageType>(fixedImage.GetPointer(), std::vector<unsigned int>());
+        ApplyIntensityModel(noisyFixed.GetPointer(), NoRemap, options.gamma, options.noiseSigma, generator);
+    }
+    itk::GDCMImageIO::Pointer fixedIO = itk::GDCMImageIO::New();
+    WriteDatasetImage<TPixel>(noisyFixed.GetPointer(), (VDimension == 2) ? DatasetImagePath(fixedDirectory, 0, 2) : fixedDirectory,
+                              fixedIO.GetPointer(), 1);
+
+    const std::string groundTruthFile = options.outputDirectory + "/ground_truth.txt";
+    std::ofstream groundTruth(groundTruthFile.c_str());
+    groundTruth << "# name, translation (mm) registering it onto Fixed, then its rotation (degrees)" << std::endl;
+    groundTruth.precision(10);
+
+    std::uniform_real_distribution<double> shift(-options.maximumShiftMm, options.maximumShiftMm);
+    std::uniform_real_distribution<double> turn(-options.maximumRotationDegrees, options.maximumRotationDegrees);
+    itk::GDCMImageIO::Pointer movingIO = itk::GDCMImageIO::New();
+    for (unsigned int i = 0; i < options.numberOfImages; ++i)
+    {
+        typename TransformType::OutputVectorType translation;
+        for (unsigned int axis = 0; axis < VDimension; ++axis)
+        {
+            translation[axis] = shift(generator);
+        }
+        std::vector<double> degrees(RigidType::NumberOfAngles, 0.0);
+        std::vector<double> radians(RigidType::NumberOfAngles, 0.0);
+        for (unsigned int a = 0; a < RigidType::NumberOfAngles; ++a)
+        {
+            degrees[a] = (options.maximumRotationDegrees > 0.0) ? turn(generator) : 0.0;
+            radians[a] = degrees[a] * itk::Math::pi / 180.0;
+        }
+
+        //moving(x) = fixed(R(x - c) + c - t)
+        typename TransformType::Pointer transform = TransformType::New();
+        transform->SetCenter(ImageCentre(fixedImage.GetPointer()));
+        RigidType::SetAngles(transform.GetPointer(), radians);
+        transform->SetTranslation(-translation);
+
+        typename ImageType::Pointer movingImage = ResampleDatasetImage<ImageType>(fixedImage.GetPointer(), std::vector<unsigned int>(),
+                                                                                  transform.GetPointer());
+        ApplyIntensityModel(movingImage.GetPointer(), options.remap, options.gamma, options.noiseSigma, generator);
+
+        const std::string path = DatasetImagePath(movingDirectory, i, VDimension);
+        WriteDatasetImage<TPixel>(movingImage.GetPointer(), path, movingIO.GetPointer(), i + 1);
+
+        groundTruth << itksys::SystemTools::GetFilenameName(path);
+        for (unsigned int axis = 0; axis < VDimension; ++axis)
+        {
+            groundTruth << ' ' << translation[axis];
+        }
+        groundTruth << "  # rotation";
+        for (unsigned int a = 0; a < RigidType::NumberOfAngles; ++a)
+        {
+            groundTruth << ' ' << degrees[a];
+        }
+        groundTruth << std::endl;
+    }
+
+    std::cout << options.numberOfImages << " moving images in " << movingDirectory << ", ground truth in " << groundTruthFile << std::endl;
+    return static_cast<bool>(groundTruth);
+}
+
+#endif
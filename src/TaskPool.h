@@ -0,0 +1,204 @@
+/*
+    Implemented by Imran Irfan, and Evan Wong
+
+*/
+#ifndef TaskPool_h
+#define TaskPool_h
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            TASK POOL
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+//Persistent worker threads shared by every registration of the process.
+//
+//Work is submitted as parallel loops. The submitting thread always runs the
+//loop itself and idle pool threads join it, each taking the next unclaimed
+//index, so an idle thread steals work from whichever registration still has
+//some left and a busy pool never blocks a caller. Creating and joining
+//threads is paid once per process instead of once per metric evaluation.
+class TaskPool
+{
+public:
+    explicit TaskPool(unsigned int numberOfThreads) : m_Stopping(false)
+    {
+        for (unsigned int t = 0; t < numberOfThreads; ++t)
+        {
+            m_Threads.push_back(std::thread(&TaskPool::WorkerLoop, this));
+        }
+    }
+
+    ~TaskPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Stopping = true;
+        }
+        m_WorkAvailable.notify_all();
+        for (std::size_t t = 0; t < m_Threads.size(); ++t)
+        {
+            m_Threads[t].join();
+        }
+    }
+
+    unsigned int GetNumberOfThreads() const { return static_cast<unsigned int>(m_Threads.size()); }
+
+    //Runs function(index, slot) for every index in [0, count) on at most
+    //maximumSlots threads, the caller included, and returns once all calls
+    //have finished. slot is in [0, maximumSlots) and is unique among the
+    //threads running the loop, so it can address per-thread partial results.
+    //The first exception thrown by function is rethrown here.
+    template <typename TFunction>
+    void ParallelFor(std::size_t count, unsigned int maximumSlots, const TFunction &function)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        if (maximumSlots <= 1 || count == 1 || m_Threads.empty())
+        {
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                function(i, 0);
+            }
+            return;
+        }
+
+        Loop loop;
+        loop.body = std::cref(function);
+        loop.count = count;
+        loop.next = 0;
+        loop.maximumSlots = maximumSlots;
+        loop.slots = 1;   //slot 0 is the caller's
+        loop.running = 1;
+
+        const std::size_t helpers = std::min<std::size_t>(std::min<std::size_t>(maximumSlots, count) - 1, m_Threads.size());
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Loops.push_back(&loop);
+        }
+        for (std::size_t h = 0; h < helpers; ++h)
+        {
+            m_WorkAvailable.notify_one();
+        }
+
+        RunSlot(loop, 0);
+
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_Loops.erase(std::find(m_Loops.begin(), m_Loops.end(), &loop));
+            --loop.running;
+            m_LoopFinished.wait(lock, [&loop] { return loop.running == 0; });
+        }
+        if (loop.error)
+        {
+            std::rethrow_exception(loop.error);
+        }
+    }
+
+    //Pool used by the registration pipeline, or null to spawn threads per call
+    static TaskPool * GetGlobal() { return GlobalPool(); }
+    static void SetGlobal(TaskPool *pool) { GlobalPool() = pool; }
+
+private:
+    struct Loop
+    {
+        std::function<void(std::size_t, unsigned int)> body;
+        std::size_t count;
+        std::atomic<std::size_t> next;
+        unsigned int maximumSlots;
+        unsigned int slots;   //guarded by m_Mutex
+        unsigned int running; //guarded by m_Mutex
+        std::mutex errorMutex;
+        std::exception_ptr error;
+    };
+
+    TaskPool(const TaskPool &);
+    void operator=(const TaskPool &);
+
+    static TaskPool *& GlobalPool()
+    {
+        static TaskPool *pool = nullptr;
+        return pool;
+    }
+
+    static void RunSlot(Loop &loop, unsigned int slot)
+    {
+        try
+        {
+            for (std::size_t i = loop.next++; i < loop.count; i = loop.next++)
+            {
+                loop.body(i, slot);
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(loop.errorMutex);
+            if (!loop.error)
+            {
+                loop.error = std::current_exception();
+            }
+            loop.next = loop.count;
+        }
+    }
+
+    //A loop that still has unclaimed indices and a free slot
+    Loop * FindLoop() const
+    {
+        for (std::size_t l = 0; l < m_Loops.size(); ++l)
+        {
+            if (m_Loops[l]->slots < m_Loops[l]->maximumSlots && m_Loops[l]->next.load() < m_Loops[l]->count)
+            {
+                return m_Loops[l];
+            }
+        }
+        return nullptr;
+    }
+
+    void WorkerLoop()
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        for (;;)
+        {
+            Loop *loop = nullptr;
+            m_WorkAvailable.wait(lock, [this, &loop] { return m_Stopping || (loop = FindLoop()) != nullptr; });
+            if (!loop)
+            {
+                return;
+            }
+            const unsigned int slot = loop->slots++;
+            ++loop->running;
+
+            lock.unlock();
+            RunSlot(*loop, slot);
+            lock.lock();
+
+            if (--loop->running == 0)
+            {
+                m_LoopFinished.notify_all();
+            }
+        }
+    }
+
+    std::mutex m_Mutex;
+    std::condition_variable m_WorkAvailable;
+    std::condition_variable m_LoopFinished;
+    std::vector<Loop *> m_Loops;
+    std::vector<std::thread> m_Threads;
+    bool m_Stopping;
+};
+
+#endif
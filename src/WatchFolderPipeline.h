@@ -0,0 +1,290 @@
+/*
+    Implemented by Imran Irfan, and Evan Wong
+
+*/
+#ifndef WatchFolderPipeline_h
+#define WatchFolderPipeline_h
+
+#include "BatchPipeline.h"
+#include "DirectoryWatcher.h"
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <sstream>
+#include <thread>
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+                            WATCH FOLDER PIPELINE
+//////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+//Slices registered as they arrive from the scanner. The batch stages are
+//kept (reader, workers, writer, bounded queues) and the workers and the
+//writer run the same steps (RegisterSliceOutputs, WriteSliceOutputs), but
+//the reader takes its slices from a DirectoryWatcher instead of a directory
+//listing, and every
+//slice's latency is measured from the moment its file was complete to the
+//moment its outputs were written.
+
+struct WatchOptions
+{
+    WatchOptions()
+        : backgroundGL(100), numberOfWorkers(0), queueDepth(4), streamDivisions(1), seedMode(FixedSeed),
+          idleSeconds(0.0), maximumSlices(0), settleSeconds(1.0) {}
+
+    std::string fixedImageFile;
+    std::string watchDirectory;
+    std::string outputDirectory;
+    std::string identityOutputDirectory;     //optional, "" to skip
+    std::string checkerboardBeforeDirectory; //optional, "" to skip
+    std::string checkerboardAfterDirectory;  //optional, "" to skip
+    double backgroundGL;
+    unsigned int numberOfWorkers;            //0 picks half the hardware threads
+    unsigned int queueDepth;                 //capacity of each inter-stage queue
+    unsigned int streamDivisions;
+    std::string resultsLogFile;              //optional, "" to skip
+    SeedMode seedMode;
+    RegistrationSettings settings;
+    double idleSeconds;                      //stop after this long without a new slice, 0 to run until interrupted
+    unsigned int maximumSlices;              //stop after this many slices, 0 for no limit
+    double settleSeconds;                    //see DirectoryWatcher
+};
+
+//Set by SIGINT / SIGTERM; the watch stops taking new slices and drains
+inline volatile std::sig_atomic_t & WatchStopRequested()
+{
+    static volatile std::sig_atomic_t stopRequested = 0;
+    return stopRequested;
+}
+
+inline void RequestWatchStop(int)
+{
+    WatchStopRequested() = 1;
+}
+
+template <typename TImage>
+struct WatchSliceJob : public BatchSliceJob<TImage>
+{
+    std::chrono::steady_clock::time_point arrivalTime; //file found complete
+};
+
+template <typename TImage>
+struct WatchOutputJob : public BatchOutputJob<TImage>
+{
+    std::chrono::steady_clock::time_point arrivalTime;
+};
+
+//Mean, median, 95th percentile and maximum of the per-slice latencies
+inline void PrintLatencyStatistics(std::ostream &os, std::vector<double> latencies)
+{
+    if (latencies.empty())
+    {
+        return;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    double sum = 0.0;
+    for (std::size_t i = 0; i < latencies.size(); ++i)
+    {
+        sum += latencies[i];
+    }
+    const std::size_t last = latencies.size() - 1;
+    os << "Latency (file complete to outputs written): mean " << 1000.0 * sum / latencies.size() << " ms"
+       << ", median " << 1000.0 * latencies[last / 2] << " ms"
+       << ", 95th percentile " << 1000.0 * latencies[(95 * last + 50) / 100] << " ms"
+       << ", max " << 1000.0 * latencies[last] << " ms" << std::endl;
+}
+
+//Registers every *.dcm file that appears in options.watchDirectory against
+//the fixed image, decoded once, and writes its outputs and results record as
+//soon as it is done. Files already in the directory are taken first. Runs
+//until options.idleSeconds pass without a new file, options.maximumSlices
+//are done, or SIGINT / SIGTERM; slices already taken are finished either way.
+//Returns the number of slices that failed.
+template <typename TImage>
+unsigned int RunWatchFolder(const WatchOptions &options)
+{
+    typedef WatchSliceJob<TImage> SliceJobType;
+    typedef WatchOutputJob<TImage> OutputJobType;
+    typedef std::chrono::steady_clock Clock;
+
+    if (!itksys::SystemTools::FileIsDirectory(options.watchDirectory.c_str()))
+    {
+        std::cerr << "Cannot watch " << options.watchDirectory << ": not a directory" << std::endl;
+        return 1;
+    }
+
+    const std::string outputDirectories[] = { options.outputDirectory, options.identityOutputDirectory,
+                                              options.checkerboardBeforeDirectory, options.checkerboardAfterDirectory };
+    for (unsigned int i = 0; i < 4; ++i)
+    {
+        if (outputDirectories[i] != std::string(""))
+        {
+            itksys::SystemTools::MakeDirectory(outputDirectories[i].c_str());
+        }
+    }
+
+    const typename TImage::Pointer fixedImage = ReadImage<TImage>(options.fixedImageFile);
+
+    RegistrationSettings settings = options.settings;
+    settings.verbose = false;
+    const unsigned int numberOfWorkers = ChooseBatchThreading(options.numberOfWorkers, settings);
+
+    ResultsLogWriter resultsLog;
+    if (options.resultsLogFile != std::string("") && !resultsLog.Open(options.resultsLogFile))
+    {
+        std::cerr << "Cannot open results log " << options.resultsLogFile << std::endl;
+        return 1;
+    }
+    ResultsLogWriter journal; //none: a watch has no fixed slice list to resume
+    BatchSliceRecorder recorder(resultsLog, journal);
+
+    DirectoryWatcher watcher(options.watchDirectory, options.settleSeconds);
+    std::cout << "Watching " << options.watchDirectory << " ("
+              << (watcher.IsUsingInotify() ? "inotify" : "polling") << "), " << numberOfWorkers << " workers" << std::endl;
+
+    WatchStopRequested() = 0;
+    std::signal(SIGINT, RequestWatchStop);
+    std::signal(SIGTERM, RequestWatchStop);
+
+    BoundedQueue<SliceJobType> readQueue(options.queueDepth);
+    BoundedQueue<OutputJobType> writeQueue(options.queueDepth);
+
+    std::atomic<unsigned int> activeWorkers(numberOfWorkers);
+
+    std::size_t numberOfSlices = 0;
+    std::vector<double> latencies;
+    std::size_t deadlineMisses = 0;
+    std::size_t deadlineCutShort = 0;
+    double worstRegistration = 0.0;
+    const Clock::time_point watchStart = Clock::now();
+    const ImageBufferPoolStatistics poolStart = ImageBufferPool::GetInstance().GetStatistics();
+
+    //While the read queue is full the reader blocks here and new files wait
+    //in the kernel's event queue (or, past its limit, for the next scan)
+    std::thread reader([&]()
+    {
+        Clock::time_point lastArrival = Clock::now();
+        bool stop = false;
+        while (!stop && !WatchStopRequested())
+        {
+            const std::vector<std::string> arrived = watcher.WaitForFiles(0.5);
+            const Clock::time_point arrivalTime = Clock::now();
+            if (arrived.empty())
+            {
+                stop = options.idleSeconds > 0.0 && std::chrono::duration<double>(arrivalTime - lastArrival).count() >= options.idleSeconds;
+                continue;
+            }
+            lastArrival = arrivalTime;
+
+            for (std::size_t i = 0; i < arrived.size() && !stop; ++i)
+            {
+                const Clock::time_point start = Clock::now();
+                SliceJobType job;
+                job.index = numberOfSlices++;
+                job.fileName = arrived[i];
+                job.arrivalTime = arrivalTime;
+                stop = options.maximumSlices > 0 && numberOfSlices >= options.maximumSlices;
+                if (!RunSliceStage(recorder, static_cast<unsigned int>(job.index), job.fileName, "File Reader", [&]()
+                    {
+                        job.image = ReadImage<TImage>(job.fileName);
+                    }))
+                {
+                    continue;
+                }
+                job.seed = SliceSeed(options.seedMode, options.settings.seed, job.index, job.fileName);
+                job.readSeconds = SecondsSince(start);
+
+                if (!readQueue.Push(job))
+                {
+                    stop = true;
+                }
+            }
+        }
+        readQueue.Close();
+    });
+
+    std::vector<std::thread> workers;
+    for (unsigned int w = 0; w < numberOfWorkers; ++w)
+    {
+        workers.push_back(std::thread([&]()
+        {
+            SliceJobType job;
+            while (readQueue.Pop(job))
+            {
+                OutputJobType output;
+                output.arrivalTime = job.arrivalTime;
+                if (!RunSliceStage(recorder, static_cast<unsigned int>(job.index), job.fileName, "registration update", [&]()
+                    {
+                        RegisterSliceOutputs<TImage>(options, settings, fixedImage, job, ITK_NULLPTR, output);
+                    }))
+                {
+                    continue;
+                }
+
+                job = SliceJobType();
+                if (!writeQueue.Push(output))
+                {
+                    break;
+                }
+            }
+            if (--activeWorkers == 0)
+            {
+                writeQueue.Close();
+            }
+        }));
+    }
+
+    std::thread writer([&]()
+    {
+        OutputJobType output;
+        while (writeQueue.Pop(output))
+        {
+            if (!WriteSliceOutputs(output, options.streamDivisions, static_cast<unsigned int>(output.index), recorder))
+            {
+                continue;
+            }
+            const double latency = SecondsSince(output.arrivalTime);
+            latencies.push_back(latency);
+            deadlineMisses += (output.result.registerSeconds > settings.deadlineSeconds) ? 1 : 0;
+            deadlineCutShort += (output.result.levelsSkipped > 0) ? 1 : 0;
+            worstRegistration = std::max(worstRegistration, output.result.registerSeconds);
+
+            //Latency = waiting in the queues + read + register + outputs + write
+            const double stageSeconds = output.result.readSeconds + output.result.registerSeconds
+                                      + output.result.outputSeconds + output.result.writeSeconds;
+            std::ostringstream suffix;
+            suffix << "  Latency = " << 1000.0 * latency << " ms"
+                   << " (queued " << 1000.0 * std::max(0.0, latency - stageSeconds) << " ms)";
+            recorder.Print(output.fileName, output.result, output.fixedFileName, suffix.str());
+
+            output = OutputJobType();
+        }
+    });
+
+    reader.join();
+    for (unsigned int w = 0; w < numberOfWorkers; ++w)
+    {
+        workers[w].join();
+    }
+    writer.join();
+
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+
+    std::cout << "////////////////////////////////////////////////////////////////////" << std::endl;
+    std::cout << "Slices = " << numberOfSlices << ", failed = " << recorder.GetNumberOfFailures() << std::endl;
+    std::cout << "Watched for " << SecondsSince(watchStart) << " s" << std::endl;
+    PrintLatencyStatistics(std::cout, latencies);
+    PrintDeadlineStatistics(std::cout, settings.deadlineSeconds, latencies.size(), deadlineMisses, deadlineCutShort, worstRegistration);
+    PrintQueueStatistics(std::cout, "Read queue", readQueue.GetStatistics());
+    PrintQueueStatistics(std::cout, "Write queue", writeQueue.GetStatistics());
+    PrintImageBufferPoolStatistics(std::cout, ImageBufferPool::GetInstance().GetStatistics().Since(poolStart), numberOfSlices);
+
+    return recorder.GetNumberOfFailures();
+}
+
+#endif
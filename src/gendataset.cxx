@@ -0,0 +1,141 @@
+/*
+    Implemented by Imran Irfan, and Evan Wong
+
+*/
+
+/*
+    Synthetic registration benchmark with known ground truth (see
+    SyntheticDataset.h for the layout).
+
+    gendataset SOURCE OUTPUT_DIRECTORY [options]
+*/
+#include "SyntheticDataset.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+static void PrintUsage(const char *programName)
+{
+    std::cerr << "Usage: " << programName << " Source, OutputDirectory [options]" << std::endl
+              << "Source is a slice such as bin/Fixed/000000.dcm, a volume file or a DICOM series directory." << std::endl
+              << "Writes OutputDirectory/Fixed, OutputDirectory/Moving and OutputDirectory/ground_truth.txt." << std::endl
+              << "Options:" << std::endl
+              << "  --count N              moving images (default 16)" << std::endl
+              << "  --size WxH[xD]         voxels of every image, covering the source's extent (default: the source's)" << std::endl
+              << "  --depth D              stack a 2D source into a volume of D slices, each turned --twist-deg further" << std::endl
+              << "                         (default 2) than the one below" << std::endl
+              << "  --max-shift-mm D       translations uniform in [-D, D] mm along each axis (default 10)" << std::endl
+              << "  --max-rotation-deg A   rigid motions: rotations uniform in [-A, A] degrees about each axis (default 0)" << std::endl
+              << "  --noise S              Gaussian noise of S grey levels on every image (default 0)" << std::endl
+              << "  --remap M              intensity mapping of the moving images: none (default), invert, gamma" << std::endl
+              << "                         (with --gamma G, default 0.5) or mr (mid grey brightest)" << std::endl
+              << "  --seed N               seed of the motions and the noise (default 1)" << std::endl;
+}
+
+//"256x256x64" as numbers; empty if malformed
+static std::vector<unsigned int> ParseSize(const std::string &text)
+{
+    std::vector<unsigned int> size;
+    std::istringstream fields(text);
+    std::string field;
+    while (std::getline(fields, field, 'x'))
+    {
+        const long value = atol(field.c_str());
+        if (value < 1)
+        {
+            return std::vector<unsigned int>();
+        }
+        size.push_back(static_cast<unsigned int>(value));
+    }
+    return size;
+}
+
+template <unsigned int VDimension>
+static bool Generate(itk::ImageIOBase::IOComponentType componentType, const DatasetOptions &options)
+{
+    //DICOM stores integers: 8-bit and unsigned 16-bit sources keep their type, the rest are written as short
+    switch (componentType)
+    {
+    case itk::ImageIOBase::UCHAR:
+        return GenerateDataset<unsigned char, VDimension>(options);
+    case itk::ImageIOBase::USHORT:
+        return GenerateDataset<unsigned short, VDimension>(options);
+    default:
+        return GenerateDataset<short, VDimension>(options);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    CommandLine commandLine(argc, argv, ITK_NULLPTR);
+    if (commandLine.GetNumberOfPositionals() < 2)
+    {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    DatasetOptions options;
+    options.sourceFile = commandLine.GetPositional(0);
+    options.outputDirectory = commandLine.GetPositional(1);
+    options.numberOfImages = static_cast<unsigned int>(std::max(1L, commandLine.GetInt("count", options.numberOfImages)));
+    options.depth = static_cast<unsigned int>(std::max(1L, commandLine.GetInt("depth", options.depth)));
+    options.twistDegrees = commandLine.GetDouble("twist-deg", options.twistDegrees);
+    options.maximumShiftMm = std::max(0.0, commandLine.GetDouble("max-shift-mm", options.maximumShiftMm));
+    options.maximumRotationDegrees = std::max(0.0, commandLine.GetDouble("max-rotation-deg", options.maximumRotationDegrees));
+    options.noiseSigma = std::max(0.0, commandLine.GetDouble("noise", options.noiseSigma));
+    options.gamma = commandLine.GetDouble("gamma", options.gamma);
+    options.seed = static_cast<unsigned int>(commandLine.GetInt("seed", options.seed));
+
+    const std::string remapName = commandLine.GetString("remap", "none");
+    if (!ParseIntensityRemapKind(remapName, options.remap))
+    {
+        std::cerr << "Unknown --remap " << remapName << " (expected none, invert, gamma or mr)" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (options.gamma <= 0.0)
+    {
+        std::cerr << "--gamma must be positive" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    itk::ImageIOBase::IOComponentType componentType;
+    if (!ReadImageHeader(options.sourceFile, componentType, options.sourceDimension))
+    {
+        std::cerr << "Cannot read the image header of " << options.sourceFile << std::endl;
+        return EXIT_FAILURE;
+    }
+    const unsigned int dimension = (options.sourceDimension == 3 || options.depth > 1) ? 3 : 2;
+    if (options.sourceDimension == 3 && options.depth > 1)
+    {
+        std::cerr << "--depth applies to 2D sources only" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (commandLine.Has("size"))
+    {
+        options.size = ParseSize(commandLine.GetString("size"));
+        if (options.size.size() != dimension)
+        {
+            std::cerr << "--size needs " << dimension << " positive numbers separated by x" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    bool written = false;
+    try
+    {
+        written = (dimension == 3) ? Generate<3>(componentType, options) : Generate<2>(componentType, options);
+    }
+    catch(itk::ExceptionObject &e)
+    {
+        std::cerr << "Exception generating the dataset " << std::endl << e << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!written)
+    {
+        std::cerr << "Cannot write the ground truth to " << options.outputDirectory << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,393 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkBinnedMattesMutualInformationImageToImageMetric_hxx
+#define itkBinnedMattesMutualInformationImageToImageMetric_hxx
+
+#include "itkBinnedMattesMutualInformationImageToImageMetric.h"
+#include "itkNumericTraits.h"
+
+#include <cmath>
+
+namespace itk
+{
+template< typename TFixedImage, typename TMovingImage >
+BinnedMattesMutualInformationImageToImageMetric< TFixedImage, TMovingImage >
+::BinnedMattesMutualInformationImageToImageMetric():
+  m_NumberOfHistogramBins(50),
+  m_FixedImageBinSize(0.0),
+  m_FixedImageNormalizedMin(0.0),
+  m_MovingImageBinSize(0.0),
+  m_MovingImageNormalizedMin(0.0),
+  m_MovingTableOrigin(0.0),
+  m_MovingTableScale(1.0)
+{
+  this->SetComputeGradient(true);
+}
+
+template< typename TFixedImage, typename TMovingImage >
+double
+BinnedMattesMutualInformationImageToImageMetric< TFixedImage, TMovingImage >
+::CubicBSpline(double x)
+{
+  const double absX = std::fabs(x);
+  if ( absX < 1.0 )
+    {
+    return ( 4.0 - 6.0 * absX * absX + 3.0 * absX * absX * absX ) / 6.0;
+    }
+  if ( absX < 2.0 )
+    {
+    const double t = 2.0 - absX;
+    return t * t * t / 6.0;
+    }
+  return 0.0;
+}
+
+template< typename TFixedImage, typename TMovingImage >
+double
+BinnedMattesMutualInformationImageToImageMetric< TFixedImage, TMovingImage >
+::CubicBSplineDerivative(double x)
+{
+  const double absX = std::fabs(x);
+  if ( absX < 1.0 )
+    {
+    return -2.0 * x + 1.5 * x * absX;
+    }
+  if ( absX < 2.0 )
+    {
+    const double t = 2.0 - absX;
+    return ( x > 0.0 ? -0.5 : 0.5 ) * t * t;
+    }
+  return 0.0;
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+BinnedMattesMutualInformationImageToImageMetric< TFixedImage, TMovingImage >
+::InitializeSamples()
+{
+  this->InitializeFixedImageBins();
+  this->InitializeMovingImageTable();
+
+  const SizeValueType bins = m_NumberOfHistogramBins;
+  m_JointPDF.assign(bins * bins, 0.0);
+  m_FixedMarginalPDF.assign(bins, 0.0);
+  m_MovingMarginalPDF.assign(bins, 0.0);
+  m_PRatio.assign(bins * bins, 0.0);
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+BinnedMattesMutualInformationImageToImageMetric< TFixedImage, TMovingImage >
+::InitializeFixedImageBins()
+{
+  double fixedMin;
+  double fixedMax;
+  this->GetFixedImageIntensityRange(fixedMin, fixedMax);
+  if ( fixedMax <= fixedMin )
+    {
+    fixedMax = fixedMin + 1.0;
+    }
+
+  const int bins = static_cast< int >( m_NumberOfHistogramBins );
+  const int padding = Padding;
+  m_FixedImageBinSize = ( fixedMax - fixedMin ) / static_cast< double >( bins - 2 * padding );
+  m_FixedImageNormalizedMin = fixedMin / m_FixedImageBinSize - static_cast< double >( padding );
+
+  // Only the samples are binned; the rest of the fixed image is never read
+  const SizeValueType numberOfSamples = this->GetNumberOfSamples();
+  m_SampleFixedBins.resize(numberOfSamples);
+  for ( SizeValueType i = 0; i < numberOfSamples; ++i )
+    {
+    const double windowTerm = this->m_SampleFixedValues[i] / m_FixedImageBinSize - m_FixedImageNormalizedMin;
+    int bin = static_cast< int >( windowTerm );
+    bin = std::max(bin, padding);
+    bin = std::min(bin, bins - padding - 1);
+    m_SampleFixedBins[i] = static_cast< BinIndexType >( bin );
+    }
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+BinnedMattesMutualInformationImageToImageMetric< TFixedImage, TMovingImage >
+::InitializeMovingImageTable()
+{
+  double movingMin;
+  double movingMax;
+  this->GetMovingImageIntensityRange(movingMin, movingMax);
+  if ( movingMax <= movingMin )
+    {
+    movingMax = movingMin + 1.0;
+    }
+
+  const int bins = static_cast< int >( m_NumberOfHistogramBins );
+  const int padding = Padding;
+  m_MovingImageBinSize = ( movingMax - movingMin ) / static_cast< double >( bins - 2 * padding );
+  m_MovingImageNormalizedMin = movingMin / m_MovingImageBinSize - static_cast< double >( padding );
+
+  // One grey level per entry covers an integer source range exactly; narrow
+  // bins get a finer step so the quantisation stays under 1/32 of a bin.
+  const double step = std::min(1.0, m_MovingImageBinSize / 32.0);
+  m_MovingTableOrigin = movingMin;
+  m_MovingTableScale = 1.0 / step;
+
+  const SizeValueType tableSize = static_cast< SizeValueType >( ( movingMax - movingMin ) * m_MovingTableScale ) + 2;
+  m_MovingImageTable.resize(tableSize);
+  for ( SizeValueType q = 0; q < tableSize; ++q )
+    {
+    const double value = std::min(movingMin + static_cast< double >( q ) * step, movingMax);
+    const double movingTerm = value / m_MovingImageBinSize - m_MovingImageNormalizedMin;
+    int bin = static_cast< int >( movingTerm );
+    bin = std::max(bin, padding);
+    bin = std::min(bin, bins - padding - 1);
+
+    MovingTableEntry & entry = m_MovingImageTable[q];
+    entry.firstBin = static_cast< unsigned int >( bin - 1 );
+    const double argument = static_cast< double >( bin - 1 ) - movingTerm;
+    for ( unsigned int k = 0; k < 4; ++k )
+      {
+      entry.weights[k] = static_cast< float >( CubicBSpline(argument + k) );
+      entry.derivativeWeights[k] = static_cast< float >( CubicBSplineDerivative(argument + k) );
+      }
+    }
+}
+
+template< typename TFixedImage, typename TMovingImage >
+SizeValueType
+BinnedMattesMutualInformationImageToImageMetric< TFixedImage, TMovingImage >
+::AccumulateJointPDF(bool withDerivatives) const
+{
+  const SizeValueType bins = m_NumberOfHistogramBins;
+  const SizeValueType histogramSize = bins * bins;
+  const SizeValueType numberOfSamples = this->GetNumberOfSamples();
+  const unsigned int  numberOfParameters = this->GetNumberOfParameters();
+  const unsigned int  numberOfPartials = this->GetNumberOfPartials();
+
+  m_PartialJointPDFs.assign(numberOfPartials * histogramSize, 0.0);
+  m_PartialCounts.assign(numberOfPartials, 0);
+  if ( withDerivatives )
+    {
+    m_SampleTableIndices.resize(numberOfSamples);
+    m_SampleGradientProjections.resize(numberOfSamples * numberOfParameters);
+    }
+
+  this->ParallelForBlocks([&](SizeValueType begin, SizeValueType end, unsigned int partial)
+    {
+    double *jointPDF = &m_PartialJointPDFs[partial * histogramSize];
+    SizeValueType counted = 0;
+    TransformJacobianType jacobian;
+    MovingImagePointType  mappedPoint;
+    double                movingValue;
+
+    for ( SizeValueType i = begin; i < end; ++i )
+      {
+      if ( !this->MapSample(i, mappedPoint, movingValue) )
+        {
+        if ( withDerivatives )
+          {
+          m_SampleTableIndices[i] = -1;
+          }
+        continue;
+        }
+
+      const unsigned int tableIndex = this->MovingTableIndex(movingValue);
+      const MovingTableEntry & entry = m_MovingImageTable[tableIndex];
+      double *row = jointPDF + m_SampleFixedBins[i] * bins + entry.firstBin;
+      row[0] += entry.weights[0];
+      row[1] += entry.weights[1];
+      row[2] += entry.weights[2];
+      row[3] += entry.weights[3];
+      ++counted;
+
+      if ( withDerivatives )
+        {
+        m_SampleTableIndices[i] = static_cast< int >( tableIndex );
+        this->ComputeGradientProjection(i, mappedPoint, jacobian, &m_SampleGradientProjections[i * numberOfParameters]);
+        }
+      }
+    m_PartialCounts[partial] += counted;
+    });
+
+  // Partials are added in index order; with a deterministic reduction that
+  // is block order, whatever the number of threads.
+  SizeValueType counted = 0;
+  std::copy(m_PartialJointPDFs.begin(), m_PartialJointPDFs.begin() + histogramSize, m_JointPDF.begin());
+  counted += m_PartialCounts[0];
+  for ( unsigned int partial = 1; partial < numberOfPartials; ++partial )
+    {
+    const double *partialPDF = &m_PartialJointPDFs[partial * histogramSize];
+    for ( SizeValueType j = 0; j < histogramSize; ++j )
+      {
+      m_JointPDF[j] += partialPDF[j];
+      }
+    counted += m_PartialCounts[partial];
+    }
+
+  if ( counted < numberOfSamples / 16 )
+    {
+    itkExceptionMacro(<< "Too many samples map outside moving image buffer: "
+                      << counted << " / " << numberOfSamples << std::endl);
+    }
+  this->m_NumberOfPixelsCounted = counted;
+  return counted;
+}
+
+template< typename TFixedImage, typename TMovingImage >
+typename BinnedMattesMutualInformationImageToImageMetric< TFixedImage, TMovingImage >::MeasureType
+BinnedMattesMutualInformationImageToImageMetric< TFixedImage, TMovingImage >
+::ComputeMutualInformation(SizeValueType numberOfSamplesCounted, bool withRatios) const
+{
+  const SizeValueType bins = m_NumberOfHistogramBins;
+  const double        closeToZero = 1.0e-16;
+
+  // Each counted sample adds a total weight of one (up to the float rounding
+  // of the table weights), so normalise by the actual sum.
+  double jointPDFSum = 0.0;
+  for ( SizeValueType j = 0; j < bins * bins; ++j )
+    {
+    jointPDFSum += m_JointPDF[j];
+    }
+  if ( jointPDFSum <= 0.0 || numberOfSamplesCounted == 0 )
+    {
+    itkExceptionMacro(<< "Joint PDF summed to zero");
+    }
+  const double normalization = 1.0 / jointPDFSum;
+
+  std::fill(m_FixedMarginalPDF.begin(), m_FixedMarginalPDF.end(), 0.0);
+  std::fill(m_MovingMarginalPDF.begin(), m_MovingMarginalPDF.end(), 0.0);
+  for ( SizeValueType f = 0; f < bins; ++f )
+    {
+    double *row = &m_JointPDF[f * bins];
+    for ( SizeValueType m = 0; m < bins; ++m )
+      {
+      row[m] *= normalization;
+      m_FixedMarginalPDF[f] += row[m];
+      m_MovingMarginalPDF[m] += row[m];
+      }
+    }
+
+  double sum = 0.0;
+  for ( SizeValueType f = 0; f < bins; ++f )
+    {
+    const double fixedPDF = m_FixedMarginalPDF[f];
+    const double *row = &m_JointPDF[f * bins];
+    double *ratioRow = withRatios ? &m_PRatio[f * bins] : ITK_NULLPTR;
+    for ( SizeValueType m = 0; m < bins; ++m )
+      {
+      const double jointPDF = row[m];
+      const double movingPDF = m_MovingMarginalPDF[m];
+      double ratio = 0.0;
+      if ( jointPDF > closeToZero && movingPDF > closeToZero )
+        {
+        ratio = std::log(jointPDF / movingPDF);
+        if ( fixedPDF > closeToZero )
+          {
+          sum += jointPDF * ( ratio - std::log(fixedPDF) );
+          }
+        }
+      if ( withRatios )
+        {
+        ratioRow[m] = ratio;
+        }
+      }
+    }
+
+  return static_cast< MeasureType >( -sum );
+}
+
+template< typename TFixedImage, typename TMovingImage >
+typename BinnedMattesMutualInformationImageToImageMetric< TFixedImage, TMovingImage >::MeasureType
+BinnedMattesMutualInformationImageToImageMetric< TFixedImage, TMovingImage >
+::ComputeValue() const
+{
+  const SizeValueType counted = this->AccumulateJointPDF(false);
+  return this->ComputeMutualInformation(counted, false);
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+BinnedMattesMutualInformationImageToImageMetric< TFixedImage, TMovingImage >
+::ComputeValueAndDerivative(MeasureType & value, DerivativeType & derivative) const
+{
+  const SizeValueType counted = this->AccumulateJointPDF(true);
+  value = this->ComputeMutualInformation(counted, true);
+
+  const SizeValueType bins = m_NumberOfHistogramBins;
+  const unsigned int  numberOfParameters = this->GetNumberOfParameters();
+  const unsigned int  numberOfPartials = this->GetNumberOfPartials();
+
+  m_PartialDerivatives.assign(numberOfPartials * numberOfParameters, 0.0);
+
+  // d(-MI)/dp = 1 / (N * movingBinSize) * sum_i (dI/dp)_i * sum_k B3'(arg_k) * log(p(f_i, m_k) / p(m_k))
+  this->ParallelForBlocks([&](SizeValueType begin, SizeValueType end, unsigned int partial)
+    {
+    double *partialDerivative = &m_PartialDerivatives[partial * numberOfParameters];
+    for ( SizeValueType i = begin; i < end; ++i )
+      {
+      const int tableIndex = m_SampleTableIndices[i];
+      if ( tableIndex < 0 )
+        {
+        continue;
+        }
+      const MovingTableEntry & entry = m_MovingImageTable[tableIndex];
+      const double *ratio = &m_PRatio[m_SampleFixedBins[i] * bins + entry.firstBin];
+      const double  weight = entry.derivativeWeights[0] * ratio[0] + entry.derivativeWeights[1] * ratio[1]
+                             + entry.derivativeWeights[2] * ratio[2] + entry.derivativeWeights[3] * ratio[3];
+      if ( weight == 0.0 )
+        {
+        continue;
+        }
+      const double *projection = &m_SampleGradientProjections[i * numberOfParameters];
+      for ( unsigned int p = 0; p < numberOfParameters; ++p )
+        {
+        partialDerivative[p] += weight * projection[p];
+        }
+      }
+    });
+
+  const double scale = 1.0 / ( static_cast< double >( counted ) * m_MovingImageBinSize );
+  derivative = DerivativeType(numberOfParameters);
+  derivative.Fill(NumericTraits< typename DerivativeType::ValueType >::ZeroValue());
+  for ( unsigned int partial = 0; partial < numberOfPartials; ++partial )
+    {
+    for ( unsigned int p = 0; p < numberOfParameters; ++p )
+      {
+      derivative[p] += m_PartialDerivatives[partial * numberOfParameters + p];
+      }
+    }
+  for ( unsigned int p = 0; p < numberOfParameters; ++p )
+    {
+    derivative[p] *= scale;
+    }
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+BinnedMattesMutualInformationImageToImageMetric< TFixedImage, TMovingImage >
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "NumberOfHistogramBins: " << m_NumberOfHistogramBins << std::endl;
+  os << indent << "FixedImageBinSize: " << m_FixedImageBinSize << std::endl;
+  os << indent << "FixedImageNormalizedMin: " << m_FixedImageNormalizedMin << std::endl;
+  os << indent << "MovingImageBinSize: " << m_MovingImageBinSize << std::endl;
+  os << indent << "MovingImageNormalizedMin: " << m_MovingImageNormalizedMin << std::endl;
+  os << indent << "MovingImageTableSize: " << m_MovingImageTable.size() << std::endl;
+}
+} // end namespace itk
+
+#endif
@@ -0,0 +1,173 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkPooledImportImageContainer_h
+#define itkPooledImportImageContainer_h
+
+#include "itkImportImageContainer.h"
+#include "itkObjectFactoryBase.h"
+#include "itkCovariantVector.h"
+#include "itkVersion.h"
+#include "ImageBufferPool.h"
+
+#include <algorithm>
+#include <typeinfo>
+
+namespace itk
+{
+/** \class PooledImportImageContainer
+ * \brief ImportImageContainer whose managed memory comes from ImageBufferPool.
+ *
+ * Drop-in replacement for the pixel container of an Image: buffers the
+ * container allocates are taken from and given back to the process-wide
+ * ImageBufferPool instead of new[] / delete[]. Imported buffers (not
+ * allocated by the pool) keep the usual ownership rules.
+ *
+ * Meant for pixel types without destructors, which covers every image of
+ * the registration pipeline.
+ */
+template< typename TElementIdentifier, typename TElement >
+class PooledImportImageContainer:
+  public ImportImageContainer< TElementIdentifier, TElement >
+{
+public:
+  /** Standard class typedefs. */
+  typedef PooledImportImageContainer                           Self;
+  typedef ImportImageContainer< TElementIdentifier, TElement > Superclass;
+  typedef SmartPointer< Self >                                 Pointer;
+  typedef SmartPointer< const Self >                           ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(PooledImportImageContainer, ImportImageContainer);
+
+  typedef typename Superclass::ElementIdentifier ElementIdentifier;
+  typedef typename Superclass::Element           Element;
+
+protected:
+  PooledImportImageContainer() {}
+
+  // The superclass destructor would only see its own DeallocateManagedMemory
+  virtual ~PooledImportImageContainer() ITK_OVERRIDE
+  {
+    this->DeallocateManagedMemory();
+  }
+
+  virtual TElement * AllocateElements(ElementIdentifier size, bool UseDefaultConstructor = false) const ITK_OVERRIDE
+  {
+    TElement *data;
+    try
+      {
+      data = static_cast< TElement * >( ImageBufferPool::GetInstance().Acquire( sizeof( TElement ) * size ) );
+      }
+    catch ( ... )
+      {
+      data = ITK_NULLPTR;
+      }
+    if ( !data )
+      {
+      throw MemoryAllocationError(__FILE__, __LINE__, "Failed to allocate memory for image.", ITK_LOCATION);
+      }
+    if ( UseDefaultConstructor )
+      {
+      std::fill( data, data + size, TElement() );
+      }
+    return data;
+  }
+
+  virtual void DeallocateManagedMemory() ITK_OVERRIDE
+  {
+    TElement *buffer = this->GetImportPointer();
+    if ( buffer != ITK_NULLPTR && this->GetContainerManageMemory()
+         && ImageBufferPool::GetInstance().Release(buffer) )
+      {
+      // Back in the pool; keep the superclass from deleting it
+      this->SetContainerManageMemory(false);
+      }
+    Superclass::DeallocateManagedMemory();
+  }
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(PooledImportImageContainer);
+};
+
+/** \class PooledImageContainerFactory
+ * \brief Object factory that makes Image allocate through ImageBufferPool.
+ *
+ * Overrides ImportImageContainer< SizeValueType, T >, the pixel container of
+ * every Image< T, N >, with PooledImportImageContainer for the pixel types
+ * the registration pipeline uses: the decoded slices, the float casts and
+ * pyramids, the metric's gradient and bin-index images and the outputs.
+ */
+class PooledImageContainerFactory:public ObjectFactoryBase
+{
+public:
+  /** Standard class typedefs. */
+  typedef PooledImageContainerFactory Self;
+  typedef ObjectFactoryBase           Superclass;
+  typedef SmartPointer< Self >        Pointer;
+  typedef SmartPointer< const Self >  ConstPointer;
+
+  /** Class methods used to interface with the registered factories. */
+  virtual const char * GetITKSourceVersion() const ITK_OVERRIDE { return ITK_SOURCE_VERSION; }
+  virtual const char * GetDescription() const ITK_OVERRIDE { return "Image pixel containers backed by ImageBufferPool"; }
+
+  /** Method for class instantiation. */
+  itkFactorylessNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(PooledImageContainerFactory, ObjectFactoryBase);
+
+  /** Register one factory of this type. */
+  static void RegisterOneFactory()
+  {
+    PooledImageContainerFactory::Pointer factory = PooledImageContainerFactory::New();
+    ObjectFactoryBase::RegisterFactory(factory);
+  }
+
+protected:
+  PooledImageContainerFactory()
+  {
+    this->RegisterContainer< unsigned char >();
+    this->RegisterContainer< short >();
+    this->RegisterContainer< unsigned short >();
+    this->RegisterContainer< float >();
+    this->RegisterContainer< double >();
+    this->RegisterContainer< CovariantVector< double, 2 > >();
+    this->RegisterContainer< CovariantVector< double, 3 > >();
+  }
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(PooledImageContainerFactory);
+
+  template< typename TElement >
+  void RegisterContainer()
+  {
+    typedef ImportImageContainer< SizeValueType, TElement >       ContainerType;
+    typedef PooledImportImageContainer< SizeValueType, TElement > PooledContainerType;
+    this->RegisterOverride( typeid( ContainerType ).name(),
+                            typeid( PooledContainerType ).name(),
+                            "Pixel container backed by ImageBufferPool",
+                            true,
+                            CreateObjectFunction< PooledContainerType >::New() );
+  }
+};
+} // end namespace itk
+
+#endif
@@ -0,0 +1,87 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkPrecomputedPyramidImageFilter_h
+#define itkPrecomputedPyramidImageFilter_h
+
+#include "itkMultiResolutionPyramidImageFilter.h"
+
+#include <vector>
+
+namespace itk
+{
+/** \class PrecomputedPyramidImageFilter
+ * \brief Multi-resolution pyramid whose levels were computed beforehand.
+ *
+ * Stands in for MultiResolutionPyramidImageFilter in a registration method
+ * when the same image takes part in several registrations. The levels are
+ * built once by an ordinary pyramid and handed over with SetLevels; each
+ * update then grafts them onto this filter's outputs instead of smoothing
+ * and shrinking the input again. The levels are shared and must not be
+ * modified while any filter uses them.
+ *
+ * The input must be the image the levels were computed from and the schedule
+ * the registration sets must match the one given with the levels; the filter
+ * throws otherwise.
+ */
+template< typename TInputImage, typename TOutputImage >
+class PrecomputedPyramidImageFilter:
+  public MultiResolutionPyramidImageFilter< TInputImage, TOutputImage >
+{
+public:
+  /** Standard class typedefs. */
+  typedef PrecomputedPyramidImageFilter                                  Self;
+  typedef MultiResolutionPyramidImageFilter< TInputImage, TOutputImage > Superclass;
+  typedef SmartPointer< Self >                                           Pointer;
+  typedef SmartPointer< const Self >                                     ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(PrecomputedPyramidImageFilter, MultiResolutionPyramidImageFilter);
+
+  typedef typename Superclass::ScheduleType        ScheduleType;
+  typedef typename Superclass::OutputImageType     OutputImageType;
+  typedef typename Superclass::OutputImagePointer  OutputImagePointer;
+  typedef std::vector< OutputImagePointer >        LevelContainerType;
+
+  /** Levels from coarsest to finest and the schedule they were computed with. */
+  void SetLevels(const LevelContainerType & levels, const ScheduleType & schedule);
+  const LevelContainerType & GetLevels() const { return m_Levels; }
+
+protected:
+  PrecomputedPyramidImageFilter() {}
+  virtual ~PrecomputedPyramidImageFilter() ITK_OVERRIDE {}
+  void PrintSelf(std::ostream & os, Indent indent) const ITK_OVERRIDE;
+
+  /** Grafts the precomputed levels onto the outputs. */
+  virtual void GenerateData() ITK_OVERRIDE;
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(PrecomputedPyramidImageFilter);
+
+  LevelContainerType m_Levels;
+  ScheduleType       m_LevelSchedule;
+};
+} // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkPrecomputedPyramidImageFilter.hxx"
+#endif
+
+#endif
@@ -0,0 +1,63 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkPrecomputedPyramidImageFilter_hxx
+#define itkPrecomputedPyramidImageFilter_hxx
+
+#include "itkPrecomputedPyramidImageFilter.h"
+
+namespace itk
+{
+template< typename TInputImage, typename TOutputImage >
+void
+PrecomputedPyramidImageFilter< TInputImage, TOutputImage >
+::SetLevels(const LevelContainerType & levels, const ScheduleType & schedule)
+{
+  m_Levels = levels;
+  m_LevelSchedule = schedule;
+  this->Modified();
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+PrecomputedPyramidImageFilter< TInputImage, TOutputImage >
+::GenerateData()
+{
+  if ( m_Levels.size() != this->GetNumberOfLevels() || m_LevelSchedule != this->GetSchedule() )
+    {
+    itkExceptionMacro(<< "The precomputed levels were built with schedule " << m_LevelSchedule
+                      << " but the pyramid is asked for " << this->GetSchedule());
+    }
+
+  for ( unsigned int level = 0; level < m_Levels.size(); ++level )
+    {
+    this->GraftNthOutput( level, m_Levels[level] );
+    }
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+PrecomputedPyramidImageFilter< TInputImage, TOutputImage >
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "Levels: " << m_Levels.size() << std::endl;
+  os << indent << "LevelSchedule: " << std::endl << m_LevelSchedule << std::endl;
+}
+} // end namespace itk
+
+#endif
@@ -0,0 +1,155 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkRegistrationOutputImageFilter_h
+#define itkRegistrationOutputImageFilter_h
+
+#include "itkImageToImageFilter.h"
+#include "itkInterpolateImageFunction.h"
+#include "itkLinearInterpolateImageFunction.h"
+#include "itkTransform.h"
+#include "itkFixedArray.h"
+
+namespace itk
+{
+/** \class RegistrationOutputImageFilter
+ * \brief Produces every registration output from a single walk over the fixed grid.
+ *
+ * For each fixed-image pixel the moving image is sampled once through the
+ * final transform and once through the identity. The two samples fill four
+ * outputs that all share the fixed image's geometry:
+ *
+ *  - RegisteredOutput: moving image resampled through the transform,
+ *    DefaultPixelValue outside the moving image.
+ *  - IdentityOutput: moving image resampled through the identity, 0 outside.
+ *  - CheckerboardBeforeOutput: checkerboard of the fixed image and IdentityOutput.
+ *  - CheckerboardAfterOutput: checkerboard of the fixed image and the
+ *    transformed moving image, 0 outside.
+ *
+ * This stands in for running ResampleImageFilter three times and
+ * CheckerBoardImageFilter twice. The checkerboard layout matches
+ * CheckerBoardImageFilter. All outputs are produced for whatever region is
+ * requested, so the filter can be streamed one slab at a time.
+ */
+template< typename TImage, typename TInterpolatorPrecisionType = double >
+class RegistrationOutputImageFilter:
+  public ImageToImageFilter< TImage, TImage >
+{
+public:
+  /** Standard class typedefs. */
+  typedef RegistrationOutputImageFilter          Self;
+  typedef ImageToImageFilter< TImage, TImage >   Superclass;
+  typedef SmartPointer< Self >                   Pointer;
+  typedef SmartPointer< const Self >             ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(RegistrationOutputImageFilter, ImageToImageFilter);
+
+  itkStaticConstMacro(ImageDimension, unsigned int, TImage::ImageDimension);
+
+  typedef TImage                          ImageType;
+  typedef typename ImageType::PixelType   PixelType;
+  typedef typename ImageType::RegionType  RegionType;
+  typedef typename ImageType::IndexType   IndexType;
+  typedef typename ImageType::PointType   PointType;
+
+  typedef Transform< TInterpolatorPrecisionType,
+                     itkGetStaticConstMacro(ImageDimension),
+                     itkGetStaticConstMacro(ImageDimension) >   TransformType;
+  typedef InterpolateImageFunction< ImageType, TInterpolatorPrecisionType >       InterpolatorType;
+  typedef LinearInterpolateImageFunction< ImageType, TInterpolatorPrecisionType > DefaultInterpolatorType;
+
+  typedef FixedArray< unsigned int, itkGetStaticConstMacro(ImageDimension) > PatternArrayType;
+
+  /** Output indices. */
+  enum OutputIdentifier
+    {
+    RegisteredOutput = 0,
+    IdentityOutput = 1,
+    CheckerboardBeforeOutput = 2,
+    CheckerboardAfterOutput = 3
+    };
+  itkStaticConstMacro(NumberOfOutputImages, unsigned int, 4);
+
+  /** Fixed image: defines the output grid and the first checkerboard input. */
+  void SetFixedImage(const ImageType *image);
+  const ImageType * GetFixedImage() const;
+
+  /** Moving image: resampled onto the fixed grid. */
+  void SetMovingImage(const ImageType *image);
+  const ImageType * GetMovingImage() const;
+
+  /** Transform mapping fixed-space points into the moving image. */
+  itkSetConstObjectMacro(Transform, TransformType);
+  itkGetConstObjectMacro(Transform, TransformType);
+
+  /** Interpolator used for both samples. Defaults to linear. */
+  itkSetObjectMacro(Interpolator, InterpolatorType);
+  itkGetModifiableObjectMacro(Interpolator, InterpolatorType);
+
+  /** Value of RegisteredOutput where the moving image has no data. */
+  itkSetMacro(DefaultPixelValue, PixelType);
+  itkGetConstReferenceMacro(DefaultPixelValue, PixelType);
+
+  /** Number of checkerboard squares along each dimension. Defaults to 4. */
+  itkSetMacro(CheckerPattern, PatternArrayType);
+  itkGetConstReferenceMacro(CheckerPattern, PatternArrayType);
+
+  ImageType * GetRegisteredOutput() { return this->GetOutput(RegisteredOutput); }
+  ImageType * GetIdentityOutput() { return this->GetOutput(IdentityOutput); }
+  ImageType * GetCheckerboardBeforeOutput() { return this->GetOutput(CheckerboardBeforeOutput); }
+  ImageType * GetCheckerboardAfterOutput() { return this->GetOutput(CheckerboardAfterOutput); }
+
+  /** Includes the transform and interpolator modification times. */
+  virtual ModifiedTimeType GetMTime() const ITK_OVERRIDE;
+
+protected:
+  RegistrationOutputImageFilter();
+  ~RegistrationOutputImageFilter() ITK_OVERRIDE {}
+  void PrintSelf(std::ostream & os, Indent indent) const ITK_OVERRIDE;
+
+  /** The moving image is needed in full; the fixed image only where output is requested. */
+  virtual void GenerateInputRequestedRegion() ITK_OVERRIDE;
+
+  /** Fixed and moving images do not have to occupy the same physical space. */
+  virtual void VerifyInputInformation() ITK_OVERRIDE {}
+
+  virtual void BeforeThreadedGenerateData() ITK_OVERRIDE;
+
+  virtual void ThreadedGenerateData(const RegionType & outputRegionForThread,
+                                    ThreadIdType threadId) ITK_OVERRIDE;
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(RegistrationOutputImageFilter);
+
+  static PixelType CastWithClamp(double value);
+
+  typename TransformType::ConstPointer  m_Transform;
+  typename InterpolatorType::Pointer    m_Interpolator;
+  PixelType                             m_DefaultPixelValue;
+  PatternArrayType                      m_CheckerPattern;
+};
+} // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkRegistrationOutputImageFilter.hxx"
+#endif
+
+#endif
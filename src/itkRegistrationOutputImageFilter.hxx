@@ -0,0 +1,243 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkRegistrationOutputImageFilter_hxx
+#define itkRegistrationOutputImageFilter_hxx
+
+#include "itkRegistrationOutputImageFilter.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
+#include "itkImageRegionIterator.h"
+#include "itkContinuousIndex.h"
+#include "itkProgressReporter.h"
+#include "itkNumericTraits.h"
+
+#include <algorithm>
+
+namespace itk
+{
+template< typename TImage, typename TInterpolatorPrecisionType >
+RegistrationOutputImageFilter< TImage, TInterpolatorPrecisionType >
+::RegistrationOutputImageFilter():
+  m_DefaultPixelValue(NumericTraits< PixelType >::ZeroValue())
+{
+  this->SetNumberOfRequiredInputs(2);
+  this->SetNumberOfRequiredOutputs(NumberOfOutputImages);
+  for ( unsigned int i = 1; i < NumberOfOutputImages; ++i )
+    {
+    this->SetNthOutput( i, this->MakeOutput(i) );
+    }
+
+  m_Interpolator = DefaultInterpolatorType::New();
+  m_CheckerPattern.Fill(4);
+}
+
+template< typename TImage, typename TInterpolatorPrecisionType >
+void
+RegistrationOutputImageFilter< TImage, TInterpolatorPrecisionType >
+::SetFixedImage(const ImageType *image)
+{
+  this->SetNthInput( 0, const_cast< ImageType * >( image ) );
+}
+
+template< typename TImage, typename TInterpolatorPrecisionType >
+const typename RegistrationOutputImageFilter< TImage, TInterpolatorPrecisionType >::ImageType *
+RegistrationOutputImageFilter< TImage, TInterpolatorPrecisionType >
+::GetFixedImage() const
+{
+  return static_cast< const ImageType * >( this->ProcessObject::GetInput(0) );
+}
+
+template< typename TImage, typename TInterpolatorPrecisionType >
+void
+RegistrationOutputImageFilter< TImage, TInterpolatorPrecisionType >
+::SetMovingImage(const ImageType *image)
+{
+  this->SetNthInput( 1, const_cast< ImageType * >( image ) );
+}
+
+template< typename TImage, typename TInterpolatorPrecisionType >
+const typename RegistrationOutputImageFilter< TImage, TInterpolatorPrecisionType >::ImageType *
+RegistrationOutputImageFilter< TImage, TInterpolatorPrecisionType >
+::GetMovingImage() const
+{
+  return static_cast< const ImageType * >( this->ProcessObject::GetInput(1) );
+}
+
+template< typename TImage, typename TInterpolatorPrecisionType >
+ModifiedTimeType
+RegistrationOutputImageFilter< TImage, TInterpolatorPrecisionType >
+::GetMTime() const
+{
+  ModifiedTimeType latestTime = Object::GetMTime();
+
+  if ( m_Transform.IsNotNull() && latestTime < m_Transform->GetMTime() )
+    {
+    latestTime = m_Transform->GetMTime();
+    }
+  if ( m_Interpolator.IsNotNull() && latestTime < m_Interpolator->GetMTime() )
+    {
+    latestTime = m_Interpolator->GetMTime();
+    }
+  return latestTime;
+}
+
+template< typename TImage, typename TInterpolatorPrecisionType >
+void
+RegistrationOutputImageFilter< TImage, TInterpolatorPrecisionType >
+::GenerateInputRequestedRegion()
+{
+  ImageType *fixedImage = const_cast< ImageType * >( this->GetFixedImage() );
+  ImageType *movingImage = const_cast< ImageType * >( this->GetMovingImage() );
+
+  if ( !fixedImage || !movingImage )
+    {
+    return;
+    }
+
+  // Any point of the moving image may be mapped onto the requested region.
+  movingImage->SetRequestedRegionToLargestPossibleRegion();
+  fixedImage->SetRequestedRegion( this->GetOutput()->GetRequestedRegion() );
+}
+
+template< typename TImage, typename TInterpolatorPrecisionType >
+void
+RegistrationOutputImageFilter< TImage, TInterpolatorPrecisionType >
+::BeforeThreadedGenerateData()
+{
+  if ( m_Transform.IsNull() )
+    {
+    itkExceptionMacro(<< "Transform not set");
+    }
+  if ( m_Interpolator.IsNull() )
+    {
+    itkExceptionMacro(<< "Interpolator not set");
+    }
+
+  m_Interpolator->SetInputImage( this->GetMovingImage() );
+}
+
+template< typename TImage, typename TInterpolatorPrecisionType >
+typename RegistrationOutputImageFilter< TImage, TInterpolatorPrecisionType >::PixelType
+RegistrationOutputImageFilter< TImage, TInterpolatorPrecisionType >
+::CastWithClamp(double value)
+{
+  // Same saturation ResampleImageFilter applies before casting.
+  const double minimum = static_cast< double >( NumericTraits< PixelType >::NonpositiveMin() );
+  const double maximum = static_cast< double >( NumericTraits< PixelType >::max() );
+
+  if ( value < minimum )
+    {
+    return NumericTraits< PixelType >::NonpositiveMin();
+    }
+  if ( value > maximum )
+    {
+    return NumericTraits< PixelType >::max();
+    }
+  return static_cast< PixelType >( value );
+}
+
+template< typename TImage, typename TInterpolatorPrecisionType >
+void
+RegistrationOutputImageFilter< TImage, TInterpolatorPrecisionType >
+::ThreadedGenerateData(const RegionType & outputRegionForThread,
+                       ThreadIdType threadId)
+{
+  typedef ContinuousIndex< TInterpolatorPrecisionType, ImageDimension > ContinuousIndexType;
+
+  const ImageType *fixedImage = this->GetFixedImage();
+  const ImageType *movingImage = this->GetMovingImage();
+
+  ImageRegionConstIteratorWithIndex< ImageType > fixedIt(fixedImage, outputRegionForThread);
+  ImageRegionIterator< ImageType > registeredIt(this->GetOutput(RegisteredOutput), outputRegionForThread);
+  ImageRegionIterator< ImageType > identityIt(this->GetOutput(IdentityOutput), outputRegionForThread);
+  ImageRegionIterator< ImageType > beforeIt(this->GetOutput(CheckerboardBeforeOutput), outputRegionForThread);
+  ImageRegionIterator< ImageType > afterIt(this->GetOutput(CheckerboardAfterOutput), outputRegionForThread);
+
+  // Square size of the checkerboard, laid out over the whole fixed image so
+  // that streamed slabs agree with each other.
+  const RegionType largestRegion = fixedImage->GetLargestPossibleRegion();
+  IndexValueType squareSize[ImageDimension];
+  for ( unsigned int d = 0; d < ImageDimension; ++d )
+    {
+    const IndexValueType pattern = std::max< IndexValueType >(m_CheckerPattern[d], 1);
+    squareSize[d] = std::max< IndexValueType >(largestRegion.GetSize(d) / pattern, 1);
+    }
+
+  const PixelType zero = NumericTraits< PixelType >::ZeroValue();
+
+  ProgressReporter progress( this, threadId, outputRegionForThread.GetNumberOfPixels() );
+
+  PointType           fixedPoint;
+  ContinuousIndexType movingIndex;
+
+  for ( fixedIt.GoToBegin(); !fixedIt.IsAtEnd(); ++fixedIt, ++registeredIt, ++identityIt, ++beforeIt, ++afterIt )
+    {
+    const IndexType index = fixedIt.GetIndex();
+    fixedImage->TransformIndexToPhysicalPoint(index, fixedPoint);
+
+    // Sample through the identity.
+    PixelType identityValue = zero;
+    movingImage->TransformPhysicalPointToContinuousIndex(fixedPoint, movingIndex);
+    if ( m_Interpolator->IsInsideBuffer(movingIndex) )
+      {
+      identityValue = CastWithClamp( m_Interpolator->EvaluateAtContinuousIndex(movingIndex) );
+      }
+
+    // Sample through the final transform.
+    bool      mappedInside = false;
+    PixelType mappedValue = zero;
+    const PointType mappedPoint = m_Transform->TransformPoint(fixedPoint);
+    movingImage->TransformPhysicalPointToContinuousIndex(mappedPoint, movingIndex);
+    if ( m_Interpolator->IsInsideBuffer(movingIndex) )
+      {
+      mappedInside = true;
+      mappedValue = CastWithClamp( m_Interpolator->EvaluateAtContinuousIndex(movingIndex) );
+      }
+
+    unsigned int sum = 0;
+    for ( unsigned int d = 0; d < ImageDimension; ++d )
+      {
+      sum += static_cast< unsigned int >( ( index[d] - largestRegion.GetIndex(d) ) / squareSize[d] );
+      }
+    const bool fixedSquare = ( sum & 1 ) == 0;
+
+    registeredIt.Set( mappedInside ? mappedValue : m_DefaultPixelValue );
+    identityIt.Set(identityValue);
+    beforeIt.Set( fixedSquare ? fixedIt.Get() : identityValue );
+    afterIt.Set( fixedSquare ? fixedIt.Get() : mappedValue );
+
+    progress.CompletedPixel();
+    }
+}
+
+template< typename TImage, typename TInterpolatorPrecisionType >
+void
+RegistrationOutputImageFilter< TImage, TInterpolatorPrecisionType >
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+
+  os << indent << "DefaultPixelValue: "
+     << static_cast< typename NumericTraits< PixelType >::PrintType >( m_DefaultPixelValue )
+     << std::endl;
+  os << indent << "CheckerPattern: " << m_CheckerPattern << std::endl;
+  os << indent << "Transform: " << m_Transform.GetPointer() << std::endl;
+  os << indent << "Interpolator: " << m_Interpolator.GetPointer() << std::endl;
+}
+} // end namespace itk
+
+#endif
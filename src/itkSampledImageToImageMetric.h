@@ -0,0 +1,268 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkSampledImageToImageMetric_h
+#define itkSampledImageToImageMetric_h
+
+#include "itkImageToImageMetric.h"
+
+#include <vector>
+
+namespace itk
+{
+/** \class SampledImageToImageMetric
+ * \brief Base class for metrics evaluated over a fixed set of fixed-image samples.
+ *
+ * Initialize() draws the samples once per pyramid level (random positions
+ * from a seed, or every pixel of the fixed region) and stores their physical
+ * points, indices and fixed values as flat arrays. Subclasses implement
+ * ComputeValue() and ComputeValueAndDerivative() on top of MapSample() and
+ * ParallelForBlocks().
+ *
+ * Samples are processed in blocks of SamplesPerBlock. With
+ * DeterministicReduction on, every block accumulates into its own partial
+ * result and the partials are added in block order, so the floating point
+ * result does not depend on the number of threads. With it off, each thread
+ * keeps one partial, which is cheaper to clear and reduce.
+ *
+ * Blocks run on the process-wide TaskPool when one is set, otherwise on
+ * threads started for each evaluation. The metric counts its evaluations and
+ * the time they take, including the part lost to threading.
+ *
+ * With a CacheTolerance above 0 the metric remembers the values (and
+ * derivatives) it computed during the current level, keyed by the
+ * parameters rounded to multiples of the tolerance. An optimizer that shrinks
+ * its step near the minimum keeps coming back to the same translations; those
+ * calls are answered from the cache instead of a pass over the samples.
+ */
+template< typename TFixedImage, typename TMovingImage >
+class SampledImageToImageMetric:
+  public ImageToImageMetric< TFixedImage, TMovingImage >
+{
+public:
+  /** Standard class typedefs. */
+  typedef SampledImageToImageMetric                       Self;
+  typedef ImageToImageMetric< TFixedImage, TMovingImage > Superclass;
+  typedef SmartPointer< Self >                            Pointer;
+  typedef SmartPointer< const Self >                      ConstPointer;
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(SampledImageToImageMetric, ImageToImageMetric);
+
+  itkStaticConstMacro(FixedImageDimension, unsigned int, TFixedImage::ImageDimension);
+  itkStaticConstMacro(MovingImageDimension, unsigned int, TMovingImage::ImageDimension);
+
+  typedef typename Superclass::TransformType          TransformType;
+  typedef typename Superclass::MeasureType            MeasureType;
+  typedef typename Superclass::DerivativeType         DerivativeType;
+  typedef typename Superclass::ParametersType         ParametersType;
+  typedef typename Superclass::FixedImageType         FixedImageType;
+  typedef typename Superclass::MovingImageType        MovingImageType;
+  typedef typename Superclass::FixedImageRegionType   FixedImageRegionType;
+  typedef typename Superclass::GradientImageType      GradientImageType;
+  typedef typename TFixedImage::IndexType             FixedImageIndexType;
+  typedef typename TransformType::InputPointType      FixedImagePointType;
+  typedef typename TransformType::OutputPointType     MovingImagePointType;
+  typedef typename TransformType::JacobianType        TransformJacobianType;
+
+  /** Number of random fixed-image samples. 0 (or more than the region holds) uses every pixel. */
+  itkSetMacro(NumberOfSpatialSamples, SizeValueType);
+  itkGetConstMacro(NumberOfSpatialSamples, SizeValueType);
+
+  /** Samples per unit of work and of reduction. */
+  itkSetClampMacro(SamplesPerBlock, SizeValueType, 1, NumericTraits< SizeValueType >::max());
+  itkGetConstMacro(SamplesPerBlock, SizeValueType);
+
+  /** Add partial results in block order, independent of the thread count. */
+  itkSetMacro(DeterministicReduction, bool);
+  itkGetConstMacro(DeterministicReduction, bool);
+  itkBooleanMacro(DeterministicReduction);
+
+  /** Seed of the sample positions, as in ImageToImageMetric. */
+  void ReinitializeSeed();
+  void ReinitializeSeed(int seed);
+
+  /** Number of GetValue / GetValueAndDerivative calls, their total wall
+   * time and the part of it spent starting, waking and waiting for threads
+   * rather than on samples. */
+  SizeValueType GetNumberOfEvaluations() const { return m_NumberOfEvaluations; }
+  double GetEvaluationSeconds() const { return m_EvaluationSeconds; }
+  double GetThreadingOverheadSeconds() const { return m_ThreadingOverheadSeconds; }
+  void ResetEvaluationStatistics();
+
+  /** Parameters that round to the same multiples of CacheTolerance, in
+   * parameter units (mm for a translation), share one cached value and
+   * derivative. The cache holds the last MaximumCacheEntries evaluations of
+   * the current level and is emptied by Initialize(). 0 turns it off. */
+  itkSetClampMacro(CacheTolerance, double, 0.0, NumericTraits< double >::max());
+  itkGetConstMacro(CacheTolerance, double);
+
+  /** Calls that looked in the cache, and those answered from it; the hits
+   * are not counted as evaluations. */
+  SizeValueType GetNumberOfCacheLookups() const { return m_NumberOfCacheLookups; }
+  SizeValueType GetNumberOfCacheHits() const { return m_NumberOfCacheHits; }
+
+  /** Known intensity range of the fixed or moving image, e.g. from the
+   * statistics gathered when it was cast. Every pyramid level lies within the
+   * range of its full resolution image, so one range serves all levels and
+   * spares subclasses that need it a pass over the image per Initialize(). */
+  void SetFixedImageIntensityRange(double minimum, double maximum);
+  void SetMovingImageIntensityRange(double minimum, double maximum);
+
+  /** Forget the known ranges; they are computed from the images again. */
+  void ClearImageIntensityRanges();
+
+  /** Number of samples drawn by the last Initialize(). */
+  SizeValueType GetNumberOfSamples() const { return static_cast< SizeValueType >( m_SamplePoints.size() ); }
+
+  virtual void Initialize(void) throw ( ExceptionObject ) ITK_OVERRIDE;
+
+  virtual MeasureType GetValue(const ParametersType & parameters) const ITK_OVERRIDE;
+
+  virtual void GetDerivative(const ParametersType & parameters,
+                             DerivativeType & derivative) const ITK_OVERRIDE;
+
+  virtual void GetValueAndDerivative(const ParametersType & parameters,
+                                     MeasureType & value,
+                                     DerivativeType & derivative) const ITK_OVERRIDE;
+
+protected:
+  SampledImageToImageMetric();
+  virtual ~SampledImageToImageMetric() ITK_OVERRIDE {}
+  void PrintSelf(std::ostream & os, Indent indent) const ITK_OVERRIDE;
+
+  /** Called at the end of Initialize(), once the samples are known. */
+  virtual void InitializeSamples() {}
+
+  /** Metric value at the transform parameters already set. */
+  virtual MeasureType ComputeValue() const = 0;
+
+  /** Value and derivative at the transform parameters already set. */
+  virtual void ComputeValueAndDerivative(MeasureType & value, DerivativeType & derivative) const = 0;
+
+  /** The known fixed image range, or the range over the fixed image region. */
+  void GetFixedImageIntensityRange(double & minimum, double & maximum) const;
+
+  /** The known moving image range, or the range over its buffered region. */
+  void GetMovingImageIntensityRange(double & minimum, double & maximum) const;
+
+  /** Maps sample i into the moving image. False if it falls outside the
+   * moving image buffer or mask. */
+  inline bool MapSample(SizeValueType i, MovingImagePointType & mappedPoint, double & movingValue) const
+  {
+    mappedPoint = this->m_Transform->TransformPoint(m_SamplePoints[i]);
+    if ( this->m_MovingImageMask.IsNotNull() && !this->m_MovingImageMask->IsInside(mappedPoint) )
+      {
+      return false;
+      }
+    if ( !this->m_Interpolator->IsInsideBuffer(mappedPoint) )
+      {
+      return false;
+      }
+    movingValue = this->m_Interpolator->Evaluate(mappedPoint);
+    return true;
+  }
+
+  /** Moving image gradient at mappedPoint projected on every transform
+   * parameter of sample i: projection[p] = sum_d J(d, p) * grad(d). */
+  void ComputeGradientProjection(SizeValueType i, const MovingImagePointType & mappedPoint,
+                                 TransformJacobianType & jacobian, double *projection) const;
+
+  /** Sizes the mapped-sample buffers; call before ParallelForBlocks(). */
+  void ResizeMappedSampleBuffers(bool withDerivatives) const;
+
+  /** Maps samples [begin, end) into the moving image: m_MappedValues gets the
+   * moving value (0 outside), m_MappedWeights 1 inside and 0 outside and,
+   * withDerivatives, m_MappedGradients the gradient projections stored
+   * parameter-major (p * numberOfSamples + i, 0 outside). The metric's own
+   * sums can then run as branch-free loops over contiguous arrays, which the
+   * compiler vectorises. */
+  void MapSamples(SizeValueType begin, SizeValueType end, bool withDerivatives) const;
+
+  /** Number of partial results ParallelForBlocks() will address. */
+  unsigned int GetNumberOfPartials() const;
+
+  /** Runs function(begin, end, partial) over all blocks of samples on up to
+   * GetNumberOfThreads() threads. partial is in [0, GetNumberOfPartials()). */
+  template< typename TFunction >
+  void ParallelForBlocks(const TFunction & function) const;
+
+  SizeValueType GetNumberOfBlocks() const;
+  unsigned int GetNumberOfWorkers() const;
+
+  std::vector< FixedImagePointType > m_SamplePoints;
+  std::vector< FixedImageIndexType > m_SampleIndices;
+  std::vector< double >              m_SampleFixedValues;
+
+  mutable std::vector< double > m_MappedValues;
+  mutable std::vector< double > m_MappedWeights;
+  mutable std::vector< double > m_MappedGradients;
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(SampledImageToImageMetric);
+
+  void SampleFixedImage();
+
+  /** One remembered evaluation. A GetValue() result has no derivative until a
+   * later GetValueAndDerivative() at the same key fills it in. */
+  struct CacheEntry
+    {
+    std::vector< long long > key;
+    MeasureType              value;
+    DerivativeType           derivative;
+    bool                     hasDerivative;
+    };
+
+  static const SizeValueType MaximumCacheEntries = 64;
+
+  void ComputeCacheKey(const ParametersType & parameters, std::vector< long long > & key) const;
+
+  /** The entry for key, or ITK_NULLPTR. Counts the lookup and, when the entry
+   * has what the caller needs, the hit. */
+  const CacheEntry * LookUpCache(const std::vector< long long > & key, bool withDerivative) const;
+
+  void StoreInCache(const std::vector< long long > & key, const MeasureType & value,
+                    const DerivativeType *derivative) const;
+
+  SizeValueType m_NumberOfSpatialSamples;
+  SizeValueType m_SamplesPerBlock;
+  bool          m_DeterministicReduction;
+  bool          m_UseFixedSeed;
+  int           m_RandomSeed;
+
+  bool   m_UseFixedImageIntensityRange;
+  double m_FixedImageIntensityRange[2];
+  bool   m_UseMovingImageIntensityRange;
+  double m_MovingImageIntensityRange[2];
+
+  mutable SizeValueType m_NumberOfEvaluations;
+  mutable double        m_EvaluationSeconds;
+  mutable double        m_ThreadingOverheadSeconds;
+
+  double                            m_CacheTolerance;
+  mutable std::vector< CacheEntry > m_Cache;
+  mutable SizeValueType             m_NextCacheEntry;
+  mutable SizeValueType             m_NumberOfCacheLookups;
+  mutable SizeValueType             m_NumberOfCacheHits;
+};
+} // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkSampledImageToImageMetric.hxx"
+#endif
+
+#endif
@@ -0,0 +1,600 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkSampledImageToImageMetric_hxx
+#define itkSampledImageToImageMetric_hxx
+
+#include "itkSampledImageToImageMetric.h"
+#include "itkImageRandomConstIteratorWithIndex.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
+#include "TaskPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+namespace itk
+{
+template< typename TFixedImage, typename TMovingImage >
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::SampledImageToImageMetric():
+  m_NumberOfSpatialSamples(50000),
+  m_SamplesPerBlock(4096),
+  m_DeterministicReduction(true),
+  m_UseFixedSeed(false),
+  m_RandomSeed(0),
+  m_UseFixedImageIntensityRange(false),
+  m_UseMovingImageIntensityRange(false),
+  m_NumberOfEvaluations(0),
+  m_EvaluationSeconds(0.0),
+  m_ThreadingOverheadSeconds(0.0),
+  m_CacheTolerance(0.0),
+  m_NextCacheEntry(0),
+  m_NumberOfCacheLookups(0),
+  m_NumberOfCacheHits(0)
+{
+  m_FixedImageIntensityRange[0] = m_FixedImageIntensityRange[1] = 0.0;
+  m_MovingImageIntensityRange[0] = m_MovingImageIntensityRange[1] = 0.0;
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::SetFixedImageIntensityRange(double minimum, double maximum)
+{
+  m_UseFixedImageIntensityRange = true;
+  m_FixedImageIntensityRange[0] = minimum;
+  m_FixedImageIntensityRange[1] = maximum;
+  this->Modified();
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::SetMovingImageIntensityRange(double minimum, double maximum)
+{
+  m_UseMovingImageIntensityRange = true;
+  m_MovingImageIntensityRange[0] = minimum;
+  m_MovingImageIntensityRange[1] = maximum;
+  this->Modified();
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::ClearImageIntensityRanges()
+{
+  m_UseFixedImageIntensityRange = false;
+  m_UseMovingImageIntensityRange = false;
+  this->Modified();
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::GetFixedImageIntensityRange(double & minimum, double & maximum) const
+{
+  if ( m_UseFixedImageIntensityRange )
+    {
+    minimum = m_FixedImageIntensityRange[0];
+    maximum = m_FixedImageIntensityRange[1];
+    return;
+    }
+  minimum = NumericTraits< double >::max();
+  maximum = NumericTraits< double >::NonpositiveMin();
+  ImageRegionConstIterator< FixedImageType > it( this->m_FixedImage, this->GetFixedImageRegion() );
+  for ( it.GoToBegin(); !it.IsAtEnd(); ++it )
+    {
+    const double value = static_cast< double >( it.Get() );
+    minimum = std::min(minimum, value);
+    maximum = std::max(maximum, value);
+    }
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::GetMovingImageIntensityRange(double & minimum, double & maximum) const
+{
+  if ( m_UseMovingImageIntensityRange )
+    {
+    minimum = m_MovingImageIntensityRange[0];
+    maximum = m_MovingImageIntensityRange[1];
+    return;
+    }
+  minimum = NumericTraits< double >::max();
+  maximum = NumericTraits< double >::NonpositiveMin();
+  ImageRegionConstIterator< MovingImageType > it( this->m_MovingImage, this->m_MovingImage->GetBufferedRegion() );
+  for ( it.GoToBegin(); !it.IsAtEnd(); ++it )
+    {
+    const double value = static_cast< double >( it.Get() );
+    minimum = std::min(minimum, value);
+    maximum = std::max(maximum, value);
+    }
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::ResetEvaluationStatistics()
+{
+  m_NumberOfEvaluations = 0;
+  m_EvaluationSeconds = 0.0;
+  m_ThreadingOverheadSeconds = 0.0;
+  m_NumberOfCacheLookups = 0;
+  m_NumberOfCacheHits = 0;
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::ReinitializeSeed()
+{
+  m_UseFixedSeed = false;
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::ReinitializeSeed(int seed)
+{
+  m_UseFixedSeed = true;
+  m_RandomSeed = seed;
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::Initialize(void)
+throw ( ExceptionObject )
+{
+  Superclass::Initialize();
+
+  this->SampleFixedImage();
+  this->InitializeSamples();
+
+  // Values of the previous level were computed on other images and samples
+  m_Cache.clear();
+  m_NextCacheEntry = 0;
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::SampleFixedImage()
+{
+  const FixedImageType *fixedImage = this->m_FixedImage;
+  const FixedImageRegionType region = this->GetFixedImageRegion();
+
+  m_SamplePoints.clear();
+  m_SampleIndices.clear();
+  m_SampleFixedValues.clear();
+
+  const SizeValueType regionPixels = region.GetNumberOfPixels();
+  const bool useAllPixels = m_NumberOfSpatialSamples == 0 || m_NumberOfSpatialSamples >= regionPixels;
+  const SizeValueType numberOfSamples = useAllPixels ? regionPixels : m_NumberOfSpatialSamples;
+
+  m_SamplePoints.reserve(numberOfSamples);
+  m_SampleIndices.reserve(numberOfSamples);
+  m_SampleFixedValues.reserve(numberOfSamples);
+
+  FixedImagePointType point;
+
+  if ( useAllPixels )
+    {
+    ImageRegionConstIteratorWithIndex< FixedImageType > it(fixedImage, region);
+    for ( it.GoToBegin(); !it.IsAtEnd(); ++it )
+      {
+      fixedImage->TransformIndexToPhysicalPoint(it.GetIndex(), point);
+      if ( this->m_FixedImageMask.IsNotNull() && !this->m_FixedImageMask->IsInside(point) )
+        {
+        continue;
+        }
+      m_SamplePoints.push_back(point);
+      m_SampleIndices.push_back( it.GetIndex() );
+      m_SampleFixedValues.push_back( static_cast< double >( it.Get() ) );
+      }
+    }
+  else
+    {
+    // With a mask, draw more positions than needed and keep the first ones inside it
+    const SizeValueType draws = this->m_FixedImageMask.IsNotNull() ? 10 * numberOfSamples : numberOfSamples;
+
+    ImageRandomConstIteratorWithIndex< FixedImageType > it(fixedImage, region);
+    if ( m_UseFixedSeed )
+      {
+      it.ReinitializeSeed(m_RandomSeed);
+      }
+    else
+      {
+      it.ReinitializeSeed();
+      }
+    it.SetNumberOfSamples(draws);
+    for ( it.GoToBegin(); !it.IsAtEnd() && m_SamplePoints.size() < numberOfSamples; ++it )
+      {
+      fixedImage->TransformIndexToPhysicalPoint(it.GetIndex(), point);
+      if ( this->m_FixedImageMask.IsNotNull() && !this->m_FixedImageMask->IsInside(point) )
+        {
+        continue;
+        }
+      m_SamplePoints.push_back(point);
+      m_SampleIndices.push_back( it.GetIndex() );
+      m_SampleFixedValues.push_back( static_cast< double >( it.Get() ) );
+      }
+    }
+
+  if ( m_SamplePoints.empty() )
+    {
+    itkExceptionMacro(<< "No fixed image samples inside the fixed image region and mask");
+    }
+}
+
+template< typename TFixedImage, typename TMovingImage >
+typename SampledImageToImageMetric< TFixedImage, TMovingImage >::MeasureType
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::GetValue(const ParametersType & parameters) const
+{
+  std::vector< long long > key;
+  if ( m_CacheTolerance > 0.0 )
+    {
+    this->ComputeCacheKey(parameters, key);
+    if ( const CacheEntry *entry = this->LookUpCache(key, false) )
+      {
+      this->SetTransformParameters(parameters);
+      return entry->value;
+      }
+    }
+
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  this->SetTransformParameters(parameters);
+  const MeasureType value = this->ComputeValue();
+  ++m_NumberOfEvaluations;
+  m_EvaluationSeconds += std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+
+  if ( m_CacheTolerance > 0.0 )
+    {
+    this->StoreInCache(key, value, ITK_NULLPTR);
+    }
+  return value;
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::GetDerivative(const ParametersType & parameters, DerivativeType & derivative) const
+{
+  MeasureType value;
+  this->GetValueAndDerivative(parameters, value, derivative);
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::GetValueAndDerivative(const ParametersType & parameters,
+                        MeasureType & value,
+                        DerivativeType & derivative) const
+{
+  std::vector< long long > key;
+  if ( m_CacheTolerance > 0.0 )
+    {
+    this->ComputeCacheKey(parameters, key);
+    if ( const CacheEntry *entry = this->LookUpCache(key, true) )
+      {
+      this->SetTransformParameters(parameters);
+      value = entry->value;
+      derivative = entry->derivative;
+      return;
+      }
+    }
+
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  this->SetTransformParameters(parameters);
+  this->ComputeValueAndDerivative(value, derivative);
+  ++m_NumberOfEvaluations;
+  m_EvaluationSeconds += std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+
+  if ( m_CacheTolerance > 0.0 )
+    {
+    this->StoreInCache(key, value, &derivative);
+    }
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::ComputeCacheKey(const ParametersType & parameters, std::vector< long long > & key) const
+{
+  key.resize( parameters.GetSize() );
+  for ( unsigned int p = 0; p < parameters.GetSize(); ++p )
+    {
+    key[p] = std::llround(parameters[p] / m_CacheTolerance);
+    }
+}
+
+template< typename TFixedImage, typename TMovingImage >
+const typename SampledImageToImageMetric< TFixedImage, TMovingImage >::CacheEntry *
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::LookUpCache(const std::vector< long long > & key, bool withDerivative) const
+{
+  ++m_NumberOfCacheLookups;
+  for ( SizeValueType e = 0; e < m_Cache.size(); ++e )
+    {
+    if ( m_Cache[e].key == key )
+      {
+      if ( withDerivative && !m_Cache[e].hasDerivative )
+        {
+        return ITK_NULLPTR;
+        }
+      ++m_NumberOfCacheHits;
+      return &m_Cache[e];
+      }
+    }
+  return ITK_NULLPTR;
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::StoreInCache(const std::vector< long long > & key, const MeasureType & value,
+               const DerivativeType *derivative) const
+{
+  // A value-only entry for this key gets the derivative; otherwise a new entry
+  // replaces the oldest once the cache is full
+  CacheEntry *entry = ITK_NULLPTR;
+  for ( SizeValueType e = 0; e < m_Cache.size() && !entry; ++e )
+    {
+    if ( m_Cache[e].key == key )
+      {
+      entry = &m_Cache[e];
+      }
+    }
+  if ( !entry )
+    {
+    if ( m_Cache.size() < MaximumCacheEntries )
+      {
+      m_Cache.push_back( CacheEntry() );
+      entry = &m_Cache.back();
+      }
+    else
+      {
+      entry = &m_Cache[m_NextCacheEntry];
+      m_NextCacheEntry = ( m_NextCacheEntry + 1 ) % MaximumCacheEntries;
+      }
+    entry->key = key;
+    entry->hasDerivative = false;
+    }
+
+  entry->value = value;
+  if ( derivative )
+    {
+    entry->derivative = *derivative;
+    entry->hasDerivative = true;
+    }
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::ComputeGradientProjection(SizeValueType i, const MovingImagePointType & mappedPoint,
+                            TransformJacobianType & jacobian, double *projection) const
+{
+  typename GradientImageType::IndexType index;
+  typename GradientImageType::PixelType gradient;
+  if ( this->m_GradientImage->TransformPhysicalPointToIndex(mappedPoint, index) )
+    {
+    gradient = this->m_GradientImage->GetPixel(index);
+    }
+  else
+    {
+    gradient.Fill(0.0);
+    }
+
+  this->m_Transform->ComputeJacobianWithRespectToParameters(m_SamplePoints[i], jacobian);
+
+  const unsigned int numberOfParameters = static_cast< unsigned int >( jacobian.cols() );
+  for ( unsigned int p = 0; p < numberOfParameters; ++p )
+    {
+    double sum = 0.0;
+    for ( unsigned int d = 0; d < MovingImageDimension; ++d )
+      {
+      sum += jacobian(d, p) * gradient[d];
+      }
+    projection[p] = sum;
+    }
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::ResizeMappedSampleBuffers(bool withDerivatives) const
+{
+  const SizeValueType numberOfSamples = this->GetNumberOfSamples();
+  m_MappedValues.resize(numberOfSamples);
+  m_MappedWeights.resize(numberOfSamples);
+  if ( withDerivatives )
+    {
+    m_MappedGradients.resize(numberOfSamples * this->GetNumberOfParameters());
+    }
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::MapSamples(SizeValueType begin, SizeValueType end, bool withDerivatives) const
+{
+  const SizeValueType numberOfSamples = this->GetNumberOfSamples();
+  const unsigned int  numberOfParameters = this->GetNumberOfParameters();
+
+  TransformJacobianType jacobian;
+  MovingImagePointType  mappedPoint;
+  double                movingValue;
+  std::vector< double > projection(numberOfParameters);
+
+  for ( SizeValueType i = begin; i < end; ++i )
+    {
+    if ( this->MapSample(i, mappedPoint, movingValue) )
+      {
+      m_MappedValues[i] = movingValue;
+      m_MappedWeights[i] = 1.0;
+      if ( withDerivatives )
+        {
+        this->ComputeGradientProjection(i, mappedPoint, jacobian, &projection[0]);
+        for ( unsigned int p = 0; p < numberOfParameters; ++p )
+          {
+          m_MappedGradients[p * numberOfSamples + i] = projection[p];
+          }
+        }
+      }
+    else
+      {
+      m_MappedValues[i] = 0.0;
+      m_MappedWeights[i] = 0.0;
+      if ( withDerivatives )
+        {
+        for ( unsigned int p = 0; p < numberOfParameters; ++p )
+          {
+          m_MappedGradients[p * numberOfSamples + i] = 0.0;
+          }
+        }
+      }
+    }
+}
+
+template< typename TFixedImage, typename TMovingImage >
+SizeValueType
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::GetNumberOfBlocks() const
+{
+  return ( static_cast< SizeValueType >( m_SamplePoints.size() ) + m_SamplesPerBlock - 1 ) / m_SamplesPerBlock;
+}
+
+template< typename TFixedImage, typename TMovingImage >
+unsigned int
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::GetNumberOfWorkers() const
+{
+  const SizeValueType threads = std::max< SizeValueType >(this->GetNumberOfThreads(), 1);
+  return static_cast< unsigned int >( std::max< SizeValueType >( std::min(threads, this->GetNumberOfBlocks()), 1 ) );
+}
+
+template< typename TFixedImage, typename TMovingImage >
+unsigned int
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::GetNumberOfPartials() const
+{
+  return m_DeterministicReduction ? static_cast< unsigned int >( this->GetNumberOfBlocks() ) : this->GetNumberOfWorkers();
+}
+
+template< typename TFixedImage, typename TMovingImage >
+template< typename TFunction >
+void
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::ParallelForBlocks(const TFunction & function) const
+{
+  const SizeValueType numberOfSamples = static_cast< SizeValueType >( m_SamplePoints.size() );
+  const SizeValueType numberOfBlocks = this->GetNumberOfBlocks();
+  const unsigned int  numberOfWorkers = this->GetNumberOfWorkers();
+  const SizeValueType blockSize = m_SamplesPerBlock;
+  const bool          deterministic = m_DeterministicReduction;
+
+  typedef std::chrono::steady_clock Clock;
+  const Clock::time_point start = Clock::now();
+  std::atomic< long long > busyNanoseconds(0);
+
+  // Blocks are handed out dynamically; which thread runs a block only
+  // matters for the non-deterministic reduction.
+  auto runBlock = [&](SizeValueType block, unsigned int workerId)
+    {
+    const Clock::time_point blockStart = Clock::now();
+    const SizeValueType begin = block * blockSize;
+    const SizeValueType end = std::min(begin + blockSize, numberOfSamples);
+    function( begin, end, deterministic ? static_cast< unsigned int >( block ) : workerId );
+    busyNanoseconds += std::chrono::duration_cast< std::chrono::nanoseconds >( Clock::now() - blockStart ).count();
+    };
+
+  TaskPool *pool = TaskPool::GetGlobal();
+  if ( pool )
+    {
+    pool->ParallelFor(numberOfBlocks, numberOfWorkers, runBlock);
+    }
+  else
+    {
+    // No process-wide pool: start and join this call's own threads
+    std::atomic< SizeValueType > nextBlock(0);
+    auto worker = [&](unsigned int workerId)
+      {
+      for ( SizeValueType block = nextBlock++; block < numberOfBlocks; block = nextBlock++ )
+        {
+        runBlock(block, workerId);
+        }
+      };
+
+    std::vector< std::thread > threads;
+    for ( unsigned int w = 1; w < numberOfWorkers; ++w )
+      {
+      threads.push_back( std::thread(worker, w) );
+      }
+    worker(0);
+    for ( unsigned int w = 0; w < threads.size(); ++w )
+      {
+      threads[w].join();
+      }
+    }
+
+  // Wall time beyond a perfect split of the work over the workers: starting,
+  // waking, waiting for and joining threads, and load imbalance
+  const double wallSeconds = std::chrono::duration< double >( Clock::now() - start ).count();
+  const double overhead = wallSeconds - 1e-9 * static_cast< double >( busyNanoseconds.load() ) / numberOfWorkers;
+  m_ThreadingOverheadSeconds += std::max(overhead, 0.0);
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+SampledImageToImageMetric< TFixedImage, TMovingImage >
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "NumberOfSpatialSamples: " << m_NumberOfSpatialSamples << std::endl;
+  os << indent << "NumberOfSamples: " << m_SamplePoints.size() << std::endl;
+  os << indent << "SamplesPerBlock: " << m_SamplesPerBlock << std::endl;
+  os << indent << "DeterministicReduction: " << ( m_DeterministicReduction ? "On" : "Off" ) << std::endl;
+  os << indent << "UseFixedSeed: " << ( m_UseFixedSeed ? "On" : "Off" ) << std::endl;
+  os << indent << "RandomSeed: " << m_RandomSeed << std::endl;
+  if ( m_UseFixedImageIntensityRange )
+    {
+    os << indent << "FixedImageIntensityRange: [" << m_FixedImageIntensityRange[0] << ", "
+       << m_FixedImageIntensityRange[1] << "]" << std::endl;
+    }
+  if ( m_UseMovingImageIntensityRange )
+    {
+    os << indent << "MovingImageIntensityRange: [" << m_MovingImageIntensityRange[0] << ", "
+       << m_MovingImageIntensityRange[1] << "]" << std::endl;
+    }
+  os << indent << "NumberOfEvaluations: " << m_NumberOfEvaluations << std::endl;
+  os << indent << "EvaluationSeconds: " << m_EvaluationSeconds << std::endl;
+  os << indent << "ThreadingOverheadSeconds: " << m_ThreadingOverheadSeconds << std::endl;
+  os << indent << "CacheTolerance: " << m_CacheTolerance << std::endl;
+  os << indent << "NumberOfCacheEntries: " << m_Cache.size() << std::endl;
+  os << indent << "NumberOfCacheLookups: " << m_NumberOfCacheLookups << std::endl;
+  os << indent << "NumberOfCacheHits: " << m_NumberOfCacheHits << std::endl;
+}
+} // end namespace itk
+
+#endif
@@ -0,0 +1,80 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkSampledMeanSquaresImageToImageMetric_h
+#define itkSampledMeanSquaresImageToImageMetric_h
+
+#include "itkSampledImageToImageMetric.h"
+
+#include <vector>
+
+namespace itk
+{
+/** \class SampledMeanSquaresImageToImageMetric
+ * \brief Mean squared difference over the samples of SampledImageToImageMetric.
+ *
+ * Value is the mean of (moving - fixed)^2 over the samples that map inside
+ * the moving image. For same-modality pairs with matching intensities
+ * (CT to CT follow-ups); each sample adds to two sums, plus one per
+ * transform parameter for the derivative.
+ */
+template< typename TFixedImage, typename TMovingImage >
+class SampledMeanSquaresImageToImageMetric:
+  public SampledImageToImageMetric< TFixedImage, TMovingImage >
+{
+public:
+  /** Standard class typedefs. */
+  typedef SampledMeanSquaresImageToImageMetric                   Self;
+  typedef SampledImageToImageMetric< TFixedImage, TMovingImage > Superclass;
+  typedef SmartPointer< Self >                                   Pointer;
+  typedef SmartPointer< const Self >                             ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(SampledMeanSquaresImageToImageMetric, SampledImageToImageMetric);
+
+  typedef typename Superclass::MeasureType    MeasureType;
+  typedef typename Superclass::DerivativeType DerivativeType;
+
+protected:
+  SampledMeanSquaresImageToImageMetric();
+  virtual ~SampledMeanSquaresImageToImageMetric() ITK_OVERRIDE {}
+
+  virtual MeasureType ComputeValue() const ITK_OVERRIDE;
+
+  virtual void ComputeValueAndDerivative(MeasureType & value, DerivativeType & derivative) const ITK_OVERRIDE;
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(SampledMeanSquaresImageToImageMetric);
+
+  /** Accumulates count, sum of squares and, withDerivatives, the
+   * sum of (moving - fixed) * gradient projection for each parameter into
+   * m_Sums. */
+  void AccumulateSums(bool withDerivatives) const;
+
+  mutable std::vector< double > m_PartialSums;
+  mutable std::vector< double > m_Sums;
+};
+} // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkSampledMeanSquaresImageToImageMetric.hxx"
+#endif
+
+#endif
@@ -0,0 +1,124 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkSampledMeanSquaresImageToImageMetric_hxx
+#define itkSampledMeanSquaresImageToImageMetric_hxx
+
+#include "itkSampledMeanSquaresImageToImageMetric.h"
+
+namespace itk
+{
+template< typename TFixedImage, typename TMovingImage >
+SampledMeanSquaresImageToImageMetric< TFixedImage, TMovingImage >
+::SampledMeanSquaresImageToImageMetric()
+{
+  this->SetComputeGradient(true);
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+SampledMeanSquaresImageToImageMetric< TFixedImage, TMovingImage >
+::AccumulateSums(bool withDerivatives) const
+{
+  const SizeValueType numberOfSamples = this->GetNumberOfSamples();
+  const unsigned int  numberOfParameters = this->GetNumberOfParameters();
+  const unsigned int  numberOfPartials = this->GetNumberOfPartials();
+  const unsigned int  stride = 2 + ( withDerivatives ? numberOfParameters : 0 );
+
+  this->ResizeMappedSampleBuffers(withDerivatives);
+  m_PartialSums.assign(numberOfPartials * stride, 0.0);
+
+  this->ParallelForBlocks([&](SizeValueType begin, SizeValueType end, unsigned int partial)
+    {
+    this->MapSamples(begin, end, withDerivatives);
+
+    const double *fixedValues = &this->m_SampleFixedValues[0];
+    const double *movingValues = &this->m_MappedValues[0];
+    const double *weights = &this->m_MappedWeights[0];
+
+    double count = 0.0, squares = 0.0;
+    for ( SizeValueType i = begin; i < end; ++i )
+      {
+      const double difference = movingValues[i] - fixedValues[i];
+      count += weights[i];
+      squares += weights[i] * difference * difference;
+      }
+
+    double *sums = &m_PartialSums[partial * stride];
+    sums[0] += count;
+    sums[1] += squares;
+
+    if ( withDerivatives )
+      {
+      // Gradients are 0 outside the moving image, so no weight is needed
+      for ( unsigned int p = 0; p < numberOfParameters; ++p )
+        {
+        const double *gradients = &this->m_MappedGradients[p * numberOfSamples];
+        double sum = 0.0;
+        for ( SizeValueType i = begin; i < end; ++i )
+          {
+          sum += ( movingValues[i] - fixedValues[i] ) * gradients[i];
+          }
+        sums[2 + p] += sum;
+        }
+      }
+    });
+
+  m_Sums.assign(stride, 0.0);
+  for ( unsigned int partial = 0; partial < numberOfPartials; ++partial )
+    {
+    for ( unsigned int j = 0; j < stride; ++j )
+      {
+      m_Sums[j] += m_PartialSums[partial * stride + j];
+      }
+    }
+
+  if ( m_Sums[0] < static_cast< double >( numberOfSamples / 16 ) || m_Sums[0] == 0.0 )
+    {
+    itkExceptionMacro(<< "Too many samples map outside moving image buffer: "
+                      << m_Sums[0] << " / " << numberOfSamples << std::endl);
+    }
+  this->m_NumberOfPixelsCounted = static_cast< SizeValueType >( m_Sums[0] );
+}
+
+template< typename TFixedImage, typename TMovingImage >
+typename SampledMeanSquaresImageToImageMetric< TFixedImage, TMovingImage >::MeasureType
+SampledMeanSquaresImageToImageMetric< TFixedImage, TMovingImage >
+::ComputeValue() const
+{
+  this->AccumulateSums(false);
+  return static_cast< MeasureType >( m_Sums[1] / m_Sums[0] );
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+SampledMeanSquaresImageToImageMetric< TFixedImage, TMovingImage >
+::ComputeValueAndDerivative(MeasureType & value, DerivativeType & derivative) const
+{
+  this->AccumulateSums(true);
+
+  const unsigned int numberOfParameters = this->GetNumberOfParameters();
+  value = static_cast< MeasureType >( m_Sums[1] / m_Sums[0] );
+  derivative = DerivativeType(numberOfParameters);
+  for ( unsigned int p = 0; p < numberOfParameters; ++p )
+    {
+    derivative[p] = 2.0 * m_Sums[2 + p] / m_Sums[0];
+    }
+}
+} // end namespace itk
+
+#endif
@@ -0,0 +1,86 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkSampledNormalizedCorrelationImageToImageMetric_h
+#define itkSampledNormalizedCorrelationImageToImageMetric_h
+
+#include "itkSampledImageToImageMetric.h"
+
+#include <vector>
+
+namespace itk
+{
+/** \class SampledNormalizedCorrelationImageToImageMetric
+ * \brief Normalised cross-correlation over the samples of SampledImageToImageMetric.
+ *
+ * Value is -NCC of the fixed and moving values at the samples that map
+ * inside the moving image, with the means subtracted, so a perfect linear
+ * match gives -1 and the optimizer minimises. Meant for same-modality pairs
+ * (CT to CT), where it is much cheaper than mutual information: each sample
+ * adds to six sums, plus three per transform parameter for the derivative.
+ */
+template< typename TFixedImage, typename TMovingImage >
+class SampledNormalizedCorrelationImageToImageMetric:
+  public SampledImageToImageMetric< TFixedImage, TMovingImage >
+{
+public:
+  /** Standard class typedefs. */
+  typedef SampledNormalizedCorrelationImageToImageMetric         Self;
+  typedef SampledImageToImageMetric< TFixedImage, TMovingImage > Superclass;
+  typedef SmartPointer< Self >                                   Pointer;
+  typedef SmartPointer< const Self >                             ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(SampledNormalizedCorrelationImageToImageMetric, SampledImageToImageMetric);
+
+  typedef typename Superclass::MeasureType    MeasureType;
+  typedef typename Superclass::DerivativeType DerivativeType;
+
+protected:
+  SampledNormalizedCorrelationImageToImageMetric();
+  virtual ~SampledNormalizedCorrelationImageToImageMetric() ITK_OVERRIDE {}
+
+  virtual MeasureType ComputeValue() const ITK_OVERRIDE;
+
+  virtual void ComputeValueAndDerivative(MeasureType & value, DerivativeType & derivative) const ITK_OVERRIDE;
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(SampledNormalizedCorrelationImageToImageMetric);
+
+  /** Position of each sum in a partial result. */
+  enum {
+    CountSum = 0, FixedSum, MovingSum, FixedFixedSum, MovingMovingSum, FixedMovingSum,
+    NumberOfScalarSums
+  };
+
+  /** Accumulates the partial sums of every block and adds them up into
+   * m_Sums; the three gradient sums of parameter p follow the scalar ones. */
+  void AccumulateSums(bool withDerivatives) const;
+
+  mutable std::vector< double > m_PartialSums;
+  mutable std::vector< double > m_Sums;
+};
+} // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkSampledNormalizedCorrelationImageToImageMetric.hxx"
+#endif
+
+#endif
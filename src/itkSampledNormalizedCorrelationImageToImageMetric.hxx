@@ -0,0 +1,169 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkSampledNormalizedCorrelationImageToImageMetric_hxx
+#define itkSampledNormalizedCorrelationImageToImageMetric_hxx
+
+#include "itkSampledNormalizedCorrelationImageToImageMetric.h"
+
+#include <cmath>
+
+namespace itk
+{
+template< typename TFixedImage, typename TMovingImage >
+SampledNormalizedCorrelationImageToImageMetric< TFixedImage, TMovingImage >
+::SampledNormalizedCorrelationImageToImageMetric()
+{
+  this->SetComputeGradient(true);
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+SampledNormalizedCorrelationImageToImageMetric< TFixedImage, TMovingImage >
+::AccumulateSums(bool withDerivatives) const
+{
+  const SizeValueType numberOfSamples = this->GetNumberOfSamples();
+  const unsigned int  numberOfParameters = this->GetNumberOfParameters();
+  const unsigned int  numberOfPartials = this->GetNumberOfPartials();
+  const unsigned int  stride = NumberOfScalarSums + ( withDerivatives ? 3 * numberOfParameters : 0 );
+
+  this->ResizeMappedSampleBuffers(withDerivatives);
+  m_PartialSums.assign(numberOfPartials * stride, 0.0);
+
+  this->ParallelForBlocks([&](SizeValueType begin, SizeValueType end, unsigned int partial)
+    {
+    this->MapSamples(begin, end, withDerivatives);
+
+    const double *fixedValues = &this->m_SampleFixedValues[0];
+    const double *movingValues = &this->m_MappedValues[0];
+    const double *weights = &this->m_MappedWeights[0];
+
+    // Moving values and gradients are 0 outside the moving image, so only
+    // the fixed terms need the weight.
+    double count = 0.0, fixedSum = 0.0, movingSum = 0.0;
+    double fixedFixed = 0.0, movingMoving = 0.0, fixedMoving = 0.0;
+    for ( SizeValueType i = begin; i < end; ++i )
+      {
+      const double weightedFixed = weights[i] * fixedValues[i];
+      count += weights[i];
+      fixedSum += weightedFixed;
+      movingSum += movingValues[i];
+      fixedFixed += weightedFixed * fixedValues[i];
+      movingMoving += movingValues[i] * movingValues[i];
+      fixedMoving += weightedFixed * movingValues[i];
+      }
+
+    double *sums = &m_PartialSums[partial * stride];
+    sums[CountSum] += count;
+    sums[FixedSum] += fixedSum;
+    sums[MovingSum] += movingSum;
+    sums[FixedFixedSum] += fixedFixed;
+    sums[MovingMovingSum] += movingMoving;
+    sums[FixedMovingSum] += fixedMoving;
+
+    if ( withDerivatives )
+      {
+      for ( unsigned int p = 0; p < numberOfParameters; ++p )
+        {
+        const double *gradients = &this->m_MappedGradients[p * numberOfSamples];
+        double fixedGradient = 0.0, movingGradient = 0.0, gradient = 0.0;
+        for ( SizeValueType i = begin; i < end; ++i )
+          {
+          fixedGradient += fixedValues[i] * gradients[i];
+          movingGradient += movingValues[i] * gradients[i];
+          gradient += gradients[i];
+          }
+        double *parameterSums = sums + NumberOfScalarSums + 3 * p;
+        parameterSums[0] += fixedGradient;
+        parameterSums[1] += movingGradient;
+        parameterSums[2] += gradient;
+        }
+      }
+    });
+
+  m_Sums.assign(stride, 0.0);
+  for ( unsigned int partial = 0; partial < numberOfPartials; ++partial )
+    {
+    for ( unsigned int j = 0; j < stride; ++j )
+      {
+      m_Sums[j] += m_PartialSums[partial * stride + j];
+      }
+    }
+
+  if ( m_Sums[CountSum] < static_cast< double >( numberOfSamples / 16 ) || m_Sums[CountSum] == 0.0 )
+    {
+    itkExceptionMacro(<< "Too many samples map outside moving image buffer: "
+                      << m_Sums[CountSum] << " / " << numberOfSamples << std::endl);
+    }
+  this->m_NumberOfPixelsCounted = static_cast< SizeValueType >( m_Sums[CountSum] );
+}
+
+template< typename TFixedImage, typename TMovingImage >
+typename SampledNormalizedCorrelationImageToImageMetric< TFixedImage, TMovingImage >::MeasureType
+SampledNormalizedCorrelationImageToImageMetric< TFixedImage, TMovingImage >
+::ComputeValue() const
+{
+  this->AccumulateSums(false);
+
+  const double count = m_Sums[CountSum];
+  const double fixedVariance = m_Sums[FixedFixedSum] - m_Sums[FixedSum] * m_Sums[FixedSum] / count;
+  const double movingVariance = m_Sums[MovingMovingSum] - m_Sums[MovingSum] * m_Sums[MovingSum] / count;
+  const double covariance = m_Sums[FixedMovingSum] - m_Sums[FixedSum] * m_Sums[MovingSum] / count;
+  const double denominator = std::sqrt(fixedVariance * movingVariance);
+  if ( !( denominator > 0.0 ) )
+    {
+    return NumericTraits< MeasureType >::ZeroValue();
+    }
+  return static_cast< MeasureType >( -covariance / denominator );
+}
+
+template< typename TFixedImage, typename TMovingImage >
+void
+SampledNormalizedCorrelationImageToImageMetric< TFixedImage, TMovingImage >
+::ComputeValueAndDerivative(MeasureType & value, DerivativeType & derivative) const
+{
+  this->AccumulateSums(true);
+
+  const unsigned int numberOfParameters = this->GetNumberOfParameters();
+  derivative = DerivativeType(numberOfParameters);
+  derivative.Fill(NumericTraits< typename DerivativeType::ValueType >::ZeroValue());
+
+  const double count = m_Sums[CountSum];
+  const double fixedVariance = m_Sums[FixedFixedSum] - m_Sums[FixedSum] * m_Sums[FixedSum] / count;
+  const double movingVariance = m_Sums[MovingMovingSum] - m_Sums[MovingSum] * m_Sums[MovingSum] / count;
+  const double covariance = m_Sums[FixedMovingSum] - m_Sums[FixedSum] * m_Sums[MovingSum] / count;
+  const double denominator = std::sqrt(fixedVariance * movingVariance);
+  if ( !( denominator > 0.0 ) )
+    {
+    value = NumericTraits< MeasureType >::ZeroValue();
+    return;
+    }
+  value = static_cast< MeasureType >( -covariance / denominator );
+
+  // d(covariance)/dp = sum(f * g) - mean(f) * sum(g)
+  // d(movingVariance)/dp = 2 * (sum(m * g) - mean(m) * sum(g))
+  for ( unsigned int p = 0; p < numberOfParameters; ++p )
+    {
+    const double *parameterSums = &m_Sums[NumberOfScalarSums + 3 * p];
+    const double covarianceDerivative = parameterSums[0] - m_Sums[FixedSum] / count * parameterSums[2];
+    const double movingVarianceDerivative = 2.0 * ( parameterSums[1] - m_Sums[MovingSum] / count * parameterSums[2] );
+    derivative[p] = -( covarianceDerivative - covariance * movingVarianceDerivative / ( 2.0 * movingVariance ) ) / denominator;
+    }
+}
+} // end namespace itk
+
+#endif
@@ -0,0 +1,172 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkStatisticsCastImageFilter_h
+#define itkStatisticsCastImageFilter_h
+
+#include "itkImageToImageFilter.h"
+#include "itkMetaDataObject.h"
+
+#include <vector>
+
+namespace itk
+{
+/** \class ImageIntensityStatistics
+ * \brief Intensity statistics of an image, gathered while it is cast.
+ *
+ * Histogram bin b counts the input values in
+ * [HistogramMinimum + b * HistogramBinWidth, HistogramMinimum + (b + 1) * HistogramBinWidth).
+ * Foreground is the bounding box of the pixels above the foreground
+ * threshold; it is empty (zero size) if there are none.
+ */
+template< unsigned int VDimension >
+struct ImageIntensityStatistics
+{
+  typedef ImageRegion< VDimension > RegionType;
+
+  ImageIntensityStatistics():
+    Minimum(0.0), Maximum(0.0), HistogramMinimum(0.0), HistogramBinWidth(1.0), NumberOfPixels(0)
+  {}
+
+  double                       Minimum;
+  double                       Maximum;
+  double                       HistogramMinimum;
+  double                       HistogramBinWidth;
+  std::vector< SizeValueType > Histogram;
+  RegionType                   Foreground;
+  SizeValueType                NumberOfPixels;
+};
+
+template< unsigned int VDimension >
+std::ostream & operator<<(std::ostream & os, const ImageIntensityStatistics< VDimension > & statistics)
+{
+  os << "[" << statistics.Minimum << ", " << statistics.Maximum << "], "
+     << statistics.Histogram.size() << " histogram bins, foreground "
+     << statistics.Foreground.GetIndex() << " " << statistics.Foreground.GetSize();
+  return os;
+}
+
+/** \class StatisticsCastImageFilter
+ * \brief Casts an image and gathers its intensity statistics in the same pass.
+ *
+ * Produces the same output as CastImageFilter. While each thread casts its
+ * region it also tracks the minimum and maximum, a coarse histogram and the
+ * bounding box of the foreground. The threads' results are merged after the
+ * pass, available from GetStatistics() and stored in the output's
+ * MetaDataDictionary under StatisticsKey(), so whoever holds the image can
+ * read them back with GetImageIntensityStatistics() instead of scanning the
+ * pixels again.
+ *
+ * The histogram covers the whole range of the input pixel type in at most
+ * NumberOfHistogramBins bins whose width is a power of two, so binning a
+ * pixel costs a subtraction and a shift. It is only gathered for integer
+ * pixel types of at most 16 bits, whose range is known before the pass; it
+ * is empty otherwise.
+ */
+template< typename TInputImage, typename TOutputImage >
+class StatisticsCastImageFilter:
+  public ImageToImageFilter< TInputImage, TOutputImage >
+{
+public:
+  /** Standard class typedefs. */
+  typedef StatisticsCastImageFilter                       Self;
+  typedef ImageToImageFilter< TInputImage, TOutputImage > Superclass;
+  typedef SmartPointer< Self >                            Pointer;
+  typedef SmartPointer< const Self >                      ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(StatisticsCastImageFilter, ImageToImageFilter);
+
+  itkStaticConstMacro(ImageDimension, unsigned int, TInputImage::ImageDimension);
+
+  typedef typename TInputImage::PixelType                                      InputPixelType;
+  typedef typename TOutputImage::PixelType                                     OutputPixelType;
+  typedef typename TOutputImage::RegionType                                    OutputImageRegionType;
+  typedef typename TInputImage::IndexType                                      IndexType;
+  typedef ImageIntensityStatistics< itkGetStaticConstMacro(ImageDimension) >  StatisticsType;
+
+  /** Pixels strictly above this value are foreground. Defaults to the
+   * lowest value of the input pixel type. */
+  itkSetMacro(ForegroundThreshold, InputPixelType);
+  itkGetConstMacro(ForegroundThreshold, InputPixelType);
+
+  itkSetClampMacro(NumberOfHistogramBins, SizeValueType, 1, 65536);
+  itkGetConstMacro(NumberOfHistogramBins, SizeValueType);
+
+  /** Statistics of the last update. */
+  const StatisticsType & GetStatistics() const { return m_Statistics; }
+
+  /** MetaDataDictionary key the statistics are stored under. */
+  static const char * StatisticsKey() { return "IntensityStatistics"; }
+
+protected:
+  StatisticsCastImageFilter();
+  virtual ~StatisticsCastImageFilter() ITK_OVERRIDE {}
+  void PrintSelf(std::ostream & os, Indent indent) const ITK_OVERRIDE;
+
+  virtual void BeforeThreadedGenerateData() ITK_OVERRIDE;
+
+  virtual void ThreadedGenerateData(const OutputImageRegionType & outputRegionForThread,
+                                    ThreadIdType threadId) ITK_OVERRIDE;
+
+  virtual void AfterThreadedGenerateData() ITK_OVERRIDE;
+
+private:
+  ITK_DISALLOW_COPY_AND_ASSIGN(StatisticsCastImageFilter);
+
+  /** One thread's share of the statistics. */
+  struct ThreadStatistics
+  {
+    double                       minimum;
+    double                       maximum;
+    std::vector< SizeValueType > histogram;
+    IndexType                    foregroundLower;
+    IndexType                    foregroundUpper;
+    bool                         hasForeground;
+    SizeValueType                numberOfPixels;
+  };
+
+  InputPixelType m_ForegroundThreshold;
+  SizeValueType  m_NumberOfHistogramBins;
+
+  bool          m_GatherHistogram;
+  long          m_HistogramMinimum;
+  unsigned int  m_HistogramShift;   // log2 of the bin width
+  SizeValueType m_HistogramSize;    // bins actually used
+
+  std::vector< ThreadStatistics > m_ThreadStatistics;
+  StatisticsType                  m_Statistics;
+};
+
+/** Statistics a StatisticsCastImageFilter stored with image. False if it has none. */
+template< typename TImage >
+bool GetImageIntensityStatistics(const TImage *image,
+                                 ImageIntensityStatistics< TImage::ImageDimension > & statistics)
+{
+  return ExposeMetaData< ImageIntensityStatistics< TImage::ImageDimension > >(
+    image->GetMetaDataDictionary(), "IntensityStatistics", statistics);
+}
+} // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkStatisticsCastImageFilter.hxx"
+#endif
+
+#endif
@@ -0,0 +1,223 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+#ifndef itkStatisticsCastImageFilter_hxx
+#define itkStatisticsCastImageFilter_hxx
+
+#include "itkStatisticsCastImageFilter.h"
+#include "itkImageScanlineConstIterator.h"
+#include "itkImageScanlineIterator.h"
+
+#include <algorithm>
+
+namespace itk
+{
+template< typename TInputImage, typename TOutputImage >
+StatisticsCastImageFilter< TInputImage, TOutputImage >
+::StatisticsCastImageFilter():
+  m_ForegroundThreshold( NumericTraits< InputPixelType >::NonpositiveMin() ),
+  m_NumberOfHistogramBins(256),
+  m_GatherHistogram(false),
+  m_HistogramMinimum(0),
+  m_HistogramShift(0),
+  m_HistogramSize(0)
+{
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+StatisticsCastImageFilter< TInputImage, TOutputImage >
+::BeforeThreadedGenerateData()
+{
+  // The histogram spans the pixel type's range, the only one known before the
+  // pass, in bins of the smallest power-of-two width that needs no more than
+  // NumberOfHistogramBins of them
+  m_GatherHistogram = NumericTraits< InputPixelType >::is_integer && sizeof( InputPixelType ) <= 2;
+  m_HistogramMinimum = m_GatherHistogram ? static_cast< long >( NumericTraits< InputPixelType >::NonpositiveMin() ) : 0;
+  const SizeValueType typeRange = m_GatherHistogram
+    ? static_cast< SizeValueType >( static_cast< long >( NumericTraits< InputPixelType >::max() ) - m_HistogramMinimum + 1 ) : 0;
+  m_HistogramShift = 0;
+  while ( ( typeRange >> m_HistogramShift ) > m_NumberOfHistogramBins )
+    {
+    ++m_HistogramShift;
+    }
+  m_HistogramSize = ( typeRange + ( SizeValueType(1) << m_HistogramShift ) - 1 ) >> m_HistogramShift;
+
+  ThreadStatistics empty;
+  empty.minimum = NumericTraits< double >::max();
+  empty.maximum = NumericTraits< double >::NonpositiveMin();
+  empty.histogram.assign(m_HistogramSize, 0);
+  empty.foregroundLower.Fill( NumericTraits< IndexValueType >::max() );
+  empty.foregroundUpper.Fill( NumericTraits< IndexValueType >::NonpositiveMin() );
+  empty.hasForeground = false;
+  empty.numberOfPixels = 0;
+  m_ThreadStatistics.assign(this->GetNumberOfThreads(), empty);
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+StatisticsCastImageFilter< TInputImage, TOutputImage >
+::ThreadedGenerateData(const OutputImageRegionType & outputRegionForThread,
+                       ThreadIdType threadId)
+{
+  if ( outputRegionForThread.GetNumberOfPixels() == 0 )
+    {
+    return;
+    }
+
+  ThreadStatistics & statistics = m_ThreadStatistics[threadId];
+  const InputPixelType threshold = m_ForegroundThreshold;
+  const long           histogramMinimum = m_HistogramMinimum;
+  const unsigned int   histogramShift = m_HistogramShift;
+
+  ImageScanlineConstIterator< TInputImage > inputIt(this->GetInput(), outputRegionForThread);
+  ImageScanlineIterator< TOutputImage >     outputIt(this->GetOutput(), outputRegionForThread);
+
+  while ( !inputIt.IsAtEnd() )
+    {
+    // Foreground columns of this line; the line's other index components are fixed
+    IndexValueType firstForeground = NumericTraits< IndexValueType >::max();
+    IndexValueType lastForeground = NumericTraits< IndexValueType >::NonpositiveMin();
+    const IndexType lineIndex = inputIt.GetIndex();
+    IndexValueType  column = lineIndex[0];
+
+    while ( !inputIt.IsAtEndOfLine() )
+      {
+      const InputPixelType value = inputIt.Get();
+      outputIt.Set( static_cast< OutputPixelType >( value ) );
+
+      const double v = static_cast< double >( value );
+      statistics.minimum = std::min(statistics.minimum, v);
+      statistics.maximum = std::max(statistics.maximum, v);
+      if ( m_GatherHistogram )
+        {
+        ++statistics.histogram[static_cast< SizeValueType >( static_cast< long >( value ) - histogramMinimum ) >> histogramShift];
+        }
+      if ( threshold < value )
+        {
+        firstForeground = std::min(firstForeground, column);
+        lastForeground = column;
+        }
+
+      ++inputIt;
+      ++outputIt;
+      ++column;
+      }
+
+    statistics.numberOfPixels += static_cast< SizeValueType >( column - lineIndex[0] );
+    if ( firstForeground <= lastForeground )
+      {
+      statistics.hasForeground = true;
+      statistics.foregroundLower[0] = std::min(statistics.foregroundLower[0], firstForeground);
+      statistics.foregroundUpper[0] = std::max(statistics.foregroundUpper[0], lastForeground);
+      for ( unsigned int d = 1; d < ImageDimension; ++d )
+        {
+        statistics.foregroundLower[d] = std::min(statistics.foregroundLower[d], lineIndex[d]);
+        statistics.foregroundUpper[d] = std::max(statistics.foregroundUpper[d], lineIndex[d]);
+        }
+      }
+
+    inputIt.NextLine();
+    outputIt.NextLine();
+    }
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+StatisticsCastImageFilter< TInputImage, TOutputImage >
+::AfterThreadedGenerateData()
+{
+  StatisticsType statistics;
+  statistics.Minimum = NumericTraits< double >::max();
+  statistics.Maximum = NumericTraits< double >::NonpositiveMin();
+  statistics.HistogramMinimum = static_cast< double >( m_HistogramMinimum );
+  statistics.HistogramBinWidth = static_cast< double >( SizeValueType(1) << m_HistogramShift );
+  statistics.Histogram.assign(m_HistogramSize, 0);
+
+  IndexType lower;
+  IndexType upper;
+  lower.Fill( NumericTraits< IndexValueType >::max() );
+  upper.Fill( NumericTraits< IndexValueType >::NonpositiveMin() );
+  bool hasForeground = false;
+
+  // Threads are merged in thread order
+  for ( unsigned int t = 0; t < m_ThreadStatistics.size(); ++t )
+    {
+    const ThreadStatistics & thread = m_ThreadStatistics[t];
+    if ( thread.numberOfPixels == 0 )
+      {
+      continue;
+      }
+    statistics.Minimum = std::min(statistics.Minimum, thread.minimum);
+    statistics.Maximum = std::max(statistics.Maximum, thread.maximum);
+    statistics.NumberOfPixels += thread.numberOfPixels;
+    for ( SizeValueType b = 0; b < statistics.Histogram.size(); ++b )
+      {
+      statistics.Histogram[b] += thread.histogram[b];
+      }
+    if ( thread.hasForeground )
+      {
+      hasForeground = true;
+      for ( unsigned int d = 0; d < ImageDimension; ++d )
+        {
+        lower[d] = std::min(lower[d], thread.foregroundLower[d]);
+        upper[d] = std::max(upper[d], thread.foregroundUpper[d]);
+        }
+      }
+    }
+  m_ThreadStatistics.clear();
+
+  if ( statistics.NumberOfPixels == 0 )
+    {
+    statistics.Minimum = 0.0;
+    statistics.Maximum = 0.0;
+    }
+
+  typename StatisticsType::RegionType::SizeType size;
+  size.Fill(0);
+  if ( hasForeground )
+    {
+    for ( unsigned int d = 0; d < ImageDimension; ++d )
+      {
+      size[d] = static_cast< SizeValueType >( upper[d] - lower[d] + 1 );
+      }
+    }
+  else
+    {
+    lower = this->GetOutput()->GetRequestedRegion().GetIndex();
+    }
+  statistics.Foreground.SetIndex(lower);
+  statistics.Foreground.SetSize(size);
+
+  m_Statistics = statistics;
+  EncapsulateMetaData< StatisticsType >(this->GetOutput()->GetMetaDataDictionary(), StatisticsKey(), m_Statistics);
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+StatisticsCastImageFilter< TInputImage, TOutputImage >
+::PrintSelf(std::ostream & os, Indent indent) const
+{
+  Superclass::PrintSelf(os, indent);
+  os << indent << "ForegroundThreshold: "
+     << static_cast< typename NumericTraits< InputPixelType >::PrintType >( m_ForegroundThreshold ) << std::endl;
+  os << indent << "NumberOfHistogramBins: " << m_NumberOfHistogramBins << std::endl;
+  os << indent << "Statistics: " << m_Statistics << std::endl;
+}
+} // end namespace itk
+
+#endif
@@ -20,387 +20,255 @@
     Implemented by Imran Irfan, and Evan Wong
 
 */
-#include "itkImage.h"
-#include "itkGDCMImageIO.h"
-#include "itkGDCMSeriesFileNames.h"
-#include "itkImageFileReader.h"
-#include "itkImageFileWriter.h"
-#include "itkRegularStepGradientDescentOptimizer.h"
-#include "itkTranslationTransform.h"
-#include "itkMattesMutualInformationImageToImageMetric.h"
-#include "itkMultiResolutionImageRegistrationMethod.h"
-#include "itkCastImageFilter.h"
-#include "itkResampleImageFilter.h"
-#include "itkCheckerBoardImageFilter.h"
-#include "itkCommand.h"
+#include "RunPipeline.h"
+#include "itkPooledImportImageContainer.h"
+#include "itkMultiThreader.h"
+#include "TaskPool.h"
+#include "RegistrationProfile.h"
 
 /*
 //////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////
-                            COMMAND TEMPLATE
+                            MAIN
 //////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////
 */
-template <typename TRegistration>
-class RegistrationInterfaceCommand : public itk::Command
-{
-public:
-    typedef RegistrationInterfaceCommand Self;
-    typedef itk::Command Superclass;
-    typedef itk::SmartPointer<Self> Pointer;
-    itkNewMacro(Self);
-
-protected:
-    RegistrationInterfaceCommand(){};
-
-public:
-    typedef TRegistration RegistrationType;
-    typedef RegistrationType * RegistrationPointer;
-    typedef itk::RegularStepGradientDescentOptimizer OptimizerType;
-    typedef OptimizerType * OptimizerPointer;
-
-    void Execute(itk::Object * object, const itk::EventObject & event) ITK_OVERRIDE
-    {
-        if (!(itk::IterationEvent().CheckEvent(&event)))
-        {
-            return;
-        }
-        RegistrationPointer registration = static_cast<RegistrationPointer>(object);
-        if (registration == ITK_NULLPTR)
-        {
-            return;
-        }
-        OptimizerPointer optimizer = static_cast<OptimizerPointer>(registration->GetModifiableOptimizer());
 
-        std::cout << "////////////////////////////////////////////////////////////////////" << std::endl;
-        std::cout << "Multi-Res Level: " << registration->GetCurrentLevel() << std::endl << std::endl;
 
-        if (registration->GetCurrentLevel() == 0)
-        {
-            optimizer->SetMaximumStepLength(16.00);
-            optimizer->SetMinimumStepLength(0.01);
-        }
+#include <iostream>
 
-        else
-        {
-            optimizer->SetMaximumStepLength(optimizer->GetMaximumStepLength() / 4.0);
-            optimizer->SetMinimumStepLength(optimizer->GetMinimumStepLength() / 10.0);
-        }
+static void PrintUsage(const char *programName)
+{
+    std::cerr << "Usage: "
+              << programName
+              << " FixedImage, MovingImage, OutputImage, [Background Grey Level], [Checkerboard Before], [Checkerboard After]"
+              << std::endl
+              << "       "
+              << programName
+              << " --batch FixedImage, MovingDirectory, OutputDirectory, [Background Grey Level], [Checkerboard Before Directory], [Checkerboard After Directory]"
+              << std::endl
+              << "       "
+              << programName
+              << " --multi-atlas FixedImage1,FixedImage2,...|FixedDirectory, MovingImage, OutputDirectory, [Background Grey Level]"
+              << std::endl
+              << "       "
+              << programName
+              << " --watch FixedImage, WatchDirectory, OutputDirectory, [Background Grey Level], [Checkerboard Before Directory], [Checkerboard After Directory]"
+              << std::endl
+              << "       "
+              << programName
+              << " --autotune FixedImage, MovingDirectory|-, ProfileFile (with --reference F or --synthetic N)"
+              << std::endl
+              << "The fixed image's header selects the pipeline: 8-bit, 16-bit (signed or unsigned) or float pixels," << std::endl
+              << "2D or 3D. A directory is read as a DICOM series volume." << std::endl
+              << "Options:" << std::endl
+              << "  --stream-divisions N   write outputs in N slabs (needs a streamable format such as .mha or .nrrd)" << std::endl
+              << "  --identity-output F    also write the moving image sampled on the fixed grid before registration" << std::endl
+              << "                         (a directory in batch mode)" << std::endl
+              << "  --workers N            batch, watch and multi-atlas modes: number of concurrent registrations" << std::endl
+              << "                         (default: half the cores)" << std::endl
+              << "  --queue-depth N        batch and watch modes: capacity of the read and write queues (default: 4)" << std::endl
+              << "  --journal F            batch mode: record of finished and failed slices (default:" << std::endl
+              << "                         OutputDirectory/.batchjournal)" << std::endl
+              << "  --resume               batch mode: skip the slices the journal records as finished whose outputs" << std::endl
+              << "                         are still readable" << std::endl
+              << "  --shard-dir D          batch mode: work on shards of the batch claimed through lock files in D;" << std::endl
+              << "                         run any number of processes, on any machines sharing D" << std::endl
+              << "  --shard-size K         --shard-dir: slices per shard (default 16)" << std::endl
+              << "  --shard-timeout-s S    --shard-dir: take over shards whose worker stopped for S seconds (default 600)" << std::endl
+              << "  --watch-idle-s S       watch mode: stop after S seconds without a new slice (default: run until" << std::endl
+              << "                         interrupted)" << std::endl
+              << "  --watch-count N        watch mode: stop after N slices" << std::endl
+              << "  --watch-settle-s S     watch mode: a file not seen being closed is complete once unchanged for S" << std::endl
+              << "                         seconds (default 1)" << std::endl
+              << "  --results-log F        append one fixed-width binary record per slice to F (see resultslog)" << std::endl
+              << "  --slice-id N           slice ID stored in the results log (default: number in the moving file name)" << std::endl
+              << "  --reproducible         per-slice sampling seeds and ordered metric reductions: results are" << std::endl
+              << "                         bit-identical for any thread or worker count" << std::endl
+              << "  --seed-mode M          seed of each slice with --reproducible: hash (of the moving file, default)" << std::endl
+              << "                         or index (of the slice)" << std::endl
+              << "  --fast                 with --reproducible keep the per-slice seeds but let the metric keep one" << std::endl
+              << "                         partial sum per thread; results then depend on the thread count" << std::endl
+              << "  --metric M             mi (Mattes MI, default), mattes (ITK's reference Mattes MI), ncc" << std::endl
+              << "                         (normalised cross-correlation) or meansquares; ncc and meansquares" << std::endl
+              << "                         suit same-modality (CT to CT) pairs" << std::endl
+              << "  --internal-type T      pixel type of the pyramids and the metric: float (default) or uint16," << std::endl
+              << "                         which halves their memory traffic" << std::endl
+              << "  --match-fixed          batch mode: FixedImage is a directory of reference slices; register each" << std::endl
+              << "                         moving slice against the reference slice whose thumbnail matches it best" << std::endl
+              << "  --match-candidates K   --match-fixed: register against the K best matches and keep the best" << std::endl
+              << "                         result (default 1)" << std::endl
+              << "  --tiered               batch mode: register every slice cheaply first and redo only slices that" << std::endl
+              << "                         look wrong next to their neighbours with the full configuration" << std::endl
+              << "  --cheap-samples N      --tiered first pass samples (default 5000)" << std::endl
+              << "  --cheap-bins N         --tiered first pass histogram bins (default 64)" << std::endl
+              << "  --cheap-iterations N   --tiered first pass iterations per level (default 100)" << std::endl
+              << "  --escalate-mm D        --tiered: translations within D mm of the neighbours are kept (default 1)" << std::endl
+              << "  --sparse               batch mode: register every k-th slice, interpolate the translations in" << std::endl
+              << "                         between and check each with one metric evaluation" << std::endl
+              << "  --sparse-step K        --sparse initial distance between registered slices (default 4)" << std::endl
+              << "  --sparse-max-jump D    --sparse: register between two slices whose translations differ by more" << std::endl
+              << "                         than D mm (default 1)" << std::endl
+              << "  --sparse-tolerance R   --sparse: an interpolated slice may have a metric value up to R (relative," << std::endl
+              << "                         default 0.05) worse than its registered neighbours" << std::endl
+              << "  --no-buffer-pool       allocate every image buffer afresh instead of recycling them across slices" << std::endl
+              << "                         (allocations are still counted and reported)" << std::endl
+              << "  --buffer-pool-mb N     most idle image buffer memory kept for reuse (default 512)" << std::endl
+              << "  --foreground-threshold T" << std::endl
+              << "                         sample the fixed image only inside the bounding box of its pixels above T" << std::endl
+              << "  --mi-range-tail F      mi: spread the fixed image's bins over its grey levels bar the darkest and" << std::endl
+              << "                         brightest F of its pixels (e.g. 0.001; default 0: the full range)" << std::endl
+              << "  --metric-cache-mm D    reuse the metric value and derivative of a level at translations that round" << std::endl
+              << "                         to the same multiple of D mm (default 0: off; mi, ncc and meansquares)" << std::endl
+              << "  --starts N             race N starting translations at the coarsest level in parallel and continue" << std::endl
+              << "                         from the best (default 1)" << std::endl
+              << "  --start-offset-mm D    spacing of the starting translations (default 20)" << std::endl
+              << "  --profile F            registration settings saved by --autotune, in place of 128 bins, 50000" << std::endl
+              << "                         samples, 3 levels, 200 iterations and relaxation 0.9" << std::endl
+              << "  --reference F          --autotune: translations of the moving slices, a results log or \"name x y [z]\" lines" << std::endl
+              << "  --synthetic N          --autotune: register N shifted copies of the fixed image instead" << std::endl
+              << "  --synthetic-max-mm D   --synthetic: largest shift along each axis (default 10)" << std::endl
+              << "  --target-error-mm D    --autotune: mean translation error the profile must stay within (default 0.5)" << std::endl
+              << "  --pareto F             --autotune: CSV of the runtime/error Pareto front (default ProfileFile.pareto.csv)" << std::endl
+              << "  --tune-bins L          --autotune: comma-separated values searched (default 32,64,128); likewise" << std::endl
+              << "                         --tune-samples (5000,20000,50000), --tune-levels (2,3,4)," << std::endl
+              << "                         --tune-iterations (50,100,200) and --tune-relaxation (0.5,0.7,0.9)" << std::endl
+              << "  --deadline-ms N        latency budget of each registration: samples, bins, levels and iteration caps" << std::endl
+              << "                         are lowered until a cost model of this machine predicts they fit, and" << std::endl
+              << "                         levels that would overrun are skipped" << std::endl
+              << "  --cost-model F         --deadline-ms: load the cost model from F, or calibrate it and save it there" << std::endl
+              << "                         (default: calibrate on the fixed image at every start)" << std::endl
+              << "  --spawn-threads        start and join threads for every filter update and metric evaluation instead" << std::endl
+              << "                         of using one persistent thread pool" << std::endl;
+}
 
-    }
+int main(int argc, char *argv[])
+{
+    const char * const flagNames[] = { "batch", "watch", "multi-atlas", "match-fixed", "resume", "reproducible", "fast", "tiered", "sparse", "no-buffer-pool", "spawn-threads", "autotune", ITK_NULLPTR };
+    CommandLine commandLine(argc, argv, flagNames);
 
-    void Execute(const itk::Object *, const itk::EventObject &) ITK_OVERRIDE
+    if( commandLine.GetNumberOfPositionals() < 3 )
     {
-        return;
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
     }
-};
-
 
-/*
-//////////////////////////////////////////////////////////////////////////////////////////
-//////////////////////////////////////////////////////////////////////////////////////////
-                            OBSERVER
-//////////////////////////////////////////////////////////////////////////////////////////
-//////////////////////////////////////////////////////////////////////////////////////////
-*/
+    //Every image buffer goes through ImageBufferPool. --no-buffer-pool only
+    //turns reuse off, so the allocation counts can still be compared.
+    itk::PooledImageContainerFactory::RegisterOneFactory();
+    ImageBufferPool::GetInstance().SetEnabled(!commandLine.Has("no-buffer-pool"));
+    ImageBufferPool::GetInstance().SetMaximumIdleBytes(static_cast<std::size_t>(std::max(0L, commandLine.GetInt("buffer-pool-mb", 512))) << 20);
 
-class CommandIterationUpdate : public itk::Command
-{
-public:
-    typedef CommandIterationUpdate Self;
-    typedef itk::Command Superclass;
-    typedef itk::SmartPointer<Self> Pointer;
-    itkNewMacro(Self);
+    //One set of worker threads for the whole process: ITK's own pool for the
+    //filters and the ITK metric, a TaskPool for our metrics. --spawn-threads
+    //goes back to starting and joining threads on every Update and evaluation.
+    const bool useThreadPool = !commandLine.Has("spawn-threads");
+    itk::MultiThreader::SetGlobalDefaultUseThreadPool(useThreadPool);
+    TaskPool taskPool(useThreadPool ? std::max(1u, std::thread::hardware_concurrency()) : 0u);
+    TaskPool::SetGlobal(useThreadPool ? &taskPool : ITK_NULLPTR);
 
-protected:
-    CommandIterationUpdate() {};
+    RegistrationSettings settings;
 
-public:
-    typedef itk::RegularStepGradientDescentOptimizer OptimizerType;
-    typedef const OptimizerType * OptimizerPointer;
+    const std::string metricName = commandLine.GetString("metric", "mi");
+    if (!ParseMetricKind(metricName, settings.metric))
+    {
+        std::cerr << "Unknown --metric " << metricName << " (expected mi, mattes, ncc or meansquares)" << std::endl;
+        return EXIT_FAILURE;
+    }
 
-    void Execute(itk::Object *caller, const itk::EventObject & event) ITK_OVERRIDE
+    const std::string internalTypeName = commandLine.GetString("internal-type", "float");
+    if (!ParseInternalPixelKind(internalTypeName, settings.internalPixel))
     {
-        Execute( (const itk::Object *)caller, event);
+        std::cerr << "Unknown --internal-type " << internalTypeName << " (expected float or uint16)" << std::endl;
+        return EXIT_FAILURE;
     }
 
-    void Execute(const itk::Object * object, const itk::EventObject & event) ITK_OVERRIDE
+    //Reproducibility: without --reproducible every slice uses the same fixed seed
+    //and the metric splits its work over however many threads ITK picks
+    SeedMode seedMode = FixedSeed;
+    if (commandLine.Has("reproducible"))
     {
-        OptimizerPointer optimizer = static_cast<OptimizerPointer>(object);
-        if (!(itk::IterationEvent().CheckEvent(&event)))
+        const std::string seedModeName = commandLine.GetString("seed-mode", "hash");
+        if (seedModeName == "hash")
         {
-            return;
+            seedMode = HashSeed;
         }
-        std::cout << optimizer->GetCurrentIteration() << "  ";
-        std::cout << optimizer->GetValue() << "  ";
-        std::cout << optimizer->GetCurrentPosition() << std::endl;
-
+        else if (seedModeName == "index")
+        {
+            seedMode = IndexSeed;
+        }
+        else
+        {
+            std::cerr << "Unknown --seed-mode " << seedModeName << " (expected hash or index)" << std::endl;
+            return EXIT_FAILURE;
+        }
+        settings.orderedReduction = !commandLine.Has("fast");
     }
-};
-
-
-/*
-//////////////////////////////////////////////////////////////////////////////////////////
-//////////////////////////////////////////////////////////////////////////////////////////
-                            MAIN
-//////////////////////////////////////////////////////////////////////////////////////////
-//////////////////////////////////////////////////////////////////////////////////////////
-*/
-
-
-#include <iostream>
 
-int main(int argc, char *argv[])
-{
-    if( argc < 4 )
+    //Restrict the metric's fixed samples to the foreground found by the load-time cast
+    if (commandLine.Has("foreground-threshold"))
     {
-    std::cerr << "Usage: "
-              << argv[0]
-              << " FixedImage, MovingImage, OutputImage, [Background Grey Level], [Checkerboard Before], [Checkerboard After]"
-              << std::endl;
-    return EXIT_FAILURE;
+        settings.foregroundRegion = true;
+        settings.foregroundThreshold = commandLine.GetDouble("foreground-threshold", 0.0);
     }
 
-    typedef unsigned short PixelType;
-    const std::string fixedImageDirectory = argv[1];
-    const std::string movingImageDirectory = argv[2];
-    const std::string outputImageFile = argv[3];
-    const PixelType backgroundGL = (argc > 4) ? atoi(argv[4]) : 100;
-    const std::string checkerboardBefore = (argc > 5) ? argv[5] : "";
-    const std::string checkerboardAfter = (argc > 6) ? argv[6] : "";
-
-    //specify dimensions 
-    const unsigned int Dimension = 2;
-    
-    typedef itk::Image<PixelType, Dimension> ImageType;
-
-    typedef itk::ImageFileReader<ImageType> ReaderType;
-
-    ReaderType::Pointer fixedReader = ReaderType::New();
-    ReaderType::Pointer movingReader = ReaderType::New();
-
-    fixedReader->SetFileName(fixedImageDirectory);
-    movingReader->SetFileName(movingImageDirectory);
-
-    typedef itk::GDCMImageIO ImageIOType;
-    ImageIOType::Pointer gdcmImageIO = ImageIOType::New();
-
-    fixedReader->SetImageIO(gdcmImageIO);
-    movingReader->SetImageIO(gdcmImageIO);
-
-    //Attempt to read
-    try
-    {
-        fixedReader->Update();
-        movingReader->Update();
-    }
-    catch(itk::ExceptionObject &e)
+    //A profile saved by --autotune replaces the hand-picked settings; an explicit --metric still wins
+    if (commandLine.Has("profile"))
     {
-        std::cerr << "Exception in File Reader " << std::endl << e << std::endl;
-        return EXIT_FAILURE;
+        RegistrationProfile profile;
+        if (!LoadRegistrationProfile(commandLine.GetString("profile"), profile))
+        {
+            std::cerr << "Cannot read the profile " << commandLine.GetString("profile") << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (!commandLine.Has("metric") && !ParseMetricKind(profile.metric, settings.metric))
+        {
+            std::cerr << "Unknown metric " << profile.metric << " in the profile" << std::endl;
+            return EXIT_FAILURE;
+        }
+        settings.numberOfHistogramBins = static_cast<unsigned int>(profile.numberOfHistogramBins);
+        settings.numberOfSpatialSamples = static_cast<unsigned int>(profile.numberOfSpatialSamples);
+        settings.numberOfLevels = static_cast<unsigned int>(profile.numberOfLevels);
+        settings.numberOfIterations = static_cast<unsigned int>(profile.numberOfIterations);
+        settings.relaxationFactor = profile.relaxationFactor;
+        std::cout << "Profile " << commandLine.GetString("profile") << ": " << profile.metric << ", "
+                  << settings.numberOfHistogramBins << " bins, " << settings.numberOfSpatialSamples << " samples, "
+                  << settings.numberOfLevels << " levels, " << settings.numberOfIterations << " iterations, relaxation "
+                  << settings.relaxationFactor << " (" << 1e3 * profile.meanSeconds << " ms, " << profile.meanErrorMm
+                  << " mm mean error when tuned)" << std::endl;
     }
 
-    std::cout << "Read Successful." << std::endl;
-
-    typedef float InternalPixelType;
-    typedef itk::Image<InternalPixelType, Dimension> InternalImageType;
-
-    //Component Declaration
-    typedef itk::TranslationTransform<double, Dimension> TransformType;
-    typedef itk::RegularStepGradientDescentOptimizer OptimizerType;
-    typedef itk::LinearInterpolateImageFunction<InternalImageType, double> InterpolatorType;
-    typedef itk::MattesMutualInformationImageToImageMetric<InternalImageType, InternalImageType> MetricType;
-    typedef itk::MultiResolutionImageRegistrationMethod<InternalImageType, InternalImageType> RegistrationType;
-
-    //Filter Declaration
-    typedef itk::MultiResolutionPyramidImageFilter<InternalImageType, InternalImageType> FixedImagePyramidType;
-    typedef itk::MultiResolutionPyramidImageFilter<InternalImageType, InternalImageType> MovingImagePyramidType;
-
-    //Component Instantiation
-    TransformType::Pointer transform = TransformType::New();
-    OptimizerType::Pointer optimizer = OptimizerType::New();
-    InterpolatorType::Pointer interpolator = InterpolatorType::New();
-    RegistrationType::Pointer registration = RegistrationType::New();
-    MetricType::Pointer metric = MetricType::New();
-
-    //Filter Instantiation
-    FixedImagePyramidType::Pointer fixedImagePyramid = FixedImagePyramidType::New();
-    MovingImagePyramidType::Pointer movingImagePyramid = MovingImagePyramidType::New();
-
-    //Connect Components to Registration Object
-    registration->SetOptimizer(optimizer);
-    registration->SetTransform(transform);
-    registration->SetInterpolator(interpolator);
-    registration->SetMetric(metric);
-
-    //Connect Filter Components to Registration Object
-    registration->SetFixedImagePyramid(fixedImagePyramid);
-    registration->SetMovingImagePyramid(movingImagePyramid);
-
-    //GDCM Reader?
-    typedef itk::ImageFileReader<ImageType> FixedImageReaderType;
-    typedef itk::ImageFileReader<ImageType> MovingImageReaderType;
-
-    FixedImageReaderType::Pointer fixedImageReader = FixedImageReaderType::New();
-    MovingImageReaderType::Pointer movingImageReader = MovingImageReaderType::New();
-
-    fixedImageReader->SetFileName(fixedImageDirectory);
-    movingImageReader->SetFileName(movingImageDirectory);
-
-    //Cast to Internal Image Type
-    typedef itk::CastImageFilter<ImageType, InternalImageType> FixedCastFilterType;
-    typedef itk::CastImageFilter<ImageType, InternalImageType> MovingCastFilterType;
-
-    FixedCastFilterType::Pointer fixedCaster = FixedCastFilterType::New();
-    MovingCastFilterType::Pointer movingCaster = MovingCastFilterType::New();
-
-    fixedCaster->SetInput(fixedImageReader->GetOutput());
-    movingCaster->SetInput(movingImageReader->GetOutput());
-
-    registration->SetFixedImage(fixedCaster->GetOutput());
-    registration->SetMovingImage(movingCaster->GetOutput());
-
-    fixedCaster->Update();
-
-    std::cout << "Fixed Caster Update Successful" << std::endl;
-
-    registration->SetFixedImageRegion(fixedCaster->GetOutput()->GetBufferedRegion());
-
-    //Initial Parameters Set Up
-    typedef RegistrationType::ParametersType ParametersType;
-    ParametersType initialParameters(transform->GetNumberOfParameters());
-
-    initialParameters[0] = 0.0; //Initial offset in mm along x
-    initialParameters[1] = 0.0; //Initial offset in mm along y
-
-    registration->SetInitialTransformParameters(initialParameters);
-
-    metric->SetNumberOfHistogramBins(128);
-    metric->SetNumberOfSpatialSamples(50000);
-
-    metric->ReinitializeSeed(76926294);
-
-    optimizer->SetNumberOfIterations(200);
-    optimizer->SetRelaxationFactor(0.9);
-
-    //Create Command observer, connect with optimizer
-    CommandIterationUpdate::Pointer observer = CommandIterationUpdate::New();
-    optimizer->AddObserver(itk::IterationEvent(), observer);
+    //Reuse metric evaluations of a level at translations within this many mm
+    settings.metricCacheTolerance = std::max(0.0, commandLine.GetDouble("metric-cache-mm", 0.0));
 
-    //Instance of Interface Command and connect it to the registration object
-    typedef RegistrationInterfaceCommand<RegistrationType> CommandType;
-    CommandType::Pointer command = CommandType::New();
-    registration->AddObserver(itk::IterationEvent(), command);
+    //Fixed image bins of mi over the bulk of its histogram
+    settings.fixedRangeTail = std::min(std::max(0.0, commandLine.GetDouble("mi-range-tail", 0.0)), 0.25);
 
-    //Set number of resolution levels
-    registration->SetNumberOfLevels(3);
-
-    try
-    {
-        registration->Update();
-        std::cout << "Optimizer stop condition: " << registration->GetOptimizer()->GetStopConditionDescription() << std::endl;
-    }
-    catch(itk::ExceptionObject &e)
+    //Starting translations raced at the coarsest level, and their spacing
+    settings.numberOfStarts = static_cast<unsigned int>(std::max(1L, commandLine.GetInt("starts", 1)));
+    settings.startOffset = commandLine.GetDouble("start-offset-mm", 20.0);
+    if (settings.startOffset <= 0.0)
     {
-        std::cerr << "Exception registration update" << e << std::endl;
+        std::cerr << "--start-offset-mm must be positive" << std::endl;
         return EXIT_FAILURE;
     }
 
-    std::cout << "Registration Update Successful" << std::endl;
-
-    //Get Final Transform parameters
-    ParametersType finalParameters = registration->GetLastTransformParameters();
-
-    double translationX = finalParameters[0];
-    double translationY = finalParameters[1];
-
-    //Get the number of total iterations and best optimizer value
-    unsigned int numIterations = optimizer->GetCurrentIteration();
-
-    double bestValue = optimizer->GetValue();
-
-    //print the results
-    std::cout << "Result = " << std::endl;
-    std::cout << "Translation along X = " << translationX << std::endl;
-    std::cout << "Translation along Y = " << translationY << std::endl;
-    std::cout << "Iterations = " << numIterations << std::endl;
-    std::cout << "Metric Value = " << bestValue << std::endl;
-
-    //Filter Process
-    typedef itk::ResampleImageFilter<ImageType, ImageType> ResampleFilterType;
-    
-    TransformType::Pointer finalTransform = TransformType::New();
-
-    finalTransform->SetParameters(finalParameters);
-    finalTransform->SetFixedParameters(transform->GetFixedParameters());
-
-    ResampleFilterType::Pointer resample = ResampleFilterType::New();
-
-    resample->SetTransform(finalTransform);
-    resample->SetInput(movingImageReader->GetOutput());
-
-    ImageType::Pointer fixedImage = fixedImageReader->GetOutput();
-
-    resample->SetSize(fixedImage->GetLargestPossibleRegion().GetSize());
-    resample->SetOutputOrigin(fixedImage->GetOrigin());
-    resample->SetOutputSpacing(fixedImage->GetSpacing());
-    resample->SetOutputDirection(fixedImage->GetDirection());
-    resample->SetDefaultPixelValue(backgroundGL); //This would be the background gray level. By default it is 100. We can set this as
-                                        //an argument if we want.
-
-    //Writer
-    //Setting up file output
-    typedef unsigned short OutputPixelType; //will only work for shorts, not for char
-                                            //strangely enough the documentation expects 2 arguments when using a char
-    typedef itk::Image<OutputPixelType, Dimension> OutputImageType;
-
-    typedef itk::CastImageFilter<ImageType, ImageType> CastFilterType;
-
-    typedef itk::ImageFileWriter<OutputImageType> WriterType;
-
-    WriterType::Pointer writer = WriterType::New();
-    CastFilterType::Pointer caster = CastFilterType::New();
-
-    writer->SetFileName(outputImageFile);
-
-    caster->SetInput(resample->GetOutput());
-    writer->SetInput(caster->GetOutput());
-    writer->Update();
-
-    std::cout << "Writer Update Successful" << std::endl;
-
-    //Generate the Checkerboard before and after registration
-
-    typedef itk::CheckerBoardImageFilter<ImageType> CheckerboardFilterType;
-
-    CheckerboardFilterType::Pointer checker = CheckerboardFilterType::New();
-    checker->SetInput1(fixedImage);
-    checker->SetInput2(resample->GetOutput());
-
-    caster->SetInput(checker->GetOutput());
-    writer->SetInput(caster->GetOutput());
-
-    resample->SetDefaultPixelValue(0);
-
-    //Before Registration set transform identity, update output file
-    TransformType::Pointer indentityTransform = TransformType::New();
-    indentityTransform->SetIdentity();
-    resample->SetTransform(indentityTransform);
-
-    if (checkerboardBefore != std::string(""))
+    //The fixed image's header picks the precompiled pipeline
+    const std::vector<std::string> references = commandLine.Has("multi-atlas") ? ListAtlasReferences(commandLine.GetPositional(0))
+                                                                             : std::vector<std::string>(1, commandLine.GetPositional(0));
+    std::string fixedImageFile = references.empty() ? commandLine.GetPositional(0) : references.front();
+    if (commandLine.Has("match-fixed"))
     {
-        writer->SetFileName(checkerboardBefore);
-        writer->Update();
+        //A series of reference slices: its first slice stands for all of them
+        const std::vector<std::string> fixedSlices = DicomSeriesFiles(fixedImageFile);
+        fixedImageFile = fixedSlices.empty() ? fixedImageFile : fixedSlices.front();
     }
-
-    //After Registration
-    resample->SetTransform(finalTransform);
-    if(checkerboardAfter != std::string(""))
+    itk::ImageIOBase::IOComponentType componentType;
+    unsigned int dimension;
+    if (!ReadImageHeader(fixedImageFile, componentType, dimension))
     {
-        writer->SetFileName(checkerboardAfter);
-        writer->Update();
+        std::cerr << "Cannot read the image header of " << fixedImageFile << std::endl;
+        return EXIT_FAILURE;
     }
-
-
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
+    return DispatchPipeline(componentType, dimension, commandLine, settings, seedMode);
+}
@@ -0,0 +1,151 @@
+/*
+    Implemented by Imran Irfan, and Evan Wong
+
+*/
+
+/*
+    Reader for the binary results log written by "project --results-log".
+
+    resultslog dump LOG          one line per record
+    resultslog csv LOG [OUT]     CSV export (to OUT, or stdout)
+    resultslog summary LOG       record count, failures, metric and timing totals
+    resultslog merge DIR OUT     one log of every shard of a --shard-dir batch
+*/
+#include "ResultsLog.h"
+#include "ShardCoordinator.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+static void PrintUsage(const char *programName)
+{
+    std::cerr << "Usage: " << programName << " dump LOG" << std::endl
+              << "       " << programName << " csv LOG [OUT.csv]" << std::endl
+              << "       " << programName << " summary LOG" << std::endl
+              << "       " << programName << " merge SHARD_DIRECTORY OUT" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const std::string command = argv[1];
+    const std::string logFile = argv[2];
+
+    if (command == "merge")
+    {
+        if (argc < 4)
+        {
+            PrintUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        unsigned long records = 0;
+        unsigned int missingShards = 0;
+        if (!MergeShardResults(logFile, argv[3], records, missingShards))
+        {
+            std::cerr << "Cannot merge the shards of " << logFile << " into " << argv[3] << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cout << "Records = " << records << std::endl;
+        if (missingShards > 0)
+        {
+            std::cerr << missingShards << " shards are not done yet" << std::endl;
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    ResultsLogReader reader;
+    if (!reader.Open(logFile))
+    {
+        std::cerr << "Cannot read results log " << logFile << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    ResultsRecord record;
+
+    if (command == "dump")
+    {
+        while (reader.Read(record))
+        {
+            std::cout << record.sliceId << "  " << GetResultsRecordName(record)
+                      << "  X = " << record.translation[0]
+                      << "  Y = " << record.translation[1]
+                      << "  Z = " << record.translation[2]
+                      << "  Metric Value = " << record.metricValue
+                      << "  Iterations =";
+            for (unsigned int level = 0; level < record.numberOfLevels && level < ResultsMaximumLevels; ++level)
+            {
+                std::cout << " " << record.iterationsPerLevel[level];
+            }
+            std::cout << "  " << StopConditionName(record.stopCondition)
+                      << "  " << record.readSeconds + record.registerSeconds + record.outputSeconds + record.writeSeconds
+                      << " s" << std::endl;
+        }
+    }
+    else if (command == "csv")
+    {
+        std::ofstream file;
+        if (argc > 3)
+        {
+            file.open(argv[3]);
+            if (!file)
+            {
+                std::cerr << "Cannot write " << argv[3] << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        std::ostream &os = (argc > 3) ? file : std::cout;
+
+        WriteResultsCsvHeader(os);
+        while (reader.Read(record))
+        {
+            WriteResultsCsvRow(os, record);
+        }
+    }
+    else if (command == "summary")
+    {
+        unsigned long records = 0;
+        unsigned long failures = 0;
+        double metricSum = 0.0;
+        double readSeconds = 0.0;
+        double registerSeconds = 0.0;
+        double outputSeconds = 0.0;
+        double writeSeconds = 0.0;
+        while (reader.Read(record))
+        {
+            ++records;
+            if (record.stopCondition < 0)
+            {
+                ++failures;
+                continue;
+            }
+            metricSum += record.metricValue;
+            readSeconds += record.readSeconds;
+            registerSeconds += record.registerSeconds;
+            outputSeconds += record.outputSeconds;
+            writeSeconds += record.writeSeconds;
+        }
+        const unsigned long succeeded = records - failures;
+        std::cout << "Records = " << records << std::endl;
+        std::cout << "Failed = " << failures << std::endl;
+        std::cout << "Mean Metric Value = " << (succeeded ? metricSum / succeeded : 0.0) << std::endl;
+        std::cout << "Read = " << readSeconds << " s" << std::endl;
+        std::cout << "Register = " << registerSeconds << " s" << std::endl;
+        std::cout << "Output = " << outputSeconds << " s" << std::endl;
+        std::cout << "Write = " << writeSeconds << " s" << std::endl;
+    }
+    else
+    {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}